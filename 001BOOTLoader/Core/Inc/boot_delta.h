@@ -0,0 +1,72 @@
+/*
+ * boot_delta.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef INC_BOOT_DELTA_H_
+#define INC_BOOT_DELTA_H_
+
+#include <stdint.h>
+
+/* Delta patch applier
+ * A patch rebuilds a new image out of the image already in the flash (old image) and
+ * of the bytes the host sends. It is a list of operations, lengths and offsets are
+ * LEB128 varints (7 bits per byte, bit 7 set if more bytes follow) :
+ *
+ * BL_DELTA_OP_COPY   offset, len   copy len bytes of the old image from offset
+ * BL_DELTA_OP_DATA   len, bytes    copy len bytes of the patch
+ * BL_DELTA_OP_FILL   len, byte     len times the same byte
+ *
+ * Like boot_lz4.c the patch can be fed in pieces of any length. The output goes through
+ * a small staging buffer to the write function given to delta_stream_init().
+ * This file doesn't use the HAL, it builds for the host too (patch tools).
+ *
+ * A BL_MEM_WRITE_DELTA stream starts with a header (little endian) :
+ * [0..3]   BL_DELTA_MAGIC
+ * [4..7]   old image length
+ * [8..11]  old image CRC32 (word mode)
+ * [12..15] new image length
+ * [16..19] new image CRC32 (word mode)
+ */
+#define BL_DELTA_MAGIC			0x31444C42UL		// "BLD1"
+#define BL_DELTA_HDR_LEN		20
+
+#define BL_DELTA_OP_COPY		0x01
+#define BL_DELTA_OP_DATA		0x02
+#define BL_DELTA_OP_FILL		0x03
+
+#define BL_DELTA_STAGE_LEN		256
+
+// Return values, on top of the status returned by the write function
+#define BL_DELTA_OK				0x00
+#define BL_DELTA_DATA_ERROR		0x05		// bad operation, out of range copy, output too long / short
+#define BL_DELTA_OLD_MISMATCH	0x06		// the image in the flash is not the one the patch was made for
+#define BL_DELTA_CRC_ERROR		0x07		// the rebuilt image doesn't have the expected CRC
+
+// Writes len bytes of output at offset, returns BL_DELTA_OK or an error code
+typedef uint8_t (*delta_write_t)(uint32_t offset, uint8_t *pData, uint32_t len);
+
+typedef struct
+{
+	uint8_t state;
+	uint8_t op;
+	uint8_t arg_count;				// varints of the current operation so far
+	uint8_t varint_shift;
+	uint32_t varint;
+	uint32_t arg[2];
+	const uint8_t *pOld;			// old image
+	uint32_t old_len;
+	uint32_t out_len;				// expected length of the output
+	uint32_t out_pos;				// output bytes so far
+	uint32_t stage_len;				// bytes in stage, they start at out_pos - stage_len
+	delta_write_t write;
+	uint8_t stage[BL_DELTA_STAGE_LEN];
+} delta_stream_t;
+
+void delta_stream_init(delta_stream_t *pStream, const uint8_t *pOld, uint32_t old_len, uint32_t out_len, delta_write_t write);
+uint8_t delta_stream_feed(delta_stream_t *pStream, const uint8_t *pIn, uint32_t len);
+uint8_t delta_stream_finish(delta_stream_t *pStream);
+
+#endif /* INC_BOOT_DELTA_H_ */
@@ -0,0 +1,62 @@
+/*
+ * boot_fast.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef INC_BOOT_FAST_H_
+#define INC_BOOT_FAST_H_
+
+#include "main.h"
+
+/* Fast boot path
+ * fast_boot() runs first thing in main(), before HAL_Init() and the clock setup : it reads the
+ * button with only the GPIOA clock on and, if it is released and the slot to start needs no
+ * flash write and no CRC check (see slot_select_fast()), starts the application straight
+ * from the HSI. Anything else (a delta copy to finish too) falls through to the full init and bootloader_jump_to_user_app().
+ *
+ * Boot time record
+ * The DWT cycle counter is started by Reset_Handler. Each boot leaves its timings in the first
+ * 32 bytes of the CCM RAM (.boot_time, NOLOAD in both linker scripts), the record survives the
+ * jump and any reset but the power on one. The application can read it at BL_BOOT_TIME_ADDR,
+ * the host reads it with BL_MEM_READ once the board is back in the bootloader.
+ * Times are from reset, each stretch between two points is converted with the core clock at
+ * its start, so the PLL start up is counted at the HSI rate.
+ */
+#define BL_FAST_BOOT_EN			1						// 0 : the full init always runs first
+
+// Reset by bootloader_jump_to_user_app() : the GPIO ports A to K and both DMA controllers
+#define BL_AHB1_RESET_MASK		(0x7FFUL | RCC_AHB1RSTR_DMA1RST | RCC_AHB1RSTR_DMA2RST)
+
+#define BL_BOOT_TIME_ADDR		CCMDATARAM_BASE
+#define BL_BOOT_TIME_MAGIC		0x454D4954UL			// "TIME"
+
+// How the last boot ended
+#define BL_BOOT_PATH_FAST		1						// application started by fast_boot()
+#define BL_BOOT_PATH_FULL		2						// application started after the full init
+#define BL_BOOT_PATH_BOOTLOADER	3						// button pressed, waiting for commands
+
+// Points of a boot, index of bl_boot_time_t.us
+#define BL_BOOT_T_CLOCK			0						// system clock configured (full init only)
+#define BL_BOOT_T_DECISION		1						// button read and slot picked
+#define BL_BOOT_T_END			2						// jump, or command loop ready
+#define BL_BOOT_T_COUNT			3
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t boots;					// boots since the power on
+	uint32_t path;					// BL_BOOT_PATH_* of the last boot
+	uint32_t cycles;				// DWT cycles from reset to the end of the last boot
+	uint32_t us[BL_BOOT_T_COUNT];	// reset to each point in microseconds, 0 if not reached
+	uint32_t app_us;				// us[BL_BOOT_T_END] of the last boot which started the application
+} bl_boot_time_t;
+
+void boot_time_start(void);
+void boot_time_mark(uint8_t point);
+void boot_time_end(uint8_t path);
+void fast_boot(void);
+void boot_start_image(void);
+
+#endif /* INC_BOOT_FAST_H_ */
@@ -0,0 +1,73 @@
+/*
+ * boot_flash_bg.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef INC_BOOT_FLASH_BG_H_
+#define INC_BOOT_FLASH_BG_H_
+
+#include "main.h"
+
+/* Background flash engine
+ * Erase and program requests go in to a queue and are carried out by the FLASH interrupt :
+ * flash_bg_irq_handler() takes the end of operation / error event of the current step
+ * (a sector erase, or one byte / halfword / word of a program request) and starts the next
+ * step straight away, the core is free in between. When a request is done the main loop
+ * (flash_bg_poll(), called by bootloader_uart_get_frame()) runs its completion callback,
+ * never the interrupt, so callbacks may log and reply to the host.
+ *
+ * The bootloader runs from bank 1 : while bank 2 is erased or programmed the core keeps going,
+ * while bank 1 is the core stalls on its next fetch from the flash, but the DMA of C_UART still
+ * fills the receive ring.
+ *
+ * There is only one flash controller : any synchronous flash operation (execute_mem_write,
+ * execute_flash_erase_sector, option bytes) and any read of bank 2 must wait for the queue first,
+ * flash_bg_wait() or flash_bg_sync(). The first error of a request without callback (background
+ * erase) is kept and returned by the next flash_bg_wait(), so it shows up in the status of the
+ * next erase or write. Requests with a callback report their status there.
+ */
+#define BL_FLASH_BG_IRQ_PRIORITY	15
+#define BL_FLASH_REQ_COUNT			16						// must be a power of 2
+
+// Status of BL_FLASH_ERASE_RANGE : bank 2 sectors are being erased in the background (BL_FLASH_ERASE waits for them)
+#define BL_ERASE_BACKGROUND			0x0B
+
+// Requests
+#define BL_FLASH_REQ_ERASE			0						// one sector
+#define BL_FLASH_REQ_PROGRAM		1						// len bytes from pData at address
+
+typedef struct flash_req flash_req_t;
+
+// Completion callback, pReq->status is the HAL status of the request
+typedef void (*flash_req_done_t)(flash_req_t *pReq);
+
+struct flash_req
+{
+	uint8_t op;
+	uint8_t sector;							// BL_FLASH_REQ_ERASE
+	volatile uint8_t status;
+	uint32_t address;						// BL_FLASH_REQ_PROGRAM
+	const uint8_t *pData;					// must stay untouched until the request is done
+	uint32_t len;
+	volatile uint32_t offset;				// bytes programmed so far
+	flash_req_done_t done;					// may be NULL
+	void *pContext;
+#if BL_PROFILE_EN
+	uint32_t cycles;						// start, then length of the request
+#endif
+};
+
+void flash_bg_erase_queue(uint32_t sectors);
+void flash_bg_submit_erase(uint8_t sector, flash_req_done_t done, void *pContext);
+void flash_bg_submit_program(uint32_t address, const uint8_t *pData, uint32_t len, flash_req_done_t done, void *pContext);
+void flash_bg_poll(void);
+uint8_t flash_bg_busy(void);
+uint32_t flash_bg_pending(void);
+uint8_t flash_bg_error(void);
+void flash_bg_sync(void);
+uint8_t flash_bg_wait(void);
+void flash_bg_irq_handler(void);
+
+#endif /* INC_BOOT_FLASH_BG_H_ */
@@ -55,6 +55,73 @@
 //This command is used to disable all sector read/write protection
 #define BL_DIS_R_W_PROTECT		0x5C
 
+//This command is used to read the protocol version and the biggest v2 payload supported by the bootloader
+#define BL_GET_PROTOCOL			0x60
+
+//This command is used to change the baud rate of C_UART, the host must confirm the new rate with a valid packet
+#define BL_SET_BAUD				0x61
+
+//This command is used to write an LZ4 compressed image (v2 packets only), the bootloader decompresses it in to the flash
+#define BL_MEM_WRITE_LZ4		0x62
+
+//This command is used to send a delta patch (v2 packets only) against the image in the flash, see boot_delta.h
+#define BL_MEM_WRITE_DELTA		0x63
+
+//This command is used to read the CRC32 of flash sectors, the host then rewrites only the sectors which differ
+#define BL_GET_SECTOR_HASHES	0x64
+
+//This command is used to know which flash sectors are blank (all 0xFF)
+#define BL_BLANK_CHECK			0x65
+
+//This command is used to erase the flash sectors which cover an address range
+#define BL_FLASH_ERASE_RANGE	0x66
+
+//This command is used to read the state of the A/B firmware slots, see boot_slot.h
+#define BL_SLOT_INFO			0x67
+
+//This command is used to activate the image written in a slot, it boots at the next reset
+#define BL_SLOT_ACTIVATE		0x68
+
+//This command is used to read the state of the background erase of bank 2, see boot_flash_bg.h
+#define BL_FLASH_STATUS			0x69
+
+//This command is used to read the cycle profile of the bootloader, see boot_profile.h
+#define BL_GET_PROFILE			0x6A
+
+/* Protocol v2
+ * A v2 packet starts with BL_V2_SOF, a v1 packet never has a zero "length to follow".
+ * [0]       BL_V2_SOF
+ * [1]       command code
+ * [2]       flags
+ * [3]       sequence number, sent back in the reply of a windowed BL_MEM_WRITE
+ * [4..5]    payload length (little endian)
+ * [6..7]    reserved
+ * [8..11]   address / argument
+ * [12..]    payload, word aligned in the packet
+ * CRC32 of the header and the payload follows the payload, then 0 to 3 padding bytes
+ * so that the packet length is a multiple of 4 and the next packet stays word aligned.
+ */
+#define BL_PROTOCOL_VERSION		2
+
+#define BL_V2_SOF				0x00
+#define BL_V2_HDR_LEN			12
+#define BL_V2_MAX_PAYLOAD		4096
+
+// v2 flags
+#define BL_V2_FLAG_CRC_WORD		0x01	// CRC32 is computed over 32-bit little endian words, see bootloader_calc_crc()
+#define BL_V2_FLAG_FIRST		0x02	// first packet of a stream (BL_MEM_WRITE_LZ4), the argument is the destination address
+#define BL_V2_FLAG_LAST			0x04	// last packet of a stream
+#define BL_V2_FLAG_AUTO_ERASE	0x08	// flash sectors are erased the first time a write touches them, see flash_prepare_write()
+#define BL_V2_FLAG_DEFER		0x10	// BL_MEM_WRITE : programmed in the background, see mem_write_defer()
+#define BL_V2_FLAG_WINDOW		0x20	// BL_MEM_WRITE : windowed write, one reply per packet, see bootloader_handle_mem_write_v2_cmd()
+
+#define BL_V2_CMD(p)			((p)[1])
+#define BL_V2_FLAGS(p)			((p)[2])
+#define BL_V2_SEQ(p)			((p)[3])
+#define BL_V2_PAYLOAD_LEN(p)	((uint32_t)(p)[4] | ((uint32_t)(p)[5] << 8))
+#define BL_V2_ARG(p)			(*((uint32_t *)&(p)[8]))
+#define BL_V2_PACKET_LEN(len)	((BL_V2_HDR_LEN + (len) + 4 + 3) & ~3UL)
+
 /* ACK and NACK bytes*/
 #define BL_ACK					0XA5
 #define BL_NACK					0X7F
@@ -63,18 +130,94 @@
 #define VERIFY_CRC_FAIL			1
 #define VERIFY_CRC_SUCCESS		0
 
+/* CRC modes
+ * BYTE : every byte is widened to a 32-bit word and fed to the CRC unit (v1 packets)
+ * WORD : 4 bytes at a time as a little endian word, the 1 to 3 trailing bytes are fed like in BYTE mode
+ */
+#define BL_CRC_MODE_BYTE		0
+#define BL_CRC_MODE_WORD		1
+
+// Capabilities reported by BL_GET_PROTOCOL
+#define BL_CAP_CRC_WORD			0x01
+#define BL_CAP_LZ4				0x02
+#define BL_CAP_DELTA			0x04
+#define BL_CAP_AUTO_ERASE		0x08
+#define BL_CAP_BG_ERASE			0x10	// bank 2 is erased in the background, BL_FLASH_ERASE_RANGE replies BL_ERASE_BACKGROUND
+#define BL_CAP_DEFER			0x20	// BL_V2_FLAG_DEFER
+#define BL_CAP_WINDOW			0x40	// BL_V2_FLAG_WINDOW, BL_GET_PROTOCOL also replies the window (BL_RX_WINDOW)
+
+/* Deferred BL_MEM_WRITE : payloads waiting for the flash engine are copied in to one of
+ * these buffers, so the receive ring is free for the next packets
+ */
+#define BL_WRITE_BUF_COUNT		4
+
+// Enable this line to feed the CRC unit of big buffers with DMA2 (memory to memory) instead of the core
+//#define BL_CRC_USE_DMA
+#define BL_CRC_DMA_MIN_LEN		256
+
 #define ADDR_VALID				0x00
 #define ADDR_INVALID			0x01
 
 #define INVALID_SECTOR			0x04
 
+/* Streamed replies (BL_MEM_READ..)
+ * ACK, "len to follow" = 7, then status (ADDR_VALID / ADDR_INVALID), chunk size (16 bits) and total length (32 bits).
+ * If the status is ADDR_VALID the data follows in chunks of BL_STREAM_CHUNK_LEN bytes (the last one may be shorter),
+ * every chunk is followed by its CRC32 in word mode.
+ */
+#define BL_STREAM_CHUNK_LEN		1024
+#define BL_STREAM_HDR_LEN		7
+
+/* OTP area : 16 blocks of 32 bytes, then one lock byte per block (0x00 = block locked) */
+#define BL_OTP_LEN				512
+#define BL_OTP_LOCK_LEN			16
+#define BL_OTP_BLOCK_LEN		32
+
 
 #define FLASH_SECTOR2_BASE		0x08008000UL			// USER APP in Sector 2 of FLASH
 
+/* Flash geometry of the STM32F429ZI : 2 banks of 1 MB with the same layout,
+ * 4 x 16 KB, 1 x 64 KB and 7 x 128 KB. Sectors 0 to 11 are in bank 1, 12 to 23 in bank 2.
+ * The sector map is a table (flash_sector_map in boot_functions.c), the number of sectors
+ * really there comes from the flash size register : 12 on a 1 MB part, 24 on a 2 MB one.
+ */
+#define BL_FLASH_BANK_SIZE		0x100000UL
+#define BL_FLASH_BANK_SECTORS	12
+#define BL_FLASH_SECTOR_COUNT	24						// biggest part, size of the sector tables
+#define BL_SECTOR_NONE			0xFF
+#define BL_MASS_ERASE			0xFF					// sector number of BL_FLASH_ERASE for a mass erase (all but the bootloader and its copy)
+
+/* BL_MEM_WRITE_DELTA builds the new image in bank 2 first (where slot B goes, so only
+ * while slot B is not used), the image in bank 1 is only replaced once the new one has the right CRC.
+ * Before the old image is erased a commit record right after the scratch area says where the
+ * new one goes. A reset during the copy leaves the record without done, bootloader_delta_resume()
+ * copies the image again at the next start.
+ * The image stays below the trailer of slot A. If slot A was activated, the record has slot set :
+ * its trailer (size and CRC of the old image) is erased and the new image activated after the copy.
+ */
+#define BL_DELTA_SCRATCH_BASE	BL_SLOT_B_BASE
+#define BL_DELTA_SCRATCH_SIZE	(BL_SLOT_TRAILER_OFFSET - sizeof(bl_delta_commit_t))
+#define BL_DELTA_COMMIT_BASE	(BL_DELTA_SCRATCH_BASE + BL_DELTA_SCRATCH_SIZE)
+#define BL_DELTA_COMMIT_MAGIC	0x43444C42UL			// "BLDC"
+
+// Programmed word by word like a slot trailer, magic after dest, len, crc and slot
+typedef struct
+{
+	uint32_t magic;
+	uint32_t dest;					// address of the old image
+	uint32_t len;					// length of the new image
+	uint32_t crc;					// CRC32 (word mode) of the new image
+	uint32_t done;					// programmed once the new image is at dest
+	uint32_t slot;					// BL_SLOT_A to activate again, left erased if slot A was not activated
+	uint32_t reserved[2];
+} bl_delta_commit_t;
+
 #define C_UART					&huart1
 #define D_UART					&huart3
 
-#define BL_RX_LEN				200
+// Biggest command packet : a v2 packet with the biggest payload
+// (v1 packets are at most 1 byte "length to follow" + 255 bytes)
+#define BL_RX_LEN				BL_V2_PACKET_LEN(BL_V2_MAX_PAYLOAD)
 
 /*Bootloader function prototypes */
 
@@ -93,19 +236,49 @@ void bootloader_handle_mem_read (uint8_t *pBuffer);
 void bootloader_handle_read_sector_protection_status(uint8_t *pBuffer);
 void bootloader_handle_read_otp(uint8_t *pBuffer);
 void bootloader_handle_dis_rw_protect(uint8_t *pBuffer);
+void bootloader_handle_get_protocol_cmd(uint8_t *pBuffer);
+void bootloader_handle_set_baud_cmd(uint8_t *pBuffer);
+void bootloader_handle_get_sector_hashes_cmd(uint8_t *pBuffer);
+void bootloader_handle_blank_check_cmd(uint8_t *pBuffer);
+void bootloader_handle_flash_erase_range_cmd(uint8_t *pBuffer);
+void bootloader_handle_slot_info_cmd(uint8_t *pBuffer);
+void bootloader_handle_slot_activate_cmd(uint8_t *pBuffer);
+void bootloader_handle_flash_status_cmd(uint8_t *pBuffer);
+void bootloader_handle_get_profile_cmd(uint8_t *pBuffer);
+
+void bootloader_handle_v2_cmd(uint8_t *pBuffer);
+void bootloader_handle_mem_write_v2_cmd(uint8_t *pBuffer);
+void bootloader_handle_mem_write_lz4_cmd(uint8_t *pBuffer);
+void bootloader_handle_mem_write_delta_cmd(uint8_t *pBuffer);
+uint8_t bootloader_delta_pending(void);
+void bootloader_delta_resume(void);
 
 void bootloader_send_ack(uint8_t command_code, uint8_t follow_len);
 void bootloader_send_nack(void);
 
 uint8_t bootloader_verify_crc (uint8_t *pData, uint32_t len,uint32_t crc_host);
+uint8_t bootloader_verify_v2_crc(uint8_t *pBuffer);
+uint32_t bootloader_calc_crc(uint8_t *pData, uint32_t len, uint8_t crc_mode);
 uint8_t get_bootloader_version(void);
 void bootloader_uart_write_data(uint8_t *pBuffer,uint32_t len);
 
 uint16_t get_mcu_chip_id(void);
 uint8_t get_flash_rdp_level(void);
 uint8_t verify_address(uint32_t go_address);
+uint8_t verify_mem_range(uint32_t mem_address, uint32_t len);
+void bootloader_stream_data(uint8_t status, uint8_t *pData, uint32_t len);
 uint8_t execute_flash_erase(uint8_t sector_number , uint8_t number_of_sector);
-uint8_t execute_mem_write(uint8_t *pBuffer, uint32_t mem_address, uint32_t len);
+uint8_t execute_flash_erase_sector(uint8_t sector);
+uint8_t execute_flash_erase_range(uint32_t mem_address, uint32_t len);
+uint8_t flash_sector_is_blank(uint8_t sector);
+uint8_t flash_prepare_write(uint32_t mem_address, uint32_t len);
+uint8_t flash_prepare_write_bg(uint32_t mem_address, uint32_t len);
+void flash_sector_set_erased(uint8_t sector);
+uint8_t get_flash_sector_count(void);
+uint8_t get_flash_sector_number(uint32_t address);
+uint32_t get_flash_sector_base(uint8_t sector);
+uint32_t get_flash_sector_size(uint8_t sector);
+uint8_t execute_mem_write(uint8_t *pBuffer, uint32_t mem_address, uint32_t len, uint32_t *pFail_offset);
 
 uint8_t configure_flash_sector_rw_protection(uint16_t sector_details, uint8_t protection_mode, uint8_t disable);
 
@@ -0,0 +1,44 @@
+/*
+ * boot_lz4.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef INC_BOOT_LZ4_H_
+#define INC_BOOT_LZ4_H_
+
+#include <stdint.h>
+
+/* Streaming LZ4 block decoder, writes straight in to the flash
+ * The compressed stream can be fed in pieces of any length (one per BL_MEM_WRITE_LZ4 packet).
+ * Decompressed bytes are collected in a small staging buffer which is programmed
+ * with execute_mem_write() when full. Matches read the bytes they copy from the staging
+ * buffer or, when they are older, from the flash already programmed. So the whole output
+ * is the window and the decoder only needs this structure in RAM.
+ */
+#define BL_LZ4_STAGE_LEN		256
+
+// Return values of lz4_stream_feed() / lz4_stream_finish(), on top of the HAL status of the flash writes
+#define BL_LZ4_OK				0x00
+#define BL_LZ4_DATA_ERROR		0x05		// not a valid LZ4 block (bad offset, stream ends in the middle of a sequence)
+
+typedef struct
+{
+	uint8_t state;
+	uint32_t lit_len;				// literals left to copy
+	uint32_t match_len;
+	uint32_t offset;
+	uint32_t out_base;				// flash address of the first decompressed byte
+	uint32_t out_pos;				// decompressed bytes so far
+	uint32_t stage_len;				// bytes in stage, they start at out_pos - stage_len
+	uint32_t fail_offset;			// offset in the output of a failed flash write
+	uint8_t auto_erase;				// erase the sectors on the way with flash_prepare_write()
+	uint8_t stage[BL_LZ4_STAGE_LEN];
+} lz4_stream_t;
+
+void lz4_stream_init(lz4_stream_t *pStream, uint32_t out_base);
+uint8_t lz4_stream_feed(lz4_stream_t *pStream, uint8_t *pIn, uint32_t len);
+uint8_t lz4_stream_finish(lz4_stream_t *pStream);
+
+#endif /* INC_BOOT_LZ4_H_ */
@@ -0,0 +1,85 @@
+/*
+ * boot_profile.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef INC_BOOT_PROFILE_H_
+#define INC_BOOT_PROFILE_H_
+
+#include "main.h"
+
+/* Cycle profile of the bootloader
+ * BL_PROFILE_BEGIN / BL_PROFILE_END take the DWT cycle counter (started by Reset_Handler, see
+ * boot_fast.h) around a phase or a command and add the cycles to its entry of the profile table :
+ * count, min, max, sum and a log2 histogram. BL_GET_PROFILE streams the table to the host.
+ * With BL_PROFILE_EN at 0 the macros are empty and nothing of the table is compiled in,
+ * BL_GET_PROFILE then replies ADDR_INVALID. It follows the DEBUG build by default.
+ */
+#ifndef BL_PROFILE_EN
+#ifdef DEBUG
+#define BL_PROFILE_EN			1
+#else
+#define BL_PROFILE_EN			0
+#endif
+#endif
+
+// Phases, entries 0 to BL_PROF_PHASES - 1 of the table
+#define BL_PROF_RX				0						// a command packet, from its first bytes seen to the last one
+#define BL_PROF_CRC				1						// bootloader_calc_crc()
+#define BL_PROF_ERASE			2						// one sector erase, synchronous or in the background
+#define BL_PROF_PROGRAM			3						// execute_mem_write(), or one background program request
+#define BL_PROF_TX				4						// blocking writes and waits on C_UART
+#define BL_PROF_PHASES			5
+
+// Commands 0x50 to 0x6F follow the phases, from the frame handed out to the handler's return
+#define BL_PROF_CMD_BASE		0x50
+#define BL_PROF_CMD_COUNT		0x20
+#define BL_PROF_CMD(code)		(BL_PROF_PHASES + (uint32_t)(code) - BL_PROF_CMD_BASE)
+#define BL_PROFILE_COUNT		(BL_PROF_PHASES + BL_PROF_CMD_COUNT)
+
+/* Histogram : bucket 0 counts the samples under 2^BL_PROFILE_FIRST_BUCKET cycles,
+ * bucket n the ones from 2^(n + BL_PROFILE_FIRST_BUCKET - 1), the last one everything above.
+ */
+#define BL_PROFILE_BUCKETS		24
+#define BL_PROFILE_FIRST_BUCKET	7
+
+typedef struct
+{
+	uint32_t count;
+	uint32_t min;					// cycles
+	uint32_t max;
+	uint32_t reserved;
+	uint64_t sum;
+	uint16_t hist[BL_PROFILE_BUCKETS];	// saturates at 0xFFFF
+} bl_profile_stat_t;
+
+// Streamed by BL_GET_PROFILE as it is in memory (little endian)
+typedef struct
+{
+	uint32_t clock;					// SystemCoreClock, cycles to time
+	uint8_t nb_stats;				// BL_PROFILE_COUNT
+	uint8_t nb_buckets;				// BL_PROFILE_BUCKETS
+	uint8_t first_bucket;			// BL_PROFILE_FIRST_BUCKET
+	uint8_t cmd_base;				// BL_PROF_CMD_BASE
+	bl_profile_stat_t stat[BL_PROFILE_COUNT];
+} bl_profile_table_t;
+
+#if BL_PROFILE_EN
+
+#define BL_PROFILE_BEGIN(t)		uint32_t t = DWT->CYCCNT
+#define BL_PROFILE_END(id, t)	profile_record((id), DWT->CYCCNT - (t))
+
+void profile_record(uint32_t id, uint32_t cycles);
+bl_profile_table_t *profile_freeze(void);
+void profile_thaw(uint8_t clear);
+
+#else
+
+#define BL_PROFILE_BEGIN(t)
+#define BL_PROFILE_END(id, t)
+
+#endif
+
+#endif /* INC_BOOT_PROFILE_H_ */
@@ -0,0 +1,83 @@
+/*
+ * boot_slot.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef INC_BOOT_SLOT_H_
+#define INC_BOOT_SLOT_H_
+
+#include "main.h"
+
+/* A/B firmware slots
+ * Slot A is sectors 2 to 11 (bank 1), slot B is sectors 14 to 23 (bank 2), both images are
+ * linked at FLASH_SECTOR2_BASE. Slot B is started with the banks swapped (SYSCFG UFB_MODE) so
+ * it shows up at FLASH_SECTOR2_BASE too. The swap also moves the code under the bootloader's
+ * feet, that's why sectors 12 and 13 hold a copy of the bootloader (sectors 0 and 1).
+ * BL_FLASH_ERASE never erases either of them, a mass erase (BL_MASS_ERASE) empties both slots
+ * and keeps the copy, so slot B can start as soon as it is written and activated again.
+ *
+ * The last 32 bytes of a slot are its trailer. The words start erased (0xFFFFFFFF) and are
+ * programmed one by one, never erased until the slot is rewritten :
+ * - BL_SLOT_ACTIVATE checks the CRC of the new image and programs size, crc, seq then magic
+ * - the bootloader programs trial the first time it starts the image
+ * - the application programs confirmed once it runs fine
+ * - an image started again with trial set but without confirmed has failed, the bootloader
+ *   programs bad and starts the other slot.
+ * The valid slot with the highest seq boots. Images written without BL_SLOT_ACTIVATE
+ * (no slot has a magic) boot from FLASH_SECTOR2_BASE like before.
+ */
+#define BL_SLOT_A				0
+#define BL_SLOT_B				1
+#define BL_SLOT_COUNT			2
+#define BL_SLOT_NONE			0xFF
+
+#define BL_SLOT_A_BASE			FLASH_SECTOR2_BASE
+#define BL_SLOT_B_BASE			0x08108000UL
+#define BL_SLOT_SIZE			0xF8000UL				// sectors 2 to 11 : 1 MB - 32 KB
+#define BL_SLOT_TRAILER_OFFSET	(BL_SLOT_SIZE - sizeof(bl_slot_trailer_t))
+
+// The bootloader (sectors 0 and 1) and its copy in bank 2 (sectors 12 and 13)
+#define BL_BOOT_SIZE			0x8000UL
+#define BL_BOOT_MIRROR_BASE		0x08100000UL
+
+#define BL_SLOT_MAGIC			0x544F4C53UL			// "SLOT"
+#define BL_SLOT_WORD_ERASED		0xFFFFFFFFUL
+#define BL_SLOT_WORD_SET		0x00000000UL
+
+// Slot states reported by BL_SLOT_INFO
+#define BL_SLOT_EMPTY			0						// no trailer
+#define BL_SLOT_PENDING			1						// activated, never started
+#define BL_SLOT_TRIAL			2						// started, not confirmed yet
+#define BL_SLOT_CONFIRMED		3
+#define BL_SLOT_BAD				4						// trial failed or CRC error
+
+// Status of BL_SLOT_ACTIVATE, on top of the HAL status of the flash writes
+#define BL_SLOT_OK				0x00
+#define BL_SLOT_INVALID			0x08					// no such slot, or size doesn't fit
+#define BL_SLOT_NOT_BLANK		0x09					// trailer already programmed, erase the slot first
+#define BL_SLOT_CRC_ERROR		0x0A
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t size;					// image length in bytes
+	uint32_t crc;					// CRC32 (word mode) of the image
+	uint32_t seq;					// activation number
+	uint32_t trial;
+	uint32_t confirmed;
+	uint32_t bad;
+	uint32_t reserved;
+} bl_slot_trailer_t;
+
+uint32_t slot_get_base(uint8_t slot);
+uint8_t slot_get_state(uint8_t slot);
+const bl_slot_trailer_t *slot_get_trailer(uint8_t slot);
+uint8_t slot_select_boot(uint8_t update);
+uint8_t slot_activate(uint8_t slot, uint32_t size, uint32_t crc);
+uint8_t slot_select_fast(uint8_t *pSlot);
+uint8_t slot_map_boot(uint8_t slot);
+void slot_swap_banks(void);
+
+#endif /* INC_BOOT_SLOT_H_ */
@@ -0,0 +1,56 @@
+/*
+ * boot_uart.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef INC_BOOT_UART_H_
+#define INC_BOOT_UART_H_
+
+#include "main.h"
+
+/* Receive ring of C_UART
+ * USART1 RX runs on DMA2 Stream2 in circular mode and fills bl_rx_ring.
+ * The IDLE line event (and the DMA half/full transfer events) wake up the core,
+ * the write position itself is always read back from the DMA counter.
+ * Must be a power of 2 and hold at least two full command packets.
+ */
+#define BL_RX_RING_LEN			16384
+
+/* Windowed writes (BL_V2_FLAG_WINDOW) : bytes of packets the host may have on the way, sent but with
+ * no reply yet. They all sit in the ring until they are handled, a completely full ring would look empty.
+ */
+#define BL_RX_WINDOW			(BL_RX_RING_LEN - 4)
+
+/* A packet which gets no new byte for BL_RX_FRAME_TIMEOUT ms is dropped (bytes lost on the link),
+ * so the packets sent again by the host start on a clean ring.
+ */
+#define BL_RX_FRAME_TIMEOUT		100
+
+/* Baud rate of C_UART
+ * After BL_SET_BAUD the host has BL_BAUD_CONFIRM_TIMEOUT ms to send a valid packet at the new rate,
+ * otherwise, or after BL_BAUD_MAX_CRC_FAIL CRC failures in a row, we go back to the last good rate.
+ */
+#define BL_BAUD_MIN				9600
+#define BL_BAUD_CONFIRM_TIMEOUT	1000
+#define BL_BAUD_MAX_CRC_FAIL	3
+
+#define BL_BAUD_OK				0x00
+#define BL_BAUD_INVALID			0x01
+
+void bootloader_uart_rx_start(void);
+void bootloader_uart_rx_stop(void);
+
+uint8_t *bootloader_uart_get_frame(uint32_t *pFrame_len);
+void bootloader_uart_release_frame(void);
+
+void bootloader_uart_write_data_dma(uint8_t *pBuffer, uint16_t len);
+void bootloader_uart_tx_wait(void);
+
+uint8_t bootloader_uart_check_baud(uint32_t baud);
+uint8_t bootloader_uart_set_baud(uint32_t baud);
+void bootloader_uart_link_ok(void);
+void bootloader_uart_link_error(void);
+
+#endif /* INC_BOOT_UART_H_ */
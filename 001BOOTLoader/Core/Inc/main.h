@@ -36,7 +36,19 @@ extern "C" {
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include "boot_profile.h"
 #include "boot_functions.h"
+#include "boot_uart.h"
+#include "boot_lz4.h"
+#include "boot_delta.h"
+#include "boot_slot.h"
+#include "boot_flash_bg.h"
+#include "boot_fast.h"
+
+// Debug log level and UART, LOG_LEVEL_NONE compiles all the logs out (see dbg_log.h)
+#define LOG_LEVEL				LOG_LEVEL_DEBUG
+#define LOG_UART				D_UART
+#include "dbg_log.h"
 
 /* USER CODE END Includes */
 
@@ -47,6 +59,10 @@ extern "C" {
 extern CRC_HandleTypeDef hcrc;
 extern UART_HandleTypeDef huart1;
 extern UART_HandleTypeDef huart3;
+extern DMA_HandleTypeDef hdma_usart1_rx;
+extern DMA_HandleTypeDef hdma_usart1_tx;
+extern DMA_HandleTypeDef hdma_crc;
+extern DMA_HandleTypeDef hdma_usart3_tx;
 
 /* USER CODE END ET */
 
@@ -65,8 +81,6 @@ void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
 
-void printmsg(char *format, ...);
-
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
@@ -58,6 +58,13 @@ void PendSV_Handler(void);
 void SysTick_Handler(void);
 /* USER CODE BEGIN EFP */
 
+void DMA2_Stream2_IRQHandler(void);
+void DMA2_Stream7_IRQHandler(void);
+void DMA1_Stream3_IRQHandler(void);
+void USART1_IRQHandler(void);
+void USART3_IRQHandler(void);
+void FLASH_IRQHandler(void);
+
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
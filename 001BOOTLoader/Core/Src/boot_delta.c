@@ -0,0 +1,206 @@
+/*
+ * boot_delta.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include <string.h>
+#include "boot_delta.h"
+
+// Decoder states, each one waits for the next input byte
+#define DELTA_OP				0
+#define DELTA_VARINT			1
+#define DELTA_DATA				2
+#define DELTA_FILL				3
+
+
+/* Gives the staging buffer to the write function */
+static uint8_t delta_flush(delta_stream_t *pStream)
+{
+	uint8_t status;
+
+	if(pStream->stage_len == 0)
+		return BL_DELTA_OK;
+
+	status = pStream->write(pStream->out_pos - pStream->stage_len, pStream->stage, pStream->stage_len);
+	pStream->stage_len = 0;
+
+	return status;
+}
+
+/* Appends len bytes of output, pData = NULL repeats fill */
+static uint8_t delta_put(delta_stream_t *pStream, const uint8_t *pData, uint8_t fill, uint32_t len)
+{
+	uint32_t chunk;
+	uint8_t status;
+
+	if(len > (pStream->out_len - pStream->out_pos))
+		return BL_DELTA_DATA_ERROR;
+
+	while(len)
+	{
+		chunk = BL_DELTA_STAGE_LEN - pStream->stage_len;
+		if(chunk > len)
+			chunk = len;
+
+		if(pData)
+		{
+			memcpy(&pStream->stage[pStream->stage_len], pData, chunk);
+			pData += chunk;
+		}else
+		{
+			memset(&pStream->stage[pStream->stage_len], fill, chunk);
+		}
+
+		pStream->stage_len += chunk;
+		pStream->out_pos += chunk;
+		len -= chunk;
+
+		if(pStream->stage_len == BL_DELTA_STAGE_LEN)
+		{
+			status = delta_flush(pStream);
+			if(status != BL_DELTA_OK)
+				return status;
+		}
+	}
+
+	return BL_DELTA_OK;
+}
+
+/* All the varints of the current operation are there, run it */
+static uint8_t delta_run_op(delta_stream_t *pStream)
+{
+	switch(pStream->op)
+	{
+	case BL_DELTA_OP_COPY:
+		if( (pStream->arg[0] > pStream->old_len) || (pStream->arg[1] > (pStream->old_len - pStream->arg[0])) )
+			return BL_DELTA_DATA_ERROR;
+		pStream->state = DELTA_OP;
+		return delta_put(pStream, &pStream->pOld[pStream->arg[0]], 0, pStream->arg[1]);
+
+	case BL_DELTA_OP_DATA:
+		pStream->state = pStream->arg[0] ? DELTA_DATA : DELTA_OP;
+		return BL_DELTA_OK;
+
+	case BL_DELTA_OP_FILL:
+		pStream->state = DELTA_FILL;
+		return BL_DELTA_OK;
+
+	default:
+		return BL_DELTA_DATA_ERROR;
+	}
+}
+
+/* This function starts a new patch
+ * pOld / old_len : old image, out_len : length of the new image
+ */
+void delta_stream_init(delta_stream_t *pStream, const uint8_t *pOld, uint32_t old_len, uint32_t out_len, delta_write_t write)
+{
+	pStream->state = DELTA_OP;
+	pStream->op = 0;
+	pStream->arg_count = 0;
+	pStream->varint_shift = 0;
+	pStream->varint = 0;
+	pStream->arg[0] = 0;
+	pStream->arg[1] = 0;
+	pStream->pOld = pOld;
+	pStream->old_len = old_len;
+	pStream->out_len = out_len;
+	pStream->out_pos = 0;
+	pStream->stage_len = 0;
+	pStream->write = write;
+}
+
+/* This function applies the next len bytes of the patch */
+uint8_t delta_stream_feed(delta_stream_t *pStream, const uint8_t *pIn, uint32_t len)
+{
+	uint8_t status = BL_DELTA_OK;
+	uint32_t chunk;
+	uint8_t data;
+
+	while(len && (status == BL_DELTA_OK))
+	{
+		switch(pStream->state)
+		{
+		case DELTA_OP:
+			pStream->op = *pIn++;
+			len--;
+			if((pStream->op < BL_DELTA_OP_COPY) || (pStream->op > BL_DELTA_OP_FILL))
+			{
+				status = BL_DELTA_DATA_ERROR;
+				break;
+			}
+			pStream->arg[0] = 0;
+			pStream->arg[1] = 0;
+			pStream->arg_count = 0;
+			pStream->varint = 0;
+			pStream->varint_shift = 0;
+			pStream->state = DELTA_VARINT;
+			break;
+
+		case DELTA_VARINT:
+			data = *pIn++;
+			len--;
+			if(pStream->varint_shift > 28)
+			{
+				status = BL_DELTA_DATA_ERROR;
+				break;
+			}
+			pStream->varint |= (uint32_t)(data & 0x7F) << pStream->varint_shift;
+			pStream->varint_shift += 7;
+			if(data & 0x80)
+				break;
+
+			pStream->arg[pStream->arg_count++] = pStream->varint;
+			pStream->varint = 0;
+			pStream->varint_shift = 0;
+
+			// COPY has 2 varints, DATA and FILL only one
+			if(pStream->arg_count == ((pStream->op == BL_DELTA_OP_COPY) ? 2 : 1))
+				status = delta_run_op(pStream);
+			break;
+
+		case DELTA_DATA:
+			// Literal bytes go straight from the packet to the staging buffer
+			chunk = (len < pStream->arg[0]) ? len : pStream->arg[0];
+			status = delta_put(pStream, pIn, 0, chunk);
+			pIn += chunk;
+			len -= chunk;
+			pStream->arg[0] -= chunk;
+			if(pStream->arg[0] == 0)
+				pStream->state = DELTA_OP;
+			break;
+
+		case DELTA_FILL:
+			data = *pIn++;
+			len--;
+			status = delta_put(pStream, NULL, data, pStream->arg[0]);
+			pStream->state = DELTA_OP;
+			break;
+
+		default:
+			status = BL_DELTA_DATA_ERROR;
+			break;
+		}
+	}
+
+	return status;
+}
+
+/* This function ends the patch : writes what is left in the staging buffer
+ * The patch must end on an operation boundary and rebuild the whole new image.
+ */
+uint8_t delta_stream_finish(delta_stream_t *pStream)
+{
+	uint8_t status;
+
+	status = delta_flush(pStream);
+	if(status != BL_DELTA_OK)
+		return status;
+
+	if((pStream->state != DELTA_OP) || (pStream->out_pos != pStream->out_len))
+		return BL_DELTA_DATA_ERROR;
+
+	return BL_DELTA_OK;
+}
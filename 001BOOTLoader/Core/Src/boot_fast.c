@@ -0,0 +1,136 @@
+/*
+ * boot_fast.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "main.h"
+
+// Left in the CCM RAM for the application and the host, never initialised by the startup code
+static bl_boot_time_t boot_time __attribute__((section(".boot_time")));
+
+// Cycle count, time and core clock at the last point
+static uint32_t time_cycles;
+static uint32_t time_us;
+static uint32_t time_clock;
+
+
+/* This function starts the record of this boot, first thing in main() */
+void boot_time_start(void)
+{
+	// Reset_Handler starts the counter, unless the image was entered some other way (debugger)
+	if(!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk))
+	{
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CYCCNT = 0;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	}
+
+	// Garbage after a power on
+	if(boot_time.magic != BL_BOOT_TIME_MAGIC)
+	{
+		memset(&boot_time, 0, sizeof(boot_time));
+		boot_time.magic = BL_BOOT_TIME_MAGIC;
+	}
+
+	boot_time.boots++;
+	boot_time.path = 0;
+	boot_time.cycles = 0;
+	memset(boot_time.us, 0, sizeof(boot_time.us));
+
+	time_cycles = 0;
+	time_us = 0;
+	time_clock = HSI_VALUE;
+}
+
+/* This function records the time from reset to a point of the boot (BL_BOOT_T_*) */
+void boot_time_mark(uint8_t point)
+{
+	uint32_t cycles = DWT->CYCCNT;
+
+	time_us += (cycles - time_cycles) / (time_clock / 1000000U);
+	time_cycles = cycles;
+	time_clock = SystemCoreClock;
+
+	if(point < BL_BOOT_T_COUNT)
+		boot_time.us[point] = time_us;
+}
+
+/* This function closes the record : the boot ends by the jump or in the command loop */
+void boot_time_end(uint8_t path)
+{
+	boot_time_mark(BL_BOOT_T_END);
+
+	boot_time.path = path;
+	boot_time.cycles = time_cycles;
+	if(path != BL_BOOT_PATH_BOOTLOADER)
+		boot_time.app_us = time_us;
+}
+
+/* This function starts the application without the full init when it can, returns otherwise
+ * The core still runs from the HSI, nothing but the flash caches and the bank mapping is touched.
+ */
+void fast_boot(void)
+{
+	uint8_t pressed;
+	uint8_t slot;
+
+	// Only the port of the button, PA0 is an input since the reset
+	__HAL_RCC_GPIOA_CLK_ENABLE();
+	pressed = (HAL_GPIO_ReadPin(B1_GPIO_Port, B1_Pin) == GPIO_PIN_SET);
+	__HAL_RCC_GPIOA_CLK_DISABLE();
+
+	if(pressed)
+		return;
+
+	// Like HAL_Init(), the trailers are read and the application starts with the caches on
+	__HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+	__HAL_FLASH_DATA_CACHE_ENABLE();
+
+	if( bootloader_delta_pending() || !slot_select_fast(&slot) )
+		return;
+	boot_time_mark(BL_BOOT_T_DECISION);
+
+	if(slot == BL_SLOT_B)
+		slot_swap_banks();
+
+	boot_time_end(BL_BOOT_PATH_FAST);
+	boot_start_image();
+}
+
+/* This function jumps to the image at FLASH_SECTOR2_BASE
+ * SysTick is stopped and no interrupt is left enabled or pending, so the application starts
+ * like after a reset. Peripherals and clocks are up to the caller.
+ */
+void boot_start_image(void)
+{
+	// Just a function pointer to hold the address of the reset handler of the user app.
+	void (*app_reset_handler)(void);
+	uint32_t msp_value = *(volatile uint32_t *)FLASH_SECTOR2_BASE;
+
+	app_reset_handler = (void *)(*(volatile uint32_t *)(FLASH_SECTOR2_BASE + 4));
+
+	__disable_irq();
+
+	SysTick->CTRL = 0;
+	SysTick->LOAD = 0;
+	SysTick->VAL = 0;
+	SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk | SCB_ICSR_PENDSVCLR_Msk;
+
+	for(uint32_t i = 0; i < (sizeof(NVIC->ICER) / sizeof(NVIC->ICER[0])); i++)
+	{
+		NVIC->ICER[i] = 0xFFFFFFFFUL;
+		NVIC->ICPR[i] = 0xFFFFFFFFUL;
+	}
+
+	SCB->VTOR = FLASH_SECTOR2_BASE;
+	__DSB();
+	__ISB();
+
+	// This function comes from CMSIS.
+	__set_MSP(msp_value);
+	__enable_irq();
+
+	app_reset_handler();
+}
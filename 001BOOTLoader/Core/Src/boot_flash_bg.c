@@ -0,0 +1,358 @@
+/*
+ * boot_flash_bg.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "main.h"
+
+#if (BL_FLASH_REQ_COUNT & (BL_FLASH_REQ_COUNT - 1)) != 0
+#error "BL_FLASH_REQ_COUNT must be a power of 2"
+#endif
+
+#define FLASH_FLAG_ERRORS		(FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | \
+								FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR)
+
+/* Request queue, the indexes run freely and are masked to get the entry :
+ * bg_tail  oldest request not reported yet (flash_bg_poll)
+ * bg_run   request the interrupt works on, bg_run == bg_head when there is nothing to do
+ * bg_head  next free entry (flash_bg_submit_*)
+ */
+static flash_req_t bg_req[BL_FLASH_REQ_COUNT];
+static volatile uint32_t bg_tail;
+static volatile uint32_t bg_run;
+static volatile uint32_t bg_head;
+
+// A step of bg_run is in progress in the flash controller
+static volatile uint8_t bg_active;
+
+// Step of the program request in progress, for the read back
+static uint32_t bg_unit_len;
+static uint32_t bg_unit_data;
+
+// First error of a request without callback, since the last flash_bg_wait()
+static volatile uint8_t bg_error;
+
+// The flash registers were unlocked for the queue
+static uint8_t bg_unlocked;
+
+
+/* Starts the next step of a request : the sector erase, or the next unit to program */
+static void bg_start_step(flash_req_t *pReq)
+{
+	uint32_t address;
+	uint32_t left;
+
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_ERRORS);
+
+	if(pReq->op == BL_FLASH_REQ_ERASE)
+	{
+		// Sectors 12 to 23 (bank 2) are numbers 16 to 27 in SNB
+		FLASH->CR &= CR_PSIZE_MASK & ~(FLASH_CR_SNB | FLASH_CR_PG);
+		FLASH->CR |= FLASH_PSIZE_WORD | FLASH_CR_SER | FLASH_CR_EOPIE | FLASH_CR_ERRIE |
+				((uint32_t)((pReq->sector < BL_FLASH_BANK_SECTORS) ? pReq->sector : (pReq->sector + 4)) << FLASH_CR_SNB_Pos);
+		FLASH->CR |= FLASH_CR_STRT;
+		return;
+	}
+
+	// Program : the biggest unit the address and the length left allow, like execute_mem_write()
+	address = pReq->address + pReq->offset;
+	left = pReq->len - pReq->offset;
+	FLASH->CR &= CR_PSIZE_MASK & ~(FLASH_CR_SER | FLASH_CR_SNB);
+
+	if( (address & 1) || (left == 1) )
+	{
+		bg_unit_len = 1;
+		bg_unit_data = pReq->pData[pReq->offset];
+		FLASH->CR |= FLASH_PSIZE_BYTE | FLASH_CR_PG | FLASH_CR_EOPIE | FLASH_CR_ERRIE;
+		*(volatile uint8_t *)address = (uint8_t)bg_unit_data;
+	}else if( (address & 2) || (left < 4) )
+	{
+		bg_unit_len = 2;
+		bg_unit_data = (uint32_t)pReq->pData[pReq->offset] | ((uint32_t)pReq->pData[pReq->offset + 1] << 8);
+		FLASH->CR |= FLASH_PSIZE_HALF_WORD | FLASH_CR_PG | FLASH_CR_EOPIE | FLASH_CR_ERRIE;
+		*(volatile uint16_t *)address = (uint16_t)bg_unit_data;
+	}else
+	{
+		bg_unit_len = 4;
+		memcpy(&bg_unit_data, &pReq->pData[pReq->offset], 4);
+		FLASH->CR |= FLASH_PSIZE_WORD | FLASH_CR_PG | FLASH_CR_EOPIE | FLASH_CR_ERRIE;
+		*(volatile uint32_t *)address = bg_unit_data;
+	}
+}
+
+/* Starts the request at bg_run if there is one, interrupt context or interrupts disabled */
+static void bg_start_next(void)
+{
+	if(bg_run == bg_head)
+	{
+		bg_active = 0;
+		return;
+	}
+
+	bg_active = 1;
+#if BL_PROFILE_EN
+	bg_req[bg_run & (BL_FLASH_REQ_COUNT - 1)].cycles = DWT->CYCCNT;
+#endif
+	bg_start_step(&bg_req[bg_run & (BL_FLASH_REQ_COUNT - 1)]);
+}
+
+/* Returns 1 if the unit just programmed reads back right
+ * Programming can only clear bits, a mismatch means the location was not erased.
+ */
+static uint8_t bg_unit_ok(uint32_t address)
+{
+	if(bg_unit_len == 1)
+		return (*(volatile uint8_t *)address == (uint8_t)bg_unit_data);
+	if(bg_unit_len == 2)
+		return (*(volatile uint16_t *)address == (uint16_t)bg_unit_data);
+
+	return (*(volatile uint32_t *)address == bg_unit_data);
+}
+
+/* Free entry at bg_head, waits for the interrupt to finish a request if the queue is full */
+static flash_req_t *bg_alloc(void)
+{
+	while((bg_head - bg_tail) >= BL_FLASH_REQ_COUNT)
+	{
+		flash_bg_poll();
+		__WFI();
+	}
+
+	return &bg_req[bg_head & (BL_FLASH_REQ_COUNT - 1)];
+}
+
+/* Puts the entry at bg_head in the queue and starts it if the flash is idle */
+static void bg_push(void)
+{
+	if(!bg_unlocked)
+	{
+		HAL_FLASH_Unlock();
+		bg_unlocked = 1;
+	}
+
+	HAL_NVIC_SetPriority(FLASH_IRQn, BL_FLASH_BG_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(FLASH_IRQn);
+
+	__disable_irq();
+	bg_head++;
+	if(!bg_active)
+		bg_start_next();
+	__enable_irq();
+}
+
+/* This function queues the erase of bank 2 sectors (bit n = sector n), the bank 1 bits are ignored */
+void flash_bg_erase_queue(uint32_t sectors)
+{
+	if(get_flash_sector_count() <= BL_FLASH_BANK_SECTORS)
+		return;
+
+	sectors &= ~((1UL << BL_FLASH_BANK_SECTORS) - 1);
+	if(sectors)
+		LOG_INFO("Background erase of sectors %#x", sectors);
+
+	for(uint8_t sector = BL_FLASH_BANK_SECTORS; sector < BL_FLASH_SECTOR_COUNT; sector++)
+	{
+		if(sectors & (1UL << sector))
+			flash_bg_submit_erase(sector, NULL, NULL);
+	}
+}
+
+/* This function queues the erase of one sector, done (may be NULL) is called once it is erased */
+void flash_bg_submit_erase(uint8_t sector, flash_req_done_t done, void *pContext)
+{
+	flash_req_t *pReq = bg_alloc();
+
+	pReq->op = BL_FLASH_REQ_ERASE;
+	pReq->sector = sector;
+	pReq->status = HAL_OK;
+	pReq->done = done;
+	pReq->pContext = pContext;
+
+	bg_push();
+}
+
+/* This function queues the programming of len bytes (not 0) from pData at address
+ * pData must stay untouched until done is called.
+ */
+void flash_bg_submit_program(uint32_t address, const uint8_t *pData, uint32_t len, flash_req_done_t done, void *pContext)
+{
+	flash_req_t *pReq = bg_alloc();
+
+	pReq->op = BL_FLASH_REQ_PROGRAM;
+	pReq->status = HAL_OK;
+	pReq->address = address;
+	pReq->pData = pData;
+	pReq->len = len;
+	pReq->offset = 0;
+	pReq->done = done;
+	pReq->pContext = pContext;
+
+	bg_push();
+}
+
+/* This function reports the requests done : runs their callbacks and frees their entries
+ * Called from the main loop, the flash is locked again once the queue is empty.
+ */
+void flash_bg_poll(void)
+{
+	flash_req_t *pReq;
+
+	while(bg_tail != bg_run)
+	{
+		pReq = &bg_req[bg_tail & (BL_FLASH_REQ_COUNT - 1)];
+
+		if(pReq->status != HAL_OK)
+		{
+			if(pReq->op == BL_FLASH_REQ_ERASE)
+				LOG_ERROR("Background erase of sector %d failed", pReq->sector);
+			if( (pReq->done == NULL) && (bg_error == HAL_OK) )
+				bg_error = pReq->status;
+		}
+
+#if BL_PROFILE_EN
+		// Recorded here, never in the interrupt, profile_record() is not reentrant
+		profile_record((pReq->op == BL_FLASH_REQ_ERASE) ? BL_PROF_ERASE : BL_PROF_PROGRAM, pReq->cycles);
+#endif
+
+		if(pReq->done)
+			pReq->done(pReq);
+
+		bg_tail++;
+	}
+
+	if( (bg_tail == bg_head) && bg_unlocked )
+	{
+		HAL_FLASH_Lock();
+		bg_unlocked = 0;
+	}
+}
+
+/* Returns 1 while requests are queued, running, or not reported yet */
+uint8_t flash_bg_busy(void)
+{
+	return (bg_tail != bg_head);
+}
+
+/* Sectors queued for an erase or being erased, bit n = sector n */
+uint32_t flash_bg_pending(void)
+{
+	uint32_t pending = 0;
+	flash_req_t *pReq;
+
+	for(uint32_t i = bg_run; i != bg_head; i++)
+	{
+		pReq = &bg_req[i & (BL_FLASH_REQ_COUNT - 1)];
+		if(pReq->op == BL_FLASH_REQ_ERASE)
+			pending |= (1UL << pReq->sector);
+	}
+
+	return pending;
+}
+
+/* First error of a request without callback, kept until flash_bg_wait() */
+uint8_t flash_bg_error(void)
+{
+	return bg_error;
+}
+
+/* This function waits until the queue is empty, the core sleeps in between */
+void flash_bg_sync(void)
+{
+	while(flash_bg_busy())
+	{
+		flash_bg_poll();
+		__WFI();
+	}
+
+	// Locks the flash again
+	flash_bg_poll();
+}
+
+/* This function waits until the queue is empty
+ * Returns the first error of a request without callback (HAL_OK if none) and forgets it,
+ * called before any synchronous flash operation.
+ */
+uint8_t flash_bg_wait(void)
+{
+	uint8_t status;
+
+	flash_bg_sync();
+
+	status = bg_error;
+	bg_error = HAL_OK;
+
+	if(status != HAL_OK)
+		LOG_ERROR("Background flash operation failed : %#x", status);
+
+	return status;
+}
+
+/* FLASH interrupt : end of operation or error of the current step
+ * Starts the next step of the request, or the next request.
+ */
+void flash_bg_irq_handler(void)
+{
+	flash_req_t *pReq;
+	uint32_t sr = FLASH->SR;
+	uint8_t status = HAL_OK;
+	uint8_t done;
+
+	if(!bg_active)
+	{
+		// Nothing of ours in progress
+		__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_ERRORS);
+		FLASH->CR &= ~(FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+		return;
+	}
+
+	pReq = &bg_req[bg_run & (BL_FLASH_REQ_COUNT - 1)];
+
+	if(sr & FLASH_FLAG_ERRORS)
+	{
+		status = HAL_ERROR;
+		done = 1;
+	}else if(sr & FLASH_FLAG_EOP)
+	{
+		if(pReq->op == BL_FLASH_REQ_ERASE)
+		{
+			FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+			// The caches may still hold the old contents of the sector
+			FLASH_FlushCaches();
+			flash_sector_set_erased(pReq->sector);
+			done = 1;
+		}else
+		{
+			FLASH->CR &= ~FLASH_CR_PG;
+			if(!bg_unit_ok(pReq->address + pReq->offset))
+			{
+				status = HAL_ERROR;
+				done = 1;
+			}else
+			{
+				pReq->offset += bg_unit_len;
+				done = (pReq->offset >= pReq->len);
+			}
+		}
+	}else
+	{
+		return;
+	}
+
+	if(!done)
+	{
+		bg_start_step(pReq);
+		return;
+	}
+
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_ERRORS);
+	FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB | FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+
+	pReq->status = status;
+#if BL_PROFILE_EN
+	pReq->cycles = DWT->CYCCNT - pReq->cycles;
+#endif
+	bg_run++;
+	bg_start_next();
+}
@@ -16,104 +16,202 @@ uint8_t supported_commands[] = {	BL_GET_VER ,
 									BL_GO_TO_ADDR,
 									BL_FLASH_ERASE,
 									BL_MEM_WRITE,
-									BL_READ_SECTOR_P_STATUS} ;
-
-uint8_t bl_rx_buffer[BL_RX_LEN];
+									BL_MEM_READ,
+									BL_READ_SECTOR_P_STATUS,
+									BL_OTP_READ,
+									BL_GET_PROTOCOL,
+									BL_SET_BAUD,
+									BL_GET_SECTOR_HASHES,
+									BL_BLANK_CHECK,
+									BL_FLASH_ERASE_RANGE,
+									BL_SLOT_INFO,
+									BL_SLOT_ACTIVATE,
+									BL_FLASH_STATUS,
+									BL_GET_PROFILE} ;
+
+
+/* Commands which don't touch the flash (or only queue a background erase),
+ * they are served while bank 2 is erased in the background
+ */
+static uint8_t command_runs_during_erase(uint8_t command_code)
+{
+	switch(command_code)
+	{
+		case BL_GET_VER:
+		case BL_GET_HELP:
+		case BL_GET_CID:
+		case BL_GET_RDP_STATUS:
+		case BL_GET_PROTOCOL:
+		case BL_SET_BAUD:
+		case BL_FLASH_ERASE:
+		case BL_FLASH_ERASE_RANGE:
+		case BL_FLASH_STATUS:
+			return 1;
+		default:
+			return 0;
+	}
+}
 
 
 void  bootloader_uart_read_data(void)
 {
-    uint8_t rcv_len=0;
+	uint8_t *pFrame;
+	uint32_t frame_len;
+
+	// Commands are received in the background by the DMA of C_UART
+	bootloader_uart_rx_start();
+	boot_time_end(BL_BOOT_PATH_BOOTLOADER);
 
 	while(1)
 	{
-		memset(bl_rx_buffer, 0, BL_RX_LEN);
 		// Here we will read and decode the commands coming from host
-		// First read only one byte from the host , which is the "length" field of the command packet
-		HAL_UART_Receive(C_UART,bl_rx_buffer,1,HAL_MAX_DELAY);
-		rcv_len= bl_rx_buffer[0];
-		HAL_UART_Receive(C_UART,&bl_rx_buffer[1],rcv_len,HAL_MAX_DELAY);
-		switch(bl_rx_buffer[1])
+		// The complete command packet is handed out in place from the receive ring
+		pFrame = bootloader_uart_get_frame(&frame_len);
+		BL_PROFILE_BEGIN(cmd_start);
+		if(pFrame[0] == BL_V2_SOF)
+		{
+			bootloader_handle_v2_cmd(pFrame);
+			BL_PROFILE_END(BL_PROF_CMD(BL_V2_CMD(pFrame)), cmd_start);
+			bootloader_uart_release_frame();
+			continue;
+		}
+
+		// The other commands read or write the flash, they wait for the background erase
+		if( flash_bg_busy() && !command_runs_during_erase(pFrame[1]) )
+		{
+			flash_bg_sync();
+		}
+
+		switch(pFrame[1])
 		{
             case BL_GET_VER:
-                bootloader_handle_getver_cmd(bl_rx_buffer);
+                bootloader_handle_getver_cmd(pFrame);
                 break;
             case BL_GET_HELP:
-                bootloader_handle_gethelp_cmd(bl_rx_buffer);
+                bootloader_handle_gethelp_cmd(pFrame);
                 break;
             case BL_GET_CID:
-                bootloader_handle_getcid_cmd(bl_rx_buffer);
+                bootloader_handle_getcid_cmd(pFrame);
                 break;
             case BL_GET_RDP_STATUS:
-                bootloader_handle_getrdp_cmd(bl_rx_buffer);
+                bootloader_handle_getrdp_cmd(pFrame);
                 break;
             case BL_GO_TO_ADDR:
-                bootloader_handle_go_cmd(bl_rx_buffer);
+                bootloader_handle_go_cmd(pFrame);
                 break;
             case BL_FLASH_ERASE:
-                bootloader_handle_flash_erase_cmd(bl_rx_buffer);
+                bootloader_handle_flash_erase_cmd(pFrame);
                 break;
             case BL_MEM_WRITE:
-                bootloader_handle_mem_write_cmd(bl_rx_buffer);
+                bootloader_handle_mem_write_cmd(pFrame);
                 break;
             case BL_EN_RW_PROTECT:
-                bootloader_handle_en_rw_protect(bl_rx_buffer);
+                bootloader_handle_en_rw_protect(pFrame);
                 break;
             case BL_MEM_READ:
-                bootloader_handle_mem_read(bl_rx_buffer);
+                bootloader_handle_mem_read(pFrame);
                 break;
             case BL_READ_SECTOR_P_STATUS:
-                bootloader_handle_read_sector_protection_status(bl_rx_buffer);
+                bootloader_handle_read_sector_protection_status(pFrame);
                 break;
             case BL_OTP_READ:
-                bootloader_handle_read_otp(bl_rx_buffer);
+                bootloader_handle_read_otp(pFrame);
+                break;
+            case BL_DIS_R_W_PROTECT:
+                bootloader_handle_dis_rw_protect(pFrame);
+                break;
+            case BL_GET_PROTOCOL:
+                bootloader_handle_get_protocol_cmd(pFrame);
+                break;
+            case BL_SET_BAUD:
+                bootloader_handle_set_baud_cmd(pFrame);
                 break;
-						case BL_DIS_R_W_PROTECT:
-                bootloader_handle_dis_rw_protect(bl_rx_buffer);
+            case BL_GET_SECTOR_HASHES:
+                bootloader_handle_get_sector_hashes_cmd(pFrame);
+                break;
+            case BL_BLANK_CHECK:
+                bootloader_handle_blank_check_cmd(pFrame);
+                break;
+            case BL_FLASH_ERASE_RANGE:
+                bootloader_handle_flash_erase_range_cmd(pFrame);
+                break;
+            case BL_SLOT_INFO:
+                bootloader_handle_slot_info_cmd(pFrame);
+                break;
+            case BL_SLOT_ACTIVATE:
+                bootloader_handle_slot_activate_cmd(pFrame);
+                break;
+            case BL_FLASH_STATUS:
+                bootloader_handle_flash_status_cmd(pFrame);
+                break;
+            case BL_GET_PROFILE:
+                bootloader_handle_get_profile_cmd(pFrame);
                 break;
              default:
-                printmsg("BL_DEBUG_MSG: Invalid command code received from host \r\n");
+                LOG_WARN("Invalid command code received from host");
                 break;
 
 
 		}
+		BL_PROFILE_END(BL_PROF_CMD(pFrame[1]), cmd_start);
 
+		// Packet is handled, give it back to the receive ring
+		bootloader_uart_release_frame();
 	}
 
 }
 
 
-/* Code to jump to user application
- * Here we are assuming FLASH_SECTOR2_BASE
- * is where the user application is stored
+/* This function undoes the init of main() : peripherals back to their reset state, core on the HSI
+ * The bank mapping (SYSCFG) is kept, slot B runs through it.
  */
-void bootloader_jump_to_user_app(void)
+static void bootloader_deinit(void)
 {
+    HAL_UART_DeInit(&huart1);
+    HAL_UART_DeInit(&huart3);
+    HAL_CRC_DeInit(&hcrc);
 
-   // Just a function pointer to hold the address of the reset handler of the user app.
-    void (*app_reset_handler)(void);
+    // The GPIO ports MX_GPIO_Init() configured and the DMA controllers
+    RCC->AHB1RSTR |= BL_AHB1_RESET_MASK;
+    RCC->AHB1RSTR &= ~BL_AHB1_RESET_MASK;
+    RCC->AHB1ENR &= ~BL_AHB1_RESET_MASK;
 
-    printmsg("BL_DEBUG_MSG: bootloader_jump_to_user_app\r\n");
+    // Back to the HSI, PLL off, SysTick is stopped by boot_start_image()
+    HAL_RCC_DeInit();
+}
+
+/* Code to jump to user application
+ * The user application is at FLASH_SECTOR2_BASE, slot B
+ * is mapped there first by swapping the banks (see boot_slot.h)
+ */
+void bootloader_jump_to_user_app(void)
+{
+    uint8_t slot;
 
+    LOG_DEBUG("bootloader_jump_to_user_app");
 
-    // 1. Configure the MSP by reading the value from the base address of the sector 2
-    uint32_t msp_value = *(volatile uint32_t *)FLASH_SECTOR2_BASE;
-    printmsg("BL_DEBUG_MSG: MSP value : %#x\r\n",msp_value);
+    // Nothing may be left running on the flash when the application starts
+    flash_bg_sync();
+    HAL_NVIC_DisableIRQ(FLASH_IRQn);
 
-    // This function comes from CMSIS.
-    __set_MSP(msp_value);
+    slot = slot_select_boot(1);
+    LOG_INFO("Boot slot : %d", slot);
+    if(slot_map_boot(slot) != HAL_OK)
+    {
+        // Bank 2 can't be mapped, whatever is in slot A gets started
+        LOG_ERROR("Slot %d can't be mapped", slot);
+    }
 
-    /* 2. Now fetch the reset handler address of the USER Application
-     * from the location FLASH_SECTOR2_BASE + 4
-     */
-    uint32_t resethandler_address = *(volatile uint32_t *) (FLASH_SECTOR2_BASE + 4);
+    LOG_INFO("MSP value : %#x", *(volatile uint32_t *)FLASH_SECTOR2_BASE);
+    LOG_INFO("USER Application Reset Handler Address : %#x", *(volatile uint32_t *)(FLASH_SECTOR2_BASE + 4));
 
-    app_reset_handler = (void*) resethandler_address;
+    // The log DMA must be done before the application takes the UART over
+    log_flush();
 
-    printmsg("BL_DEBUG_MSG: USER Application Reset Handler Address : %#x\r\n", app_reset_handler);
+    bootloader_deinit();
+    boot_time_end(BL_BOOT_PATH_FULL);
 
-    //3. Jump to reset handler of the user application
-    app_reset_handler();
+    boot_start_image();
 
 }
 
@@ -127,7 +225,7 @@ void bootloader_handle_getver_cmd(uint8_t *pBuffer)
 	uint8_t bl_version;
 
 	// 1) Verify the checksum
-	printmsg("BL_DEBUG_MSG: bootloader_handle_getver_cmd\r\n");
+	LOG_DEBUG("bootloader_handle_getver_cmd");
 
 	// Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1 ;
@@ -137,17 +235,17 @@ void bootloader_handle_getver_cmd(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
 	{
-		printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+		LOG_DEBUG("Checksum success !!");
 		// Checksum is correct..
 		uint8_t follow_len = 1;
 		bootloader_send_ack(pBuffer[0], follow_len);
 		bl_version = get_bootloader_version();
-		printmsg("BL_DEBUG_MSG: BL_VER : %d %#x\r\n", bl_version, bl_version);
+		LOG_INFO("BL_VER : %d %#x", bl_version, bl_version);
 		bootloader_uart_write_data(&bl_version, follow_len);
 
 	}else
 	{
-		printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+		LOG_WARN("Checksum fail !!");
 		// Checksum is wrong send nack
 		bootloader_send_nack();
 	}
@@ -160,7 +258,7 @@ void bootloader_handle_getver_cmd(uint8_t *pBuffer)
  */
 void bootloader_handle_gethelp_cmd(uint8_t *pBuffer)
 {
-    printmsg("BL_DEBUG_MSG: bootloader_handle_gethelp_cmd\r\n");
+    LOG_DEBUG("bootloader_handle_gethelp_cmd");
 
 	// Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1;
@@ -170,13 +268,13 @@ void bootloader_handle_gethelp_cmd(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc) )
 	{
-        printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+        LOG_DEBUG("Checksum success !!");
         bootloader_send_ack(pBuffer[0], sizeof(supported_commands));
         bootloader_uart_write_data(supported_commands, sizeof(supported_commands));
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 
@@ -186,7 +284,7 @@ void bootloader_handle_gethelp_cmd(uint8_t *pBuffer)
 void bootloader_handle_getcid_cmd(uint8_t *pBuffer)
 {
 	uint16_t bl_cid_num = 0;
-	printmsg("BL_DEBUG_MSG: bootloader_handle_getcid_cmd\r\n");
+	LOG_DEBUG("bootloader_handle_getcid_cmd");
 
     // Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1 ;
@@ -196,16 +294,16 @@ void bootloader_handle_getcid_cmd(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc) )
 	{
-        printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+        LOG_DEBUG("Checksum success !!");
         uint8_t follow_len = 2;
         bootloader_send_ack(pBuffer[0], follow_len);
         bl_cid_num = get_mcu_chip_id();
-        printmsg("BL_DEBUG_MSG: MCU ID = %d %#x !!\r\n", bl_cid_num, bl_cid_num);
+        LOG_INFO("MCU ID = %d %#x !!", bl_cid_num, bl_cid_num);
         bootloader_uart_write_data((uint8_t *)&bl_cid_num, follow_len);
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 
@@ -216,7 +314,7 @@ void bootloader_handle_getcid_cmd(uint8_t *pBuffer)
 void bootloader_handle_getrdp_cmd(uint8_t *pBuffer)
 {
     uint8_t rdp_level = 0x00;
-    printmsg("BL_DEBUG_MSG: bootloader_handle_getrdp_cmd\r\n");
+    LOG_DEBUG("bootloader_handle_getrdp_cmd");
 
     // Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1 ;
@@ -226,16 +324,16 @@ void bootloader_handle_getrdp_cmd(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
 	{
-        printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+        LOG_DEBUG("Checksum success !!");
         uint8_t follow_len = 1;
         bootloader_send_ack(pBuffer[0], follow_len);
         rdp_level = get_flash_rdp_level();
-        printmsg("BL_DEBUG_MSG: RDP level: %d %#x\r\n", rdp_level, rdp_level);
+        LOG_INFO("RDP level: %d %#x", rdp_level, rdp_level);
         bootloader_uart_write_data(&rdp_level, follow_len);
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 
@@ -249,7 +347,7 @@ void bootloader_handle_go_cmd(uint8_t *pBuffer)
     uint8_t addr_valid = ADDR_VALID;
     uint8_t addr_invalid = ADDR_INVALID;
 
-    printmsg("BL_DEBUG_MSG: bootloader_handle_go_cmd\r\n");
+    LOG_DEBUG("bootloader_handle_go_cmd");
 
     // Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1 ;
@@ -259,13 +357,13 @@ void bootloader_handle_go_cmd(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
 	{
-        printmsg("BL_DEBUG_MSG: checksum success !!\r\n");
+        LOG_DEBUG("checksum success !!");
 
         bootloader_send_ack(pBuffer[0], 1);
 
         // Extract the go address
         go_address = *((uint32_t *)&pBuffer[2] );
-        printmsg("BL_DEBUG_MSG: GO Address: %#x\r\n", go_address);
+        LOG_INFO("GO Address: %#x", go_address);
 
         if( verify_address(go_address) == ADDR_VALID )
         {
@@ -284,20 +382,24 @@ void bootloader_handle_go_cmd(uint8_t *pBuffer)
 
             void (*lets_jump)(void) = (void *)go_address;
 
-            printmsg("BL_DEBUG_MSG: Jumping to go address!\r\n");
+            LOG_INFO("Jumping to go address!");
+
+            // Stop the DMA reception, it must not keep writing in to the receive ring
+            bootloader_uart_rx_stop();
+            log_flush();
 
             lets_jump();
 
 		}else
 		{
-            printmsg("BL_DEBUG_MSG: GO Address invalid !\r\n");
+            LOG_WARN("GO Address invalid !");
             // Tell host that address is invalid
             bootloader_uart_write_data(&addr_invalid, 1);
 		}
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 
@@ -308,7 +410,7 @@ void bootloader_handle_go_cmd(uint8_t *pBuffer)
 void bootloader_handle_flash_erase_cmd(uint8_t *pBuffer)
 {
     uint8_t erase_status = 0x00;
-    printmsg("BL_DEBUG_MSG: bootloader_handle_flash_erase_cmd\r\n");
+    LOG_DEBUG("bootloader_handle_flash_erase_cmd");
 
     // Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1 ;
@@ -318,21 +420,213 @@ void bootloader_handle_flash_erase_cmd(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0],command_packet_len - 4, host_crc))
 	{
-        printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+        LOG_DEBUG("Checksum success !!");
         bootloader_send_ack(pBuffer[0], 1);
-        printmsg("BL_DEBUG_MSG: Initial_sector : %d  no_ofsectors: %d\r\n", pBuffer[2], pBuffer[3]);
+        LOG_INFO("Initial_sector : %d  no_ofsectors: %d", pBuffer[2], pBuffer[3]);
 
         HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_SET);
         erase_status = execute_flash_erase(pBuffer[2], pBuffer[3]);
         HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_RESET);
 
-        printmsg("BL_DEBUG_MSG: Flash erase status: %#x\r\n", erase_status);
+        LOG_INFO("Flash erase status: %#x", erase_status);
+
+        bootloader_uart_write_data(&erase_status, 1);
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Helper function to handle BL_FLASH_ERASE_RANGE command
+ * Command packet : start address (32 bits), length (32 bits)
+ * Erases the smallest set of sectors which covers the range, the bootloader sectors are refused.
+ */
+void bootloader_handle_flash_erase_range_cmd(uint8_t *pBuffer)
+{
+    uint8_t erase_status = 0x00;
+    uint32_t mem_address;
+    uint32_t len;
+    LOG_DEBUG("bootloader_handle_flash_erase_range_cmd");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1 ;
+
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
+
+	if (! bootloader_verify_crc(&pBuffer[0],command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+        bootloader_send_ack(pBuffer[0], 1);
+
+        mem_address = *((uint32_t *)&pBuffer[2]);
+        len = *((uint32_t *)&pBuffer[6]);
+        LOG_INFO("Erase Address : %#x len : %d", mem_address, len);
+
+        HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_SET);
+        erase_status = execute_flash_erase_range(mem_address, len);
+        HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_RESET);
+
+        LOG_INFO("Flash erase status: %#x", erase_status);
 
         bootloader_uart_write_data(&erase_status, 1);
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Helper function to handle BL_SLOT_INFO command
+ * Replies the slot the next reset starts (BL_SLOT_NONE : no slot activated, FLASH_SECTOR2_BASE),
+ * then for slot A and slot B : state, seq, size and CRC (32 bits each).
+ */
+void bootloader_handle_slot_info_cmd(uint8_t *pBuffer)
+{
+	uint8_t reply[1 + (BL_SLOT_COUNT * 13)];
+	const bl_slot_trailer_t *pTrailer;
+	uint8_t *pReply = &reply[1];
+	LOG_DEBUG("bootloader_handle_slot_info_cmd");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
+
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
+
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+        reply[0] = slot_select_boot(0);
+        for(uint8_t slot = 0; slot < BL_SLOT_COUNT; slot++)
+        {
+            pTrailer = slot_get_trailer(slot);
+            *pReply++ = slot_get_state(slot);
+            if(*(pReply - 1) == BL_SLOT_EMPTY)
+            {
+                memset(pReply, 0, 12);
+            }else
+            {
+                memcpy(&pReply[0], (const void *)&pTrailer->seq, 4);
+                memcpy(&pReply[4], (const void *)&pTrailer->size, 4);
+                memcpy(&pReply[8], (const void *)&pTrailer->crc, 4);
+            }
+            pReply += 12;
+        }
+
+        bootloader_send_ack(pBuffer[0], sizeof(reply));
+        bootloader_uart_write_data(reply, sizeof(reply));
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Helper function to handle BL_SLOT_ACTIVATE command
+ * Command packet : slot, image size (32 bits), image CRC32 in word mode (32 bits)
+ */
+void bootloader_handle_slot_activate_cmd(uint8_t *pBuffer)
+{
+	uint8_t status;
+	uint32_t size;
+	uint32_t crc;
+	LOG_DEBUG("bootloader_handle_slot_activate_cmd");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
+
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
+
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+        bootloader_send_ack(pBuffer[0], 1);
+
+        memcpy(&size, &pBuffer[3], 4);
+        memcpy(&crc, &pBuffer[7], 4);
+        LOG_INFO("Slot %d activate size : %d crc : %#x", pBuffer[2], size, crc);
+
+        status = slot_activate(pBuffer[2], size, crc);
+        bootloader_uart_write_data(&status, 1);
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Helper function to handle BL_FLASH_STATUS command
+ * Replies the state of the background erase : busy (1 byte), sectors not erased yet
+ * (32 bits, bit n = sector n) and the first error (HAL status, 0 if none).
+ */
+void bootloader_handle_flash_status_cmd(uint8_t *pBuffer)
+{
+	uint8_t reply[6];
+	uint32_t pending;
+	LOG_DEBUG("bootloader_handle_flash_status_cmd");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
+
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
+
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+        pending = flash_bg_pending();
+        reply[0] = flash_bg_busy();
+        memcpy(&reply[1], &pending, 4);
+        reply[5] = flash_bg_error();
+
+        bootloader_send_ack(pBuffer[0], sizeof(reply));
+        bootloader_uart_write_data(reply, sizeof(reply));
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Helper function to handle BL_GET_PROFILE command
+ * Streams the profile table (bl_profile_table_t, see boot_profile.h), the argument byte set
+ * clears the table once it is sent. Replies ADDR_INVALID if the profile is not compiled in.
+ */
+void bootloader_handle_get_profile_cmd(uint8_t *pBuffer)
+{
+	LOG_DEBUG("bootloader_handle_get_profile_cmd");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
+
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
+
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+#if BL_PROFILE_EN
+        // No sample may change the table while the DMA sends it
+        bootloader_stream_data(ADDR_VALID, (uint8_t *)profile_freeze(), sizeof(bl_profile_table_t));
+        profile_thaw(pBuffer[2]);
+#else
+        bootloader_stream_data(ADDR_INVALID, NULL, 0);
+#endif
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 }
@@ -342,9 +636,10 @@ void bootloader_handle_mem_write_cmd(uint8_t *pBuffer)
 {
 	uint8_t write_status = 0x00;
 	uint8_t payload_len = pBuffer[6];
+	uint32_t fail_offset = 0;
 
 	uint32_t mem_address = *((uint32_t *) (&pBuffer[2]) );
-    printmsg("BL_DEBUG_MSG: bootloader_handle_mem_write_cmd\r\n");
+    LOG_DEBUG("bootloader_handle_mem_write_cmd");
 
     // Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1;
@@ -355,22 +650,31 @@ void bootloader_handle_mem_write_cmd(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
 	{
-        printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+        LOG_DEBUG("Checksum success !!");
 
+        /* The ACK goes out before the flash is programmed : a pipelining host sends
+         * the next packet as soon as it gets the ACK, the DMA receives it in to the
+         * receive ring (second buffer) while this packet is being programmed.
+         * The write status follows once programming is done.
+         */
         bootloader_send_ack(pBuffer[0], 1);
 
-        printmsg("BL_DEBUG_MSG: Memory write Address : %\r\n",mem_address);
+        LOG_INFO("Memory write Address : %#x",mem_address);
 
 		if( verify_address(mem_address) == ADDR_VALID )
 		{
 
-            printmsg("BL_DEBUG_MSG: Valid Memory write Address\r\n");
+            LOG_DEBUG("Valid Memory write Address");
 
             // Glow the led to indicate Bootloader is currently writing to memory
             HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_SET);
 
             // Execute Memory write
-            write_status = execute_mem_write(&pBuffer[7], mem_address, payload_len);
+            write_status = execute_mem_write(&pBuffer[7], mem_address, payload_len, &fail_offset);
+            if( write_status != HAL_OK )
+            {
+                LOG_ERROR("Memory write failed at offset %d (address %#x)", fail_offset, mem_address + fail_offset);
+            }
 
             // Turn off the led to indicate memory write is over
             HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_RESET);
@@ -380,7 +684,7 @@ void bootloader_handle_mem_write_cmd(uint8_t *pBuffer)
 
 		}else
 		{
-            printmsg("BL_DEBUG_MSG: Invalid Memory write Address\r\n");
+            LOG_WARN("Invalid Memory write Address");
             write_status = ADDR_INVALID;
             // Inform host that address is invalid
             bootloader_uart_write_data(&write_status, 1);
@@ -389,7 +693,7 @@ void bootloader_handle_mem_write_cmd(uint8_t *pBuffer)
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 
@@ -399,7 +703,7 @@ void bootloader_handle_mem_write_cmd(uint8_t *pBuffer)
 void bootloader_handle_en_rw_protect(uint8_t *pBuffer)
 {
     uint8_t status = 0x00;
-    printmsg("BL_DEBUG_MSG: bootloader_handle_endis_rw_protect\r\n");
+    LOG_DEBUG("bootloader_handle_endis_rw_protect");
 
     // Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1 ;
@@ -409,18 +713,18 @@ void bootloader_handle_en_rw_protect(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
 	{
-        printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+        LOG_DEBUG("Checksum success !!");
         bootloader_send_ack(pBuffer[0], 1);
 
         status = configure_flash_sector_rw_protection(*(uint16_t*)&pBuffer[2], pBuffer[4], 0);
 
-        printmsg("BL_DEBUG_MSG: Flash erase status: %#x\r\n",status);
+        LOG_INFO("Flash erase status: %#x",status);
 
         bootloader_uart_write_data(&status, 1);
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 
@@ -432,46 +736,127 @@ void bootloader_handle_en_rw_protect(uint8_t *pBuffer)
 void bootloader_handle_dis_rw_protect(uint8_t *pBuffer)
 {
     uint8_t status = 0x00;
-    printmsg("BL_DEBUG_MSG: bootloader_handle_dis_rw_protect\r\n");
+    LOG_DEBUG("bootloader_handle_dis_rw_protect");
 
     //Total length of the command packet
-	uint32_t command_packet_len = bl_rx_buffer[0] + 1;
+	uint32_t command_packet_len = pBuffer[0] + 1;
 
 	//extract the CRC32 sent by the Host
 	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
 	{
-        printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+        LOG_DEBUG("Checksum success !!");
         bootloader_send_ack(pBuffer[0], 1);
 
         status = configure_flash_sector_rw_protection(0, 0, 1);
 
-        printmsg("BL_DEBUG_MSG: Flash erase status: %#x\r\n",status);
+        LOG_INFO("Flash erase status: %#x",status);
 
         bootloader_uart_write_data(&status, 1);
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 
 
 }
 
-/*Helper function to handle BL_MEM_READ command */
+/*Helper function to handle BL_MEM_READ command
+ * Command packet : base address (32 bits), length (32 bits)
+ * The memory is streamed back by bootloader_stream_data()
+ */
 void bootloader_handle_mem_read (uint8_t *pBuffer)
 {
+	uint32_t mem_address;
+	uint32_t len;
+	LOG_DEBUG("bootloader_handle_mem_read");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
+
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
+
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+        mem_address = *((uint32_t *)&pBuffer[2]);
+        len = *((uint32_t *)&pBuffer[6]);
+        LOG_INFO("Memory read Address : %#x len : %d", mem_address, len);
+
+        if( verify_mem_range(mem_address, len) == ADDR_VALID )
+        {
+            bootloader_stream_data(ADDR_VALID, (uint8_t *)mem_address, len);
+        }else
+        {
+            LOG_WARN("Invalid Memory read range");
+            bootloader_stream_data(ADDR_INVALID, NULL, 0);
+        }
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* This function sends a streamed reply : ACK, the stream header and then pData in CRC protected chunks
+ * Chunks go out with the DMA straight from pData, the CRC of a chunk is computed while it is being sent.
+ */
+void bootloader_stream_data(uint8_t status, uint8_t *pData, uint32_t len)
+{
+	uint8_t header[BL_STREAM_HDR_LEN];
+	uint32_t chunk_crc;
+	uint32_t chunk_len;
+	uint32_t offset = 0;
+	uint8_t use_dma = 1;
+
+	header[0] = status;
+	header[1] = (uint8_t)(BL_STREAM_CHUNK_LEN & 0xFF);
+	header[2] = (uint8_t)(BL_STREAM_CHUNK_LEN >> 8);
+	memcpy(&header[3], &len, 4);
+
+	bootloader_send_ack(0, BL_STREAM_HDR_LEN);
+	bootloader_uart_write_data(header, BL_STREAM_HDR_LEN);
+
+	if( status != ADDR_VALID )
+		return;
+
+	// The DMA has no access to the CCM RAM
+	if( ((uint32_t)pData >= CCMDATARAM_BASE) && ((uint32_t)pData <= CCMDATARAM_END) )
+		use_dma = 0;
+
+	while( offset < len )
+	{
+		chunk_len = len - offset;
+		if( chunk_len > BL_STREAM_CHUNK_LEN )
+			chunk_len = BL_STREAM_CHUNK_LEN;
 
+		if( use_dma )
+		{
+			bootloader_uart_write_data_dma(&pData[offset], chunk_len);
+			chunk_crc = bootloader_calc_crc(&pData[offset], chunk_len, BL_CRC_MODE_WORD);
+			bootloader_uart_tx_wait();
+		}else
+		{
+			chunk_crc = bootloader_calc_crc(&pData[offset], chunk_len, BL_CRC_MODE_WORD);
+			bootloader_uart_write_data(&pData[offset], chunk_len);
+		}
 
+		bootloader_uart_write_data((uint8_t *)&chunk_crc, 4);
+		offset += chunk_len;
+	}
 }
 
 /*Helper function to handle _BL_READ_SECTOR_P_STATUS command */
 void bootloader_handle_read_sector_protection_status(uint8_t *pBuffer)
 {
 	 uint16_t status;
-	printmsg("BL_DEBUG_MSG: bootloader_handle_read_sector_protection_status\r\n");
+	LOG_DEBUG("bootloader_handle_read_sector_protection_status");
 
     // Total length of the command packet
 	uint32_t command_packet_len = pBuffer[0] + 1;
@@ -481,80 +866,887 @@ void bootloader_handle_read_sector_protection_status(uint8_t *pBuffer)
 
 	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
 	{
-        printmsg("BL_DEBUG_MSG: Checksum success !!\r\n");
+        LOG_DEBUG("Checksum success !!");
         bootloader_send_ack(pBuffer[0], 2);
         status = read_OB_rw_protection_status();
-        printmsg("BL_DEBUG_MSG: nWRP status: %#x\r\n", status);
+        LOG_INFO("nWRP status: %#x", status);
         bootloader_uart_write_data((uint8_t*)&status, 2);
 
 	}else
 	{
-        printmsg("BL_DEBUG_MSG: Checksum fail !!\r\n");
+        LOG_WARN("Checksum fail !!");
         bootloader_send_nack();
 	}
 
 }
 
-/*Helper function to handle BL_OTP_READ command */
+/*Helper function to handle BL_OTP_READ command
+ * Replies the 512 OTP data bytes (16 blocks of 32 bytes) followed by the 16 lock bytes,
+ * both areas are contiguous so the whole 528 bytes go out as one streamed chunk with one CRC.
+ */
 void bootloader_handle_read_otp(uint8_t *pBuffer)
 {
+	LOG_DEBUG("bootloader_handle_read_otp");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
 
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
 
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+        bootloader_stream_data(ADDR_VALID, (uint8_t *)FLASH_OTP_BASE, BL_OTP_LEN + BL_OTP_LOCK_LEN);
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
 }
 
-/* This function sends ACK if CRC matches along with "len to follow"*/
-void bootloader_send_ack(uint8_t command_code, uint8_t follow_len)
+/* Helper function to handle BL_GET_PROTOCOL command
+ * Replies the protocol version, the capabilities, the biggest v2 payload and the window of the
+ * windowed writes, a host which gets no answer (older bootloader) stays with v1 packets.
+ */
+void bootloader_handle_get_protocol_cmd(uint8_t *pBuffer)
 {
-	 // Here we send 2 byte.. first byte is ack and the second byte is len value
-	uint8_t ack_buf[2];
-	ack_buf[0] = BL_ACK;
-	ack_buf[1] = follow_len;
-	HAL_UART_Transmit(C_UART, ack_buf, 2, HAL_MAX_DELAY);
+	uint8_t reply[6];
+	LOG_DEBUG("bootloader_handle_get_protocol_cmd");
 
-}
+	// Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
 
-/* This function sends NACK */
-void bootloader_send_nack(void)
-{
-	uint8_t nack = BL_NACK;
-	HAL_UART_Transmit(C_UART, &nack, 1, HAL_MAX_DELAY);
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
+
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+        reply[0] = BL_PROTOCOL_VERSION;
+        reply[1] = BL_CAP_CRC_WORD | BL_CAP_LZ4 | BL_CAP_DELTA | BL_CAP_AUTO_ERASE | BL_CAP_BG_ERASE | BL_CAP_DEFER | BL_CAP_WINDOW;
+        reply[2] = (uint8_t)(BL_V2_MAX_PAYLOAD & 0xFF);
+        reply[3] = (uint8_t)(BL_V2_MAX_PAYLOAD >> 8);
+        reply[4] = (uint8_t)(BL_RX_WINDOW & 0xFF);
+        reply[5] = (uint8_t)(BL_RX_WINDOW >> 8);
+        bootloader_send_ack(pBuffer[0], sizeof(reply));
+        bootloader_uart_write_data(reply, sizeof(reply));
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
 }
 
-// This verifies the CRC of the given buffer in pData .
-uint8_t bootloader_verify_crc (uint8_t *pData, uint32_t len, uint32_t crc_host)
+/* Helper function to handle BL_SET_BAUD command
+ * Command packet : new baud rate (32 bits)
+ * The reply goes out at the current rate, then C_UART switches to the new one.
+ */
+void bootloader_handle_set_baud_cmd(uint8_t *pBuffer)
 {
-	uint32_t uwCRCValue = 0xFF;
+	uint32_t baud;
+	uint8_t status;
+	LOG_DEBUG("bootloader_handle_set_baud_cmd");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
+
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
 
-	for (uint32_t i=0 ; i < len ; i++)
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
 	{
-		uint32_t i_data = pData[i];
-		uwCRCValue = HAL_CRC_Accumulate(&hcrc, &i_data, 1);
-	}
+        LOG_DEBUG("Checksum success !!");
 
-	 /* Reset CRC Calculation Unit */
-	__HAL_CRC_DR_RESET(&hcrc);
+        baud = *((uint32_t *)&pBuffer[2]);
+        status = bootloader_uart_check_baud(baud);
+        LOG_INFO("New baud rate : %d status : %d", baud, status);
 
-	if( uwCRCValue == crc_host)
+        bootloader_send_ack(pBuffer[0], 1);
+        bootloader_uart_write_data(&status, 1);
+
+        if(status == BL_BAUD_OK)
+        {
+            bootloader_uart_set_baud(baud);
+        }
+
+	}else
 	{
-		return VERIFY_CRC_SUCCESS;
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
 	}
-
-	return VERIFY_CRC_FAIL;
 }
 
-/* This function writes data in to C_UART */
-void bootloader_uart_write_data(uint8_t *pBuffer, uint32_t len)
+/* Helper function to handle BL_GET_SECTOR_HASHES command
+ * Command packet : first sector, number of sectors
+ * Replies the CRC32 (word mode) of every sector as a streamed reply. The CRC unit goes
+ * through the flash at memory speed so the host can compare instead of reading back.
+ */
+void bootloader_handle_get_sector_hashes_cmd(uint8_t *pBuffer)
 {
-	/* Can replace the below ST's USART driver API call with your MCUs driver API call */
-	HAL_UART_Transmit(C_UART, pBuffer, len, HAL_MAX_DELAY);
+	static uint32_t sector_crc[BL_FLASH_SECTOR_COUNT];
+	uint8_t first_sector;
+	uint8_t nb_sectors;
+	LOG_DEBUG("bootloader_handle_get_sector_hashes_cmd");
 
-}
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
 
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
 
-// Just returns the macro value .
-uint8_t get_bootloader_version(void)
-{
-	return (uint8_t)BL_VERSION;
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+        first_sector = pBuffer[2];
+        nb_sectors = pBuffer[3];
+        LOG_INFO("Sector hashes first : %d count : %d", first_sector, nb_sectors);
+
+        if( (nb_sectors == 0) || (first_sector >= get_flash_sector_count()) ||
+                (nb_sectors > (get_flash_sector_count() - first_sector)) )
+        {
+            LOG_WARN("Invalid sector range");
+            bootloader_stream_data(ADDR_INVALID, NULL, 0);
+            return;
+        }
+
+        for(uint8_t i = 0; i < nb_sectors; i++)
+        {
+            sector_crc[i] = bootloader_calc_crc((uint8_t *)get_flash_sector_base(first_sector + i),
+                                                get_flash_sector_size(first_sector + i), BL_CRC_MODE_WORD);
+        }
+
+        bootloader_stream_data(ADDR_VALID, (uint8_t *)sector_crc, nb_sectors * 4);
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Helper function to handle BL_BLANK_CHECK command
+ * Command packet : first sector, number of sectors
+ * Replies a status (ADDR_VALID / ADDR_INVALID) and a 32-bit bitmap, bit n set = sector n is blank.
+ */
+void bootloader_handle_blank_check_cmd(uint8_t *pBuffer)
+{
+	uint8_t reply[5] = {ADDR_VALID, 0, 0, 0, 0};
+	uint32_t blank_map = 0;
+	uint8_t first_sector;
+	uint8_t nb_sectors;
+	LOG_DEBUG("bootloader_handle_blank_check_cmd");
+
+    // Total length of the command packet
+	uint32_t command_packet_len = pBuffer[0] + 1;
+
+	// Extract the CRC32 sent by the Host
+	uint32_t host_crc = *((uint32_t * ) (pBuffer + command_packet_len - 4) ) ;
+
+	if (! bootloader_verify_crc(&pBuffer[0], command_packet_len - 4, host_crc))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+        first_sector = pBuffer[2];
+        nb_sectors = pBuffer[3];
+
+        if( (nb_sectors == 0) || (first_sector >= get_flash_sector_count()) ||
+                (nb_sectors > (get_flash_sector_count() - first_sector)) )
+        {
+            LOG_WARN("Invalid sector range");
+            reply[0] = ADDR_INVALID;
+        }else
+        {
+            for(uint8_t sector = first_sector; sector < (first_sector + nb_sectors); sector++)
+            {
+                if(flash_sector_is_blank(sector))
+                    blank_map |= (1UL << sector);
+            }
+            LOG_INFO("Blank sectors : %#x", blank_map);
+        }
+
+        memcpy(&reply[1], &blank_map, 4);
+        bootloader_send_ack(pBuffer[0], sizeof(reply));
+        bootloader_uart_write_data(reply, sizeof(reply));
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Dispatcher of the v2 packets */
+void bootloader_handle_v2_cmd(uint8_t *pBuffer)
+{
+	switch(BL_V2_CMD(pBuffer))
+	{
+		case BL_MEM_WRITE:
+			bootloader_handle_mem_write_v2_cmd(pBuffer);
+			break;
+		case BL_MEM_WRITE_LZ4:
+			bootloader_handle_mem_write_lz4_cmd(pBuffer);
+			break;
+		case BL_MEM_WRITE_DELTA:
+			bootloader_handle_mem_write_delta_cmd(pBuffer);
+			break;
+		default:
+			LOG_WARN("Invalid v2 command code received from host");
+			bootloader_send_nack();
+			break;
+	}
+}
+
+/* Deferred BL_MEM_WRITE : buffers of the payloads in the flash engine queue (bit n = buffer n in use)
+ * and the first error of the current run of packets
+ */
+static uint8_t write_buf[BL_WRITE_BUF_COUNT][BL_V2_MAX_PAYLOAD] __attribute__((aligned(4)));
+static uint8_t write_buf_used;
+static uint8_t write_defer_status;
+
+/* Completion callback of a deferred write, runs from the main loop */
+static void mem_write_done(flash_req_t *pReq)
+{
+	write_buf_used &= ~(1U << (uint32_t)pReq->pContext);
+
+	if( (pReq->status != HAL_OK) && (write_defer_status == HAL_OK) )
+	{
+		LOG_ERROR("Memory write failed at offset %d (address %#x)", pReq->offset, pReq->address + pReq->offset);
+		write_defer_status = pReq->status;
+	}
+}
+
+/* Deferred write (BL_V2_FLAG_DEFER) : the payload is copied out of the receive ring and queued
+ * for the flash engine (after the erases of BL_V2_FLAG_AUTO_ERASE), so the next packets come in
+ * while it is programmed. The status is the one of the writes of the run finished so far,
+ * BL_V2_FLAG_FIRST starts a run, BL_V2_FLAG_LAST waits for the queue and reports the whole run.
+ * After an error the rest of the run is dropped.
+ */
+static uint8_t mem_write_defer(uint8_t *pBuffer, uint32_t mem_address, uint32_t len)
+{
+	uint8_t flags = BL_V2_FLAGS(pBuffer);
+	uint8_t status;
+	uint8_t buf;
+
+	if(flags & BL_V2_FLAG_FIRST)
+		write_defer_status = HAL_OK;
+
+	if(write_defer_status == HAL_OK)
+	{
+		status = (flags & BL_V2_FLAG_AUTO_ERASE) ? flash_prepare_write_bg(mem_address, len) : HAL_OK;
+		if(status != HAL_OK)
+		{
+			LOG_ERROR("Erase before write failed : %#x (address %#x)", status, mem_address);
+			write_defer_status = status;
+		}else
+		{
+			// All the buffers in the queue : wait for a write to finish
+			while(write_buf_used == ((1U << BL_WRITE_BUF_COUNT) - 1))
+			{
+				flash_bg_poll();
+				__WFI();
+			}
+			for(buf = 0; write_buf_used & (1U << buf); buf++);
+
+			memcpy(write_buf[buf], &pBuffer[BL_V2_HDR_LEN], len);
+			write_buf_used |= (1U << buf);
+			flash_bg_submit_program(mem_address, write_buf[buf], len, mem_write_done, (void *)(uint32_t)buf);
+		}
+	}
+
+	if(flags & BL_V2_FLAG_LAST)
+	{
+		flash_bg_sync();
+		status = write_defer_status;
+		write_defer_status = HAL_OK;
+		return status;
+	}
+
+	return write_defer_status;
+}
+
+/* Helper function to handle BL_MEM_WRITE command in a v2 packet
+ * The payload starts word aligned in the packet and is programmed straight from the receive ring,
+ * or in the background with BL_V2_FLAG_DEFER.
+ *
+ * Windowed write (BL_V2_FLAG_WINDOW) : the host keeps up to BL_RX_WINDOW bytes of packets on the way
+ * and every packet gets one reply once it is programmed : ACK, 2, its sequence number and the status.
+ * A packet with a bad CRC gets a NACK as usual, the replies come in the order of the packets so the host
+ * knows which one to send again. Every packet carries its address, the ones sent again may come after
+ * the next ones (programming the same data twice is harmless). BL_V2_FLAG_DEFER is ignored.
+ */
+void bootloader_handle_mem_write_v2_cmd(uint8_t *pBuffer)
+{
+	uint8_t write_status = 0x00;
+	uint32_t fail_offset = 0;
+	uint32_t payload_len = BL_V2_PAYLOAD_LEN(pBuffer);
+	uint32_t mem_address = BL_V2_ARG(pBuffer);
+	uint8_t window = BL_V2_FLAGS(pBuffer) & BL_V2_FLAG_WINDOW;
+	uint8_t reply[2];
+
+	LOG_DEBUG("bootloader_handle_mem_write_v2_cmd");
+
+	if (! bootloader_verify_v2_crc(pBuffer))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+        // ACK before programming, the host may already send the next packet
+        // (a windowed write has its next packets on the way already)
+        if( !window )
+            bootloader_send_ack(pBuffer[1], 1);
+
+        LOG_INFO("Memory write Address : %#x len : %d", mem_address, payload_len);
+
+		if( (payload_len != 0) && !window && (BL_V2_FLAGS(pBuffer) & BL_V2_FLAG_DEFER) &&
+				(get_flash_sector_number(mem_address) != BL_SECTOR_NONE) &&
+				(get_flash_sector_number(mem_address + payload_len - 1) != BL_SECTOR_NONE) )
+		{
+            write_status = mem_write_defer(pBuffer, mem_address, payload_len);
+		}else if( (payload_len != 0) && (verify_address(mem_address) == ADDR_VALID) &&
+				(verify_address(mem_address + payload_len - 1) == ADDR_VALID) )
+		{
+            HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_SET);
+
+            if( BL_V2_FLAGS(pBuffer) & BL_V2_FLAG_AUTO_ERASE )
+            {
+                write_status = flash_prepare_write(mem_address, payload_len);
+                if( write_status != HAL_OK )
+                {
+                    LOG_ERROR("Erase before write failed : %#x (address %#x)", write_status, mem_address);
+                }
+            }
+
+            if( write_status == HAL_OK )
+            {
+                write_status = execute_mem_write(&pBuffer[BL_V2_HDR_LEN], mem_address, payload_len, &fail_offset);
+                if( write_status != HAL_OK )
+                {
+                    LOG_ERROR("Memory write failed at offset %d (address %#x)", fail_offset, mem_address + fail_offset);
+                }
+            }
+
+            HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_RESET);
+		}else
+		{
+            LOG_WARN("Invalid Memory write Address");
+            write_status = ADDR_INVALID;
+		}
+
+        // Inform host about the status
+        if( window )
+        {
+            reply[0] = BL_V2_SEQ(pBuffer);
+            reply[1] = write_status;
+            bootloader_send_ack(pBuffer[1], sizeof(reply));
+            bootloader_uart_write_data(reply, sizeof(reply));
+        }else
+        {
+            bootloader_uart_write_data(&write_status, 1);
+        }
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Decoder of the BL_MEM_WRITE_LZ4 stream in progress */
+static lz4_stream_t lz4_stream;
+static uint8_t lz4_stream_active;
+
+/*Helper function to handle BL_MEM_WRITE_LZ4 command (v2 packet)
+ * The payload is the next piece of an LZ4 block, the first packet (BL_V2_FLAG_FIRST) gives
+ * the destination address in the argument. The status of every packet covers the flash writes
+ * it caused, the status of the last one (BL_V2_FLAG_LAST) also tells if the stream ended cleanly.
+ */
+void bootloader_handle_mem_write_lz4_cmd(uint8_t *pBuffer)
+{
+	uint8_t write_status = BL_LZ4_OK;
+	uint8_t flags = BL_V2_FLAGS(pBuffer);
+
+	LOG_DEBUG("bootloader_handle_mem_write_lz4_cmd");
+
+	if (! bootloader_verify_v2_crc(pBuffer))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+        // ACK before decompressing, the host may already send the next packet
+        bootloader_send_ack(pBuffer[1], 1);
+
+        if(flags & BL_V2_FLAG_FIRST)
+        {
+            LOG_INFO("LZ4 write Address : %#x", BL_V2_ARG(pBuffer));
+            lz4_stream_init(&lz4_stream, BL_V2_ARG(pBuffer));
+            lz4_stream.auto_erase = (flags & BL_V2_FLAG_AUTO_ERASE) ? 1 : 0;
+            lz4_stream_active = 1;
+        }
+
+        if(lz4_stream_active)
+        {
+            HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_SET);
+
+            write_status = lz4_stream_feed(&lz4_stream, &pBuffer[BL_V2_HDR_LEN], BL_V2_PAYLOAD_LEN(pBuffer));
+            if((write_status == BL_LZ4_OK) && (flags & BL_V2_FLAG_LAST))
+            {
+                write_status = lz4_stream_finish(&lz4_stream);
+                lz4_stream_active = 0;
+                LOG_INFO("LZ4 write done : %d bytes", lz4_stream.out_pos);
+            }
+
+            HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_RESET);
+
+            if(write_status != BL_LZ4_OK)
+            {
+                // The stream can't go on, the host has to start over with a new first packet
+                LOG_ERROR("LZ4 write failed : %#x at offset %d", write_status, lz4_stream.fail_offset);
+                lz4_stream_active = 0;
+            }
+        }else
+        {
+            LOG_WARN("LZ4 packet without a stream");
+            write_status = BL_LZ4_DATA_ERROR;
+        }
+
+        // Inform host about the status
+        bootloader_uart_write_data(&write_status, 1);
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* Patch of the BL_MEM_WRITE_DELTA stream in progress */
+static delta_stream_t delta_stream;
+static uint8_t delta_stream_active;
+static uint32_t delta_dest;					// address of the old image, the new one goes there too
+static uint32_t delta_new_crc;
+static uint32_t delta_scratch_erased;		// bytes of the scratch area erased so far
+static uint8_t delta_slot;					// BL_SLOT_A if its trailer must be written again, else BL_SLOT_NONE
+
+/* Output of the patch : goes to the scratch area, its sectors are erased as the output reaches them */
+static uint8_t delta_scratch_write(uint32_t offset, uint8_t *pData, uint32_t len)
+{
+	uint32_t fail_offset;
+	uint8_t sector;
+	uint8_t status;
+
+	if((offset > BL_DELTA_SCRATCH_SIZE) || (len > (BL_DELTA_SCRATCH_SIZE - offset)))
+		return ADDR_INVALID;
+
+	while((offset + len) > delta_scratch_erased)
+	{
+		sector = get_flash_sector_number(BL_DELTA_SCRATCH_BASE + delta_scratch_erased);
+		status = execute_flash_erase_sector(sector);
+		if(status != HAL_OK)
+			return status;
+		delta_scratch_erased += get_flash_sector_size(sector);
+	}
+
+	return execute_mem_write(pData, BL_DELTA_SCRATCH_BASE + offset, len, &fail_offset);
+}
+
+/* Programs one word of the commit record */
+static uint8_t delta_program_word(const volatile uint32_t *pWord, uint32_t value)
+{
+	uint32_t fail_offset;
+
+	return execute_mem_write((uint8_t *)&value, (uint32_t)pWord, 4, &fail_offset);
+}
+
+/* len bytes of flash from pStart are still erased (commit record, slot trailer) */
+static uint8_t delta_words_blank(const void *pStart, uint32_t len)
+{
+	const uint32_t *pWord = (const uint32_t *)pStart;
+
+	for(uint32_t i = 0; i < (len / 4); i++)
+	{
+		if(pWord[i] != 0xFFFFFFFFUL)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Copies the new image from the scratch area over the old one, unless it is there already */
+static uint8_t delta_copy(uint32_t dest, uint32_t len, uint32_t crc)
+{
+	uint32_t fail_offset;
+	uint8_t status;
+
+	if(bootloader_calc_crc((uint8_t *)dest, len, BL_CRC_MODE_WORD) == crc)
+		return BL_DELTA_OK;
+
+	for(uint8_t sector = get_flash_sector_number(dest); sector <= get_flash_sector_number(dest + len - 1); sector++)
+	{
+		status = execute_flash_erase_sector(sector);
+		if(status != HAL_OK)
+			return status;
+	}
+
+	status = execute_mem_write((uint8_t *)BL_DELTA_SCRATCH_BASE, dest, len, &fail_offset);
+	if(status != HAL_OK)
+		return status;
+
+	if(bootloader_calc_crc((uint8_t *)dest, len, BL_CRC_MODE_WORD) != crc)
+		return BL_DELTA_CRC_ERROR;
+
+	return BL_DELTA_OK;
+}
+
+/* Carries out a commit record : the new image over the old one, then the trailer of slot A
+ * with its size and CRC if the record says so, then done. Each step finds out by itself whether
+ * it was done before a reset, bootloader_delta_resume() runs the whole of it again.
+ */
+static uint8_t delta_finish(const bl_delta_commit_t *pRecord)
+{
+	const bl_slot_trailer_t *pTrailer = slot_get_trailer(BL_SLOT_A);
+	uint8_t activate;
+	uint8_t status;
+
+	activate = (pRecord->slot == BL_SLOT_A) && !( (pTrailer->magic == BL_SLOT_MAGIC) &&
+			(pTrailer->size == pRecord->len) && (pTrailer->crc == pRecord->crc) );
+
+	// The old trailer goes first, a copy which reaches its sector is done again
+	if( activate && !delta_words_blank(pTrailer, sizeof(bl_slot_trailer_t)) )
+	{
+		status = execute_flash_erase_sector(get_flash_sector_number((uint32_t)pTrailer));
+		if(status != HAL_OK)
+			return status;
+	}
+
+	status = delta_copy(pRecord->dest, pRecord->len, pRecord->crc);
+	if(status != BL_DELTA_OK)
+		return status;
+
+	if(activate)
+	{
+		status = slot_activate(BL_SLOT_A, pRecord->len, pRecord->crc);
+		if(status != BL_SLOT_OK)
+			return status;
+	}
+
+	return delta_program_word(&pRecord->done, 0);
+}
+
+/* Checks the new image in the scratch area and copies it over the old one
+ * The commit record is programmed first : from there on a reset doesn't lose the new image.
+ */
+static uint8_t delta_commit(void)
+{
+	const bl_delta_commit_t *pRecord = (const bl_delta_commit_t *)BL_DELTA_COMMIT_BASE;
+	uint32_t len = delta_stream.out_len;
+	uint8_t status;
+
+	if(bootloader_calc_crc((uint8_t *)BL_DELTA_SCRATCH_BASE, len, BL_CRC_MODE_WORD) != delta_new_crc)
+		return BL_DELTA_CRC_ERROR;
+
+	// magic last : a reset in the middle leaves the old image as it is
+	status = delta_program_word(&pRecord->dest, delta_dest);
+	if(status == HAL_OK)
+		status = delta_program_word(&pRecord->len, len);
+	if(status == HAL_OK)
+		status = delta_program_word(&pRecord->crc, delta_new_crc);
+	if( (status == HAL_OK) && (delta_slot == BL_SLOT_A) )
+		status = delta_program_word(&pRecord->slot, BL_SLOT_A);
+	if(status == HAL_OK)
+		status = delta_program_word(&pRecord->magic, BL_DELTA_COMMIT_MAGIC);
+	if(status != HAL_OK)
+		return status;
+
+	return delta_finish(pRecord);
+}
+
+/* This function tells whether a delta copy was cut by a reset (commit record without done) */
+uint8_t bootloader_delta_pending(void)
+{
+	const bl_delta_commit_t *pRecord = (const bl_delta_commit_t *)BL_DELTA_COMMIT_BASE;
+
+	if(get_flash_sector_count() <= BL_FLASH_BANK_SECTORS)
+		return 0;
+
+	return (pRecord->magic == BL_DELTA_COMMIT_MAGIC) && (pRecord->done == 0xFFFFFFFFUL);
+}
+
+/* This function finishes a delta copy cut by a reset, it runs at each start before the boot decision
+ * The new image in the scratch area had its CRC checked before the record was programmed, it is
+ * checked again : the scratch area may have been erased since (BL_FLASH_ERASE, mass erase).
+ */
+void bootloader_delta_resume(void)
+{
+	const bl_delta_commit_t *pRecord = (const bl_delta_commit_t *)BL_DELTA_COMMIT_BASE;
+	uint8_t status;
+
+	if(!bootloader_delta_pending())
+		return;
+
+	LOG_WARN("Delta copy to %#x cut by a reset, copying again", pRecord->dest);
+
+	if( (pRecord->len == 0) || (pRecord->len > BL_DELTA_SCRATCH_SIZE) ||
+			(pRecord->dest < BL_SLOT_A_BASE) || (pRecord->dest >= (BL_SLOT_A_BASE + BL_SLOT_TRAILER_OFFSET)) ||
+			(pRecord->len > (BL_SLOT_A_BASE + BL_SLOT_TRAILER_OFFSET - pRecord->dest)) ||
+			((pRecord->slot != BL_SLOT_A) && (pRecord->slot != 0xFFFFFFFFUL)) ||
+			(bootloader_calc_crc((uint8_t *)BL_DELTA_SCRATCH_BASE, pRecord->len, BL_CRC_MODE_WORD) != pRecord->crc) )
+	{
+		LOG_ERROR("Delta scratch area lost, the image at %#x must be written again", pRecord->dest);
+		return;
+	}
+
+	flash_bg_sync();
+	status = delta_finish(pRecord);
+
+	if(status == BL_DELTA_OK)
+		LOG_INFO("Delta copy done : %d bytes", pRecord->len);
+	else
+		LOG_ERROR("Delta copy failed : %#x", status);
+}
+
+/* Starts a patch from the header at the beginning of the first packet */
+static uint8_t delta_start(uint8_t *pHeader, uint32_t len, uint32_t dest)
+{
+	uint32_t header[BL_DELTA_HDR_LEN / 4];
+	uint32_t old_len, old_crc, new_len;
+	uint8_t status;
+
+	if(len < BL_DELTA_HDR_LEN)
+		return BL_DELTA_DATA_ERROR;
+
+	memcpy(header, pHeader, BL_DELTA_HDR_LEN);
+	old_len = header[1];
+	old_crc = header[2];
+	new_len = header[3];
+
+	if((header[0] != BL_DELTA_MAGIC) || (new_len == 0) || (new_len > BL_DELTA_SCRATCH_SIZE))
+		return BL_DELTA_DATA_ERROR;
+
+	// Both images must be in slot A below its trailer, starting on a sector boundary (the start
+	// of the slot once it was activated). The scratch area needs bank 2 (idle), and slot B not in use.
+	flash_bg_sync();
+	if( (get_flash_sector_count() <= BL_FLASH_BANK_SECTORS) || (slot_get_state(BL_SLOT_B) != BL_SLOT_EMPTY) )
+		return ADDR_INVALID;
+	if( (dest < BL_SLOT_A_BASE) || (dest >= (BL_SLOT_A_BASE + BL_SLOT_TRAILER_OFFSET)) || (get_flash_sector_base(get_flash_sector_number(dest)) != dest) ||
+			(old_len > (BL_SLOT_A_BASE + BL_SLOT_TRAILER_OFFSET - dest)) || (new_len > (BL_SLOT_A_BASE + BL_SLOT_TRAILER_OFFSET - dest)) )
+		return ADDR_INVALID;
+	delta_slot = (slot_get_state(BL_SLOT_A) != BL_SLOT_EMPTY) ? BL_SLOT_A : BL_SLOT_NONE;
+	if( (delta_slot == BL_SLOT_A) && (dest != BL_SLOT_A_BASE) )
+		return ADDR_INVALID;
+
+	// A copy that never finished keeps its record and its scratch area
+	if(bootloader_delta_pending())
+		return ADDR_INVALID;
+
+	if(bootloader_calc_crc((uint8_t *)dest, old_len, BL_CRC_MODE_WORD) != old_crc)
+		return BL_DELTA_OLD_MISMATCH;
+
+	// The record of the last patch goes with its sector
+	if(!delta_words_blank((const void *)BL_DELTA_COMMIT_BASE, sizeof(bl_delta_commit_t)))
+	{
+		status = execute_flash_erase_sector(get_flash_sector_number(BL_DELTA_COMMIT_BASE));
+		if(status != HAL_OK)
+			return status;
+	}
+
+	delta_dest = dest;
+	delta_new_crc = header[4];
+	delta_scratch_erased = 0;
+	delta_stream_init(&delta_stream, (const uint8_t *)dest, old_len, new_len, delta_scratch_write);
+
+	return BL_DELTA_OK;
+}
+
+/*Helper function to handle BL_MEM_WRITE_DELTA command (v2 packet)
+ * The payload is the next piece of the patch, the first packet (BL_V2_FLAG_FIRST) starts with
+ * the patch header and gives the address of the old image in the argument. The new image is
+ * built in the scratch area, the last packet (BL_V2_FLAG_LAST) copies it over the old one.
+ */
+void bootloader_handle_mem_write_delta_cmd(uint8_t *pBuffer)
+{
+	uint8_t write_status = BL_DELTA_OK;
+	uint8_t flags = BL_V2_FLAGS(pBuffer);
+	uint8_t *pPatch = &pBuffer[BL_V2_HDR_LEN];
+	uint32_t patch_len = BL_V2_PAYLOAD_LEN(pBuffer);
+
+	LOG_DEBUG("bootloader_handle_mem_write_delta_cmd");
+
+	if (! bootloader_verify_v2_crc(pBuffer))
+	{
+        LOG_DEBUG("Checksum success !!");
+
+        // ACK before applying, the host may already send the next packet
+        bootloader_send_ack(pBuffer[1], 1);
+
+        HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_SET);
+
+        if(flags & BL_V2_FLAG_FIRST)
+        {
+            LOG_INFO("Delta write Address : %#x", BL_V2_ARG(pBuffer));
+            write_status = delta_start(pPatch, patch_len, BL_V2_ARG(pBuffer));
+            delta_stream_active = (write_status == BL_DELTA_OK);
+            pPatch += BL_DELTA_HDR_LEN;
+            patch_len -= BL_DELTA_HDR_LEN;
+        }else if(! delta_stream_active)
+        {
+            LOG_WARN("Delta packet without a patch");
+            write_status = BL_DELTA_DATA_ERROR;
+        }
+
+        if(delta_stream_active)
+        {
+            write_status = delta_stream_feed(&delta_stream, pPatch, patch_len);
+            if((write_status == BL_DELTA_OK) && (flags & BL_V2_FLAG_LAST))
+            {
+                write_status = delta_stream_finish(&delta_stream);
+                if(write_status == BL_DELTA_OK)
+                    write_status = delta_commit();
+                delta_stream_active = 0;
+                LOG_INFO("Delta write done : %d bytes", delta_stream.out_pos);
+            }
+
+            if(write_status != BL_DELTA_OK)
+                delta_stream_active = 0;
+        }
+
+        HAL_GPIO_WritePin(LD4_GPIO_Port, LD4_Pin, GPIO_PIN_RESET);
+
+        if(write_status != BL_DELTA_OK)
+        {
+            // The host has to start over with a new first packet (or a full write)
+            LOG_ERROR("Delta write failed : %#x", write_status);
+        }
+
+        // Inform host about the status
+        bootloader_uart_write_data(&write_status, 1);
+
+	}else
+	{
+        LOG_WARN("Checksum fail !!");
+        bootloader_send_nack();
+	}
+}
+
+/* This function sends ACK if CRC matches along with "len to follow"*/
+void bootloader_send_ack(uint8_t command_code, uint8_t follow_len)
+{
+	 // Here we send 2 byte.. first byte is ack and the second byte is len value
+	uint8_t ack_buf[2];
+	ack_buf[0] = BL_ACK;
+	ack_buf[1] = follow_len;
+	BL_PROFILE_BEGIN(tx_start);
+	HAL_UART_Transmit(C_UART, ack_buf, 2, HAL_MAX_DELAY);
+	BL_PROFILE_END(BL_PROF_TX, tx_start);
+
+	// A packet went through, the link works at this baud rate
+	bootloader_uart_link_ok();
+
+}
+
+/* This function sends NACK */
+void bootloader_send_nack(void)
+{
+	uint8_t nack = BL_NACK;
+	BL_PROFILE_BEGIN(tx_start);
+	HAL_UART_Transmit(C_UART, &nack, 1, HAL_MAX_DELAY);
+	BL_PROFILE_END(BL_PROF_TX, tx_start);
+
+	bootloader_uart_link_error();
+}
+
+// This verifies the CRC of the given buffer in pData .
+uint8_t bootloader_verify_crc (uint8_t *pData, uint32_t len, uint32_t crc_host)
+{
+	if( bootloader_calc_crc(pData, len, BL_CRC_MODE_BYTE) == crc_host)
+	{
+		return VERIFY_CRC_SUCCESS;
+	}
+
+	return VERIFY_CRC_FAIL;
+}
+
+// This verifies the CRC of a v2 packet, the flags of the packet select the CRC mode.
+uint8_t bootloader_verify_v2_crc(uint8_t *pBuffer)
+{
+	uint32_t len = BL_V2_HDR_LEN + BL_V2_PAYLOAD_LEN(pBuffer);
+	uint32_t crc_host = *((uint32_t * ) (pBuffer + len) ) ;
+	uint8_t crc_mode = (BL_V2_FLAGS(pBuffer) & BL_V2_FLAG_CRC_WORD) ? BL_CRC_MODE_WORD : BL_CRC_MODE_BYTE;
+
+	if( bootloader_calc_crc(pBuffer, len, crc_mode) == crc_host)
+	{
+		return VERIFY_CRC_SUCCESS;
+	}
+
+	return VERIFY_CRC_FAIL;
+}
+
+/* This function computes the CRC32 of pData with the CRC unit (poly 0x04C11DB7, init 0xFFFFFFFF)
+ * The data register is written directly, no HAL call per word.
+ * In WORD mode one write to the CRC unit covers 4 bytes instead of 1.
+ */
+uint32_t bootloader_calc_crc(uint8_t *pData, uint32_t len, uint8_t crc_mode)
+{
+	uint32_t i = 0;
+	uint32_t word;
+	uint32_t crc;
+	BL_PROFILE_BEGIN(crc_start);
+
+	/* Reset CRC Calculation Unit */
+	__HAL_CRC_DR_RESET(&hcrc);
+
+	if( crc_mode == BL_CRC_MODE_WORD )
+	{
+		uint32_t nb_words = len / 4;
+
+#ifdef BL_CRC_USE_DMA
+		// DMA needs a word aligned source, the data register is the fixed destination
+		if( (len >= BL_CRC_DMA_MIN_LEN) && (((uint32_t)pData & 3) == 0) && (nb_words <= 0xFFFF) )
+		{
+			HAL_DMA_Start(&hdma_crc, (uint32_t)pData, (uint32_t)&hcrc.Instance->DR, nb_words);
+			HAL_DMA_PollForTransfer(&hdma_crc, HAL_DMA_FULL_TRANSFER, HAL_MAX_DELAY);
+			i = nb_words * 4;
+		}
+#endif
+		for( ; i < (nb_words * 4); i += 4 )
+		{
+			// Unaligned loads are fine on the M4
+			memcpy(&word, &pData[i], 4);
+			hcrc.Instance->DR = word;
+		}
+	}
+
+	// BYTE mode, or the trailing bytes of WORD mode
+	for( ; i < len; i++ )
+	{
+		hcrc.Instance->DR = (uint32_t)pData[i];
+	}
+
+	crc = hcrc.Instance->DR;
+
+	/* Reset CRC Calculation Unit */
+	__HAL_CRC_DR_RESET(&hcrc);
+
+	BL_PROFILE_END(BL_PROF_CRC, crc_start);
+
+	return crc;
+}
+
+/* This function writes data in to C_UART */
+void bootloader_uart_write_data(uint8_t *pBuffer, uint32_t len)
+{
+	/* Can replace the below ST's USART driver API call with your MCUs driver API call */
+	BL_PROFILE_BEGIN(tx_start);
+	HAL_UART_Transmit(C_UART, pBuffer, len, HAL_MAX_DELAY);
+	BL_PROFILE_END(BL_PROF_TX, tx_start);
+
+}
+
+
+// Just returns the macro value .
+uint8_t get_bootloader_version(void)
+{
+	return (uint8_t)BL_VERSION;
 }
 
 // Read the chip identifier or device Identifier
@@ -632,73 +1824,496 @@ uint8_t verify_address(uint32_t go_address)
 
 }
 
- uint8_t execute_flash_erase(uint8_t sector_number , uint8_t number_of_sector)
+// Verify that a whole range sent by the host can be read.
+uint8_t verify_mem_range(uint32_t mem_address, uint32_t len)
+{
+	// The range has to be within one of these memories
+	static const uint32_t mem_regions[][2] = {
+		{ FLASH_BASE,      FLASH_END },
+		{ SRAM1_BASE,      SRAM3_END },			// SRAM1, SRAM2 and SRAM3 are contiguous
+		{ BKPSRAM_BASE,    BKPSRAM_END },
+		{ CCMDATARAM_BASE, CCMDATARAM_END },
+		{ FLASH_OTP_BASE,  FLASH_OTP_END },
+	};
+	uint32_t end;
+
+	if( (len == 0) || ((mem_address + len - 1) < mem_address) )
+		return ADDR_INVALID;
+
+	end = mem_address + len - 1;
+
+	for( uint32_t i = 0; i < (sizeof(mem_regions) / sizeof(mem_regions[0])); i++ )
+	{
+		if( (mem_address >= mem_regions[i][0]) && (end <= mem_regions[i][1]) )
+		{
+			// Don't hand out the flash contents when read protection is active
+			if( (i == 0) && (get_flash_rdp_level() != OB_RDP_LEVEL_0) )
+				return ADDR_INVALID;
+
+			return ADDR_VALID;
+		}
+	}
+
+	return ADDR_INVALID;
+}
+
+/* Sectors erased (or found blank) since the bootloader started, bit n = sector n
+ * The FLASH interrupt sets the bits of the sectors erased in the background.
+ */
+static volatile uint32_t flash_session_erased;
+
+/* Returns 1 if [mem_address, mem_address + len) touches the bootloader or its copy in bank 2 */
+static uint8_t flash_range_is_bootloader(uint32_t mem_address, uint32_t len)
+{
+	if( mem_address < (FLASH_BASE + BL_BOOT_SIZE) )
+		return 1;
+	if( (mem_address < (BL_BOOT_MIRROR_BASE + BL_BOOT_SIZE)) && ((mem_address + len) > BL_BOOT_MIRROR_BASE) )
+		return 1;
+
+	return 0;
+}
+
+/* Returns 1 if number_of_sector sectors from sector_number hold some of the bootloader or its copy */
+static uint8_t flash_sectors_are_bootloader(uint8_t sector_number, uint8_t number_of_sector)
+{
+	uint8_t last_sector = sector_number + number_of_sector - 1;
+	uint32_t base = get_flash_sector_base(sector_number);
+
+	return flash_range_is_bootloader(base, get_flash_sector_base(last_sector) + get_flash_sector_size(last_sector) - base);
+}
+
+/* Erases count sectors from first, the blank ones are skipped
+ * Bank 1 sectors are erased before returning. With background = 1 bank 2 sectors are queued for
+ * the background erase (see boot_flash_bg.h) and BL_ERASE_BACKGROUND is returned.
+ */
+static uint8_t flash_erase_sectors(uint8_t first, uint8_t count, uint8_t background)
+{
+	uint32_t queued = 0;
+	uint8_t status;
+
+	for(uint8_t sector = first; sector < (first + count); sector++)
+	{
+		if( background && (sector >= BL_FLASH_BANK_SECTORS) )
+		{
+			// Bank 2 : no blank check while an erase runs there, it would stall until the erase is done
+			if( flash_bg_pending() & (1UL << sector) )
+				continue;
+			if( flash_bg_busy() || !flash_sector_is_blank(sector) )
+				queued |= (1UL << sector);
+			else
+				flash_session_erased |= (1UL << sector);
+			continue;
+		}
+
+		status = execute_flash_erase_sector(sector);
+		if(status != HAL_OK)
+			return status;
+	}
+
+	if(queued)
+	{
+		flash_bg_erase_queue(queued);
+		return BL_ERASE_BACKGROUND;
+	}
+
+	return HAL_OK;
+}
+
+/* Erases number_of_sector sectors from sector_number (0 to 23 on a 2 MB part), BL_FLASH_ERASE
+ * The bootloader (sectors 0 and 1) and its copy in bank 2 (sectors 12 and 13) are never erased,
+ * INVALID_SECTOR is returned for a span which touches them.
+ * If sector_number = BL_MASS_ERASE, all the other sectors are erased one by one : both slots
+ * and the delta scratch area. The hardware mass erase would take the running bootloader with
+ * it, and the copy in bank 2 which slot B needs to start (see boot_slot.h).
+ * The sectors are erased before returning, in both banks : hosts take the status of
+ * BL_FLASH_ERASE as the end of the erase. Bank 2 is erased in the background only through
+ * BL_FLASH_ERASE_RANGE, see execute_flash_erase_range().
+ */
+uint8_t execute_flash_erase(uint8_t sector_number , uint8_t number_of_sector)
+{
+	uint8_t status;
+	uint8_t sector_count = get_flash_sector_count();
+
+
+	if(sector_number == BL_MASS_ERASE)
+	{
+		// A failed background erase doesn't matter, everything goes
+		(void)flash_bg_wait();
+
+		for(uint8_t sector = 0; sector < sector_count; sector++)
+		{
+			if(flash_sectors_are_bootloader(sector, 1))
+				continue;
+
+			status = execute_flash_erase_sector(sector);
+			if(status != HAL_OK)
+				return status;
+		}
+
+		return HAL_OK;
+	}
+
+	if( (sector_number < sector_count) && (number_of_sector <= sector_count) )
+	{
+	    /* Here we are just calculating how many sectors needs to erased */
+		uint8_t remanining_sector = sector_count - sector_number;
+        if( number_of_sector > remanining_sector)
+        {
+        	number_of_sector = remanining_sector;
+        }
+
+        if( (number_of_sector != 0) && flash_sectors_are_bootloader(sector_number, number_of_sector) )
+        	return INVALID_SECTOR;
+
+        return flash_erase_sectors(sector_number, number_of_sector, 0);
+	}
+
+	return INVALID_SECTOR;
+}
+
+/* Erases one sector, bank 1 or bank 2
+ * A sector which is already blank is not erased again, the blank check takes a few hundred
+ * microseconds where the erase of a 128 KB sector takes 1 to 2 s.
+ */
+uint8_t execute_flash_erase_sector(uint8_t sector)
 {
-    // We have totally 12 sectors in STM32F429ZITX mcu .. sector[0 to 11]
-	// number_of_sector has to be in the range of 0 to 11
-	// If sector_number = 0xff , that means mass erase !
-	// Code needs to modified if your MCU supports more flash sectors
 	FLASH_EraseInitTypeDef flashErase_handle;
 	uint32_t sectorError;
-	HAL_StatusTypeDef status;
+	uint8_t status;
+
+	if(sector >= get_flash_sector_count())
+		return INVALID_SECTOR;
 
+	status = flash_bg_wait();
+	if(status != HAL_OK)
+		return status;
+
+	if(flash_sector_is_blank(sector))
+	{
+		LOG_DEBUG("Sector %d is blank, erase skipped", sector);
+		flash_session_erased |= (1UL << sector);
+		return HAL_OK;
+	}
 
-	if( number_of_sector >= 12 )
+	flashErase_handle.TypeErase = FLASH_TYPEERASE_SECTORS;
+	flashErase_handle.Sector = sector;
+	flashErase_handle.NbSectors = 1;
+	flashErase_handle.Banks = (sector < BL_FLASH_BANK_SECTORS) ? FLASH_BANK_1 : FLASH_BANK_2;
+	flashErase_handle.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+
+	BL_PROFILE_BEGIN(erase_start);
+	HAL_FLASH_Unlock();
+	status = (uint8_t) HAL_FLASHEx_Erase(&flashErase_handle, &sectorError);
+	HAL_FLASH_Lock();
+	BL_PROFILE_END(BL_PROF_ERASE, erase_start);
+
+	if(status == HAL_OK)
+		flash_session_erased |= (1UL << sector);
+
+	return status;
+}
+
+/* Marks a sector as erased for flash_prepare_write(), called by the background erase */
+void flash_sector_set_erased(uint8_t sector)
+{
+	flash_session_erased |= (1UL << sector);
+}
+
+/* Erases the smallest set of sectors which covers [mem_address, mem_address + len), BL_FLASH_ERASE_RANGE
+ * The range must be in the flash, away from the bootloader. Bank 1 sectors are erased before
+ * returning, bank 2 sectors in the background : BL_ERASE_BACKGROUND is returned if any is left.
+ */
+uint8_t execute_flash_erase_range(uint32_t mem_address, uint32_t len)
+{
+	uint8_t first_sector = get_flash_sector_number(mem_address);
+	uint8_t last_sector = get_flash_sector_number(mem_address + len - 1);
+
+	if( (len == 0) || (len > (FLASH_END - mem_address + 1)) || flash_range_is_bootloader(mem_address, len) ||
+			(first_sector == BL_SECTOR_NONE) || (last_sector == BL_SECTOR_NONE) )
 		return INVALID_SECTOR;
 
-	if( (sector_number == 0xFF ) || (sector_number < 12) )
+	return flash_erase_sectors(first_sector, last_sector - first_sector + 1, 1);
+}
+
+/* Lazy erase (BL_V2_FLAG_AUTO_ERASE) : erases the sectors of [mem_address, mem_address + len)
+ * which were not erased yet since the bootloader started, the first time a write touches them.
+ * So a whole update is one stream of writes and every sector is erased at most once (not at all
+ * if it is blank). Writes outside the flash need nothing, the bootloader sectors are never erased.
+ */
+uint8_t flash_prepare_write(uint32_t mem_address, uint32_t len)
+{
+	uint8_t first_sector = get_flash_sector_number(mem_address);
+	uint8_t last_sector = get_flash_sector_number(mem_address + len - 1);
+	uint8_t status;
+
+	if( (len == 0) || (first_sector == BL_SECTOR_NONE) || (last_sector == BL_SECTOR_NONE) )
+		return HAL_OK;
+
+	if( flash_range_is_bootloader(mem_address, len) )
+		return ADDR_INVALID;
+
+	for(uint8_t sector = first_sector; sector <= last_sector; sector++)
 	{
-		if(sector_number == (uint8_t) 0xFF)
-		{
-			flashErase_handle.TypeErase = FLASH_TYPEERASE_MASSERASE;
-		}else
+		if(flash_session_erased & (1UL << sector))
+			continue;
+
+		LOG_INFO("Auto erase of sector %d", sector);
+		status = execute_flash_erase_sector(sector);
+		if(status != HAL_OK)
+			return status;
+	}
+
+	return HAL_OK;
+}
+
+/* Lazy erase for the deferred writes : like flash_prepare_write(), but the erases are queued
+ * for the flash engine ahead of the programming instead of being done here
+ */
+uint8_t flash_prepare_write_bg(uint32_t mem_address, uint32_t len)
+{
+	uint8_t first_sector = get_flash_sector_number(mem_address);
+	uint8_t last_sector = get_flash_sector_number(mem_address + len - 1);
+
+	if( (len == 0) || (first_sector == BL_SECTOR_NONE) || (last_sector == BL_SECTOR_NONE) )
+		return HAL_OK;
+
+	if( flash_range_is_bootloader(mem_address, len) )
+		return ADDR_INVALID;
+
+	for(uint8_t sector = first_sector; sector <= last_sector; sector++)
+	{
+		if( (flash_session_erased & (1UL << sector)) || (flash_bg_pending() & (1UL << sector)) )
+			continue;
+
+		// No blank check while the engine works, the read could stall on the bank being written
+		if( !flash_bg_busy() && flash_sector_is_blank(sector) )
 		{
-		    /* Here we are just calculating how many sectors needs to erased */
-			uint8_t remanining_sector = 12 - sector_number;
-            if( number_of_sector > remanining_sector)
-            {
-            	number_of_sector = remanining_sector;
-            }
-			flashErase_handle.TypeErase = FLASH_TYPEERASE_SECTORS;
-			flashErase_handle.Sector = sector_number; // This is the initial sector
-			flashErase_handle.NbSectors = number_of_sector;
+			flash_session_erased |= (1UL << sector);
+			continue;
 		}
-		flashErase_handle.Banks = FLASH_BANK_1;
 
-		/* Get access to touch the flash registers */
-		HAL_FLASH_Unlock();
-		flashErase_handle.VoltageRange = FLASH_VOLTAGE_RANGE_3;  // Our mcu will work on this voltage range
-		status = (uint8_t) HAL_FLASHEx_Erase(&flashErase_handle, &sectorError);
-		HAL_FLASH_Lock();
+		LOG_INFO("Auto erase of sector %d queued", sector);
+		flash_bg_submit_erase(sector, NULL, NULL);
+	}
 
-		return status;
+	return HAL_OK;
+}
+
+/* Returns 1 if every word of the sector reads 0xFFFFFFFF
+ * The words are ANDed 4 at a time, one test per 16 bytes.
+ */
+uint8_t flash_sector_is_blank(uint8_t sector)
+{
+	const volatile uint32_t *pWord = (const volatile uint32_t *)get_flash_sector_base(sector);
+	const volatile uint32_t *pEnd = pWord + (get_flash_sector_size(sector) / 4);
+
+	while(pWord < pEnd)
+	{
+		if((pWord[0] & pWord[1] & pWord[2] & pWord[3]) != 0xFFFFFFFFUL)
+			return 0;
+		pWord += 4;
 	}
 
-	return INVALID_SECTOR;
+	return 1;
+}
+
+/* Sector map, bank 2 has the same layout as bank 1 */
+static const struct
+{
+	uint32_t base;
+	uint32_t size;
+} flash_sector_map[BL_FLASH_SECTOR_COUNT] =
+{
+	{ 0x08000000UL, 0x04000UL }, { 0x08004000UL, 0x04000UL }, { 0x08008000UL, 0x04000UL }, { 0x0800C000UL, 0x04000UL },
+	{ 0x08010000UL, 0x10000UL }, { 0x08020000UL, 0x20000UL }, { 0x08040000UL, 0x20000UL }, { 0x08060000UL, 0x20000UL },
+	{ 0x08080000UL, 0x20000UL }, { 0x080A0000UL, 0x20000UL }, { 0x080C0000UL, 0x20000UL }, { 0x080E0000UL, 0x20000UL },
+
+	{ 0x08100000UL, 0x04000UL }, { 0x08104000UL, 0x04000UL }, { 0x08108000UL, 0x04000UL }, { 0x0810C000UL, 0x04000UL },
+	{ 0x08110000UL, 0x10000UL }, { 0x08120000UL, 0x20000UL }, { 0x08140000UL, 0x20000UL }, { 0x08160000UL, 0x20000UL },
+	{ 0x08180000UL, 0x20000UL }, { 0x081A0000UL, 0x20000UL }, { 0x081C0000UL, 0x20000UL }, { 0x081E0000UL, 0x20000UL },
+};
+
+/* Number of flash sectors of this part, from the flash size register (in KB) */
+uint8_t get_flash_sector_count(void)
+{
+	uint16_t flash_size_kb = *((volatile uint16_t *)FLASHSIZE_BASE);
+
+	if(flash_size_kb >= 2048)
+		return BL_FLASH_SECTOR_COUNT;
+
+	return BL_FLASH_BANK_SECTORS;
+}
+
+/* Sector which holds this flash address, BL_SECTOR_NONE if not in the flash */
+uint8_t get_flash_sector_number(uint32_t address)
+{
+	uint8_t sector_count = get_flash_sector_count();
+
+	for(uint8_t sector = 0; sector < sector_count; sector++)
+	{
+		if( (address >= flash_sector_map[sector].base) &&
+				((address - flash_sector_map[sector].base) < flash_sector_map[sector].size) )
+			return sector;
+	}
+
+	return BL_SECTOR_NONE;
+}
+
+/* Start address of a sector */
+uint32_t get_flash_sector_base(uint8_t sector)
+{
+	if(sector >= BL_FLASH_SECTOR_COUNT)
+		return 0;
+
+	return flash_sector_map[sector].base;
+}
+
+/* Size of a sector in bytes */
+uint32_t get_flash_sector_size(uint8_t sector)
+{
+	if(sector >= BL_FLASH_SECTOR_COUNT)
+		return 0;
+
+	return flash_sector_map[sector].size;
+}
+
+/* Programs one byte / halfword / word with the HAL and reads it back */
+static uint8_t flash_program_unit(uint32_t type_program, uint32_t address, uint32_t data)
+{
+	uint32_t read_back;
+
+	if( HAL_FLASH_Program(type_program, address, data) != HAL_OK )
+		return HAL_ERROR;
+
+	if( type_program == FLASH_TYPEPROGRAM_BYTE )
+		read_back = *(volatile uint8_t *)address;
+	else if( type_program == FLASH_TYPEPROGRAM_HALFWORD )
+		read_back = *(volatile uint16_t *)address;
+	else
+		read_back = *(volatile uint32_t *)address;
+
+	// Programming can only clear bits, a mismatch means the location was not erased
+	return (read_back == data) ? HAL_OK : HAL_ERROR;
 }
 
-/* This function writes the contents of pBuffer to  "mem_address" byte by byte */
+/* This function writes the contents of pBuffer to "mem_address"
+ * The word aligned body is programmed 32 bits at a time (PSIZE x32, needs FLASH_VOLTAGE_RANGE_3),
+ * only the unaligned head and tail bytes are programmed as halfword / byte.
+ * If programming fails, pFail_offset gets the offset of the first byte which could not be written.
+ */
 // Note1 : Currently this function supports writing to Flash only .
 // Note2 : This functions does not check whether "mem_address" is a valid address of the flash range.
-uint8_t execute_mem_write(uint8_t *pBuffer, uint32_t mem_address, uint32_t len)
+uint8_t execute_mem_write(uint8_t *pBuffer, uint32_t mem_address, uint32_t len, uint32_t *pFail_offset)
 {
 	uint8_t status = HAL_OK;
+	uint32_t offset = 0;
+	uint32_t address;
+	uint32_t word;
+
+	// The flash controller must be free, a background erase may still run in bank 2
+	status = flash_bg_wait();
+	if( status != HAL_OK )
+	{
+		if( pFail_offset )
+			*pFail_offset = 0;
+		return status;
+	}
+
+	BL_PROFILE_BEGIN(program_start);
 
 	// We have to unlock flash module to get control of registers
 	HAL_FLASH_Unlock();
 
-	for(uint32_t i = 0; i<len; i++)
+	// 1. Head : byte and halfword up to the first word boundary
+	if( (len > offset) && (mem_address & 1) )
+	{
+		status = flash_program_unit(FLASH_TYPEPROGRAM_BYTE, mem_address, pBuffer[offset]);
+		if( status == HAL_OK )
+			offset += 1;
+	}
+	if( (status == HAL_OK) && ((len - offset) >= 2) && ((mem_address + offset) & 2) )
 	{
-		// Here we program the flash byte by byte
-		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, mem_address + i, pBuffer[i] );
+		status = flash_program_unit(FLASH_TYPEPROGRAM_HALFWORD, mem_address + offset,
+				(uint32_t)pBuffer[offset] | ((uint32_t)pBuffer[offset + 1] << 8));
+		if( status == HAL_OK )
+			offset += 2;
+	}
+
+	// 2. Body : word by word, PSIZE and PG are set once for the whole run instead of per HAL call
+	if( (status == HAL_OK) && ((len - offset) >= 4) )
+	{
+		status = FLASH_WaitForLastOperation(HAL_MAX_DELAY);
+		if( status == HAL_OK )
+		{
+			FLASH->CR &= CR_PSIZE_MASK;
+			FLASH->CR |= FLASH_PSIZE_WORD;
+			FLASH->CR |= FLASH_CR_PG;
+
+			while( (len - offset) >= 4 )
+			{
+				address = mem_address + offset;
+				// Source may be unaligned, memcpy compiles to a single load on the M4
+				memcpy(&word, &pBuffer[offset], 4);
+
+				*(volatile uint32_t *)address = word;
+				while(__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) != RESET);
+
+				if( (FLASH->SR & (FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR |
+						FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR)) ||
+					(*(volatile uint32_t *)address != word) )
+				{
+					status = HAL_ERROR;
+					break;
+				}
+				offset += 4;
+			}
+
+			FLASH->CR &= (~FLASH_CR_PG);
+			__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+					FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR);
+		}
+	}
+
+	// 3. Tail : remaining halfword and byte
+	if( (status == HAL_OK) && ((len - offset) >= 2) )
+	{
+		status = flash_program_unit(FLASH_TYPEPROGRAM_HALFWORD, mem_address + offset,
+				(uint32_t)pBuffer[offset] | ((uint32_t)pBuffer[offset + 1] << 8));
+		if( status == HAL_OK )
+			offset += 2;
+	}
+	if( (status == HAL_OK) && (len > offset) )
+	{
+		status = flash_program_unit(FLASH_TYPEPROGRAM_BYTE, mem_address + offset, pBuffer[offset]);
+		if( status == HAL_OK )
+			offset += 1;
 	}
 
 	HAL_FLASH_Lock();
 
+	BL_PROFILE_END(BL_PROF_PROGRAM, program_start);
+
+	if( pFail_offset )
+		*pFail_offset = offset;
+
 	return status;
 }
 
 
+/* Waits for the end of the flash operation in progress (option bytes)
+ * The queue of the flash engine is emptied first, then the core sleeps until BSY clears
+ * (SysTick wakes it up) instead of spinning on the flag.
+ */
+static void flash_wait_ready(void)
+{
+	flash_bg_sync();
+
+	while(__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) != RESET)
+	{
+		__WFI();
+	}
+}
+
 /*
 Modifying user option bytes
 To modify the user option value, follow the sequence below :
@@ -726,7 +2341,7 @@ uint8_t configure_flash_sector_rw_protection(uint16_t sector_details, uint8_t pr
 		HAL_FLASH_OB_Unlock();
 
 		// Wait till no active operation on flash
-		while(__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) != RESET);
+		flash_wait_ready();
 
 		// Clear the 31st bit (default state)
 		// Please refer : Flash option control register (FLASH_OPTCR) in RM
@@ -739,7 +2354,7 @@ uint8_t configure_flash_sector_rw_protection(uint16_t sector_details, uint8_t pr
 		*pOPTCR |= ( 1 << 1);
 
 		// Wait till no active operation on flash
-		while(__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) != RESET);
+		flash_wait_ready();
 
 		HAL_FLASH_OB_Lock();
 
@@ -755,7 +2370,7 @@ uint8_t configure_flash_sector_rw_protection(uint16_t sector_details, uint8_t pr
 		HAL_FLASH_OB_Unlock();
 
 		// Wait till no active operation on flash
-		while(__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) != RESET);
+		flash_wait_ready();
 
 		// Here we are setting just write protection for the sectors
 		// Clear the 31st bit
@@ -770,7 +2385,7 @@ uint8_t configure_flash_sector_rw_protection(uint16_t sector_details, uint8_t pr
 		*pOPTCR |= ( 1 << 1);
 
 		// Wait till no active operation on flash
-		while(__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) != RESET);
+		flash_wait_ready();
 
 		HAL_FLASH_OB_Lock();
 	}
@@ -781,7 +2396,7 @@ uint8_t configure_flash_sector_rw_protection(uint16_t sector_details, uint8_t pr
 		HAL_FLASH_OB_Unlock();
 
 		// Wait till no active operation on flash
-		while(__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) != RESET);
+		flash_wait_ready();
 
 		// Here we are setting read and write protection for the sectors
 		// Set the 31st bit
@@ -797,7 +2412,7 @@ uint8_t configure_flash_sector_rw_protection(uint16_t sector_details, uint8_t pr
 		*pOPTCR |= ( 1 << 1);
 
 		// Wait till no active operation on flash
-		while(__HAL_FLASH_GET_FLAG(FLASH_FLAG_BSY) != RESET);
+		flash_wait_ready();
 
 		HAL_FLASH_OB_Lock();
 	}
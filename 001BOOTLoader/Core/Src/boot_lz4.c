@@ -0,0 +1,207 @@
+/*
+ * boot_lz4.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "main.h"
+
+/* LZ4 block : a list of sequences
+ * token (literal length : 4 bits, match length - 4 : 4 bits), more literal length bytes if 15,
+ * literals, match offset (16 bits), more match length bytes if 15.
+ * The last sequence stops after its literals.
+ */
+#define LZ4_MIN_MATCH			4
+
+// Decoder states, each one waits for the next input byte
+#define LZ4_TOKEN				0
+#define LZ4_LIT_LEN				1
+#define LZ4_LITERALS			2
+#define LZ4_OFFSET_LO			3
+#define LZ4_OFFSET_HI			4
+#define LZ4_MATCH_LEN			5
+
+
+/* Programs the staging buffer */
+static uint8_t lz4_flush(lz4_stream_t *pStream)
+{
+	uint32_t address = pStream->out_base + pStream->out_pos - pStream->stage_len;
+	uint32_t fail_offset = 0;
+	uint8_t status;
+
+	if(pStream->stage_len == 0)
+		return BL_LZ4_OK;
+
+	if( (verify_address(address) != ADDR_VALID) ||
+			(verify_address(address + pStream->stage_len - 1) != ADDR_VALID) )
+	{
+		pStream->fail_offset = pStream->out_pos - pStream->stage_len;
+		return ADDR_INVALID;
+	}
+
+	if(pStream->auto_erase)
+	{
+		status = flash_prepare_write(address, pStream->stage_len);
+		if(status != HAL_OK)
+		{
+			pStream->fail_offset = pStream->out_pos - pStream->stage_len;
+			return status;
+		}
+	}
+
+	status = execute_mem_write(pStream->stage, address, pStream->stage_len, &fail_offset);
+	if(status != HAL_OK)
+	{
+		pStream->fail_offset = pStream->out_pos - pStream->stage_len + fail_offset;
+		return status;
+	}
+
+	pStream->stage_len = 0;
+	return BL_LZ4_OK;
+}
+
+/* Appends one decompressed byte */
+static uint8_t lz4_put(lz4_stream_t *pStream, uint8_t data)
+{
+	pStream->stage[pStream->stage_len++] = data;
+	pStream->out_pos++;
+
+	if(pStream->stage_len == BL_LZ4_STAGE_LEN)
+		return lz4_flush(pStream);
+
+	return BL_LZ4_OK;
+}
+
+/* Copies a match, the source is in the staging buffer or already in the flash */
+static uint8_t lz4_copy_match(lz4_stream_t *pStream)
+{
+	uint32_t src;
+	uint32_t stage_start;
+	uint8_t data;
+	uint8_t status;
+
+	if((pStream->offset == 0) || (pStream->offset > pStream->out_pos))
+		return BL_LZ4_DATA_ERROR;
+
+	while(pStream->match_len)
+	{
+		src = pStream->out_pos - pStream->offset;
+		stage_start = pStream->out_pos - pStream->stage_len;
+
+		if(src >= stage_start)
+			data = pStream->stage[src - stage_start];
+		else
+			data = *(volatile uint8_t *)(pStream->out_base + src);
+
+		status = lz4_put(pStream, data);
+		if(status != BL_LZ4_OK)
+			return status;
+
+		pStream->match_len--;
+	}
+
+	return BL_LZ4_OK;
+}
+
+/* This function starts a new stream, decompressed bytes go to out_base and up */
+void lz4_stream_init(lz4_stream_t *pStream, uint32_t out_base)
+{
+	pStream->state = LZ4_TOKEN;
+	pStream->lit_len = 0;
+	pStream->match_len = 0;
+	pStream->offset = 0;
+	pStream->out_base = out_base;
+	pStream->out_pos = 0;
+	pStream->stage_len = 0;
+	pStream->fail_offset = 0;
+	pStream->auto_erase = 0;
+}
+
+/* This function decompresses the next len bytes of the stream */
+uint8_t lz4_stream_feed(lz4_stream_t *pStream, uint8_t *pIn, uint32_t len)
+{
+	uint8_t status = BL_LZ4_OK;
+	uint8_t data;
+
+	while(len && (status == BL_LZ4_OK))
+	{
+		data = *pIn++;
+		len--;
+
+		switch(pStream->state)
+		{
+		case LZ4_TOKEN:
+			pStream->lit_len = data >> 4;
+			pStream->match_len = (data & 0x0F) + LZ4_MIN_MATCH;
+			if(pStream->lit_len == 15)
+				pStream->state = LZ4_LIT_LEN;
+			else if(pStream->lit_len)
+				pStream->state = LZ4_LITERALS;
+			else
+				pStream->state = LZ4_OFFSET_LO;
+			break;
+
+		case LZ4_LIT_LEN:
+			pStream->lit_len += data;
+			if(data != 255)
+				pStream->state = LZ4_LITERALS;
+			break;
+
+		case LZ4_LITERALS:
+			status = lz4_put(pStream, data);
+			if(--pStream->lit_len == 0)
+				pStream->state = LZ4_OFFSET_LO;
+			break;
+
+		case LZ4_OFFSET_LO:
+			pStream->offset = data;
+			pStream->state = LZ4_OFFSET_HI;
+			break;
+
+		case LZ4_OFFSET_HI:
+			pStream->offset |= (uint32_t)data << 8;
+			if(pStream->match_len == (15 + LZ4_MIN_MATCH))
+			{
+				pStream->state = LZ4_MATCH_LEN;
+			}else
+			{
+				status = lz4_copy_match(pStream);
+				pStream->state = LZ4_TOKEN;
+			}
+			break;
+
+		case LZ4_MATCH_LEN:
+			pStream->match_len += data;
+			if(data != 255)
+			{
+				status = lz4_copy_match(pStream);
+				pStream->state = LZ4_TOKEN;
+			}
+			break;
+
+		default:
+			status = BL_LZ4_DATA_ERROR;
+			break;
+		}
+	}
+
+	return status;
+}
+
+/* This function ends the stream : programs what is left in the staging buffer
+ * The stream must end right after the literals of its last sequence.
+ */
+uint8_t lz4_stream_finish(lz4_stream_t *pStream)
+{
+	uint8_t status;
+
+	status = lz4_flush(pStream);
+	if(status != BL_LZ4_OK)
+		return status;
+
+	if(pStream->state != LZ4_OFFSET_LO)
+		return BL_LZ4_DATA_ERROR;
+
+	return BL_LZ4_OK;
+}
@@ -0,0 +1,65 @@
+/*
+ * boot_profile.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "main.h"
+
+#if BL_PROFILE_EN
+
+static bl_profile_table_t profile_table;
+
+// The table is being sent, samples are dropped so it doesn't change under the DMA
+static uint8_t profile_frozen;
+
+
+/* This function adds a sample of cycles to the entry id, ids out of the table are ignored */
+void profile_record(uint32_t id, uint32_t cycles)
+{
+	bl_profile_stat_t *pStat;
+	uint32_t bucket;
+
+	if( (id >= BL_PROFILE_COUNT) || profile_frozen )
+		return;
+
+	pStat = &profile_table.stat[id];
+	if( (pStat->count == 0) || (cycles < pStat->min) )
+		pStat->min = cycles;
+	if( cycles > pStat->max )
+		pStat->max = cycles;
+	pStat->count++;
+	pStat->sum += cycles;
+
+	bucket = 32 - __CLZ(cycles >> BL_PROFILE_FIRST_BUCKET);
+	if( bucket >= BL_PROFILE_BUCKETS )
+		bucket = BL_PROFILE_BUCKETS - 1;
+	if( pStat->hist[bucket] != 0xFFFF )
+		pStat->hist[bucket]++;
+}
+
+/* This function stops the recording and returns the table, ready to be sent */
+bl_profile_table_t *profile_freeze(void)
+{
+	profile_frozen = 1;
+
+	profile_table.clock = SystemCoreClock;
+	profile_table.nb_stats = BL_PROFILE_COUNT;
+	profile_table.nb_buckets = BL_PROFILE_BUCKETS;
+	profile_table.first_bucket = BL_PROFILE_FIRST_BUCKET;
+	profile_table.cmd_base = BL_PROF_CMD_BASE;
+
+	return &profile_table;
+}
+
+/* This function starts the recording again, the table starts over with clear = 1 */
+void profile_thaw(uint8_t clear)
+{
+	if(clear)
+		memset(profile_table.stat, 0, sizeof(profile_table.stat));
+
+	profile_frozen = 0;
+}
+
+#endif
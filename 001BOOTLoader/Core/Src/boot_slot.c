@@ -0,0 +1,254 @@
+/*
+ * boot_slot.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "main.h"
+
+
+/* Slot B needs bank 2 */
+static uint8_t slot_exists(uint8_t slot)
+{
+	if(slot == BL_SLOT_A)
+		return 1;
+	if(slot == BL_SLOT_B)
+		return (get_flash_sector_count() > BL_FLASH_BANK_SECTORS);
+
+	return 0;
+}
+
+/* Programs one word of the trailer */
+static uint8_t slot_program_word(const volatile uint32_t *pWord, uint32_t value)
+{
+	uint32_t fail_offset;
+
+	return execute_mem_write((uint8_t *)&value, (uint32_t)pWord, 4, &fail_offset);
+}
+
+/* The image of the slot has the size and CRC of its trailer */
+static uint8_t slot_check_image(uint8_t slot)
+{
+	const bl_slot_trailer_t *pTrailer = slot_get_trailer(slot);
+
+	if( (pTrailer->size == 0) || (pTrailer->size > BL_SLOT_TRAILER_OFFSET) )
+		return 0;
+
+	return (bootloader_calc_crc((uint8_t *)slot_get_base(slot), pTrailer->size, BL_CRC_MODE_WORD) == pTrailer->crc);
+}
+
+/* The copy of the bootloader in bank 2 is up to date */
+static uint8_t slot_mirror_ok(void)
+{
+	return (memcmp((const void *)FLASH_BASE, (const void *)BL_BOOT_MIRROR_BASE, BL_BOOT_SIZE) == 0);
+}
+
+/* Flash address of the first byte of a slot */
+uint32_t slot_get_base(uint8_t slot)
+{
+	return (slot == BL_SLOT_B) ? BL_SLOT_B_BASE : BL_SLOT_A_BASE;
+}
+
+const bl_slot_trailer_t *slot_get_trailer(uint8_t slot)
+{
+	return (const bl_slot_trailer_t *)(slot_get_base(slot) + BL_SLOT_TRAILER_OFFSET);
+}
+
+/* State of a slot from its trailer words, the CRC is not checked here */
+uint8_t slot_get_state(uint8_t slot)
+{
+	const bl_slot_trailer_t *pTrailer;
+
+	if(!slot_exists(slot))
+		return BL_SLOT_EMPTY;
+
+	pTrailer = slot_get_trailer(slot);
+	if(pTrailer->magic != BL_SLOT_MAGIC)
+		return BL_SLOT_EMPTY;
+	if(pTrailer->bad != BL_SLOT_WORD_ERASED)
+		return BL_SLOT_BAD;
+	if(pTrailer->confirmed != BL_SLOT_WORD_ERASED)
+		return BL_SLOT_CONFIRMED;
+	if(pTrailer->trial != BL_SLOT_WORD_ERASED)
+		return BL_SLOT_TRIAL;
+
+	return BL_SLOT_PENDING;
+}
+
+/* This function picks the slot to start : the newest one which is neither bad nor a failed trial
+ * With update = 1 the trailers are updated on the way (failed trials and CRC errors are marked bad,
+ * the picked slot is marked on trial if it is new), with update = 0 nothing is written (BL_SLOT_INFO).
+ * Returns BL_SLOT_NONE if no slot was ever activated.
+ */
+uint8_t slot_select_boot(uint8_t update)
+{
+	uint8_t tried[BL_SLOT_COUNT] = {0};
+	uint8_t slot;
+	uint8_t state;
+
+	while(1)
+	{
+		// Newest slot not looked at yet
+		slot = BL_SLOT_NONE;
+		for(uint8_t i = 0; i < BL_SLOT_COUNT; i++)
+		{
+			state = slot_get_state(i);
+			if( tried[i] || (state == BL_SLOT_EMPTY) || (state == BL_SLOT_BAD) )
+				continue;
+			if( (slot == BL_SLOT_NONE) || (slot_get_trailer(i)->seq > slot_get_trailer(slot)->seq) )
+				slot = i;
+		}
+
+		if(slot == BL_SLOT_NONE)
+			return BL_SLOT_NONE;
+		tried[slot] = 1;
+
+		state = slot_get_state(slot);
+		if(state == BL_SLOT_TRIAL)
+		{
+			// Started before and never confirmed
+			LOG_WARN("Slot %d failed its trial", slot);
+			if(update)
+				slot_program_word(&slot_get_trailer(slot)->bad, BL_SLOT_WORD_SET);
+			continue;
+		}
+
+		if(!slot_check_image(slot))
+		{
+			LOG_ERROR("Slot %d CRC error", slot);
+			if(update)
+				slot_program_word(&slot_get_trailer(slot)->bad, BL_SLOT_WORD_SET);
+			continue;
+		}
+
+		if( update && (state == BL_SLOT_PENDING) )
+		{
+			LOG_INFO("Slot %d on trial", slot);
+			slot_program_word(&slot_get_trailer(slot)->trial, BL_SLOT_WORD_SET);
+		}
+
+		return slot;
+	}
+}
+
+/* This function activates the image written in a slot : size bytes with this CRC
+ * The trailer must still be erased. seq is one more than the newest slot, so the
+ * image boots (on trial) at the next reset.
+ */
+uint8_t slot_activate(uint8_t slot, uint32_t size, uint32_t crc)
+{
+	const bl_slot_trailer_t *pTrailer;
+	const uint32_t *pWord;
+	uint32_t seq = 0;
+	uint8_t status;
+
+	if( !slot_exists(slot) || (size == 0) || (size > BL_SLOT_TRAILER_OFFSET) )
+		return BL_SLOT_INVALID;
+
+	pTrailer = slot_get_trailer(slot);
+	for(pWord = (const uint32_t *)pTrailer; pWord < (const uint32_t *)(pTrailer + 1); pWord++)
+	{
+		if(*pWord != BL_SLOT_WORD_ERASED)
+			return BL_SLOT_NOT_BLANK;
+	}
+
+	if(bootloader_calc_crc((uint8_t *)slot_get_base(slot), size, BL_CRC_MODE_WORD) != crc)
+		return BL_SLOT_CRC_ERROR;
+
+	for(uint8_t i = 0; i < BL_SLOT_COUNT; i++)
+	{
+		if( (slot_get_state(i) != BL_SLOT_EMPTY) && (slot_get_trailer(i)->seq >= seq) )
+			seq = slot_get_trailer(i)->seq + 1;
+	}
+
+	// magic last : a reset in the middle leaves a slot which is simply not activated
+	status = slot_program_word(&pTrailer->size, size);
+	if(status == HAL_OK)
+		status = slot_program_word(&pTrailer->crc, crc);
+	if(status == HAL_OK)
+		status = slot_program_word(&pTrailer->seq, seq);
+	if(status == HAL_OK)
+		status = slot_program_word(&pTrailer->magic, BL_SLOT_MAGIC);
+
+	LOG_INFO("Slot %d activated, seq %d status %d", slot, seq, status);
+
+	return status;
+}
+
+/* This function picks the slot to start without any flash write or CRC check, for fast_boot()
+ * Returns 1 with the slot in *pSlot (BL_SLOT_NONE if no slot was ever activated) when the newest
+ * slot is confirmed and can be mapped as it is, 0 when slot_select_boot() has work to do.
+ * A confirmed image had its CRC checked when it was activated and at each start until confirmed.
+ */
+uint8_t slot_select_fast(uint8_t *pSlot)
+{
+	uint8_t slot = BL_SLOT_NONE;
+	uint8_t state;
+
+	for(uint8_t i = 0; i < BL_SLOT_COUNT; i++)
+	{
+		state = slot_get_state(i);
+		if( (state == BL_SLOT_EMPTY) || (state == BL_SLOT_BAD) )
+			continue;
+		if( (slot == BL_SLOT_NONE) || (slot_get_trailer(i)->seq > slot_get_trailer(slot)->seq) )
+			slot = i;
+	}
+
+	*pSlot = slot;
+	if(slot == BL_SLOT_NONE)
+		return 1;
+	if(slot_get_state(slot) != BL_SLOT_CONFIRMED)
+		return 0;
+
+	return ( (slot != BL_SLOT_B) || slot_mirror_ok() );
+}
+
+/* This function maps the slot at FLASH_SECTOR2_BASE before the jump
+ * For slot B the copy of the bootloader in bank 2 is refreshed if needed, then the banks are swapped.
+ * The code keeps running through the swap since both banks hold the same bootloader.
+ */
+uint8_t slot_map_boot(uint8_t slot)
+{
+	uint32_t fail_offset;
+	uint8_t status;
+
+	if(slot != BL_SLOT_B)
+		return HAL_OK;
+
+	if(!slot_mirror_ok())
+	{
+		LOG_INFO("Updating the bootloader copy in bank 2");
+		for(uint8_t sector = get_flash_sector_number(BL_BOOT_MIRROR_BASE); sector <= get_flash_sector_number(BL_BOOT_MIRROR_BASE + BL_BOOT_SIZE - 1); sector++)
+		{
+			status = execute_flash_erase_sector(sector);
+			if(status != HAL_OK)
+				return status;
+		}
+
+		status = execute_mem_write((uint8_t *)FLASH_BASE, BL_BOOT_MIRROR_BASE, BL_BOOT_SIZE, &fail_offset);
+		if(status != HAL_OK)
+			return status;
+	}
+
+	slot_swap_banks();
+
+	return HAL_OK;
+}
+
+/* This function maps bank 2 at FLASH_BASE, the copy of the bootloader in bank 2 must be up to date */
+void slot_swap_banks(void)
+{
+	__HAL_RCC_SYSCFG_CLK_ENABLE();
+	SYSCFG->MEMRMP |= SYSCFG_MEMRMP_UFB_MODE;
+	__DSB();
+	__ISB();
+
+	// The flash caches still hold lines of bank 1 at the addresses which now show bank 2
+	__HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+	__HAL_FLASH_DATA_CACHE_DISABLE();
+	__HAL_FLASH_INSTRUCTION_CACHE_RESET();
+	__HAL_FLASH_DATA_CACHE_RESET();
+	__HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+	__HAL_FLASH_DATA_CACHE_ENABLE();
+}
@@ -0,0 +1,307 @@
+/*
+ * boot_uart.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "boot_uart.h"
+
+#if ((BL_RX_RING_LEN & (BL_RX_RING_LEN - 1)) != 0) || (BL_RX_RING_LEN < (2 * BL_RX_LEN))
+#error "BL_RX_RING_LEN must be a power of 2 holding at least two command packets"
+#endif
+
+#if BL_RX_WINDOW > 0xFFFF
+#error "BL_RX_WINDOW is replied on 16 bits by BL_GET_PROTOCOL"
+#endif
+
+/* The DMA writes in to the first BL_RX_RING_LEN bytes.
+ * The extra BL_RX_LEN bytes behind the ring are only used to make a packet which
+ * wraps around the end of the ring contiguous, so it can be handed out in place.
+ */
+static uint8_t bl_rx_ring[BL_RX_RING_LEN + BL_RX_LEN];
+
+// Start of the next command packet in the ring
+static uint32_t rx_tail;
+
+// Length of the packet currently handed out to the command handlers (0 if none)
+static uint32_t rx_frame_len;
+
+// Bytes of the incomplete packet at rx_tail when they last changed, and when
+static uint32_t rx_partial_len;
+static uint32_t rx_partial_tick;
+
+// Last baud rate confirmed by the host (0 until the first change)
+static uint32_t baud_good;
+
+// A baud rate change is waiting for the first valid packet from the host
+static uint8_t baud_pending;
+static uint32_t baud_pending_tick;
+
+// CRC failures in a row
+static uint32_t crc_fail_count;
+
+
+/* Current write position of the DMA in the ring */
+static uint32_t rx_head(void)
+{
+	return (BL_RX_RING_LEN - __HAL_DMA_GET_COUNTER((C_UART)->hdmarx)) & (BL_RX_RING_LEN - 1);
+}
+
+/* Number of received bytes which are not yet consumed */
+static uint32_t rx_available(void)
+{
+	return (rx_head() - rx_tail) & (BL_RX_RING_LEN - 1);
+}
+
+/* Length of the packet at the start of the ring
+ * Returns the header length if not enough bytes are received to know it yet, 0 if the length is invalid
+ */
+static uint32_t rx_frame_length(uint32_t avail)
+{
+	uint32_t payload_len;
+
+	// v1 : first byte of the command packet is the "length to follow" field
+	if(bl_rx_ring[rx_tail] != BL_V2_SOF)
+	{
+		return bl_rx_ring[rx_tail] + 1;
+	}
+
+	// v2 : the payload length is in the header
+	if(avail < BL_V2_HDR_LEN)
+	{
+		return BL_V2_HDR_LEN;
+	}
+
+	payload_len = bl_rx_ring[(rx_tail + 4) & (BL_RX_RING_LEN - 1)] |
+				(bl_rx_ring[(rx_tail + 5) & (BL_RX_RING_LEN - 1)] << 8);
+	if(payload_len > BL_V2_MAX_PAYLOAD)
+	{
+		return 0;
+	}
+
+	return BL_V2_PACKET_LEN(payload_len);
+}
+
+/* This function starts the circular DMA reception of C_UART with IDLE line detection */
+void bootloader_uart_rx_start(void)
+{
+	rx_tail = 0;
+	rx_frame_len = 0;
+	rx_partial_len = 0;
+
+	HAL_UARTEx_ReceiveToIdle_DMA(C_UART, bl_rx_ring, BL_RX_RING_LEN);
+}
+
+/* This function stops the reception, must be called before leaving the bootloader */
+void bootloader_uart_rx_stop(void)
+{
+	HAL_UART_AbortReceive(C_UART);
+}
+
+/* Reprograms the baud rate of C_UART, the receive ring starts over empty */
+static void uart_apply_baud(uint32_t baud)
+{
+	bootloader_uart_tx_wait();
+	bootloader_uart_rx_stop();
+
+	(C_UART)->Init.BaudRate = baud;
+	if(HAL_UART_Init(C_UART) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	bootloader_uart_rx_start();
+}
+
+/* Goes back to the last baud rate confirmed by the host */
+static void uart_revert_baud(void)
+{
+	baud_pending = 0;
+	crc_fail_count = 0;
+
+	if(baud_good && ((C_UART)->Init.BaudRate != baud_good))
+	{
+		uart_apply_baud(baud_good);
+	}
+}
+
+/* This function waits for a complete command packet from the host
+ * and returns a pointer to it in the receive ring. The packet is not copied,
+ * it stays valid until bootloader_uart_release_frame() is called.
+ */
+uint8_t *bootloader_uart_get_frame(uint32_t *pFrame_len)
+{
+	uint32_t frame_len = 0;
+	uint32_t avail;
+	BL_PROFILE_BEGIN(rx_start);
+
+	while(1)
+	{
+		// A reception error (overrun..) stops the DMA, just start over with an empty ring
+		if((C_UART)->RxState == HAL_UART_STATE_READY)
+		{
+			bootloader_uart_rx_start();
+		}
+
+		avail = rx_available();
+		if(avail)
+		{
+			frame_len = rx_frame_length(avail);
+			if(frame_len == 0)
+			{
+				// Length can't be valid, we lost track of the packets.. drop what we have
+				rx_tail = rx_head();
+				bootloader_send_nack();
+			}
+			else if(avail >= frame_len)
+			{
+				break;
+			}
+			else if(avail != rx_partial_len)
+			{
+				rx_partial_len = avail;
+				rx_partial_tick = HAL_GetTick();
+			}
+			else if((HAL_GetTick() - rx_partial_tick) > BL_RX_FRAME_TIMEOUT)
+			{
+				// The rest of the packet is not coming
+				LOG_WARN("Incomplete packet dropped : %d of %d bytes", avail, frame_len);
+				rx_tail = (rx_tail + avail) & (BL_RX_RING_LEN - 1);
+				rx_partial_len = 0;
+			}
+		}
+		else
+		{
+			rx_partial_len = 0;
+#if BL_PROFILE_EN
+			// Idle link, the reception starts with the first bytes of the packet
+			rx_start = DWT->CYCCNT;
+#endif
+		}
+
+		// The host didn't confirm the new baud rate in time
+		if(baud_pending && ((HAL_GetTick() - baud_pending_tick) > BL_BAUD_CONFIRM_TIMEOUT))
+		{
+			uart_revert_baud();
+		}
+
+		// Next sectors of the background erase, if the last ones are done
+		flash_bg_poll();
+
+		// Sleep until the next IDLE line / DMA / FLASH event (or SysTick)
+		__WFI();
+	}
+
+	// Packet wraps around the end of the ring, copy its beginning behind the ring
+	if((rx_tail + frame_len) > BL_RX_RING_LEN)
+	{
+		memcpy(&bl_rx_ring[BL_RX_RING_LEN], &bl_rx_ring[0], rx_tail + frame_len - BL_RX_RING_LEN);
+	}
+
+	rx_frame_len = frame_len;
+	rx_partial_len = 0;
+	*pFrame_len = frame_len;
+	BL_PROFILE_END(BL_PROF_RX, rx_start);
+
+	return &bl_rx_ring[rx_tail];
+}
+
+/* This function gives the packet handed out by bootloader_uart_get_frame() back to the ring */
+void bootloader_uart_release_frame(void)
+{
+	rx_tail = (rx_tail + rx_frame_len) & (BL_RX_RING_LEN - 1);
+	rx_frame_len = 0;
+}
+
+/* This function starts a DMA transmission on C_UART and returns immediately
+ * pBuffer must stay untouched until bootloader_uart_tx_wait() returns, it must not be in the CCM RAM.
+ */
+void bootloader_uart_write_data_dma(uint8_t *pBuffer, uint16_t len)
+{
+	bootloader_uart_tx_wait();
+	HAL_UART_Transmit_DMA(C_UART, pBuffer, len);
+}
+
+/* This function waits for the end of the current DMA transmission */
+void bootloader_uart_tx_wait(void)
+{
+	BL_PROFILE_BEGIN(tx_start);
+
+	while((C_UART)->gState != HAL_UART_STATE_READY)
+	{
+		__WFI();
+	}
+
+	BL_PROFILE_END(BL_PROF_TX, tx_start);
+}
+
+/* This function checks that C_UART can run at this baud rate */
+uint8_t bootloader_uart_check_baud(uint32_t baud)
+{
+	uint32_t baud_max;
+
+	// OVER16 : the baud rate can't go above fPCLK2 / 16 (fPCLK2 / 8 with OVER8)
+	baud_max = HAL_RCC_GetPCLK2Freq() / (((C_UART)->Init.OverSampling == UART_OVERSAMPLING_8) ? 8 : 16);
+	if((baud < BL_BAUD_MIN) || (baud > baud_max))
+	{
+		return BL_BAUD_INVALID;
+	}
+
+	return BL_BAUD_OK;
+}
+
+/* This function switches C_UART to a new baud rate
+ * Must be called once the reply at the old rate is sent. The new rate stays
+ * pending until the host sends a valid packet (bootloader_uart_link_ok()).
+ */
+uint8_t bootloader_uart_set_baud(uint32_t baud)
+{
+	if(bootloader_uart_check_baud(baud) != BL_BAUD_OK)
+	{
+		return BL_BAUD_INVALID;
+	}
+
+	if(!baud_pending)
+	{
+		baud_good = (C_UART)->Init.BaudRate;
+	}
+
+	uart_apply_baud(baud);
+
+	baud_pending = 1;
+	baud_pending_tick = HAL_GetTick();
+	crc_fail_count = 0;
+
+	return BL_BAUD_OK;
+}
+
+/* Called for every packet accepted (ACK), confirms the current baud rate */
+void bootloader_uart_link_ok(void)
+{
+	crc_fail_count = 0;
+
+	if(baud_pending)
+	{
+		baud_pending = 0;
+		baud_good = (C_UART)->Init.BaudRate;
+	}
+}
+
+/* Called for every packet rejected (NACK), too many in a row and the link is not usable at this rate */
+void bootloader_uart_link_error(void)
+{
+	if(++crc_fail_count >= BL_BAUD_MAX_CRC_FAIL)
+	{
+		uart_revert_baud();
+	}
+}
+
+/* Reception event of the DMA (IDLE line, half and full transfer)
+ * Nothing to do here, the interrupt itself wakes up bootloader_uart_get_frame()
+ */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size)
+{
+	(void)huart;
+	(void)Size;
+}
@@ -0,0 +1,126 @@
+/*
+ * dbg_log.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "main.h"
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+
+#if (LOG_RING_LEN & (LOG_RING_LEN - 1)) != 0
+#error "LOG_RING_LEN must be a power of 2"
+#endif
+
+/* Records wait here for the DMA of LOG_UART.
+ * The writers only move log_head and the DMA side (TX complete callback) only moves log_tail,
+ * one byte always stays free so that head == tail means empty.
+ */
+static uint8_t log_ring[LOG_RING_LEN];
+static volatile uint32_t log_head;
+static volatile uint32_t log_tail;
+
+// Length of the DMA transfer in progress (0 if none)
+static volatile uint32_t log_tx_len;
+
+// Records lost because the ring was full
+volatile uint32_t log_dropped;
+
+
+/* Starts the DMA on the pending part of the ring if it is idle
+ * Called with the interrupts masked or from the TX complete callback.
+ */
+static void log_kick(void)
+{
+	uint32_t len;
+
+	if(log_tx_len)
+		return;
+
+	len = (log_head - log_tail) & (LOG_RING_LEN - 1);
+	if(len == 0)
+		return;
+
+	// The DMA can't wrap around, the rest goes with the next transfer
+	if((log_tail + len) > LOG_RING_LEN)
+		len = LOG_RING_LEN - log_tail;
+
+	log_tx_len = len;
+	if(HAL_UART_Transmit_DMA(LOG_UART, &log_ring[log_tail], len) != HAL_OK)
+	{
+		log_tx_len = 0;
+	}
+}
+
+/* This function pushes one record in to the ring, use the LOG_xxx macros instead */
+void log_write(uint32_t fmt_id, uint32_t level_nargs, ...)
+{
+	uint32_t record[2 + LOG_MAX_ARGS];
+	uint32_t nargs = level_nargs & 0x0F;
+	uint32_t len = (2 + nargs) * 4;
+	uint32_t first;
+	uint32_t primask;
+	va_list args;
+
+	record[0] = (fmt_id & 0xFFFF) | ((level_nargs & 0xFF) << 16) | ((uint32_t)LOG_SYNC << 24);
+	record[1] = HAL_GetTick();
+
+	va_start(args, level_nargs);
+	for(uint32_t i = 0; i < nargs; i++)
+	{
+		record[2 + i] = va_arg(args, uint32_t);
+	}
+	va_end(args);
+
+	// Interrupt handlers log too, the copy must not be interleaved with theirs
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	if(((log_tail - log_head - 1) & (LOG_RING_LEN - 1)) >= len)
+	{
+		first = LOG_RING_LEN - log_head;
+		if(first > len)
+			first = len;
+
+		memcpy(&log_ring[log_head], record, first);
+		memcpy(&log_ring[0], (uint8_t *)record + first, len - first);
+		log_head = (log_head + len) & (LOG_RING_LEN - 1);
+
+		log_kick();
+	}else
+	{
+		log_dropped++;
+	}
+
+	__set_PRIMASK(primask);
+}
+
+/* This function waits until the ring is sent, must not be called with the interrupts masked */
+void log_flush(void)
+{
+	uint32_t primask;
+
+	while((log_head != log_tail) || log_tx_len)
+	{
+		// In case the last kick found the UART busy
+		primask = __get_PRIMASK();
+		__disable_irq();
+		log_kick();
+		__set_PRIMASK(primask);
+	}
+}
+
+/* End of a DMA transfer on LOG_UART, send what was written in the meantime */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+	if(huart != LOG_UART)
+		return;
+
+	log_tail = (log_tail + log_tx_len) & (LOG_RING_LEN - 1);
+	log_tx_len = 0;
+
+	log_kick();
+}
+
+#endif
@@ -33,9 +33,6 @@
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
 
-// Enable this line to get debug messages over debug UART
-#define BL_DEBUG_MSG_EN
-
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -52,6 +49,10 @@ UART_HandleTypeDef huart3;
 
 /* USER CODE BEGIN PV */
 
+DMA_HandleTypeDef hdma_usart1_rx;
+DMA_HandleTypeDef hdma_usart1_tx;
+DMA_HandleTypeDef hdma_crc;
+DMA_HandleTypeDef hdma_usart3_tx;
 
 /* USER CODE END PV */
 
@@ -78,6 +79,13 @@ int main(void)
 {
   /* USER CODE BEGIN 1 */
 
+  boot_time_start();
+
+#if BL_FAST_BOOT_EN
+  // Button released and nothing to check : the application starts from here, see boot_fast.h
+  fast_boot();
+#endif
+
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -94,6 +102,8 @@ int main(void)
 
   /* USER CODE BEGIN SysInit */
 
+  boot_time_mark(BL_BOOT_T_CLOCK);
+
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
@@ -103,10 +113,14 @@ int main(void)
   MX_USART3_UART_Init();
   /* USER CODE BEGIN 2 */
 
+  // A delta copy cut by a reset is finished before anything runs from the flash
+  bootloader_delta_resume();
+
   /* Lets check whether button is pressed or not, if not pressed jump to user application */
   if ( HAL_GPIO_ReadPin(B1_GPIO_Port, B1_Pin) == GPIO_PIN_SET )
   {
-	  printmsg("BL_DEBUG_MSG: Button is pressed .. going to BL mode\r\n");
+	  boot_time_mark(BL_BOOT_T_DECISION);
+	  LOG_INFO("Button is pressed .. going to BL mode");
 
 	  //we should continue in Bootloader mode
 	  bootloader_uart_read_data();
@@ -114,7 +128,8 @@ int main(void)
   }
   else
   {
-	  printmsg("BL_DEBUG_MSG: Button is not pressed .. executing USER Application\r\n");
+	  boot_time_mark(BL_BOOT_T_DECISION);
+	  LOG_INFO("Button is not pressed .. executing USER Application");
 	  //jump to user application
 	  bootloader_jump_to_user_app();
 
@@ -523,21 +538,6 @@ static void MX_GPIO_Init(void)
 
 /* USER CODE BEGIN 4 */
 
-
-/* Prints formatted string to console over UART */
-void printmsg(char *format, ...)
-{
-#ifdef BL_DEBUG_MSG_EN
-	char str[100];
-	/* Extract the argument list using VA API */
-	va_list args;
-	va_start(args, format);
-	vsprintf(str, format, args);
-	HAL_UART_Transmit(D_UART, (uint8_t*)str, strlen(str), HAL_MAX_DELAY);
-	va_end(args);
-#endif
-}
-
 /* USER CODE END 4 */
 
 /**
@@ -96,6 +96,29 @@ void HAL_CRC_MspInit(CRC_HandleTypeDef* hcrc)
     __HAL_RCC_CRC_CLK_ENABLE();
   /* USER CODE BEGIN CRC_MspInit 1 */
 
+#ifdef BL_CRC_USE_DMA
+    /* CRC DMA Init : memory to memory transfer in to the fixed CRC data register */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    hdma_crc.Instance = DMA2_Stream0;
+    hdma_crc.Init.Channel = DMA_CHANNEL_0;
+    hdma_crc.Init.Direction = DMA_MEMORY_TO_MEMORY;
+    hdma_crc.Init.PeriphInc = DMA_PINC_ENABLE;
+    hdma_crc.Init.MemInc = DMA_MINC_DISABLE;
+    hdma_crc.Init.PeriphDataAlignment = DMA_PDATAALIGN_WORD;
+    hdma_crc.Init.MemDataAlignment = DMA_MDATAALIGN_WORD;
+    hdma_crc.Init.Mode = DMA_NORMAL;
+    hdma_crc.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_crc.Init.FIFOMode = DMA_FIFOMODE_ENABLE;
+    hdma_crc.Init.FIFOThreshold = DMA_FIFO_THRESHOLD_FULL;
+    hdma_crc.Init.MemBurst = DMA_MBURST_SINGLE;
+    hdma_crc.Init.PeriphBurst = DMA_PBURST_SINGLE;
+    if (HAL_DMA_Init(&hdma_crc) != HAL_OK)
+    {
+      Error_Handler();
+    }
+#endif
+
   /* USER CODE END CRC_MspInit 1 */
   }
 
@@ -118,6 +141,10 @@ void HAL_CRC_MspDeInit(CRC_HandleTypeDef* hcrc)
     __HAL_RCC_CRC_CLK_DISABLE();
   /* USER CODE BEGIN CRC_MspDeInit 1 */
 
+#ifdef BL_CRC_USE_DMA
+    HAL_DMA_DeInit(&hdma_crc);
+#endif
+
   /* USER CODE END CRC_MspDeInit 1 */
   }
 
@@ -154,6 +181,53 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
 
   /* USER CODE BEGIN USART1_MspInit 1 */
 
+    /* USART1 DMA Init */
+    /* USART1_RX Init : circular reception in to the bootloader receive ring */
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    hdma_usart1_rx.Instance = DMA2_Stream2;
+    hdma_usart1_rx.Init.Channel = DMA_CHANNEL_4;
+    hdma_usart1_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_usart1_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart1_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart1_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart1_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart1_rx.Init.Mode = DMA_CIRCULAR;
+    hdma_usart1_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_usart1_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_usart1_rx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(huart,hdmarx,hdma_usart1_rx);
+
+    /* USART1_TX Init : bulk replies (BL_MEM_READ) */
+    hdma_usart1_tx.Instance = DMA2_Stream7;
+    hdma_usart1_tx.Init.Channel = DMA_CHANNEL_4;
+    hdma_usart1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_usart1_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart1_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart1_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart1_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart1_tx.Init.Mode = DMA_NORMAL;
+    hdma_usart1_tx.Init.Priority = DMA_PRIORITY_MEDIUM;
+    hdma_usart1_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_usart1_tx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(huart,hdmatx,hdma_usart1_tx);
+
+    /* DMA2_Stream2_IRQn, DMA2_Stream7_IRQn and USART1_IRQn (IDLE line, TX complete) interrupt configuration */
+    HAL_NVIC_SetPriority(DMA2_Stream2_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream2_IRQn);
+    HAL_NVIC_SetPriority(DMA2_Stream7_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(DMA2_Stream7_IRQn);
+    HAL_NVIC_SetPriority(USART1_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(USART1_IRQn);
+
   /* USER CODE END USART1_MspInit 1 */
   }
   else if(huart->Instance==USART3)
@@ -178,6 +252,33 @@ void HAL_UART_MspInit(UART_HandleTypeDef* huart)
 
   /* USER CODE BEGIN USART3_MspInit 1 */
 
+    /* DMA controller clock enable */
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    /* USART3_TX Init : drains the debug log ring (dbg_log.c) */
+    hdma_usart3_tx.Instance = DMA1_Stream3;
+    hdma_usart3_tx.Init.Channel = DMA_CHANNEL_4;
+    hdma_usart3_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_usart3_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart3_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart3_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart3_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart3_tx.Init.Mode = DMA_NORMAL;
+    hdma_usart3_tx.Init.Priority = DMA_PRIORITY_LOW;
+    hdma_usart3_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_usart3_tx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(huart,hdmatx,hdma_usart3_tx);
+
+    /* DMA1_Stream3_IRQn and USART3_IRQn (TX complete) interrupt configuration, logs come last */
+    HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, 15, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+    HAL_NVIC_SetPriority(USART3_IRQn, 15, 0);
+    HAL_NVIC_EnableIRQ(USART3_IRQn);
+
   /* USER CODE END USART3_MspInit 1 */
   }
 
@@ -207,6 +308,15 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* huart)
 
   /* USER CODE BEGIN USART1_MspDeInit 1 */
 
+    /* USART1 DMA DeInit */
+    HAL_DMA_DeInit(huart->hdmarx);
+    HAL_DMA_DeInit(huart->hdmatx);
+
+    /* USART1 interrupt DeInit */
+    HAL_NVIC_DisableIRQ(DMA2_Stream2_IRQn);
+    HAL_NVIC_DisableIRQ(DMA2_Stream7_IRQn);
+    HAL_NVIC_DisableIRQ(USART1_IRQn);
+
   /* USER CODE END USART1_MspDeInit 1 */
   }
   else if(huart->Instance==USART3)
@@ -225,6 +335,13 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* huart)
 
   /* USER CODE BEGIN USART3_MspDeInit 1 */
 
+    /* USART3 DMA DeInit */
+    HAL_DMA_DeInit(huart->hdmatx);
+
+    /* USART3 interrupt DeInit */
+    HAL_NVIC_DisableIRQ(DMA1_Stream3_IRQn);
+    HAL_NVIC_DisableIRQ(USART3_IRQn);
+
   /* USER CODE END USART3_MspDeInit 1 */
   }
 
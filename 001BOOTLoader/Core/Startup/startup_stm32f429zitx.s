@@ -60,6 +60,18 @@ defined in linker script */
   .type  Reset_Handler, %function
 Reset_Handler: 
   ldr   sp, =_estack       /* set stack pointer */
+
+/* Start the DWT cycle counter, the boot time is measured from here (see boot_fast.h) */
+  ldr   r0, =0xE000EDFC    /* CoreDebug DEMCR */
+  ldr   r1, [r0]
+  orr   r1, r1, #0x01000000 /* TRCENA */
+  str   r1, [r0]
+  ldr   r0, =0xE0001000    /* DWT CTRL */
+  movs  r1, #0
+  str   r1, [r0, #4]       /* DWT CYCCNT */
+  ldr   r1, [r0]
+  orr   r1, r1, #1         /* CYCCNTENA */
+  str   r1, [r0]
  
 /* Copy the data segment initializers from flash to SRAM */  
   ldr r0, =_sdata
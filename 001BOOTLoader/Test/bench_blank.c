@@ -0,0 +1,179 @@
+/*
+ * bench_blank.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include <stdio.h>
+#include "mock_hal.h"
+
+/* Erase time saved by the blank check, on a partially used device
+ *
+ * usage : bench_blank [image.bin]        (the .bin of 002USER_Application by default)
+ *
+ * Slot A (sectors 2 to 11) holds the image repeated up to each size of used[], some cases keep
+ * settings at the end of sector 11 too. The application area is erased by BL_FLASH_ERASE
+ * (execute_flash_erase(), blank sectors are skipped) and, for comparison, the way it was done
+ * before : HAL_FLASHEx_Erase() over every sector. Before the erase BL_BLANK_CHECK gives the host
+ * its bitmap. Erase times are the ones of the flash model (typical times of the datasheet).
+ * The blank check itself costs reading the flash : BLANK_CHECK_NS_PER_16B is an estimate for the
+ * loop of flash_sector_is_blank() (4 words, about 10 cycles at 180 MHz through the ART).
+ * After each erase the sectors must read blank, CTest runs it with the default image.
+ */
+
+#define BLANK_CHECK_NS_PER_16B	55
+#define FIRST_SECTOR			2
+#define NB_SECTORS				10
+#define SETTINGS_LEN			256
+#define USED_IMAGE				0xFFFFFFFFUL		// the image once
+
+typedef struct
+{
+	uint32_t used;					// bytes of slot A in use
+	uint8_t settings;				// the end of sector 11 is in use too
+} bench_case_t;
+
+static const bench_case_t cases[] =
+{
+	{ 0,			0 },
+	{ 0,			1 },
+	{ USED_IMAGE,	0 },
+	{ 48 * 1024,	0 },
+	{ 128 * 1024,	1 },
+	{ 320 * 1024,	0 },
+	{ 640 * 1024,	1 },
+	{ 992 * 1024,	0 },
+};
+
+static uint8_t image[BL_SLOT_SIZE];
+static uint32_t image_len;
+
+static void fill_device(uint32_t used, uint8_t settings)
+{
+	for(uint32_t pos = 0; pos < used; pos += image_len)
+		mock_flash_load(BL_SLOT_A_BASE + pos, image, ((used - pos) < image_len) ? (used - pos) : image_len);
+	if(settings)
+		mock_flash_fill(BL_SLOT_A_BASE + BL_SLOT_SIZE - SETTINGS_LEN, 0x5A, SETTINGS_LEN);
+}
+
+/* BL_BLANK_CHECK of the application sectors, as the host sends it */
+static uint32_t blank_check(void)
+{
+	uint8_t pkt[8] = { 7, BL_BLANK_CHECK, FIRST_SECTOR, NB_SECTORS };
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint32_t map;
+
+	for(uint32_t i = 0; i < 4; i++)
+		crc = mock_crc_word(crc, pkt[i]);
+	memcpy(&pkt[4], &crc, 4);
+
+	mock_tx_clear();
+	bootloader_handle_blank_check_cmd(pkt);
+	if( (mock_tx_len != 7) || (mock_tx[0] != BL_ACK) || (mock_tx[2] != ADDR_VALID) )
+		return 0;
+	memcpy(&map, &mock_tx[3], 4);
+
+	return map;
+}
+
+/* Bytes flash_sector_is_blank() reads : up to the first 16 byte group not blank */
+static uint32_t blank_check_bytes(void)
+{
+	uint32_t bytes = 0;
+
+	for(uint8_t sector = FIRST_SECTOR; sector < (FIRST_SECTOR + NB_SECTORS); sector++)
+	{
+		const uint32_t *pWord = (const uint32_t *)get_flash_sector_base(sector);
+		uint32_t size = get_flash_sector_size(sector);
+		uint32_t n = 0;
+
+		while( (n < size) && ((pWord[n / 4] & pWord[n / 4 + 1] & pWord[n / 4 + 2] & pWord[n / 4 + 3]) == 0xFFFFFFFFUL) )
+			n += 16;
+		bytes += (n < size) ? (n + 16) : size;
+	}
+
+	return bytes;
+}
+
+static int all_blank(void)
+{
+	for(uint8_t sector = FIRST_SECTOR; sector < (FIRST_SECTOR + NB_SECTORS); sector++)
+	{
+		if(!flash_sector_is_blank(sector))
+			return 0;
+	}
+
+	return 1;
+}
+
+static int bench_case(const bench_case_t *pCase)
+{
+	FLASH_EraseInitTypeDef erase;
+	uint32_t sector_error;
+	HAL_StatusTypeDef status;
+	uint32_t used = (pCase->used == USED_IMAGE) ? image_len : pCase->used;
+	uint32_t map;
+	uint32_t erased = 0;
+	double check_ms;
+	double skip_s;
+	double all_s;
+
+	// Blank check, then BL_FLASH_ERASE
+	mock_reset();
+	fill_device(used, pCase->settings);
+	map = blank_check();
+	check_ms = blank_check_bytes() * (BLANK_CHECK_NS_PER_16B / 16.0) * 1e-6;
+	if( (execute_flash_erase(FIRST_SECTOR, NB_SECTORS) != HAL_OK) || !all_blank() )
+		return -1;
+	skip_s = mock_flash_stats.erase_us * 1e-6;
+	for(uint8_t sector = FIRST_SECTOR; sector < (FIRST_SECTOR + NB_SECTORS); sector++)
+		erased += mock_flash_stats.erases[sector];
+
+	// Every sector erased
+	mock_reset();
+	fill_device(used, pCase->settings);
+	erase.TypeErase = FLASH_TYPEERASE_SECTORS;
+	erase.Sector = FIRST_SECTOR;
+	erase.NbSectors = NB_SECTORS;
+	erase.Banks = FLASH_BANK_1;
+	erase.VoltageRange = FLASH_VOLTAGE_RANGE_3;
+	HAL_FLASH_Unlock();
+	status = HAL_FLASHEx_Erase(&erase, &sector_error);
+	HAL_FLASH_Lock();
+	if( (status != HAL_OK) || !all_blank() )
+		return -1;
+	all_s = mock_flash_stats.erase_us * 1e-6;
+
+	printf("   %7u %8s %#10x %7u/%u %9.2f %9.2f %9.2f %10.2f\n", used / 1024, pCase->settings ? "yes" : "no", map,
+			erased, NB_SECTORS, all_s, skip_s + check_ms * 1e-3, all_s - skip_s - check_ms * 1e-3, check_ms);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *pPath = (argc > 1) ? argv[1] : BENCH_REPO_DIR "/002USER_Application/Debug/002USER_Application.bin";
+	FILE *pFile = fopen(pPath, "rb");
+	int failures = 0;
+
+	if(pFile == NULL)
+	{
+		fprintf(stderr, "%s: can't open\n", pPath);
+		return 1;
+	}
+	image_len = (uint32_t)fread(image, 1, sizeof(image), pFile);
+	fclose(pFile);
+	if(image_len == 0)
+		return 1;
+
+	mock_init();
+
+	printf("\n   %s, %u bytes, sectors %d to %d\n\n", pPath, image_len, FIRST_SECTOR, FIRST_SECTOR + NB_SECTORS - 1);
+	printf("   %7s %8s %10s %9s %9s %9s %9s %10s\n", "used KB", "settings", "blank map", "erased", "all s",
+			"skip s", "saved s", "check ms");
+	for(uint32_t n = 0; n < (sizeof(cases) / sizeof(cases[0])); n++)
+		failures += (bench_case(&cases[n]) != 0);
+
+	return (failures == 0) ? 0 : 1;
+}
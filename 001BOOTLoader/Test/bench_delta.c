@@ -0,0 +1,390 @@
+/*
+ * bench_delta.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "mock_hal.h"
+
+/* BL_MEM_WRITE_DELTA against a full BL_MEM_WRITE over real build outputs
+ *
+ * usage : bench_delta [image.bin ...]    (the .bin of 001BOOTLoader and 002USER_Application by default)
+ *
+ * Each image is the old one in slot A, the new ones are :
+ * - const   : 4 bytes changed in the middle (a version number)
+ * - insert  : 64 bytes inserted at a third, what follows moves
+ * - rebuild : the next image of the list, a different build which shares the HAL code
+ * The patch is made the way the tool does it (delta_make_patch() of STM32_Programmer_V1.py, the same
+ * greedy generator), both writes go through the command handlers to the virtual flash and are read
+ * back. The transfer time counts the link time of the packets and the simulated flash time of each
+ * packet overlapped (pipelined host loop) : the full write erases first (BL_FLASH_ERASE_RANGE), the
+ * patch erases the scratch area on the way and copies the new image over the old one at the end.
+ * A write which doesn't give the new image fails the run, CTest runs it on the default images.
+ */
+
+#define BENCH_MAX_LEN			(256 * 1024)
+#define BENCH_DEST				BL_SLOT_A_BASE
+#define INSERT_LEN				64
+
+// delta_make_patch() of the tool
+#define DELTA_KEY_LEN			8
+#define DELTA_MIN_COPY			12
+#define DELTA_MIN_FILL			16
+
+#define LINK_BITS_PER_BYTE		10
+
+static const uint32_t baud_rates[] = { 115200, 460800, 921600, 2000000 };
+
+static const char *default_images[] =
+{
+	BENCH_REPO_DIR "/001BOOTLoader/Debug/001BOOTLoader.bin",
+	BENCH_REPO_DIR "/002USER_Application/Debug/002USER_Application.bin",
+};
+
+typedef struct
+{
+	uint64_t erase_us;								// erased before the first packet
+	uint32_t packets;
+	uint32_t packet_len[BENCH_MAX_LEN / 1024];		// payload of each packet
+	uint64_t flash_us[BENCH_MAX_LEN / 1024];		// simulated flash time of each packet
+} bench_run_t;
+
+static uint8_t images[8][BENCH_MAX_LEN];
+static uint32_t image_len[8];
+static uint8_t new_image[BENCH_MAX_LEN + INSERT_LEN];
+static uint8_t patch[2 * BENCH_MAX_LEN];
+static uint32_t pkt[BL_RX_LEN / 4];
+static bench_run_t full_run;
+static bench_run_t delta_run;
+
+/* First position of each 8 byte key of the old image, the dict of the tool */
+static uint64_t *key_table;
+static int32_t *pos_table;
+static uint32_t table_mask;
+
+static uint32_t host_crc_word(const uint8_t *pData, uint32_t len)
+{
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint32_t word;
+	uint32_t i = 0;
+
+	for( ; (i + 4) <= len; i += 4)
+	{
+		memcpy(&word, &pData[i], 4);
+		crc = mock_crc_word(crc, word);
+	}
+	for( ; i < len; i++)
+		crc = mock_crc_word(crc, pData[i]);
+
+	return crc;
+}
+
+static int32_t *table_slot(const uint8_t *pKey)
+{
+	uint64_t key;
+	uint32_t n;
+
+	memcpy(&key, pKey, DELTA_KEY_LEN);
+	n = (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & table_mask;
+	while( (pos_table[n] >= 0) && (key_table[n] != key) )
+		n = (n + 1) & table_mask;
+
+	key_table[n] = key;
+	return &pos_table[n];
+}
+
+static void put_varint(uint8_t **ppOut, uint32_t value)
+{
+	while(value >= 0x80)
+	{
+		*(*ppOut)++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*(*ppOut)++ = (uint8_t)value;
+}
+
+static uint32_t match_len(const uint8_t *pOld, uint32_t old_len, uint32_t src, const uint8_t *pNew, uint32_t new_len, uint32_t pos)
+{
+	uint32_t n = ((old_len - src) < (new_len - pos)) ? (old_len - src) : (new_len - pos);
+	uint32_t len = 0;
+
+	while( (len < n) && (pOld[src + len] == pNew[pos + len]) )
+		len++;
+
+	return len;
+}
+
+static void flush_literals(uint8_t **ppOut, const uint8_t *pLit, uint32_t len)
+{
+	if(len == 0)
+		return;
+
+	*(*ppOut)++ = BL_DELTA_OP_DATA;
+	put_varint(ppOut, len);
+	memcpy(*ppOut, pLit, len);
+	*ppOut += len;
+}
+
+static uint32_t make_patch(const uint8_t *pOld, uint32_t old_len, const uint8_t *pNew, uint32_t new_len)
+{
+	uint32_t header[BL_DELTA_HDR_LEN / 4] =
+	{
+		BL_DELTA_MAGIC, old_len, host_crc_word(pOld, old_len), new_len, host_crc_word(pNew, new_len)
+	};
+	uint8_t *pOut = patch + BL_DELTA_HDR_LEN;
+	uint32_t lit_start = 0;
+	int32_t displacement = 0;
+	uint32_t pos = 0;
+
+	memcpy(patch, header, BL_DELTA_HDR_LEN);
+
+	for(table_mask = 1; table_mask < (2 * old_len); table_mask <<= 1)
+		;
+	key_table = malloc(table_mask * sizeof(uint64_t));
+	pos_table = malloc(table_mask * sizeof(int32_t));
+	memset(pos_table, 0xFF, table_mask * sizeof(int32_t));
+	table_mask--;
+	for(uint32_t i = 0; (i + DELTA_KEY_LEN) <= old_len; i++)
+	{
+		int32_t *pPos = table_slot(&pOld[i]);
+
+		if(*pPos < 0)
+			*pPos = (int32_t)i;
+	}
+
+	while(pos < new_len)
+	{
+		uint32_t run = 1;
+		uint32_t best_len = 0;
+		uint32_t best_src = 0;
+		int64_t srcs[2];
+
+		while( ((pos + run) < new_len) && (pNew[pos + run] == pNew[pos]) && (run < DELTA_MIN_FILL) )
+			run++;
+		if(run >= DELTA_MIN_FILL)
+		{
+			while( ((pos + run) < new_len) && (pNew[pos + run] == pNew[pos]) )
+				run++;
+			flush_literals(&pOut, &pNew[lit_start], pos - lit_start);
+			*pOut++ = BL_DELTA_OP_FILL;
+			put_varint(&pOut, run);
+			*pOut++ = pNew[pos];
+			pos += run;
+			lit_start = pos;
+			continue;
+		}
+
+		// Same displacement as the last copy first, then the index
+		srcs[0] = (int64_t)pos + displacement;
+		srcs[1] = -1;
+		if((pos + DELTA_KEY_LEN) <= new_len)
+		{
+			int32_t *pPos = table_slot(&pNew[pos]);
+
+			srcs[1] = *pPos;
+		}
+		for(uint32_t n = 0; n < 2; n++)
+		{
+			uint32_t len;
+
+			if( (srcs[n] < 0) || (srcs[n] >= old_len) )
+				continue;
+			len = match_len(pOld, old_len, (uint32_t)srcs[n], pNew, new_len, pos);
+			if(len > best_len)
+			{
+				best_len = len;
+				best_src = (uint32_t)srcs[n];
+			}
+		}
+
+		if(best_len >= DELTA_MIN_COPY)
+		{
+			flush_literals(&pOut, &pNew[lit_start], pos - lit_start);
+			*pOut++ = BL_DELTA_OP_COPY;
+			put_varint(&pOut, best_src);
+			put_varint(&pOut, best_len);
+			displacement = (int32_t)best_src - (int32_t)pos;
+			pos += best_len;
+			lit_start = pos;
+		}else
+		{
+			pos++;
+		}
+	}
+	flush_literals(&pOut, &pNew[lit_start], pos - lit_start);
+
+	free(key_table);
+	free(pos_table);
+	return (uint32_t)(pOut - patch);
+}
+
+/* Sends data in v2 packets to a handler, the flash time of each packet goes in pRun */
+static int send_packets(void (*handler)(uint8_t *), uint8_t command, uint8_t stream, const uint8_t *pData, uint32_t len, bench_run_t *pRun)
+{
+	uint32_t chunk;
+	uint8_t flags;
+
+	pRun->packets = 0;
+	for(uint32_t pos = 0; pos < len; pos += chunk)
+	{
+		uint64_t before = mock_flash_stats.erase_us + mock_flash_stats.program_us;
+
+		chunk = ((len - pos) < BL_V2_MAX_PAYLOAD) ? (len - pos) : BL_V2_MAX_PAYLOAD;
+		flags = 0;
+		if(stream && (pos == 0))
+			flags |= BL_V2_FLAG_FIRST;
+		if(stream && ((pos + chunk) == len))
+			flags |= BL_V2_FLAG_LAST;
+
+		mock_tx_clear();
+		mock_v2_packet((uint8_t *)pkt, command, flags, BENCH_DEST + (stream ? 0 : pos), &pData[pos], chunk);
+		handler((uint8_t *)pkt);
+		if( (mock_tx_len != 3) || (mock_tx[0] != BL_ACK) || (mock_tx[2] != 0) )
+			return -1;
+
+		pRun->packet_len[pRun->packets] = chunk;
+		pRun->flash_us[pRun->packets++] = mock_flash_stats.erase_us + mock_flash_stats.program_us - before;
+	}
+
+	return 0;
+}
+
+static double wire_time(uint32_t nbytes, uint32_t baud)
+{
+	return (double)nbytes * LINK_BITS_PER_BYTE / baud;
+}
+
+/* Packet N is written while packet N + 1 is on the wire */
+static double transfer_time(const bench_run_t *pRun, uint32_t baud)
+{
+	double t = pRun->erase_us * 1e-6 + wire_time(BL_V2_PACKET_LEN(pRun->packet_len[0]), baud);
+
+	for(uint32_t n = 0; n < pRun->packets; n++)
+	{
+		double next = 0.0;
+		double flash = pRun->flash_us[n] * 1e-6;
+
+		if((n + 1) < pRun->packets)
+			next = wire_time(BL_V2_PACKET_LEN(pRun->packet_len[n + 1]), baud);
+		// ACK and write status
+		t += ((next > flash) ? next : flash) + wire_time(3, baud);
+	}
+
+	return t;
+}
+
+static double flash_time(const bench_run_t *pRun)
+{
+	uint64_t us = pRun->erase_us;
+
+	for(uint32_t n = 0; n < pRun->packets; n++)
+		us += pRun->flash_us[n];
+
+	return us * 1e-6;
+}
+
+static int bench_pair(const char *pName, const uint8_t *pOld, uint32_t old_len, const uint8_t *pNew, uint32_t new_len)
+{
+	uint32_t patch_len = make_patch(pOld, old_len, pNew, new_len);
+
+	// Full write : erase, then the image
+	mock_reset();
+	mock_flash_load(BENCH_DEST, pOld, old_len);
+	if(execute_flash_erase_range(BENCH_DEST, new_len) != HAL_OK)
+		return -1;
+	full_run.erase_us = mock_flash_stats.erase_us;
+	if( (send_packets(bootloader_handle_mem_write_v2_cmd, BL_MEM_WRITE, 0, pNew, new_len, &full_run) != 0) ||
+			(memcmp((void *)BENCH_DEST, pNew, new_len) != 0) )
+	{
+		fprintf(stderr, "%s: full write failed\n", pName);
+		return -1;
+	}
+
+	// Patch against the old image
+	mock_reset();
+	mock_flash_load(BENCH_DEST, pOld, old_len);
+	delta_run.erase_us = 0;
+	if( (send_packets(bootloader_handle_mem_write_delta_cmd, BL_MEM_WRITE_DELTA, 1, patch, patch_len, &delta_run) != 0) ||
+			(memcmp((void *)BENCH_DEST, pNew, new_len) != 0) )
+	{
+		fprintf(stderr, "%s: delta write failed\n", pName);
+		return -1;
+	}
+
+	printf("\n   %-8s %6u -> %6u bytes, patch %6u bytes (%4.1f%%), flash time %.2f s, full write %.2f s\n", pName,
+			old_len, new_len, patch_len, 100.0 * patch_len / new_len, flash_time(&delta_run), flash_time(&full_run));
+	printf("   %8s %10s %10s %8s\n", "baud", "full s", "delta s", "gain");
+	for(uint32_t n = 0; n < (sizeof(baud_rates) / sizeof(baud_rates[0])); n++)
+	{
+		double full_s = transfer_time(&full_run, baud_rates[n]);
+		double delta_s = transfer_time(&delta_run, baud_rates[n]);
+
+		printf("   %8u %10.3f %10.3f %7.0f%%\n", baud_rates[n], full_s, delta_s, (full_s / delta_s - 1) * 100);
+	}
+
+	return 0;
+}
+
+static int load_image(const char *pPath, uint32_t n)
+{
+	FILE *pFile = fopen(pPath, "rb");
+
+	if(pFile == NULL)
+	{
+		fprintf(stderr, "%s: can't open\n", pPath);
+		return -1;
+	}
+	image_len[n] = (uint32_t)fread(images[n], 1, BENCH_MAX_LEN, pFile);
+	fclose(pFile);
+
+	return (image_len[n] != 0) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	const char **ppPaths = (argc > 1) ? (const char **)&argv[1] : default_images;
+	uint32_t count = (argc > 1) ? (uint32_t)(argc - 1) : (sizeof(default_images) / sizeof(default_images[0]));
+	int failures = 0;
+
+	if(count > (sizeof(images) / sizeof(images[0])))
+		count = sizeof(images) / sizeof(images[0]);
+
+	mock_init();
+
+	for(uint32_t n = 0; n < count; n++)
+	{
+		if(load_image(ppPaths[n], n) != 0)
+			return 1;
+	}
+
+	for(uint32_t n = 0; n < count; n++)
+	{
+		uint32_t len = image_len[n];
+		uint32_t at = (len / 3) & ~3UL;
+
+		printf("\n   %s\n", ppPaths[n]);
+
+		memcpy(new_image, images[n], len);
+		for(uint32_t i = 0; i < 4; i++)
+			new_image[(len / 2) + i] ^= 0x5A;
+		failures += (bench_pair("const", images[n], len, new_image, len) != 0);
+
+		memcpy(new_image, images[n], at);
+		for(uint32_t i = 0; i < INSERT_LEN; i++)
+			new_image[at + i] = (uint8_t)(i * 29 + 3);
+		memcpy(&new_image[at + INSERT_LEN], &images[n][at], len - at);
+		failures += (bench_pair("insert", images[n], len, new_image, len + INSERT_LEN) != 0);
+
+		if(count > 1)
+		{
+			uint32_t next = (n + 1) % count;
+
+			failures += (bench_pair("rebuild", images[n], len, images[next], image_len[next]) != 0);
+		}
+	}
+
+	return (failures == 0) ? 0 : 1;
+}
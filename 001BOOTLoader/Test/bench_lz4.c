@@ -0,0 +1,319 @@
+/*
+ * bench_lz4.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "mock_hal.h"
+
+/* BL_MEM_WRITE_LZ4 against BL_MEM_WRITE over real build outputs
+ *
+ * usage : bench_lz4 [image.bin ...]      (the .bin of 001BOOTLoader and 002USER_Application by default)
+ *
+ * Each image is compressed the way the tool does it (lz4_compress() of STM32_Programmer_V1.py, the same
+ * greedy parser), sent in v2 packets of BL_V2_MAX_PAYLOAD bytes to the virtual flash, once raw through
+ * execute_mem_write() and once through lz4_stream_feed(), and read back. It prints :
+ * - the compression ratio
+ * - the decode speed : host time of the LZ4 write minus the one of a raw write in pieces of
+ *   BL_LZ4_STAGE_LEN bytes (the same programming through the flash model, the same number of
+ *   execute_mem_write() calls), so the cost of the decoder alone
+ * - the transfer time at each baud rate : the link time of the packets and the simulated programming time
+ *   of each packet overlap (the pipelined host loop), the device CPU time is left out, the programming
+ *   dominates it. The sectors are blank (the erase time is the same for both).
+ * A round trip which doesn't give the image back fails the run, CTest runs it on the default images.
+ */
+
+#define BENCH_BASE				0x08020000UL		// sector 5 and up, room for 1 MB
+#define BENCH_MAX_LEN			(1024 * 1024)
+#define BENCH_RUNS				5
+
+// lz4_compress() of the tool
+#define LZ4_MIN_MATCH			4
+#define LZ4_MAX_OFFSET			65535
+#define LZ4_LAST_LITERALS		5
+#define LZ4_MF_LIMIT			12
+
+#define LINK_BITS_PER_BYTE		10
+
+static const uint32_t baud_rates[] = { 115200, 460800, 921600, 2000000 };
+
+static const char *default_images[] =
+{
+	BENCH_REPO_DIR "/001BOOTLoader/Debug/001BOOTLoader.bin",
+	BENCH_REPO_DIR "/002USER_Application/Debug/002USER_Application.bin",
+};
+
+typedef struct
+{
+	uint32_t packets;
+	uint32_t packet_len[BENCH_MAX_LEN / 256];		// payload of each packet
+	uint64_t program_us[BENCH_MAX_LEN / 256];		// simulated flash time of each packet
+	double host_s;
+} bench_run_t;
+
+static uint8_t image[BENCH_MAX_LEN];
+static uint8_t packed[BENCH_MAX_LEN + (BENCH_MAX_LEN / 255) + 16];
+static bench_run_t raw_run;
+static bench_run_t stage_run;
+static bench_run_t lz4_run;
+
+/* Exact map of the 4 byte keys to their last position, the dict of the tool */
+static uint32_t *key_table;
+static int32_t *pos_table;
+static uint32_t table_mask;
+
+static uint32_t key_at(const uint8_t *pData)
+{
+	uint32_t key;
+
+	memcpy(&key, pData, 4);
+	return key;
+}
+
+static int32_t *table_slot(uint32_t key)
+{
+	uint32_t n = (key * 2654435761UL) & table_mask;
+
+	while( (pos_table[n] >= 0) && (key_table[n] != key) )
+		n = (n + 1) & table_mask;
+
+	key_table[n] = key;
+	return &pos_table[n];
+}
+
+static void put_len(uint8_t **ppOut, uint32_t len)
+{
+	while(len >= 255)
+	{
+		*(*ppOut)++ = 255;
+		len -= 255;
+	}
+	*(*ppOut)++ = (uint8_t)len;
+}
+
+static void put_sequence(uint8_t **ppOut, const uint8_t *pLit, uint32_t lit_len, uint32_t offset, uint32_t match_len)
+{
+	uint8_t token = (uint8_t)((lit_len < 15 ? lit_len : 15) << 4);
+
+	if(match_len)
+		token |= (match_len - LZ4_MIN_MATCH) < 15 ? (match_len - LZ4_MIN_MATCH) : 15;
+	*(*ppOut)++ = token;
+	if(lit_len >= 15)
+		put_len(ppOut, lit_len - 15);
+	memcpy(*ppOut, pLit, lit_len);
+	*ppOut += lit_len;
+	if(match_len)
+	{
+		*(*ppOut)++ = offset & 0xFF;
+		*(*ppOut)++ = offset >> 8;
+		if((match_len - LZ4_MIN_MATCH) >= 15)
+			put_len(ppOut, match_len - LZ4_MIN_MATCH - 15);
+	}
+}
+
+static uint32_t lz4_compress(const uint8_t *pData, uint32_t len, uint8_t *pOut)
+{
+	uint8_t *pStart = pOut;
+	uint32_t match_limit = len - LZ4_LAST_LITERALS;
+	uint32_t anchor = 0;
+	uint32_t pos = 0;
+
+	for(table_mask = 1; table_mask < (2 * len); table_mask <<= 1)
+		;
+	key_table = malloc(table_mask * sizeof(uint32_t));
+	pos_table = malloc(table_mask * sizeof(int32_t));
+	memset(pos_table, 0xFF, table_mask * sizeof(int32_t));
+	table_mask--;
+
+	while( (len >= LZ4_MF_LIMIT) && ((pos + LZ4_MF_LIMIT) <= len) )
+	{
+		int32_t *pRef = table_slot(key_at(&pData[pos]));
+		int32_t ref = *pRef;
+		uint32_t match_len = LZ4_MIN_MATCH;
+
+		*pRef = (int32_t)pos;
+		if( (ref < 0) || ((pos - ref) > LZ4_MAX_OFFSET) )
+		{
+			pos++;
+			continue;
+		}
+		while( ((pos + match_len) < match_limit) && (pData[ref + match_len] == pData[pos + match_len]) )
+			match_len++;
+		put_sequence(&pOut, &pData[anchor], pos - anchor, pos - ref, match_len);
+		pos += match_len;
+		anchor = pos;
+	}
+	put_sequence(&pOut, &pData[anchor], len - anchor, 0, 0);
+
+	free(key_table);
+	free(pos_table);
+	return (uint32_t)(pOut - pStart);
+}
+
+static double host_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* One BL_MEM_WRITE per packet of piece_len bytes */
+static int write_raw(uint32_t len, uint32_t piece_len, bench_run_t *pRun)
+{
+	uint32_t fail_offset;
+	double start = host_now();
+
+	pRun->packets = 0;
+	for(uint32_t pos = 0; pos < len; pos += piece_len)
+	{
+		uint32_t chunk = ((len - pos) < piece_len) ? (len - pos) : piece_len;
+		uint64_t before = mock_flash_stats.program_us;
+
+		if(execute_mem_write(&image[pos], BENCH_BASE + pos, chunk, &fail_offset) != HAL_OK)
+			return -1;
+		pRun->packet_len[pRun->packets] = chunk;
+		pRun->program_us[pRun->packets++] = mock_flash_stats.program_us - before;
+	}
+	pRun->host_s = host_now() - start;
+
+	return 0;
+}
+
+/* One BL_MEM_WRITE_LZ4 stream, the last packet flushes the staging buffer */
+static int write_lz4(uint32_t packed_len, bench_run_t *pRun)
+{
+	lz4_stream_t stream;
+	double start = host_now();
+
+	lz4_stream_init(&stream, BENCH_BASE);
+	pRun->packets = 0;
+	for(uint32_t pos = 0; pos < packed_len; pos += BL_V2_MAX_PAYLOAD)
+	{
+		uint32_t chunk = ((packed_len - pos) < BL_V2_MAX_PAYLOAD) ? (packed_len - pos) : BL_V2_MAX_PAYLOAD;
+		uint64_t before = mock_flash_stats.program_us;
+
+		if(lz4_stream_feed(&stream, &packed[pos], chunk) != BL_LZ4_OK)
+			return -1;
+		if( ((pos + chunk) == packed_len) && (lz4_stream_finish(&stream) != BL_LZ4_OK) )
+			return -1;
+		pRun->packet_len[pRun->packets] = chunk;
+		pRun->program_us[pRun->packets++] = mock_flash_stats.program_us - before;
+	}
+	pRun->host_s = host_now() - start;
+
+	return 0;
+}
+
+static double wire_time(uint32_t nbytes, uint32_t baud)
+{
+	return (double)nbytes * LINK_BITS_PER_BYTE / baud;
+}
+
+/* Packet N is programmed while packet N + 1 is on the wire */
+static double transfer_time(const bench_run_t *pRun, uint32_t baud)
+{
+	double t = wire_time(BL_V2_PACKET_LEN(pRun->packet_len[0]), baud);
+
+	for(uint32_t n = 0; n < pRun->packets; n++)
+	{
+		double next = 0.0;
+		double flash = pRun->program_us[n] * 1e-6;
+
+		if((n + 1) < pRun->packets)
+			next = wire_time(BL_V2_PACKET_LEN(pRun->packet_len[n + 1]), baud);
+		// ACK and write status
+		t += ((next > flash) ? next : flash) + wire_time(3, baud);
+	}
+
+	return t;
+}
+
+static int bench_image(const char *pPath)
+{
+	FILE *pFile = fopen(pPath, "rb");
+	uint32_t len;
+	uint32_t packed_len;
+	double stage_best = 1e9;
+	double lz4_best = 1e9;
+
+	if(pFile == NULL)
+	{
+		fprintf(stderr, "%s: can't open\n", pPath);
+		return -1;
+	}
+	len = (uint32_t)fread(image, 1, sizeof(image), pFile);
+	fclose(pFile);
+	if(len == 0)
+	{
+		fprintf(stderr, "%s: empty\n", pPath);
+		return -1;
+	}
+
+	packed_len = lz4_compress(image, len, packed);
+
+	for(uint32_t run = 0; run < BENCH_RUNS; run++)
+	{
+		mock_reset();
+		if( (write_raw(len, BL_V2_MAX_PAYLOAD, &raw_run) != 0) || (memcmp((void *)BENCH_BASE, image, len) != 0) )
+		{
+			fprintf(stderr, "%s: raw write failed\n", pPath);
+			return -1;
+		}
+		mock_reset();
+		if(write_raw(len, BL_LZ4_STAGE_LEN, &stage_run) != 0)
+		{
+			fprintf(stderr, "%s: raw write failed\n", pPath);
+			return -1;
+		}
+		mock_reset();
+		if( (write_lz4(packed_len, &lz4_run) != 0) || (memcmp((void *)BENCH_BASE, image, len) != 0) )
+		{
+			fprintf(stderr, "%s: LZ4 round trip failed\n", pPath);
+			return -1;
+		}
+		if(stage_run.host_s < stage_best)
+			stage_best = stage_run.host_s;
+		if(lz4_run.host_s < lz4_best)
+			lz4_best = lz4_run.host_s;
+	}
+
+	printf("\n   %s\n", pPath);
+	printf("   %u bytes, LZ4 %u bytes, ratio %.2f, %u packets against %u\n", len, packed_len,
+			(double)len / packed_len, lz4_run.packets, raw_run.packets);
+	printf("   host write : raw %.2f ms, LZ4 %.2f ms, decoder %.1f MB/s\n", stage_best * 1e3, lz4_best * 1e3,
+			(lz4_best > stage_best) ? (len / (lz4_best - stage_best) / 1e6) : 0.0);
+	printf("   %8s %10s %10s %8s\n", "baud", "raw s", "LZ4 s", "gain");
+	for(uint32_t n = 0; n < (sizeof(baud_rates) / sizeof(baud_rates[0])); n++)
+	{
+		double raw_s = transfer_time(&raw_run, baud_rates[n]);
+		double lz4_s = transfer_time(&lz4_run, baud_rates[n]);
+
+		printf("   %8u %10.3f %10.3f %7.0f%%\n", baud_rates[n], raw_s, lz4_s, (raw_s / lz4_s - 1) * 100);
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int failures = 0;
+
+	mock_init();
+
+	if(argc > 1)
+	{
+		for(int n = 1; n < argc; n++)
+			failures += (bench_image(argv[n]) != 0);
+	}else
+	{
+		for(uint32_t n = 0; n < (sizeof(default_images) / sizeof(default_images[0])); n++)
+			failures += (bench_image(default_images[n]) != 0);
+	}
+
+	return (failures == 0) ? 0 : 1;
+}
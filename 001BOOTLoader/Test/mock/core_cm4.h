@@ -0,0 +1,56 @@
+/*
+ * core_cm4.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+/* Host build of the bootloader : found before Drivers/CMSIS/Include/core_cm4.h
+ * The Cortex-M intrinsics of cmsis_gcc.h are ARM assembly, they are replaced here by the ones of the
+ * mock (mock_hal.c) before the real core_cm4.h is pulled in for the register definitions.
+ */
+
+#ifndef MOCK_CORE_CM4_H_
+#define MOCK_CORE_CM4_H_
+
+#include <stdint.h>
+
+// cmsis_gcc.h is left out, core_cm4.h gets what it needs from here
+#define __CMSIS_GCC_H
+
+#define __ASM					__asm
+#define __INLINE				inline
+#define __STATIC_INLINE			static inline
+#define __STATIC_FORCEINLINE	__attribute__((always_inline)) static inline
+#define __NO_RETURN				__attribute__((__noreturn__))
+#define __USED					__attribute__((used))
+#define __WEAK					__attribute__((weak))
+#define __PACKED				__attribute__((packed, aligned(1)))
+#define __PACKED_STRUCT			struct __attribute__((packed, aligned(1)))
+#define __PACKED_UNION			union __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)			__attribute__((aligned(x)))
+#define __RESTRICT				__restrict
+#define __COMPILER_BARRIER()	__asm volatile("" ::: "memory")
+
+#define __NOP()					__COMPILER_BARRIER()
+#define __DSB()					__COMPILER_BARRIER()
+#define __ISB()					__COMPILER_BARRIER()
+#define __DMB()					__COMPILER_BARRIER()
+#define __SEV()					__COMPILER_BARRIER()
+#define __WFE()					mock_wfi()
+#define __WFI()					mock_wfi()
+#define __CLZ(x)				(uint8_t)((x) ? __builtin_clz(x) : 32)
+#define __REV(x)				__builtin_bswap32(x)
+
+// PRIMASK and the pending interrupts of the mock, see mock_hal.c
+void mock_wfi(void);
+void __enable_irq(void);
+void __disable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t priMask);
+void __set_MSP(uint32_t topOfMainStack);
+uint32_t __get_MSP(void);
+
+#include_next "core_cm4.h"
+
+#endif /* MOCK_CORE_CM4_H_ */
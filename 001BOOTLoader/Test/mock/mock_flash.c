@@ -0,0 +1,517 @@
+/*
+ * mock_flash.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "mock_flash.h"
+
+/* Memory of the chip at its own addresses
+ *
+ * The flash and the register page 0x40023000 (CRC, RCC, FLASH) are shared memory mapped twice : read only
+ * at the real address for the firmware, writable anywhere for the model. A store of the firmware faults,
+ * the page is opened for that one instruction (trap flag of x86), then the store is replayed the way the
+ * chip would take it and the page is closed again.
+ */
+
+#define PAGE_LEN				0x1000UL
+#define REG_PAGE				0x40023000UL
+
+#define FLASH_LEN				(2 * BL_FLASH_BANK_SIZE)
+#define SYSMEM_BASE				0x1FFF0000UL
+#define SYSMEM_LEN				0x10000UL
+#define SRAM_LEN				0x30000UL
+#define CCM_LEN					0x10000UL
+#define PERIPH_LEN				0x80000UL
+#define CORE_BASE				0xE0000000UL
+#define CORE_LEN				0x100000UL
+
+#define EFLAGS_TF				0x100
+
+#define FLASH_SR_ERRORS			(FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | \
+								FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR)
+#define MOCK_FAIL_MAX			8
+
+FLASH_TypeDef *mock_flash_regs;
+CRC_TypeDef *mock_crc_regs;
+mock_flash_stats_t mock_flash_stats;
+
+static uint8_t *flash_alias;
+static uint8_t *reg_alias;
+
+// Store being replayed : 0 none, 1 flash, 2 register
+static uint8_t trap_kind;
+static uint32_t trap_addr;
+static uint8_t trap_old[16];
+static uint32_t trap_old_word;
+static uint8_t key_step;
+static uint8_t opt_key_step;
+
+// Erase started with STRT, done at op_end_us
+static uint8_t op_pending;
+static uint32_t op_sectors;
+static uint64_t op_end_us;
+
+static uint32_t fail_addr[MOCK_FAIL_MAX];
+static uint32_t fail_count;
+
+// Power cut : cut_left more programs go through, then the flash takes nothing until mock_flash_power_on()
+static uint8_t cut_armed;
+static uint8_t power_off;
+static uint32_t cut_left;
+
+static const uint32_t bank_sector_len[BL_FLASH_BANK_SECTORS] =
+{
+	0x4000, 0x4000, 0x4000, 0x4000, 0x10000,
+	0x20000, 0x20000, 0x20000, 0x20000, 0x20000, 0x20000, 0x20000
+};
+
+
+static void fatal(const char *pMsg)
+{
+	fprintf(stderr, "mock: %s\n", pMsg);
+	exit(2);
+}
+
+static uint32_t sector_offset(uint8_t sector)
+{
+	uint32_t offset = (sector < BL_FLASH_BANK_SECTORS) ? 0 : BL_FLASH_BANK_SIZE;
+
+	for(uint8_t i = 0; i < (sector % BL_FLASH_BANK_SECTORS); i++)
+		offset += bank_sector_len[i];
+
+	return offset;
+}
+
+static uint64_t sector_erase_us(uint8_t sector)
+{
+	switch(bank_sector_len[sector % BL_FLASH_BANK_SECTORS])
+	{
+	case 0x4000:
+		return MOCK_ERASE_16K_US;
+	case 0x10000:
+		return MOCK_ERASE_64K_US;
+	default:
+		return MOCK_ERASE_128K_US;
+	}
+}
+
+static void erase_now(uint8_t sector)
+{
+	if(power_off)
+		return;
+	memset(flash_alias + sector_offset(sector), 0xFF, bank_sector_len[sector % BL_FLASH_BANK_SECTORS]);
+	mock_flash_stats.erases[sector]++;
+}
+
+/* CRC unit of the F4 : polynomial 0x04C11DB7, 32-bit words MSB first, no reflection */
+uint32_t mock_crc_word(uint32_t crc, uint32_t word)
+{
+	crc ^= word;
+	for(int i = 0; i < 32; i++)
+		crc = (crc & 0x80000000UL) ? ((crc << 1) ^ 0x04C11DB7UL) : (crc << 1);
+
+	return crc;
+}
+
+/* A flash operation started by STRT is over once the clock reaches op_end_us */
+void flash_model_update(void)
+{
+	if(!op_pending || (mock_now_us() < op_end_us))
+		return;
+
+	op_pending = 0;
+	for(uint8_t sector = 0; sector < BL_FLASH_SECTOR_COUNT; sector++)
+	{
+		if(op_sectors & (1UL << sector))
+			erase_now(sector);
+	}
+
+	mock_flash_regs->SR &= ~FLASH_SR_BSY;
+	mock_flash_regs->CR &= ~FLASH_CR_STRT;
+	if(mock_flash_regs->CR & FLASH_CR_EOPIE)
+		mock_flash_regs->SR |= FLASH_SR_EOP;
+}
+
+/* End of the operation started by STRT, UINT64_MAX if there is none */
+uint64_t flash_model_op_end(void)
+{
+	return op_pending ? op_end_us : UINT64_MAX;
+}
+
+/* Completes the operation in progress, the core stalls on a flash access until then */
+void mock_flash_settle(void)
+{
+	if(op_pending)
+		mock_advance_us(op_end_us - mock_now_us());
+}
+
+/* Level of the FLASH interrupt line */
+uint8_t flash_model_irq(void)
+{
+	uint32_t sr = mock_flash_regs->SR;
+	uint32_t cr = mock_flash_regs->CR;
+
+	return ((sr & FLASH_SR_EOP) && (cr & FLASH_CR_EOPIE)) || ((sr & FLASH_SR_ERRORS) && (cr & FLASH_CR_ERRIE));
+}
+
+void flash_model_erase_sector(uint8_t sector)
+{
+	mock_flash_settle();
+	erase_now(sector);
+	mock_flash_stats.erase_us += sector_erase_us(sector);
+	mock_advance_us(sector_erase_us(sector));
+}
+
+void flash_model_mass_erase(uint32_t banks)
+{
+	mock_flash_settle();
+	for(uint8_t sector = 0; sector < BL_FLASH_SECTOR_COUNT; sector++)
+	{
+		if(banks & ((sector < BL_FLASH_BANK_SECTORS) ? FLASH_BANK_1 : FLASH_BANK_2))
+			erase_now(sector);
+	}
+	mock_flash_stats.erase_us += MOCK_MASS_ERASE_US;
+	mock_advance_us(MOCK_MASS_ERASE_US);
+}
+
+/* Counts a program operation, 0 once the power is gone */
+static uint8_t flash_powered(void)
+{
+	if(cut_armed && (cut_left-- == 0))
+	{
+		cut_armed = 0;
+		power_off = 1;
+	}
+
+	return !power_off;
+}
+
+static uint8_t byte_fails(uint32_t address)
+{
+	for(uint32_t i = 0; i < fail_count; i++)
+	{
+		if(fail_addr[i] == address)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Programming can only clear bits, a failing byte keeps its old value */
+void flash_model_program(uint32_t address, const uint8_t *pData, uint32_t len)
+{
+	uint8_t powered;
+
+	mock_flash_settle();
+	powered = flash_powered();
+	for(uint32_t i = 0; (i < len) && powered; i++)
+	{
+		if(!byte_fails(address + i))
+			flash_alias[address + i - FLASH_BASE] &= pData[i];
+	}
+
+	mock_flash_stats.programs++;
+	mock_flash_stats.program_us += MOCK_PROGRAM_US;
+	mock_advance_us(MOCK_PROGRAM_US);
+}
+
+/* The firmware wrote the flash (trap_old holds the 16 bytes before the store) */
+static void replay_flash_store(void)
+{
+	uint8_t *pMem = flash_alias + (trap_addr - FLASH_BASE);
+	uint8_t written[16];
+	uint32_t cr = mock_flash_regs->CR;
+	uint8_t powered;
+
+	memcpy(written, pMem, sizeof(written));
+	memcpy(pMem, trap_old, sizeof(written));
+
+	if((cr & FLASH_CR_LOCK) || !(cr & FLASH_CR_PG))
+	{
+		mock_flash_regs->SR |= FLASH_SR_PGSERR;
+		return;
+	}
+
+	powered = flash_powered();
+	for(uint32_t i = 0; (i < sizeof(written)) && powered; i++)
+	{
+		if((written[i] != trap_old[i]) && !byte_fails(trap_addr + i))
+			pMem[i] &= written[i];
+	}
+
+	mock_flash_stats.programs++;
+	mock_flash_stats.program_us += MOCK_PROGRAM_US;
+	mock_advance_us(MOCK_PROGRAM_US);
+
+	if(cr & FLASH_CR_EOPIE)
+		mock_flash_regs->SR |= FLASH_SR_EOP;
+}
+
+/* STRT : sector erase (SER, SNB) or bank erase (MER, MER1) in the background, BSY until it is done */
+static void start_flash_op(uint32_t cr)
+{
+	uint32_t snb = (cr & FLASH_CR_SNB) >> FLASH_CR_SNB_Pos;
+	uint64_t us = 0;
+
+	op_sectors = 0;
+	if(cr & FLASH_CR_SER)
+	{
+		if((snb % 16) >= BL_FLASH_BANK_SECTORS)
+		{
+			mock_flash_regs->SR |= FLASH_SR_PGSERR;
+			mock_flash_regs->CR &= ~FLASH_CR_STRT;
+			return;
+		}
+		snb = (snb < 16) ? snb : (snb - 4);
+		op_sectors = 1UL << snb;
+		us = sector_erase_us((uint8_t)snb);
+	}
+	if(cr & FLASH_CR_MER)
+		op_sectors |= (1UL << BL_FLASH_BANK_SECTORS) - 1;
+	if(cr & FLASH_CR_MER1)
+		op_sectors |= ((1UL << BL_FLASH_BANK_SECTORS) - 1) << BL_FLASH_BANK_SECTORS;
+	if(cr & (FLASH_CR_MER | FLASH_CR_MER1))
+		us = MOCK_MASS_ERASE_US;
+
+	mock_flash_stats.erase_us += us;
+	op_pending = 1;
+	op_end_us = mock_now_us() + us;
+	mock_flash_regs->SR |= FLASH_SR_BSY;
+}
+
+/* The firmware wrote a register of the page 0x40023000 (trap_old_word is its value before) */
+static void replay_reg_store(void)
+{
+	uint32_t offset = trap_addr - REG_PAGE;
+	uint32_t *pReg = (uint32_t *)(reg_alias + offset);
+	uint32_t written = *pReg;
+
+	switch(offset)
+	{
+	case offsetof(CRC_TypeDef, DR):
+		*pReg = mock_crc_word(trap_old_word, written);
+		break;
+
+	case offsetof(CRC_TypeDef, CR):
+		if(written & CRC_CR_RESET)
+			mock_crc_regs->DR = 0xFFFFFFFFUL;
+		*pReg = 0;
+		break;
+
+	case 0xC00 + offsetof(FLASH_TypeDef, KEYR):
+		if(written == FLASH_KEY1)
+			key_step = 1;
+		else if((key_step == 1) && (written == FLASH_KEY2))
+			mock_flash_regs->CR &= ~FLASH_CR_LOCK;
+		if(written != FLASH_KEY1)
+			key_step = 0;
+		*pReg = 0;
+		break;
+
+	case 0xC00 + offsetof(FLASH_TypeDef, OPTKEYR):
+		if(written == FLASH_OPT_KEY1)
+			opt_key_step = 1;
+		else if((opt_key_step == 1) && (written == FLASH_OPT_KEY2))
+			mock_flash_regs->OPTCR &= ~FLASH_OPTCR_OPTLOCK;
+		if(written != FLASH_OPT_KEY1)
+			opt_key_step = 0;
+		*pReg = 0;
+		break;
+
+	case 0xC00 + offsetof(FLASH_TypeDef, SR):
+		// rc_w1, BSY is read only
+		*pReg = trap_old_word & ~(written & (FLASH_SR_ERRORS | FLASH_SR_EOP));
+		break;
+
+	case 0xC00 + offsetof(FLASH_TypeDef, CR):
+		if(trap_old_word & FLASH_CR_LOCK)
+		{
+			*pReg = trap_old_word;
+			break;
+		}
+		if((written & FLASH_CR_STRT) && !(trap_old_word & FLASH_CR_STRT))
+			start_flash_op(written);
+		break;
+
+	case 0xC00 + offsetof(FLASH_TypeDef, OPTCR):
+		if(trap_old_word & FLASH_OPTCR_OPTLOCK)
+			*pReg = trap_old_word | (written & FLASH_OPTCR_OPTLOCK);
+		else
+			*pReg = written & ~FLASH_OPTCR_OPTSTRT;
+		break;
+
+	default:
+		// RCC and the rest of the page : plain registers
+		break;
+	}
+}
+
+static void trap_segv(int sig, siginfo_t *pInfo, void *pContext)
+{
+	ucontext_t *pUc = pContext;
+	uintptr_t address = (uintptr_t)pInfo->si_addr;
+	uintptr_t page = address & ~(PAGE_LEN - 1);
+
+	(void)sig;
+	if((address >= FLASH_BASE) && (address < (FLASH_BASE + FLASH_LEN)))
+	{
+		// The core stalls on a flash store until the erase in progress is over
+		mock_flash_settle();
+		trap_kind = 1;
+		trap_addr = (uint32_t)(address & ~7UL);
+		if(trap_addr > (FLASH_BASE + FLASH_LEN - sizeof(trap_old)))
+			trap_addr = FLASH_BASE + FLASH_LEN - sizeof(trap_old);
+		memcpy(trap_old, flash_alias + (trap_addr - FLASH_BASE), sizeof(trap_old));
+	}else if(page == REG_PAGE)
+	{
+		trap_kind = 2;
+		trap_addr = (uint32_t)(address & ~3UL);
+		trap_old_word = *(uint32_t *)(reg_alias + (trap_addr - REG_PAGE));
+	}else
+	{
+		static const char msg[] = "mock: access outside of the memory map\n";
+		(void)!write(2, msg, sizeof(msg) - 1);
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+
+	mprotect((void *)page, PAGE_LEN, PROT_READ | PROT_WRITE);
+	pUc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+}
+
+static void trap_step(int sig, siginfo_t *pInfo, void *pContext)
+{
+	ucontext_t *pUc = pContext;
+
+	(void)sig;
+	(void)pInfo;
+	pUc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+	if(trap_kind == 0)
+		return;
+
+	mprotect((void *)(uintptr_t)(trap_addr & ~(PAGE_LEN - 1)), PAGE_LEN, PROT_READ);
+	if(trap_kind == 1)
+		replay_flash_store();
+	else
+		replay_reg_store();
+	trap_kind = 0;
+}
+
+static void map_fixed(uintptr_t base, size_t len, int prot, int fd)
+{
+	int flags = MAP_SHARED | MAP_FIXED_NOREPLACE;
+	void *p;
+
+	if(fd < 0)
+		flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE;
+	p = mmap((void *)base, len, prot, flags, fd, 0);
+	if(p != (void *)base)
+		fatal("can't map the memory of the chip at its address (built without -no-pie ?)");
+}
+
+static uint8_t *map_shared(uintptr_t base, size_t len, const char *pName)
+{
+	int fd = memfd_create(pName, 0);
+	void *p;
+
+	if((fd < 0) || (ftruncate(fd, (off_t)len) != 0))
+		fatal("memfd_create failed");
+
+	map_fixed(base, len, PROT_READ, fd);
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED)
+		fatal("can't map the writable view");
+	close(fd);
+
+	return p;
+}
+
+/* This function maps the memory of the chip and installs the trap handlers, once per process */
+void mock_mem_map(void)
+{
+	struct sigaction sa;
+
+	flash_alias = map_shared(FLASH_BASE, FLASH_LEN, "flash");
+	map_fixed(CCMDATARAM_BASE, CCM_LEN, PROT_READ | PROT_WRITE, -1);
+	map_fixed(SYSMEM_BASE, SYSMEM_LEN, PROT_READ | PROT_WRITE, -1);
+	map_fixed(SRAM1_BASE, SRAM_LEN, PROT_READ | PROT_WRITE, -1);
+	map_fixed(PERIPH_BASE, REG_PAGE - PERIPH_BASE, PROT_READ | PROT_WRITE, -1);
+	reg_alias = map_shared(REG_PAGE, PAGE_LEN, "regs");
+	map_fixed(REG_PAGE + PAGE_LEN, PERIPH_BASE + PERIPH_LEN - REG_PAGE - PAGE_LEN, PROT_READ | PROT_WRITE, -1);
+	map_fixed(CORE_BASE, CORE_LEN, PROT_READ | PROT_WRITE, -1);
+
+	mock_flash_regs = (FLASH_TypeDef *)(reg_alias + (FLASH_R_BASE - REG_PAGE));
+	mock_crc_regs = (CRC_TypeDef *)(reg_alias + (CRC_BASE - REG_PAGE));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_flags = SA_SIGINFO;
+	sa.sa_sigaction = trap_segv;
+	sigaction(SIGSEGV, &sa, NULL);
+	sa.sa_sigaction = trap_step;
+	sigaction(SIGTRAP, &sa, NULL);
+}
+
+/* Power on state : erased flash, blank OTP, registers at their reset values */
+void mock_mem_reset(void)
+{
+	memset(flash_alias, 0xFF, FLASH_LEN);
+	memset(reg_alias, 0, PAGE_LEN);
+	memset((void *)SYSMEM_BASE, 0xFF, SYSMEM_LEN);
+	memset((void *)SRAM1_BASE, 0, SRAM_LEN);
+	memset((void *)CCMDATARAM_BASE, 0, CCM_LEN);
+
+	*(volatile uint16_t *)FLASHSIZE_BASE = 2048;
+	mock_crc_regs->DR = 0xFFFFFFFFUL;
+	mock_flash_regs->CR = FLASH_CR_LOCK;
+	mock_flash_regs->OPTCR = 0x0FFFAAEDUL;
+	mock_flash_regs->OPTCR1 = 0x0FFF0000UL;
+	DBGMCU->IDCODE = 0x20036419UL;
+
+	op_pending = 0;
+	key_step = 0;
+	opt_key_step = 0;
+	fail_count = 0;
+	cut_armed = 0;
+	power_off = 0;
+	memset(&mock_flash_stats, 0, sizeof(mock_flash_stats));
+}
+
+void mock_flash_fill(uint32_t address, uint8_t value, uint32_t len)
+{
+	memset(flash_alias + (address - FLASH_BASE), value, len);
+}
+
+void mock_flash_load(uint32_t address, const uint8_t *pData, uint32_t len)
+{
+	memcpy(flash_alias + (address - FLASH_BASE), pData, len);
+}
+
+/* The byte at address won't take a program anymore (worn out cell), its read back fails */
+void mock_flash_fail_at(uint32_t address)
+{
+	if(fail_count < MOCK_FAIL_MAX)
+		fail_addr[fail_count++] = address;
+}
+
+/* The supply drops after programs more program operations : what follows doesn't reach the flash */
+void mock_flash_cut_after(uint32_t programs)
+{
+	cut_armed = 1;
+	cut_left = programs;
+}
+
+/* Next start, the flash keeps what it had */
+void mock_flash_power_on(void)
+{
+	cut_armed = 0;
+	power_off = 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * mock_flash.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef MOCK_FLASH_H_
+#define MOCK_FLASH_H_
+
+#include "mock_hal.h"
+
+/* Between mock_flash.c (memory map, flash and CRC model) and mock_hal.c (HAL functions, clock, interrupts)
+ * mock_flash_regs / mock_crc_regs are writable views of the registers the firmware sees read only.
+ */
+
+extern FLASH_TypeDef *mock_flash_regs;
+extern CRC_TypeDef *mock_crc_regs;
+
+void mock_mem_map(void);
+void mock_mem_reset(void);
+
+void flash_model_erase_sector(uint8_t sector);
+void flash_model_mass_erase(uint32_t banks);
+void flash_model_program(uint32_t address, const uint8_t *pData, uint32_t len);
+void flash_model_update(void);
+uint64_t flash_model_op_end(void);
+uint8_t flash_model_irq(void);
+
+#endif /* MOCK_FLASH_H_ */
@@ -0,0 +1,503 @@
+/*
+ * mock_hal.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mock_flash.h"
+
+/* HAL functions the bootloader calls, the handles of main.c, the clock and the interrupts of the mock
+ * The interrupts are taken when the firmware sleeps (__WFI) or unmasks them, never in the middle of
+ * its code : the FLASH line is a level (EOP / errors and their enables), the end of a DMA transmission
+ * is pending from HAL_UART_Transmit_DMA() on.
+ */
+
+// Sleeps without any progress : the firmware waits for something the test never sends
+#define MOCK_WFI_MAX			1000000
+
+CRC_HandleTypeDef hcrc;
+UART_HandleTypeDef huart1;
+UART_HandleTypeDef huart3;
+DMA_HandleTypeDef hdma_usart1_rx;
+DMA_HandleTypeDef hdma_usart1_tx;
+DMA_HandleTypeDef hdma_crc;
+DMA_HandleTypeDef hdma_usart3_tx;
+uint32_t SystemCoreClock = 180000000UL;
+
+uint8_t mock_tx[MOCK_TX_LEN];
+uint32_t mock_tx_len;
+void (*mock_idle_hook)(void);
+
+static uint64_t now_us;
+static uint32_t primask;
+static uint8_t in_irq;
+static uint8_t flash_irq_enabled;
+static uint8_t tx_done_pending;
+static uint32_t wfi_count;
+
+// Receive ring of the last HAL_UARTEx_ReceiveToIdle_DMA()
+static uint8_t *rx_ring;
+static uint32_t rx_ring_len;
+
+static DMA_Stream_TypeDef rx_stream;
+static DMA_Stream_TypeDef tx_stream;
+
+
+uint64_t mock_now_us(void)
+{
+	return now_us;
+}
+
+void mock_advance_us(uint64_t us)
+{
+	now_us += us;
+	flash_model_update();
+}
+
+/* Takes the pending interrupts, unless they are masked or one is already running */
+static void irq_dispatch(void)
+{
+	if(primask || in_irq)
+		return;
+
+	in_irq = 1;
+	while(1)
+	{
+		if(flash_irq_enabled && flash_model_irq())
+		{
+			flash_bg_irq_handler();
+			continue;
+		}
+		if(tx_done_pending & 1)
+		{
+			tx_done_pending &= ~1;
+			huart1.gState = HAL_UART_STATE_READY;
+			HAL_UART_TxCpltCallback(&huart1);
+			continue;
+		}
+		if(tx_done_pending & 2)
+		{
+			tx_done_pending &= ~2;
+			huart3.gState = HAL_UART_STATE_READY;
+			HAL_UART_TxCpltCallback(&huart3);
+			continue;
+		}
+		break;
+	}
+	in_irq = 0;
+}
+
+/* Sleep : up to the next SysTick, or the end of the flash operation if it comes first */
+void mock_wfi(void)
+{
+	uint64_t next = (now_us / 1000 + 1) * 1000;
+
+	if(++wfi_count > MOCK_WFI_MAX)
+	{
+		fprintf(stderr, "mock: the firmware sleeps forever (%llu us)\n", (unsigned long long)now_us);
+		exit(2);
+	}
+
+	if(flash_model_op_end() < next)
+		next = flash_model_op_end();
+	mock_advance_us(next - now_us);
+
+	if(mock_idle_hook)
+		mock_idle_hook();
+
+	irq_dispatch();
+}
+
+void __enable_irq(void)
+{
+	primask = 0;
+	irq_dispatch();
+}
+
+void __disable_irq(void)
+{
+	primask = 1;
+}
+
+uint32_t __get_PRIMASK(void)
+{
+	return primask;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+	primask = priMask & 1;
+	irq_dispatch();
+}
+
+void __set_MSP(uint32_t topOfMainStack)
+{
+	(void)topOfMainStack;
+}
+
+uint32_t __get_MSP(void)
+{
+	return 0;
+}
+
+/* This function maps the memory the first time and puts everything back to its power on state */
+void mock_reset(void)
+{
+	static uint8_t mapped;
+
+	if(!mapped)
+	{
+		mock_mem_map();
+		mapped = 1;
+	}
+	mock_mem_reset();
+
+	now_us = 0;
+	primask = 0;
+	in_irq = 0;
+	flash_irq_enabled = 0;
+	tx_done_pending = 0;
+	wfi_count = 0;
+	mock_idle_hook = NULL;
+	mock_tx_len = 0;
+	rx_ring = NULL;
+
+	memset(&rx_stream, 0, sizeof(rx_stream));
+	memset(&huart1, 0, sizeof(huart1));
+	memset(&huart3, 0, sizeof(huart3));
+	hcrc.Instance = CRC;
+	hdma_usart1_rx.Instance = &rx_stream;
+	hdma_usart1_tx.Instance = &tx_stream;
+	huart1.Instance = USART1;
+	huart1.Init.BaudRate = 115200;
+	huart1.Init.OverSampling = UART_OVERSAMPLING_16;
+	huart1.hdmarx = &hdma_usart1_rx;
+	huart1.hdmatx = &hdma_usart1_tx;
+	huart1.gState = HAL_UART_STATE_READY;
+	huart1.RxState = HAL_UART_STATE_READY;
+	huart3.Instance = USART3;
+	huart3.hdmatx = &hdma_usart3_tx;
+	huart3.gState = HAL_UART_STATE_READY;
+	huart3.RxState = HAL_UART_STATE_READY;
+}
+
+void mock_init(void)
+{
+	setvbuf(stdout, NULL, _IONBF, 0);
+	mock_reset();
+}
+
+/* The host sends len bytes : the DMA puts them in the ring and its counter goes down */
+void mock_uart_rx(const uint8_t *pData, uint32_t len)
+{
+	uint32_t pos;
+
+	if(rx_ring == NULL)
+		return;
+
+	pos = (rx_ring_len - rx_stream.NDTR) % rx_ring_len;
+	for(uint32_t i = 0; i < len; i++)
+	{
+		rx_ring[pos] = pData[i];
+		pos = (pos + 1) % rx_ring_len;
+	}
+	rx_stream.NDTR = rx_ring_len - pos;
+}
+
+void mock_tx_clear(void)
+{
+	mock_tx_len = 0;
+}
+
+/* Builds a v2 packet like the host does, word mode CRC (BL_V2_FLAG_CRC_WORD), returns its length */
+uint32_t mock_v2_packet(uint8_t *pPkt, uint8_t command, uint8_t flags, uint32_t arg, const uint8_t *pPayload, uint32_t len)
+{
+	return mock_v2_packet_seq(pPkt, command, flags, 0, arg, pPayload, len);
+}
+
+/* The same with a sequence number (windowed BL_MEM_WRITE) */
+uint32_t mock_v2_packet_seq(uint8_t *pPkt, uint8_t command, uint8_t flags, uint8_t seq, uint32_t arg,
+		const uint8_t *pPayload, uint32_t len)
+{
+	uint32_t crc_len = BL_V2_HDR_LEN + len;
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint32_t word;
+	uint32_t i = 0;
+
+	memset(pPkt, 0, BL_V2_PACKET_LEN(len));
+	pPkt[0] = BL_V2_SOF;
+	pPkt[1] = command;
+	pPkt[2] = flags | BL_V2_FLAG_CRC_WORD;
+	pPkt[3] = seq;
+	pPkt[4] = len & 0xFF;
+	pPkt[5] = len >> 8;
+	memcpy(&pPkt[8], &arg, 4);
+	memcpy(&pPkt[BL_V2_HDR_LEN], pPayload, len);
+
+	for( ; (i + 4) <= crc_len; i += 4)
+	{
+		memcpy(&word, &pPkt[i], 4);
+		crc = mock_crc_word(crc, word);
+	}
+	for( ; i < crc_len; i++)
+		crc = mock_crc_word(crc, pPkt[i]);
+	memcpy(&pPkt[crc_len], &crc, 4);
+
+	return BL_V2_PACKET_LEN(len);
+}
+
+static void tx_capture(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size)
+{
+	// Only C_UART is kept, the log is binary and goes nowhere
+	if((huart != &huart1) || ((mock_tx_len + Size) > MOCK_TX_LEN))
+		return;
+
+	memcpy(&mock_tx[mock_tx_len], pData, Size);
+	mock_tx_len += Size;
+}
+
+/* ------------------------------- HAL ------------------------------- */
+
+void Error_Handler(void)
+{
+	fprintf(stderr, "mock: Error_Handler()\n");
+	exit(2);
+}
+
+HAL_StatusTypeDef HAL_Init(void)
+{
+	return HAL_OK;
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)(now_us / 1000);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+	mock_advance_us((uint64_t)Delay * 1000);
+}
+
+HAL_StatusTypeDef HAL_RCC_DeInit(void)
+{
+	return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+	return 90000000UL;
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority)
+{
+	(void)IRQn;
+	(void)PreemptPriority;
+	(void)SubPriority;
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+	if(IRQn == FLASH_IRQn)
+		flash_irq_enabled = 1;
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+	if(IRQn == FLASH_IRQn)
+		flash_irq_enabled = 0;
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+	(void)GPIOx;
+	(void)GPIO_Pin;
+	return GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	(void)GPIOx;
+	(void)GPIO_Pin;
+	(void)PinState;
+}
+
+HAL_StatusTypeDef HAL_CRC_DeInit(CRC_HandleTypeDef *hcrc)
+{
+	(void)hcrc;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_Start(DMA_HandleTypeDef *hdma, uint32_t SrcAddress, uint32_t DstAddress, uint32_t DataLength)
+{
+	(void)hdma;
+	for(uint32_t i = 0; i < DataLength; i++)
+		*(volatile uint32_t *)(uintptr_t)DstAddress = ((uint32_t *)(uintptr_t)SrcAddress)[i];
+
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_DMA_PollForTransfer(DMA_HandleTypeDef *hdma, HAL_DMA_LevelCompleteTypeDef CompleteLevel, uint32_t Timeout)
+{
+	(void)hdma;
+	(void)CompleteLevel;
+	(void)Timeout;
+	return HAL_OK;
+}
+
+/* ------------------------------- UART ------------------------------- */
+
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart)
+{
+	huart->gState = HAL_UART_STATE_READY;
+	huart->RxState = HAL_UART_STATE_READY;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_DeInit(UART_HandleTypeDef *huart)
+{
+	huart->gState = HAL_UART_STATE_RESET;
+	huart->RxState = HAL_UART_STATE_RESET;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	(void)Timeout;
+	tx_capture(huart, pData, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if(huart->gState != HAL_UART_STATE_READY)
+		return HAL_BUSY;
+
+	tx_capture(huart, pData, Size);
+	huart->gState = HAL_UART_STATE_BUSY_TX;
+	tx_done_pending |= (huart == &huart1) ? 1 : 2;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UARTEx_ReceiveToIdle_DMA(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size)
+{
+	if(huart != &huart1)
+		return HAL_ERROR;
+
+	rx_ring = pData;
+	rx_ring_len = Size;
+	rx_stream.NDTR = Size;
+	huart->RxState = HAL_UART_STATE_BUSY_RX;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_AbortReceive(UART_HandleTypeDef *huart)
+{
+	huart->RxState = HAL_UART_STATE_READY;
+	if(huart == &huart1)
+		rx_ring = NULL;
+	return HAL_OK;
+}
+
+/* ------------------------------- FLASH ------------------------------- */
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	mock_flash_regs->CR &= ~FLASH_CR_LOCK;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	mock_flash_regs->CR |= FLASH_CR_LOCK;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_OB_Unlock(void)
+{
+	mock_flash_regs->OPTCR &= ~FLASH_OPTCR_OPTLOCK;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_OB_Lock(void)
+{
+	mock_flash_regs->OPTCR |= FLASH_OPTCR_OPTLOCK;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef FLASH_WaitForLastOperation(uint32_t Timeout)
+{
+	const uint32_t errors = FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR | FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR |
+			FLASH_FLAG_PGSERR | FLASH_FLAG_RDERR;
+
+	(void)Timeout;
+	mock_flash_settle();
+
+	// Like the HAL, the error flags are cleared once reported
+	if(mock_flash_regs->SR & errors)
+	{
+		mock_flash_regs->SR &= ~errors;
+		return HAL_ERROR;
+	}
+
+	mock_flash_regs->SR &= ~FLASH_SR_EOP;
+	return HAL_OK;
+}
+
+void FLASH_FlushCaches(void)
+{
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data)
+{
+	static const uint8_t unit_len[] = { 1, 2, 4, 8 };
+
+	if(mock_flash_regs->CR & FLASH_CR_LOCK)
+		return HAL_ERROR;
+	if(FLASH_WaitForLastOperation(0) != HAL_OK)
+		return HAL_ERROR;
+
+	flash_model_program(Address, (const uint8_t *)&Data, unit_len[TypeProgram & 3]);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *pEraseInit, uint32_t *SectorError)
+{
+	if(mock_flash_regs->CR & FLASH_CR_LOCK)
+		return HAL_ERROR;
+	if(FLASH_WaitForLastOperation(0) != HAL_OK)
+		return HAL_ERROR;
+
+	*SectorError = 0xFFFFFFFFUL;
+	if(pEraseInit->TypeErase == FLASH_TYPEERASE_MASSERASE)
+	{
+		flash_model_mass_erase(pEraseInit->Banks);
+		return HAL_OK;
+	}
+
+	for(uint32_t sector = pEraseInit->Sector; sector < (pEraseInit->Sector + pEraseInit->NbSectors); sector++)
+	{
+		if(sector >= BL_FLASH_SECTOR_COUNT)
+		{
+			*SectorError = sector;
+			return HAL_ERROR;
+		}
+		flash_model_erase_sector((uint8_t)sector);
+	}
+
+	return HAL_OK;
+}
+
+void HAL_FLASHEx_OBGetConfig(FLASH_OBProgramInitTypeDef *pOBInit)
+{
+	uint32_t optcr = mock_flash_regs->OPTCR;
+
+	pOBInit->OptionType = OPTIONBYTE_WRP | OPTIONBYTE_RDP | OPTIONBYTE_USER | OPTIONBYTE_BOR;
+	pOBInit->WRPSector = (optcr >> 16) & 0xFFF;
+	pOBInit->RDPLevel = (optcr >> 8) & 0xFF;
+	pOBInit->BORLevel = optcr & FLASH_OPTCR_BOR_LEV;
+	pOBInit->USERConfig = optcr & 0xE0;
+}
@@ -0,0 +1,70 @@
+/*
+ * mock_hal.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef MOCK_HAL_H_
+#define MOCK_HAL_H_
+
+#include "main.h"
+
+/* Host model of the parts of the STM32F429 the bootloader uses
+ *
+ * The memory of the chip is mapped at its own addresses (the tests are linked with -no-pie so the
+ * pointers fit in 32 bits), the firmware runs unmodified against it :
+ * - flash (2 MB), system memory (OTP, flash size, option bytes), SRAM, CCM, peripherals, core
+ * - the flash and the page of the CRC / RCC / FLASH registers are read only, a store of the firmware
+ *   traps and is replayed by mock_flash.c : programming only clears bits and needs PG, the flash
+ *   registers start erases, the CRC data register runs the CRC
+ * - the UART DMA ring is filled by mock_uart_rx(), what the bootloader sends lands in mock_tx
+ * - time only moves when the firmware sleeps (__WFI) or the flash works, HAL_GetTick() follows it
+ */
+
+#define MOCK_TX_LEN				(64 * 1024)
+
+// Typical times of the datasheet at x32 parallelism
+#define MOCK_PROGRAM_US			16
+#define MOCK_ERASE_16K_US		250000
+#define MOCK_ERASE_64K_US		550000
+#define MOCK_ERASE_128K_US		1000000
+#define MOCK_MASS_ERASE_US		8000000
+
+typedef struct
+{
+	uint32_t erases[BL_FLASH_SECTOR_COUNT];		// sector erases, mass erases count in every sector
+	uint32_t programs;							// program operations (byte, halfword or word)
+	uint64_t erase_us;							// flash busy time
+	uint64_t program_us;
+} mock_flash_stats_t;
+
+extern uint8_t mock_tx[MOCK_TX_LEN];
+extern uint32_t mock_tx_len;
+extern mock_flash_stats_t mock_flash_stats;
+
+// Called at each __WFI(), to feed the receive ring while the bootloader waits
+extern void (*mock_idle_hook)(void);
+
+void mock_init(void);
+void mock_reset(void);
+
+uint64_t mock_now_us(void);
+void mock_advance_us(uint64_t us);
+
+void mock_uart_rx(const uint8_t *pData, uint32_t len);
+uint32_t mock_v2_packet(uint8_t *pPkt, uint8_t command, uint8_t flags, uint32_t arg, const uint8_t *pPayload, uint32_t len);
+uint32_t mock_v2_packet_seq(uint8_t *pPkt, uint8_t command, uint8_t flags, uint8_t seq, uint32_t arg,
+		const uint8_t *pPayload, uint32_t len);
+void mock_tx_clear(void);
+
+void mock_flash_fill(uint32_t address, uint8_t value, uint32_t len);
+void mock_flash_load(uint32_t address, const uint8_t *pData, uint32_t len);
+void mock_flash_fail_at(uint32_t address);
+void mock_flash_settle(void);
+void mock_flash_cut_after(uint32_t programs);
+void mock_flash_power_on(void);
+
+uint32_t mock_crc_word(uint32_t crc, uint32_t word);
+
+#endif /* MOCK_HAL_H_ */
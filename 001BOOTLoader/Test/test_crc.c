@@ -0,0 +1,142 @@
+/*
+ * test_crc.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* Golden vectors of bootloader_calc_crc(), the same as HOST/python/test_crc.py
+ * BYTE mode is the per-byte CRC the bootloader always had (every byte widened to a word), WORD mode
+ * feeds little endian words and the trailing bytes one by one. Built twice : CPU writes of the data
+ * register (test_crc) and the DMA path of BL_CRC_USE_DMA (test_crc_dma).
+ */
+
+typedef struct
+{
+	const char *pName;
+	uint32_t len;
+	uint32_t crc_byte;
+	uint32_t crc_word;
+} crc_vector_t;
+
+static const crc_vector_t vectors[] =
+{
+	{ "digits",		0,		0xFFFFFFFFUL, 0xFFFFFFFFUL },
+	{ "digits",		1,		0x17F7AD5CUL, 0x17F7AD5CUL },
+	{ "digits",		3,		0x188F59D0UL, 0x188F59D0UL },
+	{ "digits",		4,		0x368DF0F0UL, 0xC2091428UL },
+	{ "digits",		5,		0x804CD4BEUL, 0xEC5BAA37UL },
+	{ "digits",		8,		0x6C660178UL, 0xFEFC54F9UL },
+	{ "digits",		9,		0x1556F485UL, 0xAFF19057UL },
+	{ "ramp",		253,	0x775D3749UL, 0x6035C9B3UL },
+	{ "ramp",		254,	0x1AB5BE92UL, 0x884C7688UL },
+	{ "ramp",		255,	0x3ADE4C51UL, 0x4ED07C79UL },
+	{ "ramp",		256,	0x96670628UL, 0xB7EC66F4UL },
+	{ "pattern",	1021,	0xE2950ED3UL, 0x1637BA97UL },
+};
+
+// Word aligned, plus room to move the data off the alignment
+static uint32_t src_words[(1024 + 8) / 4];
+
+static const uint8_t *vector_data(const char *pName)
+{
+	static uint8_t data[1024];
+
+	if(strcmp(pName, "digits") == 0)
+	{
+		memcpy(data, "123456789", 9);
+	}else
+	{
+		for(uint32_t i = 0; i < sizeof(data); i++)
+			data[i] = (strcmp(pName, "ramp") == 0) ? (uint8_t)i : (uint8_t)(i * 37 + 11);
+	}
+
+	return data;
+}
+
+/* The per-byte reference : every byte through the CRC unit model as a 32-bit word */
+static uint32_t reference_crc(const uint8_t *pData, uint32_t len)
+{
+	uint32_t crc = 0xFFFFFFFFUL;
+
+	for(uint32_t i = 0; i < len; i++)
+		crc = mock_crc_word(crc, pData[i]);
+
+	return crc;
+}
+
+static void test_golden_byte_mode(void)
+{
+	for(uint32_t n = 0; n < (sizeof(vectors) / sizeof(vectors[0])); n++)
+	{
+		uint8_t *pSrc = (uint8_t *)src_words;
+
+		memcpy(pSrc, vector_data(vectors[n].pName), vectors[n].len);
+		CHECK_EQ(reference_crc(pSrc, vectors[n].len), vectors[n].crc_byte);
+		CHECK_EQ(bootloader_calc_crc(pSrc, vectors[n].len, BL_CRC_MODE_BYTE), vectors[n].crc_byte);
+		CHECK_EQ(bootloader_verify_crc(pSrc, vectors[n].len, vectors[n].crc_byte), VERIFY_CRC_SUCCESS);
+		CHECK_EQ(bootloader_verify_crc(pSrc, vectors[n].len, vectors[n].crc_byte ^ 1), VERIFY_CRC_FAIL);
+	}
+}
+
+static void test_golden_word_mode(void)
+{
+	for(uint32_t n = 0; n < (sizeof(vectors) / sizeof(vectors[0])); n++)
+	{
+		// Aligned (DMA when long enough) and at each misalignment (CPU writes)
+		for(uint32_t shift = 0; shift < 4; shift++)
+		{
+			uint8_t *pSrc = (uint8_t *)src_words + shift;
+
+			memcpy(pSrc, vector_data(vectors[n].pName), vectors[n].len);
+			CHECK_EQ(bootloader_calc_crc(pSrc, vectors[n].len, BL_CRC_MODE_WORD), vectors[n].crc_word);
+		}
+	}
+}
+
+/* Word mode of a length under 4 is the byte mode, and the unit is left reset for the next user */
+static void test_short_and_reset(void)
+{
+	uint8_t *pSrc = (uint8_t *)src_words;
+
+	memcpy(pSrc, "123", 3);
+	CHECK_EQ(bootloader_calc_crc(pSrc, 3, BL_CRC_MODE_WORD), bootloader_calc_crc(pSrc, 3, BL_CRC_MODE_BYTE));
+	CHECK_EQ(CRC->DR, 0xFFFFFFFFUL);
+}
+
+/* v2 packet : BL_V2_FLAG_CRC_WORD selects the mode of the packet CRC */
+static void test_v2_packet_crc(void)
+{
+	uint8_t *pPkt = (uint8_t *)src_words;
+	uint32_t len = BL_V2_HDR_LEN + 13;
+	uint32_t crc;
+
+	memset(pPkt, 0, BL_V2_PACKET_LEN(13));
+	pPkt[1] = BL_MEM_WRITE;
+	pPkt[4] = 13;
+	memcpy(&pPkt[BL_V2_HDR_LEN], vector_data("pattern"), 13);
+
+	crc = reference_crc(pPkt, len);
+	memcpy(&pPkt[len], &crc, 4);
+	CHECK_EQ(bootloader_verify_v2_crc(pPkt), VERIFY_CRC_SUCCESS);
+
+	pPkt[2] = BL_V2_FLAG_CRC_WORD;
+	CHECK_EQ(bootloader_verify_v2_crc(pPkt), VERIFY_CRC_FAIL);
+	crc = bootloader_calc_crc(pPkt, len, BL_CRC_MODE_WORD);
+	memcpy(&pPkt[len], &crc, 4);
+	CHECK_EQ(bootloader_verify_v2_crc(pPkt), VERIFY_CRC_SUCCESS);
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_golden_byte_mode);
+	RUN_TEST(test_golden_word_mode);
+	RUN_TEST(test_short_and_reset);
+	RUN_TEST(test_v2_packet_crc);
+
+	return TEST_RESULT();
+}
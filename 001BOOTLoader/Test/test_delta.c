@@ -0,0 +1,448 @@
+/*
+ * test_delta.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* Delta patches : the applier of boot_delta.c on its own (output to RAM, patch fed whole or byte
+ * by byte, bad patches) and BL_MEM_WRITE_DELTA on the virtual flash, with the supply cut at each
+ * step of the commit : the old image stays until the commit record is complete, from there
+ * bootloader_delta_resume() finishes the copy at the next start.
+ */
+
+#define OLD_BASE				0x08020000UL		// sector 5
+#define OLD_LEN					0x3000
+#define PATCH_MAX				(2 * OLD_LEN)
+
+static uint8_t old_image[OLD_LEN];
+static uint8_t new_image[2 * OLD_LEN];
+static uint32_t new_len;
+static uint8_t patch[PATCH_MAX];
+static uint32_t patch_len;
+
+static uint8_t ram_out[2 * OLD_LEN];
+static uint32_t ram_next;					// the applier writes its output in order
+
+static uint32_t host_crc_word(const uint8_t *pData, uint32_t len)
+{
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint32_t word;
+	uint32_t i = 0;
+
+	for( ; (i + 4) <= len; i += 4)
+	{
+		memcpy(&word, &pData[i], 4);
+		crc = mock_crc_word(crc, word);
+	}
+	for( ; i < len; i++)
+		crc = mock_crc_word(crc, pData[i]);
+
+	return crc;
+}
+
+static void put_varint(uint32_t value)
+{
+	while(value >= 0x80)
+	{
+		patch[patch_len++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	patch[patch_len++] = (uint8_t)value;
+}
+
+/* Each operation goes in the patch and in the image it rebuilds */
+static void op_copy(uint32_t offset, uint32_t len)
+{
+	patch[patch_len++] = BL_DELTA_OP_COPY;
+	put_varint(offset);
+	put_varint(len);
+	memcpy(&new_image[new_len], &old_image[offset], len);
+	new_len += len;
+}
+
+static void op_data(uint32_t len, uint8_t seed)
+{
+	patch[patch_len++] = BL_DELTA_OP_DATA;
+	put_varint(len);
+	for(uint32_t i = 0; i < len; i++)
+	{
+		patch[patch_len++] = (uint8_t)(seed + i * 5);
+		new_image[new_len++] = (uint8_t)(seed + i * 5);
+	}
+}
+
+static void op_fill(uint32_t len, uint8_t value)
+{
+	patch[patch_len++] = BL_DELTA_OP_FILL;
+	put_varint(len);
+	patch[patch_len++] = value;
+	memset(&new_image[new_len], value, len);
+	new_len += len;
+}
+
+/* A new build : a changed constant, 40 bytes of code inserted, a run of 0xFF, the end moved */
+static void make_patch(void)
+{
+	uint32_t header[BL_DELTA_HDR_LEN / 4];
+
+	for(uint32_t i = 0; i < OLD_LEN; i++)
+		old_image[i] = (uint8_t)((i * 7) ^ (i >> 5));
+
+	new_len = 0;
+	patch_len = BL_DELTA_HDR_LEN;
+	op_copy(0, 0x800);
+	op_data(4, 0x10);
+	op_copy(0x804, 0x1000);
+	op_data(40, 0x80);
+	op_copy(0x1804, 0x1000);
+	op_fill(0x300, 0xFF);
+	op_copy(0x2804, OLD_LEN - 0x2804);
+	op_copy(0x100, 0x20);
+
+	header[0] = BL_DELTA_MAGIC;
+	header[1] = OLD_LEN;
+	header[2] = host_crc_word(old_image, OLD_LEN);
+	header[3] = new_len;
+	header[4] = host_crc_word(new_image, new_len);
+	memcpy(patch, header, BL_DELTA_HDR_LEN);
+}
+
+static uint8_t ram_write(uint32_t offset, uint8_t *pData, uint32_t len)
+{
+	if((offset != ram_next) || ((offset + len) > sizeof(ram_out)))
+		return BL_DELTA_DATA_ERROR;
+
+	memcpy(&ram_out[offset], pData, len);
+	ram_next += len;
+
+	return BL_DELTA_OK;
+}
+
+static void ram_start(delta_stream_t *pStream, uint32_t out_len)
+{
+	ram_next = 0;
+	memset(ram_out, 0, sizeof(ram_out));
+	delta_stream_init(pStream, old_image, OLD_LEN, out_len, ram_write);
+}
+
+/* Sends the patch for the old image at dest in packets of piece bytes, returns the status of the last one */
+static uint8_t send_patch(uint32_t dest, uint32_t piece)
+{
+	static uint32_t pkt[BL_RX_LEN / 4];
+	uint8_t status = 0xFF;
+	uint8_t flags;
+	uint32_t len;
+
+	for(uint32_t pos = 0; pos < patch_len; pos += len)
+	{
+		len = ((patch_len - pos) < piece) ? (patch_len - pos) : piece;
+		flags = (pos == 0) ? BL_V2_FLAG_FIRST : 0;
+		if((pos + len) == patch_len)
+			flags |= BL_V2_FLAG_LAST;
+
+		mock_tx_clear();
+		mock_v2_packet((uint8_t *)pkt, BL_MEM_WRITE_DELTA, flags, dest, &patch[pos], len);
+		bootloader_handle_mem_write_delta_cmd((uint8_t *)pkt);
+
+		CHECK_EQ(mock_tx_len, 3);
+		CHECK_EQ(mock_tx[0], BL_ACK);
+		status = mock_tx[2];
+		if(status != BL_DELTA_OK)
+			break;
+	}
+
+	return status;
+}
+
+static const bl_delta_commit_t *record(void)
+{
+	return (const bl_delta_commit_t *)BL_DELTA_COMMIT_BASE;
+}
+
+static void test_stream_ops(void)
+{
+	delta_stream_t stream;
+
+	make_patch();
+
+	// Whole patch at once
+	ram_start(&stream, new_len);
+	CHECK_EQ(delta_stream_feed(&stream, &patch[BL_DELTA_HDR_LEN], patch_len - BL_DELTA_HDR_LEN), BL_DELTA_OK);
+	CHECK_EQ(delta_stream_finish(&stream), BL_DELTA_OK);
+	CHECK_EQ(ram_next, new_len);
+	CHECK(memcmp(ram_out, new_image, new_len) == 0);
+
+	// Byte by byte : varints, data and fill split anywhere
+	ram_start(&stream, new_len);
+	for(uint32_t i = BL_DELTA_HDR_LEN; i < patch_len; i++)
+		CHECK_EQ(delta_stream_feed(&stream, &patch[i], 1), BL_DELTA_OK);
+	CHECK_EQ(delta_stream_finish(&stream), BL_DELTA_OK);
+	CHECK(memcmp(ram_out, new_image, new_len) == 0);
+}
+
+static void test_stream_errors(void)
+{
+	delta_stream_t stream;
+	uint8_t bad_copy[] = { BL_DELTA_OP_COPY, 0x80, 0x60, 0x01 };			// 0x3000, 1 byte : past the end
+	uint8_t bad_op[] = { 0x04, 0x01 };
+	uint8_t long_varint[] = { BL_DELTA_OP_FILL, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x01 };
+	uint8_t fill[] = { BL_DELTA_OP_FILL, 0x10, 0xAA };
+
+	make_patch();
+
+	ram_start(&stream, new_len);
+	CHECK_EQ(delta_stream_feed(&stream, bad_copy, sizeof(bad_copy)), BL_DELTA_DATA_ERROR);
+
+	ram_start(&stream, new_len);
+	CHECK_EQ(delta_stream_feed(&stream, bad_op, sizeof(bad_op)), BL_DELTA_DATA_ERROR);
+
+	ram_start(&stream, new_len);
+	CHECK_EQ(delta_stream_feed(&stream, long_varint, sizeof(long_varint)), BL_DELTA_DATA_ERROR);
+
+	// Longer than the new image
+	ram_start(&stream, 8);
+	CHECK_EQ(delta_stream_feed(&stream, fill, sizeof(fill)), BL_DELTA_DATA_ERROR);
+
+	// Shorter than the new image, and a patch cut in the middle of an operation
+	ram_start(&stream, 0x20);
+	CHECK_EQ(delta_stream_feed(&stream, fill, sizeof(fill)), BL_DELTA_OK);
+	CHECK_EQ(delta_stream_finish(&stream), BL_DELTA_DATA_ERROR);
+	ram_start(&stream, 0x10);
+	CHECK_EQ(delta_stream_feed(&stream, fill, 2), BL_DELTA_OK);
+	CHECK_EQ(delta_stream_finish(&stream), BL_DELTA_DATA_ERROR);
+}
+
+static void test_delta_write(void)
+{
+	make_patch();
+	mock_flash_load(OLD_BASE, old_image, OLD_LEN);
+
+	CHECK_EQ(send_patch(OLD_BASE, 1000), BL_DELTA_OK);
+	CHECK(memcmp((void *)OLD_BASE, new_image, new_len) == 0);
+	CHECK_EQ(record()->magic, BL_DELTA_COMMIT_MAGIC);
+	CHECK_EQ(record()->dest, OLD_BASE);
+	CHECK_EQ(record()->len, new_len);
+	CHECK_EQ(record()->done, 0);
+	CHECK_EQ(record()->slot, 0xFFFFFFFFUL);
+	CHECK(!bootloader_delta_pending());
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_EMPTY);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_EMPTY);
+
+	// A second patch : the record of the first one is erased before it starts
+	memcpy(old_image, new_image, OLD_LEN);
+	patch_len = BL_DELTA_HDR_LEN;
+	new_len = 0;
+	op_copy(0, OLD_LEN);
+	{
+		uint32_t header[BL_DELTA_HDR_LEN / 4] = { BL_DELTA_MAGIC, OLD_LEN, 0, OLD_LEN, 0 };
+
+		header[2] = host_crc_word((uint8_t *)OLD_BASE, OLD_LEN);
+		header[4] = header[2];
+		memcpy(patch, header, BL_DELTA_HDR_LEN);
+	}
+	CHECK_EQ(send_patch(OLD_BASE, BL_V2_MAX_PAYLOAD), BL_DELTA_OK);
+	CHECK_EQ(record()->done, 0);
+}
+
+static void test_old_mismatch(void)
+{
+	make_patch();
+	mock_flash_load(OLD_BASE, old_image, OLD_LEN);
+	mock_flash_fill(OLD_BASE + 0x10, 0x00, 1);
+
+	CHECK_EQ(send_patch(OLD_BASE, BL_V2_MAX_PAYLOAD), BL_DELTA_OLD_MISMATCH);
+	CHECK(memcmp((void *)(OLD_BASE + 0x20), &old_image[0x20], OLD_LEN - 0x20) == 0);
+	CHECK_EQ(record()->magic, 0xFFFFFFFFUL);
+}
+
+/* Programs of a whole BL_MEM_WRITE_DELTA and the first one of its commit */
+static uint32_t commit_start(uint32_t *pTotal)
+{
+	make_patch();
+	mock_reset();
+	mock_flash_load(OLD_BASE, old_image, OLD_LEN);
+	CHECK_EQ(send_patch(OLD_BASE, BL_V2_MAX_PAYLOAD), BL_DELTA_OK);
+	*pTotal = mock_flash_stats.programs;
+
+	// 4 words of record, the copy (new_len is a multiple of 4), done
+	CHECK_EQ(new_len % 4, 0);
+	return mock_flash_stats.programs - (4 + (new_len / 4) + 1);
+}
+
+/* The supply drops after programs more program operations, then the board starts again */
+static void cut_and_resume(uint32_t programs)
+{
+	make_patch();
+	mock_reset();
+	mock_flash_load(OLD_BASE, old_image, OLD_LEN);
+
+	mock_flash_cut_after(programs);
+	CHECK(send_patch(OLD_BASE, BL_V2_MAX_PAYLOAD) != BL_DELTA_OK);
+	mock_flash_power_on();
+
+	bootloader_delta_resume();
+}
+
+static void test_cut_before_record(void)
+{
+	uint32_t total;
+	uint32_t start = commit_start(&total);
+
+	// dest, len, crc but no magic : the old image is still there, nothing to resume
+	cut_and_resume(start + 3);
+	CHECK(!bootloader_delta_pending());
+	CHECK(memcmp((void *)OLD_BASE, old_image, OLD_LEN) == 0);
+	CHECK_EQ(record()->magic, 0xFFFFFFFFUL);
+
+	// The half record doesn't stop the next patch
+	CHECK_EQ(send_patch(OLD_BASE, BL_V2_MAX_PAYLOAD), BL_DELTA_OK);
+	CHECK(memcmp((void *)OLD_BASE, new_image, new_len) == 0);
+	CHECK_EQ(record()->done, 0);
+}
+
+static void test_cut_in_copy(void)
+{
+	uint32_t total;
+	uint32_t start = commit_start(&total);
+	uint32_t cuts[] =
+	{
+		start + 4,							// record complete, the old image not erased yet
+		start + 4 + (new_len / 8),			// half of the copy
+		start + 4 + (new_len / 4),			// copy done, done not programmed
+	};
+
+	for(uint32_t n = 0; n < (sizeof(cuts) / sizeof(cuts[0])); n++)
+	{
+		cut_and_resume(cuts[n]);
+		CHECK(!bootloader_delta_pending());
+		CHECK(memcmp((void *)OLD_BASE, new_image, new_len) == 0);
+		CHECK_EQ(record()->done, 0);
+	}
+}
+
+/* The scratch area was erased before the start (BL_FLASH_ERASE, mass erase) : nothing to copy from */
+static void test_scratch_lost(void)
+{
+	uint32_t total;
+	uint32_t start = commit_start(&total);
+
+	make_patch();
+	mock_reset();
+	mock_flash_load(OLD_BASE, old_image, OLD_LEN);
+	mock_flash_cut_after(start + 10);
+	send_patch(OLD_BASE, BL_V2_MAX_PAYLOAD);
+	mock_flash_power_on();
+	CHECK(bootloader_delta_pending());
+
+	mock_flash_fill(BL_DELTA_SCRATCH_BASE, 0xFF, 0x100);
+	bootloader_delta_resume();
+	CHECK(bootloader_delta_pending());
+
+	// Nor is a new patch taken over it
+	CHECK_EQ(send_patch(OLD_BASE, BL_V2_MAX_PAYLOAD), ADDR_INVALID);
+}
+
+/* The old image in slot A, activated and confirmed */
+static void slot_a_setup(void)
+{
+	uint32_t confirmed = BL_SLOT_WORD_SET;
+	uint32_t fail_offset;
+
+	make_patch();
+	mock_reset();
+	mock_flash_load(BL_SLOT_A_BASE, old_image, OLD_LEN);
+	CHECK_EQ(slot_activate(BL_SLOT_A, OLD_LEN, host_crc_word(old_image, OLD_LEN)), BL_SLOT_OK);
+	CHECK_EQ(execute_mem_write((uint8_t *)&confirmed, (uint32_t)&slot_get_trailer(BL_SLOT_A)->confirmed, 4, &fail_offset), HAL_OK);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_CONFIRMED);
+}
+
+/* Slot A holds the new image with a trailer to match, it boots on trial */
+static void check_slot_a_new(void)
+{
+	CHECK(memcmp((void *)BL_SLOT_A_BASE, new_image, new_len) == 0);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_PENDING);
+	CHECK_EQ(slot_get_trailer(BL_SLOT_A)->size, new_len);
+	CHECK_EQ(slot_get_trailer(BL_SLOT_A)->crc, host_crc_word(new_image, new_len));
+	CHECK(!bootloader_delta_pending());
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_A);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_TRIAL);
+}
+
+static void test_slot_a_activated(void)
+{
+	slot_a_setup();
+	CHECK_EQ(send_patch(BL_SLOT_A_BASE, BL_V2_MAX_PAYLOAD), BL_DELTA_OK);
+	CHECK_EQ(record()->slot, BL_SLOT_A);
+	CHECK_EQ(record()->done, 0);
+	check_slot_a_new();
+}
+
+/* Once slot A is activated the patch goes to its start, nothing reaches its trailer */
+static void test_slot_a_limits(void)
+{
+	uint32_t last = get_flash_sector_base(11);
+	uint32_t header[BL_DELTA_HDR_LEN / 4];
+
+	slot_a_setup();
+	CHECK_EQ(send_patch(OLD_BASE, BL_V2_MAX_PAYLOAD), ADDR_INVALID);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_CONFIRMED);
+
+	// New image up to the trailer : the end of sector 11 is not in the image
+	mock_reset();
+	make_patch();
+	mock_flash_load(last, old_image, OLD_LEN);
+	memcpy(header, patch, BL_DELTA_HDR_LEN);
+	header[3] = BL_SLOT_A_BASE + BL_SLOT_TRAILER_OFFSET - last + 4;
+	memcpy(patch, header, BL_DELTA_HDR_LEN);
+	CHECK_EQ(send_patch(last, BL_V2_MAX_PAYLOAD), ADDR_INVALID);
+	CHECK_EQ(record()->magic, 0xFFFFFFFFUL);
+	CHECK(memcmp((void *)last, old_image, OLD_LEN) == 0);
+}
+
+/* Cut during the copy and during the activation : the next start ends with the new image activated */
+static void test_slot_a_cut(void)
+{
+	uint32_t start;
+	uint32_t cuts[3];
+
+	// 5 words of record, the copy, 4 words of trailer, done
+	slot_a_setup();
+	CHECK_EQ(send_patch(BL_SLOT_A_BASE, BL_V2_MAX_PAYLOAD), BL_DELTA_OK);
+	start = mock_flash_stats.programs - (5 + (new_len / 4) + 4 + 1);
+	cuts[0] = start + 5;
+	cuts[1] = start + 5 + (new_len / 8);
+	cuts[2] = start + 5 + (new_len / 4) + 2;
+
+	for(uint32_t n = 0; n < (sizeof(cuts) / sizeof(cuts[0])); n++)
+	{
+		slot_a_setup();
+		mock_flash_cut_after(cuts[n] - mock_flash_stats.programs);
+		CHECK(send_patch(BL_SLOT_A_BASE, BL_V2_MAX_PAYLOAD) != BL_DELTA_OK);
+		mock_flash_power_on();
+		CHECK(bootloader_delta_pending());
+
+		bootloader_delta_resume();
+		check_slot_a_new();
+	}
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_stream_ops);
+	RUN_TEST(test_stream_errors);
+	RUN_TEST(test_delta_write);
+	RUN_TEST(test_old_mismatch);
+	RUN_TEST(test_cut_before_record);
+	RUN_TEST(test_cut_in_copy);
+	RUN_TEST(test_scratch_lost);
+	RUN_TEST(test_slot_a_activated);
+	RUN_TEST(test_slot_a_limits);
+	RUN_TEST(test_slot_a_cut);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,117 @@
+/*
+ * test_erase.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* BL_FLASH_ERASE on the virtual flash : spans over the bootloader (sectors 0 and 1) or its copy
+ * in bank 2 (sectors 12 and 13) are refused, the mass erase empties everything else. Bank 2 is
+ * erased before the reply, only BL_FLASH_ERASE_RANGE leaves it to the background erase.
+ */
+
+#define BOOT_MIRROR_SECTOR		12
+
+/* Some data at the start of every sector */
+static void fill_sectors(void)
+{
+	for(uint8_t sector = 0; sector < BL_FLASH_SECTOR_COUNT; sector++)
+		mock_flash_fill(get_flash_sector_base(sector), sector, 0x100);
+}
+
+/* BL_FLASH_ERASE as the host sends it, returns the status the bootloader sends back */
+static uint8_t erase_cmd(uint8_t sector, uint8_t count)
+{
+	uint8_t pkt[8] = { 7, BL_FLASH_ERASE, sector, count };
+	uint32_t crc = 0xFFFFFFFFUL;
+
+	for(uint32_t i = 0; i < 4; i++)
+		crc = mock_crc_word(crc, pkt[i]);
+	memcpy(&pkt[4], &crc, 4);
+
+	mock_tx_clear();
+	bootloader_handle_flash_erase_cmd(pkt);
+	CHECK_EQ(mock_tx_len, 3);
+	CHECK_EQ(mock_tx[0], BL_ACK);
+
+	return mock_tx[2];
+}
+
+static void test_bootloader_spans(void)
+{
+	static const uint8_t spans[][2] =
+	{
+		{ 0, 1 }, { 0, 12 }, { 1, 1 }, { 1, 3 },
+		{ 11, 2 }, { 10, 4 }, { 12, 1 }, { 13, 1 }, { 13, 11 },
+	};
+
+	fill_sectors();
+
+	for(uint32_t n = 0; n < (sizeof(spans) / sizeof(spans[0])); n++)
+		CHECK_EQ(execute_flash_erase(spans[n][0], spans[n][1]), INVALID_SECTOR);
+	CHECK_EQ(erase_cmd(0, 2), INVALID_SECTOR);
+	CHECK_EQ(erase_cmd(BOOT_MIRROR_SECTOR, 2), INVALID_SECTOR);
+
+	for(uint8_t sector = 0; sector < BL_FLASH_SECTOR_COUNT; sector++)
+		CHECK_EQ(mock_flash_stats.erases[sector], 0);
+
+	// Right next to them
+	CHECK_EQ(erase_cmd(2, 10), HAL_OK);
+	for(uint8_t sector = 2; sector < 12; sector++)
+		CHECK_EQ(mock_flash_stats.erases[sector], 1);
+	CHECK_EQ(*(volatile uint8_t *)get_flash_sector_base(1), 1);
+}
+
+static void test_mass_erase(void)
+{
+	fill_sectors();
+
+	CHECK_EQ(erase_cmd(BL_MASS_ERASE, 0), HAL_OK);
+
+	for(uint8_t sector = 0; sector < BL_FLASH_SECTOR_COUNT; sector++)
+	{
+		if( (sector < 2) || (sector == BOOT_MIRROR_SECTOR) || (sector == (BOOT_MIRROR_SECTOR + 1)) )
+		{
+			CHECK_EQ(mock_flash_stats.erases[sector], 0);
+			CHECK_EQ(*(volatile uint8_t *)get_flash_sector_base(sector), sector);
+		}else
+		{
+			CHECK_EQ(mock_flash_stats.erases[sector], 1);
+			CHECK(flash_sector_is_blank(sector));
+		}
+	}
+}
+
+static void test_bank2(void)
+{
+	uint32_t base = get_flash_sector_base(14);
+
+	fill_sectors();
+
+	CHECK_EQ(erase_cmd(14, 2), HAL_OK);
+	CHECK(!flash_bg_busy());
+	CHECK_EQ(mock_flash_stats.erases[14], 1);
+	CHECK_EQ(mock_flash_stats.erases[15], 1);
+	CHECK(flash_sector_is_blank(14));
+	CHECK(flash_sector_is_blank(15));
+
+	// The range erase leaves them to the background, the next flash operation waits for them
+	mock_flash_fill(base, 0x00, 0x100);
+	CHECK_EQ(execute_flash_erase_range(base, 0x100), BL_ERASE_BACKGROUND);
+	CHECK_EQ(flash_bg_wait(), HAL_OK);
+	CHECK_EQ(mock_flash_stats.erases[14], 2);
+	CHECK(flash_sector_is_blank(14));
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_bootloader_spans);
+	RUN_TEST(test_mass_erase);
+	RUN_TEST(test_bank2);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,167 @@
+/*
+ * test_flash_bg.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* Deferred BL_MEM_WRITE (BL_V2_FLAG_DEFER) on the virtual flash : the payloads are queued for the
+ * flash engine of boot_flash_bg.c, which programs them from the FLASH interrupt while the next
+ * packets come in. The virtual flash programs a word at once (the core stalls) and erases in the
+ * background, so the writes queued behind an erase wait for it, and a packet which finds
+ * BL_WRITE_BUF_COUNT buffers in use waits for the erase and the oldest write. BL_V2_FLAG_LAST waits
+ * for the queue and reports the whole run.
+ */
+
+#define PKT_LEN			BL_V2_MAX_PAYLOAD
+#define PKT_US			((PKT_LEN / 4) * MOCK_PROGRAM_US)		// programming time of one packet
+#define RUN_PACKETS		(2 * BL_WRITE_BUF_COUNT)
+
+static uint8_t image[RUN_PACKETS * PKT_LEN];
+
+static void pattern(uint8_t *pData, uint32_t len, uint8_t seed)
+{
+	for(uint32_t i = 0; i < len; i++)
+		pData[i] = (uint8_t)(seed + i * 3 + (i >> 8));
+}
+
+/* One deferred BL_MEM_WRITE v2 packet, returns the status the bootloader sends back */
+static uint8_t defer_write(uint32_t mem_address, const uint8_t *pData, uint32_t len, uint8_t flags)
+{
+	static uint32_t pkt[BL_RX_LEN / 4];
+
+	mock_tx_clear();
+	mock_v2_packet((uint8_t *)pkt, BL_MEM_WRITE, flags | BL_V2_FLAG_DEFER, mem_address, pData, len);
+	bootloader_handle_mem_write_v2_cmd((uint8_t *)pkt);
+
+	CHECK_EQ(mock_tx_len, 3);
+	CHECK_EQ(mock_tx[0], BL_ACK);
+
+	return mock_tx[2];
+}
+
+static uint8_t run_flags(uint32_t n, uint32_t count)
+{
+	return (uint8_t)(((n == 0) ? BL_V2_FLAG_FIRST : 0) | ((n == (count - 1)) ? BL_V2_FLAG_LAST : 0));
+}
+
+/* More packets than buffers : the erase of the sector goes first, the packets behind it are only
+ * queued until the buffers are all in use, the next one waits for the erase and the oldest write
+ */
+static void test_buffers_full(void)
+{
+	uint32_t base = get_flash_sector_base(6);
+	uint64_t start;
+
+	pattern(image, sizeof(image), 0x21);
+	mock_flash_fill(base + 0x10000, 0x00, 0x100);
+
+	for(uint32_t n = 0; n < RUN_PACKETS; n++)
+	{
+		start = mock_now_us();
+		CHECK_EQ(defer_write(base + n * PKT_LEN, &image[n * PKT_LEN], PKT_LEN,
+				BL_V2_FLAG_AUTO_ERASE | run_flags(n, RUN_PACKETS)), HAL_OK);
+
+		if(n < BL_WRITE_BUF_COUNT)
+		{
+			CHECK_EQ(mock_now_us(), start);
+			CHECK(flash_bg_pending() & (1UL << 6));
+			CHECK_EQ(mock_flash_stats.programs, 0);
+		}else if(n == BL_WRITE_BUF_COUNT)
+		{
+			CHECK(mock_now_us() - start >= MOCK_ERASE_128K_US);
+			CHECK_EQ(mock_flash_stats.erases[6], 1);
+			CHECK(mock_flash_stats.programs >= (PKT_LEN / 4));
+		}
+	}
+
+	// LAST waited for everything
+	CHECK(!flash_bg_busy());
+	CHECK_EQ(mock_flash_stats.erases[6], 1);
+	CHECK_EQ(mock_flash_stats.programs, sizeof(image) / 4);
+	CHECK(mock_now_us() >= MOCK_ERASE_128K_US + RUN_PACKETS * PKT_US);
+	CHECK(memcmp((void *)base, image, sizeof(image)) == 0);
+	CHECK_EQ(*(volatile uint32_t *)(base + 0x10000), 0xFFFFFFFFUL);
+}
+
+/* A program error in packet 1 : reported from the packet which finds it on, LAST reports it,
+ * the packets after it are dropped, the next run starts clean
+ */
+static void test_error_in_run(void)
+{
+	uint32_t base = get_flash_sector_base(7);
+	uint32_t fail = PKT_LEN + 100;
+	uint8_t status[RUN_PACKETS];
+	uint32_t first_error = RUN_PACKETS;
+
+	pattern(image, sizeof(image), 0x35);
+	CHECK(image[fail] != 0xFF);
+	mock_flash_fail_at(base + fail);
+
+	for(uint32_t n = 0; n < RUN_PACKETS; n++)
+	{
+		status[n] = defer_write(base + n * PKT_LEN, &image[n * PKT_LEN], PKT_LEN, run_flags(n, RUN_PACKETS));
+		if( (status[n] != HAL_OK) && (first_error == RUN_PACKETS) )
+			first_error = n;
+	}
+
+	CHECK_EQ(status[RUN_PACKETS - 1], HAL_ERROR);
+	CHECK(first_error > 1);
+	CHECK(first_error < (RUN_PACKETS - 1));
+	for(uint32_t n = first_error; n < RUN_PACKETS; n++)
+		CHECK_EQ(status[n], HAL_ERROR);
+
+	// Written up to the failing word, nothing after the packet which saw the error
+	CHECK(memcmp((void *)base, image, fail & ~3UL) == 0);
+	for(uint32_t n = first_error + 1; n < RUN_PACKETS; n++)
+		CHECK_EQ(*(volatile uint32_t *)(base + n * PKT_LEN), 0xFFFFFFFFUL);
+	CHECK(!flash_bg_busy());
+
+	CHECK_EQ(defer_write(base + 0x10000, image, PKT_LEN, BL_V2_FLAG_FIRST | BL_V2_FLAG_LAST), HAL_OK);
+	CHECK(memcmp((void *)(base + 0x10000), image, PKT_LEN) == 0);
+}
+
+/* AUTO_ERASE : the erases of sectors 8 and 9 go in the queue ahead of the packets which need them */
+static void test_auto_erase_queued(void)
+{
+	uint32_t boundary = get_flash_sector_base(9);
+	uint32_t start = boundary - 2 * PKT_LEN;
+	uint32_t count = 4;
+
+	pattern(image, count * PKT_LEN, 0x4C);
+	mock_flash_fill(get_flash_sector_base(8), 0x00, 0x100);
+	mock_flash_fill(boundary + 0x10000, 0x00, 0x100);
+
+	CHECK_EQ(defer_write(start, image, PKT_LEN, BL_V2_FLAG_AUTO_ERASE | BL_V2_FLAG_FIRST), HAL_OK);
+	CHECK(flash_bg_pending() & (1UL << 8));
+	CHECK_EQ(mock_flash_stats.erases[8], 0);
+	CHECK_EQ(mock_flash_stats.programs, 0);
+
+	for(uint32_t n = 1; n < count; n++)
+	{
+		CHECK_EQ(defer_write(start + n * PKT_LEN, &image[n * PKT_LEN], PKT_LEN,
+				BL_V2_FLAG_AUTO_ERASE | run_flags(n, count)), HAL_OK);
+		if(n == 2)
+			CHECK(flash_bg_pending() & (1UL << 9));
+	}
+
+	CHECK_EQ(mock_flash_stats.erases[8], 1);
+	CHECK_EQ(mock_flash_stats.erases[9], 1);
+	CHECK(mock_now_us() >= 2ULL * MOCK_ERASE_128K_US);
+	CHECK(memcmp((void *)start, image, count * PKT_LEN) == 0);
+	CHECK_EQ(*(volatile uint32_t *)get_flash_sector_base(8), 0xFFFFFFFFUL);
+	CHECK_EQ(*(volatile uint32_t *)(boundary + 0x10000), 0xFFFFFFFFUL);
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_buffers_full);
+	RUN_TEST(test_error_in_run);
+	RUN_TEST(test_auto_erase_queued);
+
+	return TEST_RESULT();
+}
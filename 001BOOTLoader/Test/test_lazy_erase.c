@@ -0,0 +1,152 @@
+/*
+ * test_lazy_erase.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* Lazy erase (BL_V2_FLAG_AUTO_ERASE) on the virtual flash : a sector is erased the first time a
+ * write touches it and never again in the session, a blank one is not erased at all, a write
+ * across a sector boundary erases both, the bootloader and its mirror are never erased.
+ * The sectors erased in the session are kept by the bootloader, not by the mock : mock_reset()
+ * doesn't clear them, so each test works in sectors of its own.
+ */
+
+#define PKT_LEN			256
+
+/* One BL_MEM_WRITE v2 packet with AUTO_ERASE, returns the status the bootloader sends back */
+static uint8_t auto_write(uint32_t mem_address, const uint8_t *pData, uint32_t len)
+{
+	static uint32_t pkt[BL_RX_LEN / 4];
+
+	mock_tx_clear();
+	mock_v2_packet((uint8_t *)pkt, BL_MEM_WRITE, BL_V2_FLAG_AUTO_ERASE, mem_address, pData, len);
+	bootloader_handle_mem_write_v2_cmd((uint8_t *)pkt);
+
+	CHECK_EQ(mock_tx_len, 3);
+	CHECK_EQ(mock_tx[0], BL_ACK);
+
+	return mock_tx[2];
+}
+
+static void pattern(uint8_t *pData, uint32_t len, uint8_t seed)
+{
+	for(uint32_t i = 0; i < len; i++)
+		pData[i] = (uint8_t)(seed + i * 3);
+}
+
+/* Old data in the sector : erased by the first write, the second one keeps the first */
+static void test_erased_once(void)
+{
+	uint32_t base = get_flash_sector_base(5);
+	uint8_t first[PKT_LEN];
+	uint8_t second[PKT_LEN];
+
+	pattern(first, PKT_LEN, 0x11);
+	pattern(second, PKT_LEN, 0x77);
+	mock_flash_fill(base, 0x00, 0x1000);
+
+	CHECK_EQ(auto_write(base, first, PKT_LEN), HAL_OK);
+	CHECK_EQ(mock_flash_stats.erases[5], 1);
+	CHECK(memcmp((void *)base, first, PKT_LEN) == 0);
+	CHECK_EQ(*(volatile uint8_t *)(base + 0x800), 0xFF);
+
+	CHECK_EQ(auto_write(base + PKT_LEN, second, PKT_LEN), HAL_OK);
+	CHECK_EQ(mock_flash_stats.erases[5], 1);
+	CHECK(memcmp((void *)base, first, PKT_LEN) == 0);
+	CHECK(memcmp((void *)(base + PKT_LEN), second, PKT_LEN) == 0);
+}
+
+/* A blank sector is not erased, and not later once it holds data either */
+static void test_blank_skipped(void)
+{
+	uint32_t base = get_flash_sector_base(6);
+	uint8_t first[PKT_LEN];
+	uint8_t second[PKT_LEN];
+
+	pattern(first, PKT_LEN, 0x23);
+	pattern(second, PKT_LEN, 0x95);
+
+	CHECK_EQ(auto_write(base + 0x10000, first, PKT_LEN), HAL_OK);
+	CHECK_EQ(mock_flash_stats.erases[6], 0);
+	CHECK_EQ(auto_write(base, second, PKT_LEN), HAL_OK);
+	CHECK_EQ(mock_flash_stats.erases[6], 0);
+	CHECK(memcmp((void *)(base + 0x10000), first, PKT_LEN) == 0);
+	CHECK(memcmp((void *)base, second, PKT_LEN) == 0);
+}
+
+/* One packet over the end of sector 3 (16 KB) and the start of sector 4 (64 KB) */
+static void test_sector_boundary(void)
+{
+	uint32_t boundary = get_flash_sector_base(4);
+	uint8_t data[2 * PKT_LEN];
+	uint8_t next[PKT_LEN];
+
+	pattern(data, sizeof(data), 0x42);
+	pattern(next, PKT_LEN, 0xC8);
+	mock_flash_fill(get_flash_sector_base(2), 0x5A, 0x100);
+	mock_flash_fill(boundary - 0x1000, 0x00, 0x2000);
+
+	CHECK_EQ(auto_write(boundary - PKT_LEN, data, sizeof(data)), HAL_OK);
+	CHECK_EQ(mock_flash_stats.erases[2], 0);
+	CHECK_EQ(mock_flash_stats.erases[3], 1);
+	CHECK_EQ(mock_flash_stats.erases[4], 1);
+	CHECK(memcmp((void *)(boundary - PKT_LEN), data, sizeof(data)) == 0);
+	CHECK_EQ(*(volatile uint8_t *)(boundary - 0x1000), 0xFF);
+	CHECK_EQ(*(volatile uint8_t *)(boundary + 0x800), 0xFF);
+
+	// Neighbour sector untouched, no erase on the next packet
+	CHECK_EQ(*(volatile uint8_t *)get_flash_sector_base(2), 0x5A);
+	CHECK_EQ(auto_write(boundary + PKT_LEN, next, PKT_LEN), HAL_OK);
+	CHECK_EQ(mock_flash_stats.erases[4], 1);
+	CHECK(memcmp((void *)(boundary - PKT_LEN), data, sizeof(data)) == 0);
+}
+
+/* The bootloader and its mirror in bank 2 : refused, nothing erased or programmed */
+static void test_bootloader_refused(void)
+{
+	uint8_t data[PKT_LEN];
+
+	pattern(data, PKT_LEN, 0x31);
+	mock_flash_fill(FLASH_BASE, 0x5A, 0x100);
+	mock_flash_fill(BL_BOOT_MIRROR_BASE, 0x5A, 0x100);
+
+	CHECK_EQ(flash_prepare_write(FLASH_BASE, PKT_LEN), ADDR_INVALID);
+	CHECK_EQ(flash_prepare_write(BL_SLOT_A_BASE - 0x10, 0x20), ADDR_INVALID);
+	CHECK_EQ(flash_prepare_write(BL_BOOT_MIRROR_BASE + BL_BOOT_SIZE - 0x10, 0x20), ADDR_INVALID);
+	CHECK_EQ(flash_prepare_write_bg(BL_BOOT_MIRROR_BASE, PKT_LEN), ADDR_INVALID);
+
+	CHECK_EQ(auto_write(FLASH_BASE, data, PKT_LEN), ADDR_INVALID);
+	CHECK_EQ(auto_write(BL_BOOT_MIRROR_BASE, data, PKT_LEN), ADDR_INVALID);
+
+	for(uint8_t sector = 0; sector < BL_FLASH_SECTOR_COUNT; sector++)
+		CHECK_EQ(mock_flash_stats.erases[sector], 0);
+	CHECK_EQ(mock_flash_stats.programs, 0);
+	CHECK_EQ(*(volatile uint8_t *)FLASH_BASE, 0x5A);
+	CHECK_EQ(*(volatile uint8_t *)BL_BOOT_MIRROR_BASE, 0x5A);
+}
+
+/* Outside the flash there is nothing to erase */
+static void test_outside_flash(void)
+{
+	CHECK_EQ(flash_prepare_write(SRAM1_BASE + 0x8000, PKT_LEN), HAL_OK);
+	CHECK_EQ(flash_prepare_write(get_flash_sector_base(7), 0), HAL_OK);
+
+	for(uint8_t sector = 0; sector < BL_FLASH_SECTOR_COUNT; sector++)
+		CHECK_EQ(mock_flash_stats.erases[sector], 0);
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_erased_once);
+	RUN_TEST(test_blank_skipped);
+	RUN_TEST(test_sector_boundary);
+	RUN_TEST(test_bootloader_refused);
+	RUN_TEST(test_outside_flash);
+
+	return TEST_RESULT();
+}
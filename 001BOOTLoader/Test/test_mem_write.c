@@ -0,0 +1,141 @@
+/*
+ * test_mem_write.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* execute_mem_write() on the virtual flash : programming only clears bits, the word body is written
+ * 32 bits at a time with direct stores, the unaligned head and tail as byte / halfword, a read back
+ * mismatch stops the write and pFail_offset is the first byte not written.
+ */
+
+#define BASE					0x08020000UL		// sector 5, erased at reset
+
+static uint8_t data[64];
+
+static void fill_data(void)
+{
+	for(uint32_t i = 0; i < sizeof(data); i++)
+		data[i] = (uint8_t)(0x11 * (i + 1) + (i >> 4));
+}
+
+static void test_virtual_flash_clears_bits(void)
+{
+	// Locked, PG clear : the store is refused with PGSERR
+	*(volatile uint32_t *)BASE = 0x12345678UL;
+	CHECK_EQ(*(volatile uint32_t *)BASE, 0xFFFFFFFFUL);
+	CHECK(FLASH->SR & FLASH_FLAG_PGSERR);
+	__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_PGSERR);
+	CHECK((FLASH->SR & FLASH_FLAG_PGSERR) == 0);
+
+	// Programming ANDs the new value in
+	HAL_FLASH_Unlock();
+	CHECK_EQ(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, BASE + 4, 0x0F0F0F0FUL), HAL_OK);
+	CHECK_EQ(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, BASE + 4, 0x00FF00FFUL), HAL_OK);
+	CHECK_EQ(*(volatile uint32_t *)(BASE + 4), 0x000F000FUL);
+	HAL_FLASH_Lock();
+}
+
+static void test_aligned_body(void)
+{
+	uint32_t fail = 0xFFFFFFFFUL;
+
+	fill_data();
+	CHECK_EQ(execute_mem_write(data, BASE, 32, &fail), HAL_OK);
+	CHECK_EQ(fail, 32);
+	CHECK(memcmp((void *)BASE, data, 32) == 0);
+	CHECK_EQ(*(volatile uint8_t *)(BASE + 32), 0xFF);
+	CHECK_EQ(mock_flash_stats.programs, 8);
+	CHECK(FLASH->CR & FLASH_CR_LOCK);
+}
+
+static void test_odd_head_and_tail(void)
+{
+	uint32_t fail = 0;
+
+	fill_data();
+
+	// byte (+1), halfword (+2), 2 words (+4 .. +11), halfword (+12), byte (+14)
+	CHECK_EQ(execute_mem_write(data, BASE + 1, 14, &fail), HAL_OK);
+	CHECK_EQ(fail, 14);
+	CHECK(memcmp((void *)(BASE + 1), data, 14) == 0);
+	CHECK_EQ(*(volatile uint8_t *)BASE, 0xFF);
+	CHECK_EQ(*(volatile uint8_t *)(BASE + 15), 0xFF);
+	CHECK_EQ(mock_flash_stats.programs, 6);
+
+	// Shorter than the head : a byte then a halfword
+	mock_flash_stats.programs = 0;
+	CHECK_EQ(execute_mem_write(data, BASE + 0x101, 3, &fail), HAL_OK);
+	CHECK_EQ(fail, 3);
+	CHECK(memcmp((void *)(BASE + 0x101), data, 3) == 0);
+	CHECK_EQ(mock_flash_stats.programs, 2);
+
+	// Unaligned source, aligned destination
+	CHECK_EQ(execute_mem_write(&data[3], BASE + 0x200, 9, &fail), HAL_OK);
+	CHECK_EQ(fail, 9);
+	CHECK(memcmp((void *)(BASE + 0x200), &data[3], 9) == 0);
+}
+
+static void test_not_erased_body(void)
+{
+	uint32_t fail = 0;
+
+	fill_data();
+	mock_flash_fill(BASE + 9, 0x00, 1);
+
+	// The word at +8 can't take its value, the write stops there
+	CHECK_EQ(execute_mem_write(data, BASE, 24, &fail), HAL_ERROR);
+	CHECK_EQ(fail, 8);
+	CHECK(memcmp((void *)BASE, data, 8) == 0);
+	CHECK_EQ(*(volatile uint32_t *)(BASE + 12), 0xFFFFFFFFUL);
+	CHECK(FLASH->CR & FLASH_CR_LOCK);
+	CHECK((FLASH->CR & FLASH_CR_PG) == 0);
+}
+
+static void test_read_back_failure(void)
+{
+	uint32_t fail = 0;
+
+	fill_data();
+
+	// Head byte
+	mock_flash_fail_at(BASE + 1);
+	CHECK_EQ(execute_mem_write(data, BASE + 1, 8, &fail), HAL_ERROR);
+	CHECK_EQ(fail, 0);
+
+	// Head halfword, after the byte
+	mock_flash_fail_at(BASE + 0x43);
+	CHECK_EQ(execute_mem_write(data, BASE + 0x41, 8, &fail), HAL_ERROR);
+	CHECK_EQ(fail, 1);
+
+	// Word of the body
+	mock_flash_fail_at(BASE + 0x8E);
+	CHECK_EQ(execute_mem_write(data, BASE + 0x82, 20, &fail), HAL_ERROR);
+	CHECK_EQ(fail, 10);
+	CHECK(memcmp((void *)(BASE + 0x82), data, 10) == 0);
+
+	// Tail halfword and tail byte
+	mock_flash_fail_at(BASE + 0xC8);
+	CHECK_EQ(execute_mem_write(data, BASE + 0xC0, 11, &fail), HAL_ERROR);
+	CHECK_EQ(fail, 8);
+	mock_flash_fail_at(BASE + 0x10A);
+	CHECK_EQ(execute_mem_write(data, BASE + 0x100, 11, &fail), HAL_ERROR);
+	CHECK_EQ(fail, 10);
+	CHECK(memcmp((void *)(BASE + 0x100), data, 10) == 0);
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_virtual_flash_clears_bits);
+	RUN_TEST(test_aligned_body);
+	RUN_TEST(test_odd_head_and_tail);
+	RUN_TEST(test_not_erased_body);
+	RUN_TEST(test_read_back_failure);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,142 @@
+/*
+ * test_otp.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* BL_OTP_READ against the simulated OTP area of the system memory : the 512 data bytes and the
+ * 16 lock bytes go out as one streamed reply, one chunk with its CRC.
+ */
+
+#define OTP_DUMP_LEN			(BL_OTP_LEN + BL_OTP_LOCK_LEN)
+#define OTP_LOCK_BASE			(FLASH_OTP_BASE + BL_OTP_LEN)
+
+static uint32_t host_crc(const uint8_t *pData, uint32_t len)
+{
+	uint32_t crc = 0xFFFFFFFFUL;
+
+	for(uint32_t i = 0; i < len; i++)
+		crc = mock_crc_word(crc, pData[i]);
+
+	return crc;
+}
+
+/* Host side CRC of a chunk : little endian words, the trailing bytes one by one */
+static uint32_t host_crc_word(const uint8_t *pData, uint32_t len)
+{
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint32_t word;
+	uint32_t i = 0;
+
+	for( ; (i + 4) <= len; i += 4)
+	{
+		memcpy(&word, &pData[i], 4);
+		crc = mock_crc_word(crc, word);
+	}
+	for( ; i < len; i++)
+		crc = mock_crc_word(crc, pData[i]);
+
+	return crc;
+}
+
+static void otp_program(void)
+{
+	uint8_t *pOtp = (uint8_t *)FLASH_OTP_BASE;
+
+	// Blocks 0 and 3 hold a serial number and a key, blocks 0 and 3 are locked
+	for(uint32_t i = 0; i < BL_OTP_BLOCK_LEN; i++)
+	{
+		pOtp[i] = (uint8_t)(0xA0 + i);
+		pOtp[3 * BL_OTP_BLOCK_LEN + i] = (uint8_t)(0x5A ^ (i * 13));
+	}
+	pOtp[BL_OTP_LEN - 1] = 0x42;
+	((uint8_t *)OTP_LOCK_BASE)[0] = 0x00;
+	((uint8_t *)OTP_LOCK_BASE)[3] = 0x00;
+
+	// What follows the lock bytes must not be sent
+	((uint8_t *)OTP_LOCK_BASE)[BL_OTP_LOCK_LEN] = 0x99;
+}
+
+static void otp_command(uint8_t *pPkt, uint8_t good_crc)
+{
+	uint32_t crc;
+
+	pPkt[0] = 5;
+	pPkt[1] = BL_OTP_READ;
+	crc = host_crc(pPkt, 2) ^ (good_crc ? 0 : 1);
+	memcpy(&pPkt[2], &crc, 4);
+}
+
+static void test_otp_dump(void)
+{
+	uint8_t pkt[6];
+	uint32_t total;
+	uint32_t crc;
+
+	otp_program();
+	otp_command(pkt, 1);
+	bootloader_handle_read_otp(pkt);
+
+	// ACK, header, the 528 bytes as one chunk, its CRC
+	CHECK_EQ(mock_tx_len, 2 + BL_STREAM_HDR_LEN + OTP_DUMP_LEN + 4);
+	CHECK_EQ(mock_tx[0], BL_ACK);
+	CHECK_EQ(mock_tx[1], BL_STREAM_HDR_LEN);
+	CHECK_EQ(mock_tx[2], ADDR_VALID);
+	CHECK_EQ(mock_tx[3] | (mock_tx[4] << 8), BL_STREAM_CHUNK_LEN);
+	memcpy(&total, &mock_tx[5], 4);
+	CHECK_EQ(total, OTP_DUMP_LEN);
+
+	CHECK(memcmp(&mock_tx[9], (void *)FLASH_OTP_BASE, OTP_DUMP_LEN) == 0);
+	CHECK_EQ(mock_tx[9], 0xA0);
+	CHECK_EQ(mock_tx[9 + BL_OTP_LEN - 1], 0x42);
+	CHECK_EQ(mock_tx[9 + BL_OTP_LEN], 0x00);
+	CHECK_EQ(mock_tx[9 + BL_OTP_LEN + 1], 0xFF);
+	CHECK_EQ(mock_tx[9 + BL_OTP_LEN + 3], 0x00);
+
+	memcpy(&crc, &mock_tx[9 + OTP_DUMP_LEN], 4);
+	CHECK_EQ(crc, host_crc_word(&mock_tx[9], OTP_DUMP_LEN));
+}
+
+static void test_blank_otp(void)
+{
+	uint8_t pkt[6];
+
+	otp_command(pkt, 1);
+	bootloader_handle_read_otp(pkt);
+
+	CHECK_EQ(mock_tx_len, 2 + BL_STREAM_HDR_LEN + OTP_DUMP_LEN + 4);
+	for(uint32_t i = 0; i < OTP_DUMP_LEN; i++)
+	{
+		if(mock_tx[9 + i] != 0xFF)
+		{
+			CHECK_EQ(mock_tx[9 + i], 0xFF);
+			break;
+		}
+	}
+}
+
+static void test_bad_crc(void)
+{
+	uint8_t pkt[6];
+
+	otp_program();
+	otp_command(pkt, 0);
+	bootloader_handle_read_otp(pkt);
+
+	CHECK_EQ(mock_tx_len, 1);
+	CHECK_EQ(mock_tx[0], BL_NACK);
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_otp_dump);
+	RUN_TEST(test_blank_otp);
+	RUN_TEST(test_bad_crc);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,222 @@
+/*
+ * test_slot.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* A/B slots of boot_slot.c on the virtual flash : slot A in bank 1, slot B in bank 2, each with its
+ * trailer in its last 32 bytes. slot_activate() checks the image and programs size, crc, seq and magic
+ * last, slot_select_boot() starts the newest slot which is neither bad nor a failed trial and checks its
+ * CRC, slot_select_fast() only takes a confirmed newest slot.
+ */
+
+#define IMAGE_LEN		0x1000
+
+static uint8_t image[BL_SLOT_COUNT][IMAGE_LEN];
+
+static uint32_t host_crc_word(const uint8_t *pData, uint32_t len)
+{
+	uint32_t crc = 0xFFFFFFFFUL;
+	uint32_t word;
+	uint32_t i = 0;
+
+	for( ; (i + 4) <= len; i += 4)
+	{
+		memcpy(&word, &pData[i], 4);
+		crc = mock_crc_word(crc, word);
+	}
+	for( ; i < len; i++)
+		crc = mock_crc_word(crc, pData[i]);
+
+	return crc;
+}
+
+static void pattern(uint8_t *pData, uint32_t len, uint8_t seed)
+{
+	for(uint32_t i = 0; i < len; i++)
+		pData[i] = (uint8_t)(seed + i * 7 + (i >> 8));
+}
+
+/* An image written in the slot and activated */
+static void activate(uint8_t slot, uint8_t seed)
+{
+	pattern(image[slot], IMAGE_LEN, seed);
+	mock_flash_load(slot_get_base(slot), image[slot], IMAGE_LEN);
+	CHECK_EQ(slot_activate(slot, IMAGE_LEN, host_crc_word(image[slot], IMAGE_LEN)), BL_SLOT_OK);
+	CHECK_EQ(slot_get_state(slot), BL_SLOT_PENDING);
+}
+
+/* Programs a trailer word the way the bootloader (trial) or the application (confirmed) does */
+static void set_word(const volatile uint32_t *pWord)
+{
+	uint32_t value = BL_SLOT_WORD_SET;
+	uint32_t fail_offset;
+
+	CHECK_EQ(execute_mem_write((uint8_t *)&value, (uint32_t)pWord, 4, &fail_offset), HAL_OK);
+}
+
+/* A confirmed and a newer one started once : the newer one never confirmed is marked bad at the next
+ * start, the confirmed one boots
+ */
+static void test_failed_trial(void)
+{
+	activate(BL_SLOT_A, 0x11);
+	set_word(&slot_get_trailer(BL_SLOT_A)->confirmed);
+	activate(BL_SLOT_B, 0x22);
+
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_B);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_TRIAL);
+
+	// Reset without confirmed
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_A);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_BAD);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_CONFIRMED);
+
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_A);
+}
+
+/* A byte of the newest image changed after its activation : bad, the other one boots */
+static void test_crc_error(void)
+{
+	activate(BL_SLOT_B, 0x33);
+	set_word(&slot_get_trailer(BL_SLOT_B)->confirmed);
+	activate(BL_SLOT_A, 0x44);
+
+	mock_flash_fill(BL_SLOT_A_BASE + 0x123, (uint8_t)~image[BL_SLOT_A][0x123], 1);
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_B);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_BAD);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_CONFIRMED);
+
+	// No good slot left
+	mock_flash_fill(BL_SLOT_B_BASE, (uint8_t)~image[BL_SLOT_B][0], 1);
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_NONE);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_BAD);
+}
+
+/* The activation number decides, not the slot number */
+static void test_highest_seq(void)
+{
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_NONE);
+
+	activate(BL_SLOT_B, 0x55);
+	activate(BL_SLOT_A, 0x66);
+	CHECK_EQ(slot_get_trailer(BL_SLOT_B)->seq, 0);
+	CHECK_EQ(slot_get_trailer(BL_SLOT_A)->seq, 1);
+
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_A);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_TRIAL);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_PENDING);
+}
+
+/* update = 0 (BL_SLOT_INFO) : the same pick, nothing written */
+static void test_no_update(void)
+{
+	uint32_t programs;
+
+	activate(BL_SLOT_A, 0x77);
+	activate(BL_SLOT_B, 0x88);
+	set_word(&slot_get_trailer(BL_SLOT_B)->trial);
+
+	programs = mock_flash_stats.programs;
+	CHECK_EQ(slot_select_boot(0), BL_SLOT_A);
+	CHECK_EQ(mock_flash_stats.programs, programs);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_PENDING);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_TRIAL);
+
+	// Nor for a CRC error
+	mock_flash_fill(BL_SLOT_A_BASE, (uint8_t)~image[BL_SLOT_A][0], 1);
+	CHECK_EQ(slot_select_boot(0), BL_SLOT_NONE);
+	CHECK_EQ(mock_flash_stats.programs, programs);
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_PENDING);
+}
+
+/* Checks before any write, magic programmed last */
+static void test_activate(void)
+{
+	const bl_slot_trailer_t *pTrailer = slot_get_trailer(BL_SLOT_B);
+	uint32_t crc;
+	uint32_t programs;
+
+	pattern(image[BL_SLOT_B], IMAGE_LEN, 0x99);
+	mock_flash_load(BL_SLOT_B_BASE, image[BL_SLOT_B], IMAGE_LEN);
+	crc = host_crc_word(image[BL_SLOT_B], IMAGE_LEN);
+
+	programs = mock_flash_stats.programs;
+	CHECK_EQ(slot_activate(BL_SLOT_B, 0, crc), BL_SLOT_INVALID);
+	CHECK_EQ(slot_activate(BL_SLOT_B, BL_SLOT_TRAILER_OFFSET + 1, crc), BL_SLOT_INVALID);
+	CHECK_EQ(slot_activate(BL_SLOT_COUNT, IMAGE_LEN, crc), BL_SLOT_INVALID);
+	CHECK_EQ(slot_activate(BL_SLOT_B, IMAGE_LEN, crc ^ 1), BL_SLOT_CRC_ERROR);
+	CHECK_EQ(mock_flash_stats.programs, programs);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_EMPTY);
+
+	// Power cut before the last word : size, crc and seq are there, the slot is not activated
+	mock_flash_cut_after(3);
+	CHECK(slot_activate(BL_SLOT_B, IMAGE_LEN, crc) != BL_SLOT_OK);
+	mock_flash_power_on();
+	CHECK_EQ(pTrailer->size, IMAGE_LEN);
+	CHECK_EQ(pTrailer->crc, crc);
+	CHECK_EQ(pTrailer->seq, 0);
+	CHECK_EQ(pTrailer->magic, BL_SLOT_WORD_ERASED);
+	CHECK_EQ(slot_get_state(BL_SLOT_B), BL_SLOT_EMPTY);
+	CHECK_EQ(slot_select_boot(1), BL_SLOT_NONE);
+
+	// The trailer has to be erased again first
+	programs = mock_flash_stats.programs;
+	CHECK_EQ(slot_activate(BL_SLOT_B, IMAGE_LEN, crc), BL_SLOT_NOT_BLANK);
+	CHECK_EQ(mock_flash_stats.programs, programs);
+
+	mock_flash_fill((uint32_t)pTrailer, 0xFF, sizeof(*pTrailer));
+	CHECK_EQ(slot_activate(BL_SLOT_B, IMAGE_LEN, crc), BL_SLOT_OK);
+	CHECK_EQ(pTrailer->magic, BL_SLOT_MAGIC);
+	CHECK_EQ(slot_activate(BL_SLOT_B, IMAGE_LEN, crc), BL_SLOT_NOT_BLANK);
+}
+
+/* Only a confirmed newest slot is taken without slot_select_boot(), slot B with its bootloader copy */
+static void test_select_fast(void)
+{
+	uint8_t slot = 0;
+
+	CHECK_EQ(slot_select_fast(&slot), 1);
+	CHECK_EQ(slot, BL_SLOT_NONE);
+
+	activate(BL_SLOT_A, 0xAA);
+	set_word(&slot_get_trailer(BL_SLOT_A)->confirmed);
+	CHECK_EQ(slot_select_fast(&slot), 1);
+	CHECK_EQ(slot, BL_SLOT_A);
+
+	activate(BL_SLOT_B, 0xBB);
+	CHECK_EQ(slot_select_fast(&slot), 0);
+	CHECK_EQ(slot, BL_SLOT_B);
+	set_word(&slot_get_trailer(BL_SLOT_B)->trial);
+	CHECK_EQ(slot_select_fast(&slot), 0);
+
+	set_word(&slot_get_trailer(BL_SLOT_B)->confirmed);
+	CHECK_EQ(slot_select_fast(&slot), 1);
+	CHECK_EQ(slot, BL_SLOT_B);
+
+	// The copy of the bootloader in bank 2 is out of date
+	mock_flash_fill(FLASH_BASE, 0x5A, 0x100);
+	CHECK_EQ(slot_select_fast(&slot), 0);
+	mock_flash_load(BL_BOOT_MIRROR_BASE, (const uint8_t *)FLASH_BASE, BL_BOOT_SIZE);
+	CHECK_EQ(slot_select_fast(&slot), 1);
+
+	// Nothing written
+	CHECK_EQ(slot_get_state(BL_SLOT_A), BL_SLOT_CONFIRMED);
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_failed_trial);
+	RUN_TEST(test_crc_error);
+	RUN_TEST(test_highest_seq);
+	RUN_TEST(test_no_update);
+	RUN_TEST(test_activate);
+	RUN_TEST(test_select_fast);
+
+	return TEST_RESULT();
+}
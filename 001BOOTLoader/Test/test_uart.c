@@ -0,0 +1,194 @@
+/*
+ * test_uart.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* Receive ring of boot_uart.c : packets handed out in place, the copy of a packet which wraps
+ * around the end of the ring, the bound on the v2 payload length and the drop of an incomplete packet.
+ */
+
+// Bytes the idle hook sends once the clock reaches hook_at_ms
+static const uint8_t *hook_data;
+static uint32_t hook_len;
+static uint32_t hook_at_ms;
+
+static void send_later(void)
+{
+	if(hook_data && (HAL_GetTick() >= hook_at_ms))
+	{
+		mock_uart_rx(hook_data, hook_len);
+		hook_data = NULL;
+	}
+}
+
+static void schedule(const uint8_t *pData, uint32_t len, uint32_t at_ms)
+{
+	hook_data = pData;
+	hook_len = len;
+	hook_at_ms = at_ms;
+	mock_idle_hook = send_later;
+}
+
+/* v1 packet : length to follow, command, then pattern bytes */
+static uint32_t make_v1(uint8_t *pBuf, uint32_t len, uint8_t seed)
+{
+	pBuf[0] = (uint8_t)(len - 1);
+	pBuf[1] = BL_GET_VER;
+	for(uint32_t i = 2; i < len; i++)
+		pBuf[i] = (uint8_t)(seed + i * 7);
+
+	return len;
+}
+
+static void test_v1_in_place(void)
+{
+	uint8_t pkt[6];
+	uint8_t *pFrame;
+	uint32_t len = 0;
+
+	bootloader_uart_rx_start();
+	mock_uart_rx(pkt, make_v1(pkt, sizeof(pkt), 1));
+
+	pFrame = bootloader_uart_get_frame(&len);
+	CHECK_EQ(len, sizeof(pkt));
+	CHECK(memcmp(pFrame, pkt, sizeof(pkt)) == 0);
+	bootloader_uart_release_frame();
+}
+
+static void test_wrap_copy(void)
+{
+	uint8_t filler[256];
+	uint8_t pkt[40];
+	uint8_t *pFrame;
+	uint8_t *pFirst = NULL;
+	uint32_t len = 0;
+	uint32_t offset = 0;
+	uint32_t n;
+
+	bootloader_uart_rx_start();
+
+	// Walk the ring up to 10 bytes before its end
+	while(offset < (BL_RX_RING_LEN - 10))
+	{
+		n = BL_RX_RING_LEN - 10 - offset;
+		if(n > sizeof(filler))
+			n = sizeof(filler);
+		mock_uart_rx(filler, make_v1(filler, n, (uint8_t)offset));
+		pFrame = bootloader_uart_get_frame(&len);
+		CHECK_EQ(len, n);
+		if(offset == 0)
+			pFirst = pFrame;
+		bootloader_uart_release_frame();
+		offset += n;
+	}
+
+	// 10 bytes at the end of the ring, 30 at its start : the packet must still read contiguous
+	mock_uart_rx(pkt, make_v1(pkt, sizeof(pkt), 0x55));
+	pFrame = bootloader_uart_get_frame(&len);
+	CHECK_EQ(len, sizeof(pkt));
+	CHECK(pFrame == (pFirst + BL_RX_RING_LEN - 10));
+	CHECK(memcmp(pFrame, pkt, sizeof(pkt)) == 0);
+	bootloader_uart_release_frame();
+
+	// And the next one starts at the right place in the ring
+	mock_uart_rx(pkt, make_v1(pkt, 8, 0x11));
+	pFrame = bootloader_uart_get_frame(&len);
+	CHECK_EQ(len, 8);
+	CHECK(pFrame == (pFirst + 30));
+	CHECK(memcmp(pFrame, pkt, 8) == 0);
+	bootloader_uart_release_frame();
+}
+
+static void v2_header(uint8_t *pBuf, uint32_t payload_len)
+{
+	memset(pBuf, 0, BL_V2_HDR_LEN);
+	pBuf[0] = BL_V2_SOF;
+	pBuf[1] = BL_GET_PROTOCOL;
+	pBuf[4] = (uint8_t)payload_len;
+	pBuf[5] = (uint8_t)(payload_len >> 8);
+}
+
+static void test_v2_length_bound(void)
+{
+	static uint8_t pkt[BL_V2_PACKET_LEN(BL_V2_MAX_PAYLOAD)];
+	uint8_t good[6];
+	uint8_t *pFrame;
+	uint32_t len = 0;
+
+	bootloader_uart_rx_start();
+
+	// One byte over the limit : NACK and the ring is dropped, the next packet is found again
+	v2_header(pkt, BL_V2_MAX_PAYLOAD + 1);
+	mock_uart_rx(pkt, BL_V2_HDR_LEN);
+	schedule(good, make_v1(good, sizeof(good), 3), 5);
+
+	pFrame = bootloader_uart_get_frame(&len);
+	CHECK_EQ(mock_tx_len, 1);
+	CHECK_EQ(mock_tx[0], BL_NACK);
+	CHECK_EQ(len, sizeof(good));
+	CHECK(memcmp(pFrame, good, sizeof(good)) == 0);
+	bootloader_uart_release_frame();
+
+	// Right at the limit : the whole packet is waited for
+	mock_tx_clear();
+	v2_header(pkt, BL_V2_MAX_PAYLOAD);
+	for(uint32_t i = BL_V2_HDR_LEN; i < sizeof(pkt); i++)
+		pkt[i] = (uint8_t)i;
+	mock_uart_rx(pkt, BL_V2_HDR_LEN);
+	schedule(&pkt[BL_V2_HDR_LEN], sizeof(pkt) - BL_V2_HDR_LEN, HAL_GetTick() + 5);
+
+	pFrame = bootloader_uart_get_frame(&len);
+	CHECK_EQ(mock_tx_len, 0);
+	CHECK_EQ(len, sizeof(pkt));
+	CHECK(memcmp(pFrame, pkt, sizeof(pkt)) == 0);
+	bootloader_uart_release_frame();
+}
+
+static void test_partial_timeout(void)
+{
+	uint8_t pkt[11];
+	uint8_t next[7];
+	uint8_t *pFrame;
+	uint32_t len = 0;
+	uint32_t start;
+
+	bootloader_uart_rx_start();
+	make_v1(pkt, sizeof(pkt), 9);
+	make_v1(next, sizeof(next), 4);
+
+	// The rest comes before the timeout : one packet
+	start = HAL_GetTick();
+	mock_uart_rx(pkt, 5);
+	schedule(&pkt[5], sizeof(pkt) - 5, start + BL_RX_FRAME_TIMEOUT - 10);
+	pFrame = bootloader_uart_get_frame(&len);
+	CHECK_EQ(len, sizeof(pkt));
+	CHECK(memcmp(pFrame, pkt, sizeof(pkt)) == 0);
+	bootloader_uart_release_frame();
+
+	// The rest never comes : the 5 bytes are dropped after BL_RX_FRAME_TIMEOUT, the next packet is found
+	start = HAL_GetTick();
+	mock_uart_rx(pkt, 5);
+	schedule(next, sizeof(next), start + BL_RX_FRAME_TIMEOUT + 20);
+	pFrame = bootloader_uart_get_frame(&len);
+	CHECK(HAL_GetTick() > (start + BL_RX_FRAME_TIMEOUT));
+	CHECK_EQ(len, sizeof(next));
+	CHECK(memcmp(pFrame, next, sizeof(next)) == 0);
+	CHECK_EQ(mock_tx_len, 0);
+	bootloader_uart_release_frame();
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_v1_in_place);
+	RUN_TEST(test_wrap_copy);
+	RUN_TEST(test_v2_length_bound);
+	RUN_TEST(test_partial_timeout);
+
+	return TEST_RESULT();
+}
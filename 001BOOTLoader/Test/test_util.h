@@ -0,0 +1,49 @@
+/*
+ * test_util.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef TEST_UTIL_H_
+#define TEST_UTIL_H_
+
+#include <stdio.h>
+#include "mock_hal.h"
+
+/* Checks of the host tests : a failed check is printed and counted, the test goes on
+ * Each test program runs its tests with RUN_TEST() (the chip is reset in between) and
+ * returns TEST_RESULT() to CTest.
+ */
+
+static int test_failures;
+
+#define CHECK(cond) \
+	do { \
+		if(!(cond)) { \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			test_failures++; \
+		} \
+	} while(0)
+
+#define CHECK_EQ(actual, expected) \
+	do { \
+		unsigned long long a_ = (unsigned long long)(actual); \
+		unsigned long long e_ = (unsigned long long)(expected); \
+		if(a_ != e_) { \
+			fprintf(stderr, "%s:%d: %s is %#llx, expected %#llx\n", __FILE__, __LINE__, #actual, a_, e_); \
+			test_failures++; \
+		} \
+	} while(0)
+
+#define RUN_TEST(fn) \
+	do { \
+		int before_ = test_failures; \
+		mock_reset(); \
+		fn(); \
+		printf("%-48s %s\n", #fn, (test_failures == before_) ? "ok" : "FAILED"); \
+	} while(0)
+
+#define TEST_RESULT()			((test_failures == 0) ? 0 : 1)
+
+#endif /* TEST_UTIL_H_ */
@@ -0,0 +1,175 @@
+/*
+ * test_window.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "test_util.h"
+
+/* Windowed BL_MEM_WRITE (BL_V2_FLAG_WINDOW) through the receive ring : the host sends several packets
+ * before the first reply, the bootloader takes them out of the ring one by one and replies to each
+ * in order, ACK, 2, its sequence number and the status. A bad CRC gets a NACK and nothing else, the
+ * packet sent again comes with a new sequence number after the others.
+ */
+
+#define PKT_LEN			256
+#define WINDOW_BASE		0x08020000			// sector 5
+
+static uint8_t batch[BL_RX_WINDOW];
+static uint32_t batch_len;
+
+static void pattern(uint8_t *pData, uint32_t len, uint8_t seed)
+{
+	for(uint32_t i = 0; i < len; i++)
+		pData[i] = (uint8_t)(seed + i * 3);
+}
+
+/* Adds a windowed BL_MEM_WRITE to the batch, returns its offset in the batch */
+static uint32_t add_packet(uint8_t seq, uint32_t mem_address, const uint8_t *pData, uint32_t len)
+{
+	uint32_t offset = batch_len;
+
+	batch_len += mock_v2_packet_seq(&batch[offset], BL_MEM_WRITE, BL_V2_FLAG_WINDOW, seq, mem_address, pData, len);
+
+	return offset;
+}
+
+/* The batch goes on the wire at once, then the bootloader handles count packets like its main loop */
+static void send_batch(uint32_t count)
+{
+	uint8_t *pFrame;
+	uint32_t frame_len;
+
+	mock_tx_clear();
+	mock_uart_rx(batch, batch_len);
+	batch_len = 0;
+
+	for(uint32_t n = 0; n < count; n++)
+	{
+		pFrame = bootloader_uart_get_frame(&frame_len);
+		CHECK_EQ(pFrame[0], BL_V2_SOF);
+		bootloader_handle_v2_cmd(pFrame);
+		bootloader_uart_release_frame();
+	}
+}
+
+static void check_reply(uint32_t n, uint8_t seq, uint8_t status)
+{
+	CHECK_EQ(mock_tx[4 * n], BL_ACK);
+	CHECK_EQ(mock_tx[4 * n + 1], 2);
+	CHECK_EQ(mock_tx[4 * n + 2], seq);
+	CHECK_EQ(mock_tx[4 * n + 3], status);
+}
+
+static void test_replies(void)
+{
+	uint8_t data[3][PKT_LEN];
+
+	bootloader_uart_rx_start();
+	for(uint8_t n = 0; n < 3; n++)
+	{
+		pattern(data[n], PKT_LEN, (uint8_t)(0x10 * n + 1));
+		add_packet((uint8_t)(0xFE + n), WINDOW_BASE + n * PKT_LEN, data[n], PKT_LEN);
+	}
+	send_batch(3);
+
+	// The sequence numbers wrap around
+	CHECK_EQ(mock_tx_len, 12);
+	check_reply(0, 0xFE, HAL_OK);
+	check_reply(1, 0xFF, HAL_OK);
+	check_reply(2, 0x00, HAL_OK);
+	for(uint32_t n = 0; n < 3; n++)
+		CHECK(memcmp((void *)(WINDOW_BASE + n * PKT_LEN), data[n], PKT_LEN) == 0);
+}
+
+/* Bad CRC in the middle : NACK, the others are written, the packet sent again is */
+static void test_bad_crc(void)
+{
+	uint8_t data[3][PKT_LEN];
+	uint32_t offset;
+
+	bootloader_uart_rx_start();
+	for(uint8_t n = 0; n < 3; n++)
+	{
+		pattern(data[n], PKT_LEN, (uint8_t)(0x40 + n));
+		offset = add_packet((uint8_t)(n + 1), WINDOW_BASE + n * PKT_LEN, data[n], PKT_LEN);
+		if(n == 1)
+			batch[offset + BL_V2_HDR_LEN + 7] ^= 0x01;
+	}
+	send_batch(3);
+
+	CHECK_EQ(mock_tx_len, 9);
+	check_reply(0, 1, HAL_OK);
+	CHECK_EQ(mock_tx[4], BL_NACK);
+	CHECK_EQ(mock_tx[5], BL_ACK);
+	CHECK_EQ(mock_tx[6], 2);
+	CHECK_EQ(mock_tx[7], 3);
+	CHECK_EQ(mock_tx[8], HAL_OK);
+	CHECK_EQ(*(volatile uint32_t *)(WINDOW_BASE + PKT_LEN), 0xFFFFFFFFUL);
+
+	add_packet(4, WINDOW_BASE + PKT_LEN, data[1], PKT_LEN);
+	send_batch(1);
+	CHECK_EQ(mock_tx_len, 4);
+	check_reply(0, 4, HAL_OK);
+	for(uint32_t n = 0; n < 3; n++)
+		CHECK(memcmp((void *)(WINDOW_BASE + n * PKT_LEN), data[n], PKT_LEN) == 0);
+}
+
+/* A status other than HAL_OK carries the sequence number too, DEFER is ignored in a window */
+static void test_status(void)
+{
+	uint8_t data[PKT_LEN];
+
+	pattern(data, PKT_LEN, 0x77);
+	bootloader_uart_rx_start();
+	add_packet(9, 0x60000000, data, PKT_LEN);
+	batch_len += mock_v2_packet_seq(&batch[batch_len], BL_MEM_WRITE, BL_V2_FLAG_WINDOW | BL_V2_FLAG_DEFER, 10,
+			WINDOW_BASE, data, PKT_LEN);
+	send_batch(2);
+
+	CHECK_EQ(mock_tx_len, 8);
+	check_reply(0, 9, ADDR_INVALID);
+	check_reply(1, 10, HAL_OK);
+	CHECK(memcmp((void *)WINDOW_BASE, data, PKT_LEN) == 0);
+}
+
+/* Full windows of the biggest packets, the second one wraps around the end of the ring */
+static void test_full_window(void)
+{
+	static uint8_t data[2][3][BL_V2_MAX_PAYLOAD];
+	uint32_t address = WINDOW_BASE;
+	uint8_t seq = 0;
+
+	CHECK((3 * BL_V2_PACKET_LEN(BL_V2_MAX_PAYLOAD)) <= BL_RX_WINDOW);
+
+	bootloader_uart_rx_start();
+	for(uint32_t round = 0; round < 2; round++)
+	{
+		for(uint32_t n = 0; n < 3; n++)
+		{
+			pattern(data[round][n], BL_V2_MAX_PAYLOAD, (uint8_t)(round * 3 + n));
+			add_packet(seq++, address, data[round][n], BL_V2_MAX_PAYLOAD);
+			address += BL_V2_MAX_PAYLOAD;
+		}
+		send_batch(3);
+
+		CHECK_EQ(mock_tx_len, 12);
+		for(uint32_t n = 0; n < 3; n++)
+			check_reply(n, (uint8_t)(round * 3 + n), HAL_OK);
+	}
+
+	CHECK(memcmp((void *)WINDOW_BASE, data, sizeof(data)) == 0);
+}
+
+int main(void)
+{
+	mock_init();
+
+	RUN_TEST(test_replies);
+	RUN_TEST(test_bad_crc);
+	RUN_TEST(test_status);
+	RUN_TEST(test_full_window);
+
+	return TEST_RESULT();
+}
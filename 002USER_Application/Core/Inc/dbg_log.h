@@ -0,0 +1,90 @@
+/*
+ * dbg_log.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef INC_DBG_LOG_H_
+#define INC_DBG_LOG_H_
+
+#include <stdint.h>
+
+/* Binary debug log
+ * A log call doesn't format anything on the target, it only pushes a small record
+ * (format string id, time stamp and up to LOG_MAX_ARGS 32-bit arguments) in to a ring
+ * and the DMA of LOG_UART sends the ring in the background.
+ * The format strings are placed in the .log_fmt section, which is kept in the ELF file but
+ * is not loaded in the flash. The offset of a string in this section is the id of its records.
+ * HOST/python/log_decoder.py reads the strings back from the ELF file and prints the messages.
+ *
+ * Record (little endian) :
+ * [0..1]   format string id
+ * [2]      level (bits 7..4), number of arguments (bits 3..0)
+ * [3]      LOG_SYNC
+ * [4..7]   HAL tick (ms)
+ * [8..]    arguments, 4 bytes each
+ *
+ * Arguments are 32-bit values (integers, pointers) : no %s, no floats.
+ */
+
+#define LOG_LEVEL_NONE			0
+#define LOG_LEVEL_ERROR			1
+#define LOG_LEVEL_WARN			2
+#define LOG_LEVEL_INFO			3
+#define LOG_LEVEL_DEBUG			4
+
+// Define LOG_LEVEL (and LOG_UART) before including this file, LOG_LEVEL_NONE compiles all the log calls out
+#ifndef LOG_LEVEL
+#define LOG_LEVEL				LOG_LEVEL_NONE
+#endif
+
+#define LOG_SYNC				0xEB
+#define LOG_MAX_ARGS			4
+#define LOG_RING_LEN			1024		// must be a power of 2
+
+#if LOG_LEVEL > LOG_LEVEL_NONE
+
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...)	N
+#define LOG_NARGS(...)			LOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+
+#define LOG_RECORD(level, fmt, ...)	do { \
+		static const char log_fmt_str[] __attribute__((section(".log_fmt"), used)) = fmt; \
+		_Static_assert(LOG_NARGS(__VA_ARGS__) <= LOG_MAX_ARGS, "too many log arguments"); \
+		log_write((uint32_t)log_fmt_str, ((level) << 4) | LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__); \
+	} while(0)
+
+void log_write(uint32_t fmt_id, uint32_t level_nargs, ...);
+void log_flush(void);
+
+#else
+
+#define log_flush()				((void)0)
+
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...)		LOG_RECORD(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...)		((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...)		LOG_RECORD(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...)		((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...)		LOG_RECORD(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...)		((void)0)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...)		LOG_RECORD(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...)		((void)0)
+#endif
+
+#endif /* INC_DBG_LOG_H_ */
@@ -33,16 +33,42 @@ extern "C" {
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 
+#include <stdarg.h>
+#include <string.h>
+
+// Debug log level and UART, LOG_LEVEL_NONE compiles all the logs out (see dbg_log.h)
+#define LOG_LEVEL				LOG_LEVEL_INFO
+#define LOG_UART				(&huart1)
+#include "dbg_log.h"
+
 /* USER CODE END Includes */
 
 /* Exported types ------------------------------------------------------------*/
 /* USER CODE BEGIN ET */
 
+extern UART_HandleTypeDef huart1;
+extern DMA_HandleTypeDef hdma_usart1_tx;
+
 /* USER CODE END ET */
 
 /* Exported constants --------------------------------------------------------*/
 /* USER CODE BEGIN EC */
 
+/* Trailer of the firmware slot we run from, see boot_slot.h of the bootloader.
+ * Slot B is mapped at the address of slot A while it runs, so the trailer is always here.
+ */
+#define APP_SLOT_TRAILER_ADDR	(0x08008000UL + 0xF8000UL - 32)
+#define APP_SLOT_CONFIRMED_ADDR	(APP_SLOT_TRAILER_ADDR + 20)
+#define APP_SLOT_MAGIC			0x544F4C53UL
+#define APP_SLOT_CONFIRM_TRIES	3
+
+/* Boot time record of the bootloader, see boot_fast.h of the bootloader : 32 bytes at the start
+ * of the CCM RAM, kept free by the linker scripts (.boot_time).
+ */
+#define APP_BOOT_TIME_ADDR		0x10000000UL
+#define APP_BOOT_TIME_MAGIC		0x454D4954UL
+#define APP_BOOT_TIME_WORDS		8
+
 /* USER CODE END EC */
 
 /* Exported macro ------------------------------------------------------------*/
@@ -55,8 +81,6 @@ void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
 
-void printmsg(char *format, ...);
-
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
@@ -59,6 +59,9 @@ void SysTick_Handler(void);
 void EXTI0_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
+void DMA2_Stream7_IRQHandler(void);
+void USART1_IRQHandler(void);
+
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
@@ -36,9 +36,6 @@
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
 
-// Enable this line to get debug messages over debug UART
-#define USER_DEBUG_MSG_EN
-
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -51,6 +48,8 @@ UART_HandleTypeDef huart1;
 
 /* USER CODE BEGIN PV */
 
+DMA_HandleTypeDef hdma_usart1_tx;
+
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -58,12 +57,61 @@ void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
 static void MX_USART1_UART_Init(void);
 /* USER CODE BEGIN PFP */
-
+static void app_confirm_slot(void);
+static void app_log_boot_time(void);
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
 
+/* Confirms the firmware slot : a new image stays on trial until it gets here, the bootloader
+ * goes back to the previous slot if the image is started again without being confirmed.
+ */
+static void app_confirm_slot(void)
+{
+	if( (*(volatile uint32_t *)APP_SLOT_TRAILER_ADDR != APP_SLOT_MAGIC) ||
+			(*(volatile uint32_t *)APP_SLOT_CONFIRMED_ADDR != 0xFFFFFFFFUL) )
+		return;
+
+	HAL_StatusTypeDef status = HAL_ERROR;
+
+	// A flag left over by an earlier access makes the program fail at once, it is cleared before each try
+	for(uint32_t attempt = 0; (attempt < APP_SLOT_CONFIRM_TRIES) && (status != HAL_OK); attempt++)
+	{
+		HAL_FLASH_Unlock();
+		__HAL_FLASH_CLEAR_FLAG(FLASH_FLAG_EOP | FLASH_FLAG_OPERR | FLASH_FLAG_WRPERR |
+				FLASH_FLAG_PGAERR | FLASH_FLAG_PGPERR | FLASH_FLAG_PGSERR);
+		status = HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, APP_SLOT_CONFIRMED_ADDR, 0);
+		HAL_FLASH_Lock();
+
+		if( (status == HAL_OK) && (*(volatile uint32_t *)APP_SLOT_CONFIRMED_ADDR != 0) )
+			status = HAL_ERROR;
+	}
+
+	if(status != HAL_OK)
+	{
+		// Still on trial : the bootloader goes back to the previous slot at the next start
+		LOG_ERROR("Firmware slot not confirmed, flash error %#x", HAL_FLASH_GetError());
+		return;
+	}
+
+	LOG_INFO("Firmware slot confirmed");
+}
+
+/* Logs how long the bootloader took to start us : magic, boots, path, cycles, then the times
+ * from reset to the clock setup, the boot decision and the jump in microseconds.
+ */
+static void app_log_boot_time(void)
+{
+	const volatile uint32_t *pRecord = (const volatile uint32_t *)APP_BOOT_TIME_ADDR;
+
+	if(pRecord[0] != APP_BOOT_TIME_MAGIC)
+		return;
+
+	LOG_INFO("Boot %d : path %d, %d cycles", pRecord[1], pRecord[2], pRecord[3]);
+	LOG_INFO("Boot decision %d us, jump %d us", pRecord[5], pRecord[6]);
+}
+
 /* USER CODE END 0 */
 
 /**
@@ -97,6 +145,10 @@ int main(void)
   MX_USART1_UART_Init();
   /* USER CODE BEGIN 2 */
 
+  // Everything is up, this image is good
+  app_confirm_slot();
+  app_log_boot_time();
+
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -104,9 +156,9 @@ int main(void)
   while (1)
   {
 
-	  printmsg("USER_APP: Hello from USER Application\r\n");
+	  LOG_INFO("Hello from USER Application");
 
-	  printmsg("USER_APP: Current Tick : %d\r\n", HAL_GetTick());
+	  LOG_INFO("Current Tick : %d", HAL_GetTick());
 
 	  HAL_Delay(1000);
 
@@ -456,20 +508,6 @@ static void MX_GPIO_Init(void)
 
 /* USER CODE BEGIN 4 */
 
-/* Prints formatted string to console over UART */
-void printmsg(char *format, ...)
-{
-#ifdef USER_DEBUG_MSG_EN
-	char str[100];
-	/* Extract the argument list using VA API */
-	va_list args;
-	va_start(args, format);
-	vsprintf(str, format, args);
-	HAL_UART_Transmit(&huart1, (uint8_t*)str, strlen(str), HAL_MAX_DELAY);
-	va_end(args);
-#endif
-}
-
 /* USER CODE END 4 */
 
 /**
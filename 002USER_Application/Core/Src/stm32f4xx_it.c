@@ -208,7 +208,7 @@ void EXTI0_IRQHandler(void)
 
 	HAL_GPIO_TogglePin(LD3_GPIO_Port, LD3_Pin);
 
-	printmsg("USER_APP: LED Green Toggled\r\n");
+	LOG_INFO("LED Green Toggled");
 
   /* USER CODE END EXTI0_IRQn 0 */
   HAL_GPIO_EXTI_IRQHandler(GPIO_PIN_0);
@@ -219,5 +219,21 @@ void EXTI0_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles DMA2 stream7 global interrupt (USART1_TX, debug log).
+  */
+void DMA2_Stream7_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_usart1_tx);
+}
+
+/**
+  * @brief This function handles USART1 global interrupt (TX complete, debug log).
+  */
+void USART1_IRQHandler(void)
+{
+  HAL_UART_IRQHandler(&huart1);
+}
+
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
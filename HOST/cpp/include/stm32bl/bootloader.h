@@ -0,0 +1,103 @@
+/*
+ * bootloader.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef STM32BL_BOOTLOADER_H_
+#define STM32BL_BOOTLOADER_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "stm32bl/error.h"
+#include "stm32bl/serial_port.h"
+
+namespace stm32bl {
+
+// Command codes of the v1 protocol, see boot_functions.h
+constexpr uint8_t BL_GET_VER				= 0x51;
+constexpr uint8_t BL_GET_HELP				= 0x52;
+constexpr uint8_t BL_GET_CID				= 0x53;
+constexpr uint8_t BL_GET_RDP_STATUS			= 0x54;
+constexpr uint8_t BL_GO_TO_ADDR				= 0x55;
+constexpr uint8_t BL_FLASH_ERASE			= 0x56;
+constexpr uint8_t BL_MEM_WRITE				= 0x57;
+constexpr uint8_t BL_EN_R_W_PROTECT			= 0x58;
+constexpr uint8_t BL_MEM_READ				= 0x59;
+constexpr uint8_t BL_READ_SECTOR_P_STATUS	= 0x5A;
+constexpr uint8_t BL_OTP_READ				= 0x5B;
+constexpr uint8_t BL_DIS_R_W_PROTECT		= 0x5C;
+
+constexpr uint8_t BL_ACK					= 0xA5;
+constexpr uint8_t BL_NACK					= 0x7F;
+
+constexpr uint8_t BL_MASS_ERASE				= 0xFF;		// sector number of BL_FLASH_ERASE
+constexpr size_t BL_V1_MAX_PAYLOAD			= 128;
+constexpr size_t BL_STREAM_HDR_LEN			= 7;
+constexpr uint8_t ADDR_VALID				= 0x00;
+
+// Flash_HAL_xx status of the write / erase replies
+constexpr uint8_t Flash_HAL_OK				= 0x00;
+constexpr uint8_t Flash_HAL_TIMEOUT			= 0x03;
+
+/* Host side of the bootloader protocol v1 (0x51 to 0x5C)
+ * A packet is built in the tx buffer of the object and goes out with one write, replies are read
+ * with their exact length. Status bytes are returned as they are, transport errors are thrown.
+ */
+class Bootloader {
+public:
+	// done / total bytes, called after every packet of a write or chunk of a read
+	using Progress = std::function<void(size_t done, size_t total)>;
+
+	static constexpr std::chrono::milliseconds kReplyTimeout{2000};
+	static constexpr std::chrono::milliseconds kEraseTimeout{5000};		// a 128 KB sector takes up to 2 s
+	static constexpr std::chrono::milliseconds kMassEraseTimeout{60000};	// both banks take up to 32 s at x32
+
+	explicit Bootloader(SerialPort &port);
+
+	uint8_t get_version();
+	std::vector<uint8_t> get_help();
+	uint16_t get_cid();
+	uint8_t get_rdp_status();
+	uint8_t go_to_address(uint32_t address);
+	uint8_t flash_erase(uint8_t sector, uint8_t count);		// sector BL_MASS_ERASE for the whole flash
+	uint8_t mem_write(uint32_t address, const uint8_t *data, size_t len, const Progress &progress = {});
+	uint8_t enable_rw_protect(uint16_t sectors, uint8_t mode);
+	std::vector<uint8_t> mem_read(uint32_t address, uint32_t len, const Progress &progress = {});
+	uint16_t read_sector_status();
+	std::vector<uint8_t> otp_read();
+	uint8_t disable_rw_protect();
+
+private:
+	// [len to follow][command][args][CRC32] in tx_, returns the packet length
+	size_t build(uint8_t command, const uint8_t *args, size_t args_len);
+	size_t build_mem_write(uint32_t address, const uint8_t *data, size_t len);
+	void send(size_t len);
+	void read_exact(uint8_t *data, size_t len, std::chrono::milliseconds timeout);
+	// ACK + len to follow, throws Nack on 0x7F
+	uint8_t read_ack(std::chrono::milliseconds timeout);
+	// Sends the command and reads its whole reply
+	std::vector<uint8_t> transact(uint8_t command, const uint8_t *args, size_t args_len,
+			std::chrono::milliseconds timeout = kReplyTimeout);
+	uint8_t transact_status(uint8_t command, const uint8_t *args, size_t args_len,
+			std::chrono::milliseconds timeout = kReplyTimeout);
+	// Header + chunks with their word mode CRC32, see bootloader_stream_data()
+	std::vector<uint8_t> transact_stream(uint8_t command, const uint8_t *args, size_t args_len,
+			const Progress &progress);
+
+	SerialPort &port_;
+	// 1 byte len + 1 byte command + 4 byte address + 1 byte len + payload + 4 byte CRC
+	std::array<uint8_t, 11 + BL_V1_MAX_PAYLOAD> tx_;
+	std::array<uint8_t, 256> rx_;
+};
+
+} // namespace stm32bl
+
+#endif /* STM32BL_BOOTLOADER_H_ */
@@ -0,0 +1,29 @@
+/*
+ * crc32.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef STM32BL_CRC32_H_
+#define STM32BL_CRC32_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace stm32bl {
+
+/* CRC32 of the STM32 CRC unit : poly 0x04C11DB7, init 0xFFFFFFFF, MSB first, no final xor.
+ * Table driven, 8 bits per step instead of the bit loop of get_crc() in the Python tool.
+ */
+constexpr uint32_t kCrcInit = 0xFFFFFFFFu;
+
+// Byte mode : every byte goes in to the unit as a 32-bit word (v1 packets, BL_CRC_MODE_BYTE)
+uint32_t crc32_byte(const uint8_t *data, size_t len, uint32_t crc = kCrcInit);
+
+// Word mode : 4 bytes at a time as a little endian word, the tail as in byte mode (BL_CRC_MODE_WORD)
+uint32_t crc32_word(const uint8_t *data, size_t len, uint32_t crc = kCrcInit);
+
+} // namespace stm32bl
+
+#endif /* STM32BL_CRC32_H_ */
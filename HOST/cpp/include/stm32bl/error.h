@@ -0,0 +1,35 @@
+/*
+ * error.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef STM32BL_ERROR_H_
+#define STM32BL_ERROR_H_
+
+#include <stdexcept>
+
+namespace stm32bl {
+
+// Transport and protocol errors, the status bytes of the bootloader are returned as they are
+class Error : public std::runtime_error {
+public:
+	using std::runtime_error::runtime_error;
+};
+
+// No reply, or a short one, within the timeout
+class Timeout : public Error {
+public:
+	using Error::Error;
+};
+
+// The bootloader replied NACK (0x7F), the CRC of the packet was bad
+class Nack : public Error {
+public:
+	using Error::Error;
+};
+
+} // namespace stm32bl
+
+#endif /* STM32BL_ERROR_H_ */
@@ -0,0 +1,46 @@
+/*
+ * serial_port.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#ifndef STM32BL_SERIAL_PORT_H_
+#define STM32BL_SERIAL_PORT_H_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace stm32bl {
+
+/* Raw 8N1 serial port (POSIX termios), also works on a pseudo terminal
+ * write() hands the whole buffer to the kernel in one call, read_exact() waits for
+ * exactly len bytes or the timeout.
+ */
+class SerialPort {
+public:
+	SerialPort(const std::string &path, unsigned baud);
+	~SerialPort();
+
+	SerialPort(const SerialPort &) = delete;
+	SerialPort &operator=(const SerialPort &) = delete;
+
+	void write(const uint8_t *data, size_t len);
+
+	// Returns the number of bytes read, less than len only on timeout
+	size_t read_exact(uint8_t *data, size_t len, std::chrono::milliseconds timeout);
+
+	void flush_input();
+	void set_baud(unsigned baud);
+	unsigned baud() const { return baud_; }
+
+private:
+	int fd_;
+	unsigned baud_;
+};
+
+} // namespace stm32bl
+
+#endif /* STM32BL_SERIAL_PORT_H_ */
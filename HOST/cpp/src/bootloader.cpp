@@ -0,0 +1,275 @@
+/*
+ * bootloader.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "stm32bl/bootloader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "stm32bl/crc32.h"
+
+namespace stm32bl {
+
+namespace {
+
+inline void put_u32(uint8_t *dst, uint32_t value)
+{
+	dst[0] = (uint8_t)value;
+	dst[1] = (uint8_t)(value >> 8);
+	dst[2] = (uint8_t)(value >> 16);
+	dst[3] = (uint8_t)(value >> 24);
+}
+
+inline uint32_t get_u32(const uint8_t *src)
+{
+	return (uint32_t)src[0] | ((uint32_t)src[1] << 8) | ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+std::string hex(uint32_t value)
+{
+	char buf[16];
+	snprintf(buf, sizeof(buf), "0x%x", value);
+	return buf;
+}
+
+} // namespace
+
+constexpr std::chrono::milliseconds Bootloader::kReplyTimeout;
+constexpr std::chrono::milliseconds Bootloader::kEraseTimeout;
+constexpr std::chrono::milliseconds Bootloader::kMassEraseTimeout;
+
+Bootloader::Bootloader(SerialPort &port)
+	: port_(port), tx_{}, rx_{}
+{
+}
+
+size_t Bootloader::build(uint8_t command, const uint8_t *args, size_t args_len)
+{
+	size_t len = 2 + args_len + 4;
+
+	tx_[0] = (uint8_t)(len - 1);
+	tx_[1] = command;
+	if (args_len)
+		memcpy(&tx_[2], args, args_len);
+	put_u32(&tx_[2 + args_len], crc32_byte(tx_.data(), 2 + args_len));
+	return len;
+}
+
+size_t Bootloader::build_mem_write(uint32_t address, const uint8_t *data, size_t len)
+{
+	size_t total = 11 + len;
+
+	tx_[0] = (uint8_t)(total - 1);
+	tx_[1] = BL_MEM_WRITE;
+	put_u32(&tx_[2], address);
+	tx_[6] = (uint8_t)len;
+	memcpy(&tx_[7], data, len);
+	put_u32(&tx_[7 + len], crc32_byte(tx_.data(), 7 + len));
+	return total;
+}
+
+void Bootloader::send(size_t len)
+{
+	port_.write(tx_.data(), len);
+}
+
+void Bootloader::read_exact(uint8_t *data, size_t len, std::chrono::milliseconds timeout)
+{
+	size_t got = port_.read_exact(data, len, timeout);
+	if (got < len)
+		throw Timeout("bootloader not responding (" + std::to_string(got) + "/" + std::to_string(len) + " bytes)");
+}
+
+uint8_t Bootloader::read_ack(std::chrono::milliseconds timeout)
+{
+	uint8_t ack[2];
+
+	read_exact(ack, 1, timeout);
+	if (ack[0] == BL_NACK)
+		throw Nack("NACK from the bootloader, CRC of the packet failed");
+	if (ack[0] != BL_ACK)
+		throw Error("unexpected reply " + hex(ack[0]));
+	read_exact(&ack[1], 1, kReplyTimeout);
+	return ack[1];
+}
+
+std::vector<uint8_t> Bootloader::transact(uint8_t command, const uint8_t *args, size_t args_len,
+		std::chrono::milliseconds timeout)
+{
+	send(build(command, args, args_len));
+	uint8_t len = read_ack(kReplyTimeout);
+	read_exact(rx_.data(), len, timeout);
+	return std::vector<uint8_t>(rx_.begin(), rx_.begin() + len);
+}
+
+uint8_t Bootloader::transact_status(uint8_t command, const uint8_t *args, size_t args_len,
+		std::chrono::milliseconds timeout)
+{
+	std::vector<uint8_t> reply = transact(command, args, args_len, timeout);
+	if (reply.empty())
+		throw Error("empty reply to command " + hex(command));
+	return reply[0];
+}
+
+std::vector<uint8_t> Bootloader::transact_stream(uint8_t command, const uint8_t *args, size_t args_len,
+		const Progress &progress)
+{
+	uint8_t hdr[BL_STREAM_HDR_LEN];
+
+	send(build(command, args, args_len));
+	if (read_ack(kReplyTimeout) < BL_STREAM_HDR_LEN)
+		throw Error("short stream header");
+	read_exact(hdr, BL_STREAM_HDR_LEN, kReplyTimeout);
+	if (hdr[0] != ADDR_VALID)
+		throw Error("address invalid, status " + hex(hdr[0]));
+
+	size_t chunk_len = (size_t)hdr[1] | ((size_t)hdr[2] << 8);
+	size_t total = get_u32(&hdr[3]);
+	if (total && !chunk_len)
+		throw Error("stream with no chunk length");
+
+	// chunks are read straight in to the result
+	std::vector<uint8_t> data(total);
+	size_t done = 0;
+	while (done < total) {
+		size_t this_len = std::min(chunk_len, total - done);
+		uint8_t crc[4];
+		read_exact(&data[done], this_len, kReplyTimeout);
+		read_exact(crc, sizeof(crc), kReplyTimeout);
+		if (get_u32(crc) != crc32_word(&data[done], this_len)) {
+			port_.flush_input();
+			throw Error("CRC of the stream failed at offset " + std::to_string(done));
+		}
+		done += this_len;
+		if (progress)
+			progress(done, total);
+	}
+	return data;
+}
+
+uint8_t Bootloader::get_version()
+{
+	return transact_status(BL_GET_VER, nullptr, 0);
+}
+
+std::vector<uint8_t> Bootloader::get_help()
+{
+	return transact(BL_GET_HELP, nullptr, 0);
+}
+
+uint16_t Bootloader::get_cid()
+{
+	std::vector<uint8_t> reply = transact(BL_GET_CID, nullptr, 0);
+	if (reply.size() < 2)
+		throw Error("short chip id reply");
+	return (uint16_t)(reply[0] | (reply[1] << 8));
+}
+
+uint8_t Bootloader::get_rdp_status()
+{
+	return transact_status(BL_GET_RDP_STATUS, nullptr, 0);
+}
+
+uint8_t Bootloader::go_to_address(uint32_t address)
+{
+	uint8_t args[4];
+
+	put_u32(args, address);
+	return transact_status(BL_GO_TO_ADDR, args, sizeof(args));
+}
+
+uint8_t Bootloader::flash_erase(uint8_t sector, uint8_t count)
+{
+	uint8_t args[2] = { sector, count };
+
+	// the bootloader replies once every sector is erased, bank 2 too
+	std::chrono::milliseconds timeout = kEraseTimeout * std::max<int>(count, 1);
+	if (sector == BL_MASS_ERASE || timeout > kMassEraseTimeout)
+		timeout = kMassEraseTimeout;
+	return transact_status(BL_FLASH_ERASE, args, sizeof(args), timeout);
+}
+
+/* Pipelined as mem_write_run() of the Python tool : packet N+1 goes out as soon as the ACK of
+ * packet N is in, the bootloader receives it while it programs packet N. The write status of N
+ * is read afterwards.
+ */
+uint8_t Bootloader::mem_write(uint32_t address, const uint8_t *data, size_t len, const Progress &progress)
+{
+	// a packet may wait for the erase of its sector
+	std::chrono::milliseconds timeout = kEraseTimeout;
+
+	size_t done = 0;
+	if (!len)
+		return Flash_HAL_OK;
+
+	size_t this_len = std::min(len, BL_V1_MAX_PAYLOAD);
+	send(build_mem_write(address, data, this_len));
+	while (this_len) {
+		read_ack(timeout);
+		done += this_len;
+
+		// next packet goes on the wire while the current one is programmed
+		size_t next_len = std::min(len - done, BL_V1_MAX_PAYLOAD);
+		if (next_len)
+			send(build_mem_write(address + (uint32_t)done, data + done, next_len));
+
+		uint8_t status;
+		read_exact(&status, 1, timeout);
+		if (status != Flash_HAL_OK) {
+			if (next_len) {
+				// drop the reply of the packet already in flight
+				try {
+					read_ack(timeout);
+					read_exact(rx_.data(), 1, timeout);
+				} catch (const Error &) {
+				}
+			}
+			return status;
+		}
+		if (progress)
+			progress(done, len);
+		this_len = next_len;
+	}
+	return Flash_HAL_OK;
+}
+
+uint8_t Bootloader::enable_rw_protect(uint16_t sectors, uint8_t mode)
+{
+	uint8_t args[3] = { (uint8_t)sectors, (uint8_t)(sectors >> 8), mode };
+
+	return transact_status(BL_EN_R_W_PROTECT, args, sizeof(args));
+}
+
+std::vector<uint8_t> Bootloader::mem_read(uint32_t address, uint32_t len, const Progress &progress)
+{
+	uint8_t args[8];
+
+	put_u32(&args[0], address);
+	put_u32(&args[4], len);
+	return transact_stream(BL_MEM_READ, args, sizeof(args), progress);
+}
+
+uint16_t Bootloader::read_sector_status()
+{
+	std::vector<uint8_t> reply = transact(BL_READ_SECTOR_P_STATUS, nullptr, 0);
+	if (reply.size() < 2)
+		throw Error("short sector status reply");
+	return (uint16_t)(reply[0] | (reply[1] << 8));
+}
+
+std::vector<uint8_t> Bootloader::otp_read()
+{
+	return transact_stream(BL_OTP_READ, nullptr, 0, {});
+}
+
+uint8_t Bootloader::disable_rw_protect()
+{
+	return transact_status(BL_DIS_R_W_PROTECT, nullptr, 0);
+}
+
+} // namespace stm32bl
@@ -0,0 +1,65 @@
+/*
+ * crc32.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "stm32bl/crc32.h"
+
+#include <array>
+#include <cstring>
+
+namespace stm32bl {
+
+namespace {
+
+constexpr uint32_t kPoly = 0x04C11DB7u;
+
+// table[i] : i in the top byte of the register, shifted out 8 times
+constexpr std::array<uint32_t, 256> make_table()
+{
+	std::array<uint32_t, 256> table{};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i << 24;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x80000000u) ? ((crc << 1) ^ kPoly) : (crc << 1);
+		table[i] = crc;
+	}
+	return table;
+}
+
+constexpr std::array<uint32_t, 256> kTable = make_table();
+
+// One write to the data register of the CRC unit
+inline uint32_t feed_word(uint32_t crc, uint32_t word)
+{
+	crc ^= word;
+	crc = (crc << 8) ^ kTable[crc >> 24];
+	crc = (crc << 8) ^ kTable[crc >> 24];
+	crc = (crc << 8) ^ kTable[crc >> 24];
+	crc = (crc << 8) ^ kTable[crc >> 24];
+	return crc;
+}
+
+} // namespace
+
+uint32_t crc32_byte(const uint8_t *data, size_t len, uint32_t crc)
+{
+	for (size_t i = 0; i < len; i++)
+		crc = feed_word(crc, data[i]);
+	return crc;
+}
+
+uint32_t crc32_word(const uint8_t *data, size_t len, uint32_t crc)
+{
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4) {
+		uint32_t word = (uint32_t)data[i] | ((uint32_t)data[i + 1] << 8) |
+				((uint32_t)data[i + 2] << 16) | ((uint32_t)data[i + 3] << 24);
+		crc = feed_word(crc, word);
+	}
+	return crc32_byte(data + i, len - i, crc);
+}
+
+} // namespace stm32bl
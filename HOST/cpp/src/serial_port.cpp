@@ -0,0 +1,142 @@
+/*
+ * serial_port.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include "stm32bl/serial_port.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "stm32bl/error.h"
+
+namespace stm32bl {
+
+namespace {
+
+std::string sys_error(const std::string &what)
+{
+	return what + ": " + strerror(errno);
+}
+
+speed_t to_speed(unsigned baud)
+{
+	switch (baud) {
+	case 9600:		return B9600;
+	case 19200:		return B19200;
+	case 38400:		return B38400;
+	case 57600:		return B57600;
+	case 115200:	return B115200;
+	case 230400:	return B230400;
+#ifdef B460800
+	case 460800:	return B460800;
+#endif
+#ifdef B921600
+	case 921600:	return B921600;
+#endif
+#ifdef B1000000
+	case 1000000:	return B1000000;
+#endif
+#ifdef B2000000
+	case 2000000:	return B2000000;
+#endif
+	default:
+		throw Error("unsupported baud rate " + std::to_string(baud));
+	}
+}
+
+} // namespace
+
+SerialPort::SerialPort(const std::string &path, unsigned baud)
+	: fd_(-1), baud_(baud)
+{
+	fd_ = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (fd_ < 0)
+		throw Error(sys_error("open " + path));
+
+	try {
+		set_baud(baud);
+	} catch (...) {
+		::close(fd_);
+		throw;
+	}
+	flush_input();
+}
+
+SerialPort::~SerialPort()
+{
+	if (fd_ >= 0)
+		::close(fd_);
+}
+
+void SerialPort::set_baud(unsigned baud)
+{
+	struct termios tio;
+
+	if (tcgetattr(fd_, &tio) < 0)
+		throw Error(sys_error("tcgetattr"));
+	cfmakeraw(&tio);
+	tio.c_cflag |= CLOCAL | CREAD;
+	tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	speed_t speed = to_speed(baud);
+	cfsetispeed(&tio, speed);
+	cfsetospeed(&tio, speed);
+	if (tcsetattr(fd_, TCSANOW, &tio) < 0)
+		throw Error(sys_error("tcsetattr"));
+	baud_ = baud;
+}
+
+void SerialPort::write(const uint8_t *data, size_t len)
+{
+	// one call for the whole frame, the loop only runs again on a partial write
+	while (len) {
+		ssize_t n = ::write(fd_, data, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			throw Error(sys_error("write"));
+		}
+		data += n;
+		len -= (size_t)n;
+	}
+}
+
+size_t SerialPort::read_exact(uint8_t *data, size_t len, std::chrono::milliseconds timeout)
+{
+	using clock = std::chrono::steady_clock;
+	const clock::time_point deadline = clock::now() + timeout;
+	size_t got = 0;
+
+	while (got < len) {
+		ssize_t n = ::read(fd_, data + got, len - got);
+		if (n > 0) {
+			got += (size_t)n;
+			continue;
+		}
+		if (n < 0 && errno != EINTR && errno != EAGAIN)
+			throw Error(sys_error("read"));
+
+		auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - clock::now());
+		if (left.count() <= 0)
+			break;
+		struct pollfd pfd = { fd_, POLLIN, 0 };
+		if (::poll(&pfd, 1, (int)left.count()) < 0 && errno != EINTR)
+			throw Error(sys_error("poll"));
+	}
+	return got;
+}
+
+void SerialPort::flush_input()
+{
+	tcflush(fd_, TCIFLUSH);
+}
+
+} // namespace stm32bl
@@ -0,0 +1,256 @@
+/*
+ * stm32bl_cli.cpp
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: KPODAR
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "stm32bl/bootloader.h"
+
+using namespace stm32bl;
+
+namespace {
+
+const char kUsage[] =
+	"usage : stm32bl -p PORT [-b BAUD] [-t] COMMAND [ARGS]\n"
+	"        stm32bl -p PORT [-b BAUD] [-t] -s SCRIPT     (one command per line, - for stdin)\n"
+	"\n"
+	"commands :\n"
+	"  version                      BL_GET_VER\n"
+	"  help                         BL_GET_HELP\n"
+	"  cid                          BL_GET_CID\n"
+	"  rdp                          BL_GET_RDP_STATUS\n"
+	"  go ADDR                      BL_GO_TO_ADDR\n"
+	"  erase SECTOR COUNT           BL_FLASH_ERASE\n"
+	"  mass-erase                   BL_FLASH_ERASE, sector 0xFF\n"
+	"  write FILE ADDR              BL_MEM_WRITE of the whole file\n"
+	"  read ADDR LEN FILE           BL_MEM_READ in to FILE\n"
+	"  protect SECTORS MODE         BL_EN_R_W_PROTECT, SECTORS is a bit mask, MODE 1 or 2\n"
+	"  sector-status                BL_READ_SECTOR_P_STATUS\n"
+	"  otp FILE                     BL_OTP_READ in to FILE\n"
+	"  unprotect                    BL_DIS_R_W_PROTECT\n"
+	"\n"
+	"Numbers take a 0x prefix for hex. -t prints the time and the rate of every command.\n"
+	"A script stops at the first command that fails, # starts a comment.\n";
+
+class UsageError : public Error {
+public:
+	using Error::Error;
+};
+
+uint32_t parse_number(const std::string &text)
+{
+	char *end;
+	unsigned long value = strtoul(text.c_str(), &end, 0);
+	if (text.empty() || *end)
+		throw UsageError("bad number '" + text + "'");
+	return (uint32_t)value;
+}
+
+void need_args(const std::vector<std::string> &args, size_t count)
+{
+	if (args.size() != count + 1)
+		throw UsageError(args[0] + " takes " + std::to_string(count) + " argument(s)");
+}
+
+std::vector<uint8_t> load_file(const std::string &name)
+{
+	std::ifstream file(name, std::ios::binary);
+	if (!file)
+		throw Error("cannot open " + name);
+	return std::vector<uint8_t>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void save_file(const std::string &name, const std::vector<uint8_t> &data)
+{
+	std::ofstream file(name, std::ios::binary);
+	if (!file.write((const char *)data.data(), (std::streamsize)data.size()))
+		throw Error("cannot write " + name);
+}
+
+// Non zero status of a write / erase / protect command
+void check_status(const char *what, uint8_t status)
+{
+	if (status == Flash_HAL_OK)
+		return;
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%s failed, status 0x%02x", what, status);
+	throw Error(buf);
+}
+
+// Runs one command, returns the number of bytes of data moved for the rate of -t
+size_t run_command(Bootloader &bl, const std::vector<std::string> &args)
+{
+	const std::string &cmd = args[0];
+
+	if (cmd == "version") {
+		need_args(args, 0);
+		printf("version 0x%02x\n", bl.get_version());
+	} else if (cmd == "help") {
+		need_args(args, 0);
+		printf("commands");
+		for (uint8_t code : bl.get_help())
+			printf(" 0x%02x", code);
+		printf("\n");
+	} else if (cmd == "cid") {
+		need_args(args, 0);
+		printf("cid 0x%03x\n", bl.get_cid());
+	} else if (cmd == "rdp") {
+		need_args(args, 0);
+		printf("rdp 0x%02x\n", bl.get_rdp_status());
+	} else if (cmd == "go") {
+		need_args(args, 1);
+		uint8_t status = bl.go_to_address(parse_number(args[1]));
+		if (status != ADDR_VALID)
+			throw Error("go : address invalid");
+		printf("go ok\n");
+	} else if (cmd == "erase" || cmd == "mass-erase") {
+		uint8_t status;
+		if (cmd == "erase") {
+			need_args(args, 2);
+			status = bl.flash_erase((uint8_t)parse_number(args[1]), (uint8_t)parse_number(args[2]));
+		} else {
+			need_args(args, 0);
+			status = bl.flash_erase(BL_MASS_ERASE, 0);
+		}
+		check_status("erase", status);
+		printf("erase ok\n");
+	} else if (cmd == "write") {
+		need_args(args, 2);
+		std::vector<uint8_t> data = load_file(args[1]);
+		check_status("write", bl.mem_write(parse_number(args[2]), data.data(), data.size()));
+		printf("write ok, %zu bytes\n", data.size());
+		return data.size();
+	} else if (cmd == "read") {
+		need_args(args, 3);
+		std::vector<uint8_t> data = bl.mem_read(parse_number(args[1]), parse_number(args[2]));
+		save_file(args[3], data);
+		printf("read ok, %zu bytes to %s\n", data.size(), args[3].c_str());
+		return data.size();
+	} else if (cmd == "protect") {
+		need_args(args, 2);
+		check_status("protect", bl.enable_rw_protect((uint16_t)parse_number(args[1]),
+				(uint8_t)parse_number(args[2])));
+		printf("protect ok\n");
+	} else if (cmd == "sector-status") {
+		need_args(args, 0);
+		printf("sector-status 0x%04x\n", bl.read_sector_status());
+	} else if (cmd == "otp") {
+		need_args(args, 1);
+		std::vector<uint8_t> data = bl.otp_read();
+		save_file(args[1], data);
+		printf("otp ok, %zu bytes to %s\n", data.size(), args[1].c_str());
+		return data.size();
+	} else if (cmd == "unprotect") {
+		need_args(args, 0);
+		check_status("unprotect", bl.disable_rw_protect());
+		printf("unprotect ok\n");
+	} else {
+		throw UsageError("unknown command '" + cmd + "'");
+	}
+	return 0;
+}
+
+void run_timed(Bootloader &bl, const std::vector<std::string> &args, bool timing)
+{
+	auto start = std::chrono::steady_clock::now();
+	size_t bytes = run_command(bl, args);
+	if (!timing)
+		return;
+
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (bytes && elapsed > 0)
+		printf("  %s : %.3f s, %zu bytes, %.1f bytes/s\n", args[0].c_str(), elapsed, bytes, bytes / elapsed);
+	else
+		printf("  %s : %.3f s\n", args[0].c_str(), elapsed);
+}
+
+int run_script(Bootloader &bl, std::istream &in, bool timing)
+{
+	std::string line;
+	unsigned line_nb = 0;
+
+	while (std::getline(in, line)) {
+		line_nb++;
+		line = line.substr(0, line.find('#'));
+		std::istringstream words(line);
+		std::vector<std::string> args{ std::istream_iterator<std::string>(words), std::istream_iterator<std::string>() };
+		if (args.empty())
+			continue;
+		try {
+			run_timed(bl, args, timing);
+		} catch (const Error &e) {
+			fprintf(stderr, "line %u : %s\n", line_nb, e.what());
+			return 1;
+		}
+	}
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	std::string port_name;
+	std::string script;
+	unsigned baud = 115200;
+	bool timing = false;
+	int i = 1;
+
+	for (; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+		std::string opt = argv[i];
+		if (opt == "-t") {
+			timing = true;
+		} else if ((opt == "-p" || opt == "-b" || opt == "-s") && i + 1 < argc) {
+			std::string value = argv[++i];
+			if (opt == "-p")
+				port_name = value;
+			else if (opt == "-s")
+				script = value;
+			else
+				baud = (unsigned)strtoul(value.c_str(), nullptr, 0);
+		} else {
+			fputs(kUsage, stderr);
+			return 2;
+		}
+	}
+
+	std::vector<std::string> args(argv + i, argv + argc);
+	if (port_name.empty() || (script.empty() == args.empty())) {
+		fputs(kUsage, stderr);
+		return 2;
+	}
+
+	try {
+		SerialPort port(port_name, baud);
+		Bootloader bl(port);
+
+		if (args.size()) {
+			run_timed(bl, args, timing);
+			return 0;
+		}
+		if (script == "-")
+			return run_script(bl, std::cin, timing);
+		std::ifstream file(script);
+		if (!file)
+			throw Error("cannot open " + script);
+		return run_script(bl, file, timing);
+	} catch (const UsageError &e) {
+		fprintf(stderr, "%s\n\n%s", e.what(), kUsage);
+		return 2;
+	} catch (const Error &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
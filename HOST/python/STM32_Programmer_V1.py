@@ -3,6 +3,12 @@ import struct
 import os
 import sys
 import glob
+import time
+import collections
+import concurrent.futures
+import io
+
+import image_loader
 
 Flash_HAL_OK                                        = 0x00
 Flash_HAL_ERROR                                     = 0x01
@@ -24,6 +30,17 @@ COMMAND_BL_READ_SECTOR_P_STATUS                     = 0x5A
 COMMAND_BL_OTP_READ                                 = 0x5B
 COMMAND_BL_DIS_R_W_PROTECT                          = 0x5C
 COMMAND_BL_MY_NEW_COMMAND                           = 0x5D
+COMMAND_BL_GET_PROTOCOL                             = 0x60
+COMMAND_BL_SET_BAUD                                 = 0x61
+COMMAND_BL_MEM_WRITE_LZ4                            = 0x62
+COMMAND_BL_MEM_WRITE_DELTA                          = 0x63
+COMMAND_BL_GET_SECTOR_HASHES                        = 0x64
+COMMAND_BL_BLANK_CHECK                              = 0x65
+COMMAND_BL_FLASH_ERASE_RANGE                        = 0x66
+COMMAND_BL_SLOT_INFO                                = 0x67
+COMMAND_BL_SLOT_ACTIVATE                            = 0x68
+COMMAND_BL_FLASH_STATUS                             = 0x69
+COMMAND_BL_GET_PROFILE                              = 0x6A
 
 
 #len details of the command
@@ -35,13 +52,113 @@ COMMAND_BL_GO_TO_ADDR_LEN                           = 10
 COMMAND_BL_FLASH_ERASE_LEN                          = 8
 COMMAND_BL_MEM_WRITE_LEN                            = 11
 COMMAND_BL_EN_R_W_PROTECT_LEN                       = 9
+COMMAND_BL_MEM_READ_LEN                             = 14
+COMMAND_BL_OTP_READ_LEN                             = 6
 COMMAND_BL_READ_SECTOR_P_STATUS_LEN                 = 6
 COMMAND_BL_DIS_R_W_PROTECT_LEN                      = 6
 COMMAND_BL_MY_NEW_COMMAND_LEN                       = 8
+COMMAND_BL_GET_PROTOCOL_LEN                         = 6
+COMMAND_BL_SET_BAUD_LEN                             = 10
+COMMAND_BL_GET_SECTOR_HASHES_LEN                    = 8
+COMMAND_BL_BLANK_CHECK_LEN                          = 8
+COMMAND_BL_FLASH_ERASE_RANGE_LEN                    = 14
+COMMAND_BL_SLOT_INFO_LEN                            = 6
+COMMAND_BL_SLOT_ACTIVATE_LEN                        = 15
+COMMAND_BL_FLASH_STATUS_LEN                         = 6
+COMMAND_BL_GET_PROFILE_LEN                          = 7
+
+#A/B firmware slots, see boot_slot.h
+BL_SLOT_A                                           = 0
+BL_SLOT_B                                           = 1
+BL_SLOT_NONE                                        = 0xFF
+BL_SLOT_BASE                                        = [ 0x08008000, 0x08108000 ]
+BL_SLOT_SIZE                                        = 0xF8000
+BL_SLOT_TRAILER_LEN                                 = 32
+BL_SLOT_OK                                          = 0x00
+slot_names = [ "A", "B" ]
+slot_state_names = [ "EMPTY", "PENDING", "TRIAL", "CONFIRMED", "BAD" ]
+slot_status_names = { 0x08 : "SLOT_INVALID", 0x09 : "SLOT_NOT_BLANK (erase the slot first)", 0x0A : "SLOT_CRC_ERROR" }
+
+#BL_SET_BAUD
+BL_BAUD_OK                                          = 0x00
+BL_BAUD_CONFIRM_TIMEOUT                             = 1.0       #seconds, the bootloader goes back to the old rate after this
+
+#Protocol v2 packets
+BL_V2_SOF                                           = 0x00
+BL_V2_HDR_LEN                                       = 12
+BL_V1_MAX_PAYLOAD                                   = 128
+BL_V2_FLAG_CRC_WORD                                 = 0x01
+BL_V2_FLAG_FIRST                                    = 0x02
+BL_V2_FLAG_LAST                                     = 0x04
+BL_V2_FLAG_AUTO_ERASE                               = 0x08      #the bootloader erases the sectors the first time a write touches them
+BL_V2_FLAG_DEFER                                    = 0x10      #the bootloader programs in the background, the status covers the packets done so far
+BL_V2_FLAG_WINDOW                                   = 0x20      #windowed write, one reply per packet : ACK, 2, sequence number, status
+BL_CAP_CRC_WORD                                     = 0x01
+BL_CAP_LZ4                                          = 0x02
+BL_CAP_DELTA                                        = 0x04
+BL_CAP_AUTO_ERASE                                   = 0x08
+BL_CAP_BG_ERASE                                     = 0x10
+BL_CAP_DEFER                                        = 0x20
+BL_CAP_WINDOW                                       = 0x40
+
+#windowed BL_MEM_WRITE
+BL_RX_FRAME_TIMEOUT                                 = 0.1       #seconds, the bootloader drops a packet which stops coming in
+BL_WINDOW_MAX_PACKETS                               = 255       #sequence numbers of the packets on the way must differ
+BL_WINDOW_MAX_RETRIES                               = 8         #packets sent again in a row without any progress
+
+#BL_FLASH_ERASE_RANGE status : the bank 2 sectors are erased in the background, the next flash commands wait for it
+BL_ERASE_BACKGROUND                                 = 0x0B
+#menu entries the bootloader serves while it erases in the background, the others wait for the erase
+BG_ERASE_MENUS                                      = [ 0, 1, 2, 3, 4, 7, 8, 15, 16, 17, 19, 21, 23, 24 ]
+
+#status of the streamed writes (BL_MEM_WRITE_LZ4, BL_MEM_WRITE_DELTA), on top of the Flash_HAL_xx ones
+BL_STREAM_DATA_ERROR                                = 0x05
+BL_DELTA_OLD_MISMATCH                               = 0x06
+BL_DELTA_CRC_ERROR                                  = 0x07
+BL_STREAM_LAST_TIMEOUT                              = 30        #seconds, the last packet of a delta erases and copies the image
+
+#Streamed replies (BL_MEM_READ..)
+BL_STREAM_HDR_LEN                                   = 7
+ADDR_VALID                                          = 0x00
+
+#boot time record of the bootloader (boot_fast.h), first 32 bytes of the CCM RAM
+BL_BOOT_TIME_ADDR                                   = 0x10000000
+BL_BOOT_TIME_LEN                                    = 32
+BL_BOOT_TIME_MAGIC                                  = 0x454D4954
+boot_path_names = { 0 : "unfinished", 1 : "FAST", 2 : "FULL", 3 : "BOOTLOADER" }
+
+#BL_GET_PROFILE : phases of the profile table (boot_profile.h), the commands follow
+BL_PROFILE_PHASES                                   = [ "RX", "CRC", "ERASE", "PROGRAM", "TX" ]
+BL_PROFILE_HDR_LEN                                  = 8
+BL_PROFILE_STAT_HDR_LEN                             = 24
+
+#OTP area of the F429
+BL_OTP_LEN                                          = 512
+BL_OTP_LOCK_LEN                                     = 16
+BL_OTP_BLOCK_LEN                                    = 32
 
 
 verbose_mode = 1
 mem_write_active =0
+mem_write_flags = 0
+#an erase runs in the background since the last BL_FLASH_ERASE_RANGE (BL_FLASH_ERASE replies once it is done)
+bg_erase_pending = 0
+
+#negotiated with the bootloader by protocol_negotiate()
+bl_protocol_version = 1
+bl_max_payload = BL_V1_MAX_PAYLOAD
+bl_capabilities = 0
+#bytes of packets the bootloader can take ahead of its replies (BL_CAP_WINDOW)
+bl_window = 0
+
+#last baud rate confirmed with the bootloader
+bl_baud_good = 115200
+
+#output file of BL_MEM_READ
+mem_read_file_name = "mem_read.bin"
+#output file of BL_GET_PROFILE, the table is printed if empty
+profile_csv_file_name = ""
+hashes_first_sector = 0
 
 #----------------------------- file ops----------------------------------------
 
@@ -55,6 +172,11 @@ def open_the_file():
     #read = bin_file.read()
     #global file_contents = bytearray(read)
 
+#the writes read their bytes from data instead of the .bin file
+def open_the_buffer(data):
+    global bin_file
+    bin_file = io.BytesIO(data)
+
 def read_the_file():
     pass
 
@@ -64,25 +186,106 @@ def close_the_file():
 
 
 
+#----------------------------- flash layout ----------------------------------------
+
+#STM32F429ZI : 2 banks of 12 sectors (4 x 16 KB, 1 x 64 KB, 7 x 128 KB)
+FLASH_BASE                                          = 0x08000000
+FLASH_BANK_SIZE                                     = 0x100000
+FLASH_SECTOR_COUNT                                  = 24
+BL_ERASE_TIMEOUT                                    = 5         #seconds, a 128 KB sector takes up to 2 s
+BL_MASS_ERASE_TIMEOUT                               = 60        #seconds, both banks take up to 32 s at x32
+
+#sector sizes of one bank, bank 2 has the same layout
+FLASH_BANK_SECTOR_SIZES = [ 0x4000, 0x4000, 0x4000, 0x4000, 0x10000, 0x20000, 0x20000, 0x20000, 0x20000, 0x20000, 0x20000, 0x20000 ]
+
+def flash_sector_base(sector):
+    bank = sector // len(FLASH_BANK_SECTOR_SIZES)
+    return FLASH_BASE + bank * FLASH_BANK_SIZE + sum(FLASH_BANK_SECTOR_SIZES[0:sector % len(FLASH_BANK_SECTOR_SIZES)])
+
+def flash_sector_size(sector):
+    return FLASH_BANK_SECTOR_SIZES[sector % len(FLASH_BANK_SECTOR_SIZES)]
+
+#sector which starts at address, None if address is not the start of a sector
+def flash_sector_at(address):
+    for sector in range(FLASH_SECTOR_COUNT):
+        if(flash_sector_base(sector) == address):
+            return sector
+    return None
+
+#sector which holds address, None outside the flash
+def flash_sector_of(address):
+    for sector in range(FLASH_SECTOR_COUNT):
+        if(flash_sector_base(sector) <= address < flash_sector_base(sector) + flash_sector_size(sector)):
+            return sector
+    return None
+
+#start addresses of the sectors and the end of the flash, a write run never crosses one
+def flash_sector_bounds():
+    bounds = [flash_sector_base(sector) for sector in range(FLASH_SECTOR_COUNT)]
+    return bounds + [flash_sector_base(FLASH_SECTOR_COUNT - 1) + flash_sector_size(FLASH_SECTOR_COUNT - 1)]
+
 #----------------------------- utilities----------------------------------------
 
 def word_to_byte(addr, index , lowerfirst):
     value = (addr >> ( 8 * ( index -1)) & 0x000000FF )
     return value
 
+#STM32 CRC unit : poly 0x04C11DB7, init 0xFFFFFFFF, MSB first, no final xor
+#CRC_TABLE[i] is i in the top byte of the register shifted out 8 times, so a 32-bit word
+#going through the unit is 4 table steps instead of 32 bit steps
+def make_crc_table():
+    table = []
+    for i in range(256):
+        Crc = i << 24
+        for bit in range(8):
+            if(Crc & 0x80000000):
+                Crc = ((Crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF
+            else:
+                Crc = (Crc << 1) & 0xFFFFFFFF
+        table.append(Crc)
+    return table
+
+CRC_TABLE = make_crc_table()
+
+#one 32-bit word written to the data register of the CRC unit
+def crc_feed_word(Crc, data):
+    Crc = Crc ^ data
+    Crc = ((Crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[Crc >> 24]
+    Crc = ((Crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[Crc >> 24]
+    Crc = ((Crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[Crc >> 24]
+    Crc = ((Crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[Crc >> 24]
+    return Crc
+
+#CRC of the bootloader "byte" mode : every byte goes in to the unit as a 32-bit word
 def get_crc(buff, length):
     Crc = 0xFFFFFFFF
-    #print(length)
     for data in buff[0:length]:
-        Crc = Crc ^ data
-        for i in range(32):
-            if(Crc & 0x80000000):
-                Crc = (Crc << 1) ^ 0x04C11DB7
-            else:
-                Crc = (Crc << 1)
+        Crc = crc_feed_word(Crc, data)
+    return Crc
+
+#CRC of the bootloader "word" mode : 4 bytes at a time as a little endian word,
+#the trailing bytes are fed one by one like in get_crc()
+def get_crc_word(buff, length):
+    Crc = 0xFFFFFFFF
+    nb_words = length // 4
+    for (data,) in struct.iter_unpack('<I', bytes(buff[0:4*nb_words])):
+        Crc = crc_feed_word(Crc, data)
+    for data in buff[4*nb_words:length]:
+        Crc = crc_feed_word(Crc, data)
     return Crc
 
 #----------------------------- Serial Port ----------------------------------------
+SERIAL_PROBE_THREADS                                = 32
+
+#True if the port opens
+def serial_port_probe(port):
+    try:
+        s = serial.Serial(port)
+        s.close()
+        return True
+    except (OSError, serial.SerialException):
+        return False
+
 def serial_ports():
     """ Lists serial port names
 
@@ -101,15 +304,10 @@ def serial_ports():
     else:
         raise EnvironmentError('Unsupported platform')
 
-    result = []
-    for port in ports:
-        try:
-            s = serial.Serial(port)
-            s.close()
-            result.append(port)
-        except (OSError, serial.SerialException):
-            pass
-    return result
+    #an open can block for a while on a missing port, the ports are probed in parallel
+    with concurrent.futures.ThreadPoolExecutor(max_workers=SERIAL_PROBE_THREADS) as pool:
+        found = list(pool.map(serial_port_probe, ports))
+    return [port for port, ok in zip(ports, found) if ok]
 
 def Serial_Port_Configuration(port):
     global ser
@@ -141,18 +339,217 @@ def Close_serial_port():
 def purge_serial_port():
     ser.reset_input_buffer()
     
-def Write_to_serial_port(value, *length):
-        data = struct.pack('>B', value)
-        if (verbose_mode):
-            value = bytearray(data)
-            #print("   "+hex(value[0]), end='')
-            print("   "+"0x{:02x}".format(value[0]),end=' ')
-        if(mem_write_active and (not verbose_mode)):
-                print("#",end=' ')
-        ser.write(data)
+#sends a whole frame (the first length bytes of buff) with one write
+def Write_to_serial_port(buff, length):
+    data = bytes(buff[0:length])
+    if (verbose_mode):
+        print("".join("   0x{:02x} ".format(x) for x in data), end='')
+    if(mem_write_active and (not verbose_mode)):
+        print("#",end=' ')
+    ser.write(data)
+
 
 
         
+#----------------------------- LZ4 ----------------------------------------
+
+#LZ4 block format, see boot_lz4.c
+LZ4_MIN_MATCH                                       = 4
+LZ4_MAX_OFFSET                                      = 65535
+LZ4_LAST_LITERALS                                   = 5     #the last 5 bytes are always literals
+LZ4_MF_LIMIT                                        = 12    #no match starts in the last 12 bytes
+
+def lz4_put_len(out, length):
+    while(length >= 255):
+        out.append(255)
+        length -= 255
+    out.append(length)
+
+def lz4_put_sequence(out, literals, offset, match_len):
+    lit_len = len(literals)
+    token = min(lit_len, 15) << 4
+    if(match_len):
+        token |= min(match_len - LZ4_MIN_MATCH, 15)
+    out.append(token)
+    if(lit_len >= 15):
+        lz4_put_len(out, lit_len - 15)
+    out += literals
+    if(match_len):
+        out.append(offset & 0xFF)
+        out.append(offset >> 8)
+        if(match_len - LZ4_MIN_MATCH >= 15):
+            lz4_put_len(out, match_len - LZ4_MIN_MATCH - 15)
+
+#greedy LZ4 block compressor, good enough for the 0xFF / 0x00 runs of a firmware image
+def lz4_compress(data):
+    out = bytearray()
+    table = {}
+    length = len(data)
+    match_limit = length - LZ4_LAST_LITERALS
+    anchor = 0
+    pos = 0
+    while(pos + LZ4_MF_LIMIT <= length):
+        key = data[pos:pos+LZ4_MIN_MATCH]
+        ref = table.get(key)
+        table[key] = pos
+        if(ref is None or pos - ref > LZ4_MAX_OFFSET):
+            pos += 1
+            continue
+        match_len = LZ4_MIN_MATCH
+        while(pos + match_len < match_limit and data[ref + match_len] == data[pos + match_len]):
+            match_len += 1
+        lz4_put_sequence(out, data[anchor:pos], pos - ref, match_len)
+        pos += match_len
+        anchor = pos
+    lz4_put_sequence(out, data[anchor:], 0, 0)
+    return bytes(out)
+
+#reference decoder, checks the compressor output before it is sent
+def lz4_decompress(data):
+    out = bytearray()
+    pos = 0
+    while(pos < len(data)):
+        token = data[pos]
+        pos += 1
+        lit_len = token >> 4
+        if(lit_len == 15):
+            while True:
+                lit_len += data[pos]
+                pos += 1
+                if(data[pos-1] != 255):
+                    break
+        out += data[pos:pos+lit_len]
+        pos += lit_len
+        if(pos >= len(data)):
+            break
+        offset = data[pos] | (data[pos+1] << 8)
+        pos += 2
+        match_len = (token & 0x0F) + LZ4_MIN_MATCH
+        if(match_len == 15 + LZ4_MIN_MATCH):
+            while True:
+                match_len += data[pos]
+                pos += 1
+                if(data[pos-1] != 255):
+                    break
+        for i in range(match_len):
+            out.append(out[-offset])
+    return bytes(out)
+
+#----------------------------- delta patches ----------------------------------------
+
+#patch format, see boot_delta.h
+BL_DELTA_MAGIC                                      = 0x31444C42
+BL_DELTA_HDR_LEN                                    = 20
+BL_DELTA_OP_COPY                                    = 0x01
+BL_DELTA_OP_DATA                                    = 0x02
+BL_DELTA_OP_FILL                                    = 0x03
+DELTA_KEY_LEN                                       = 8     #length of the keys of the old image index
+DELTA_MIN_COPY                                      = 12    #shorter copies cost more than the bytes themselves
+DELTA_MIN_FILL                                      = 16
+
+def delta_put_varint(out, value):
+    while(value >= 0x80):
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+
+def delta_get_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        value |= (data[pos] & 0x7F) << shift
+        shift += 7
+        pos += 1
+        if(not (data[pos-1] & 0x80)):
+            return value, pos
+
+#number of equal bytes at a[ai:] and b[bi:]
+def delta_match_len(a, ai, b, bi):
+    n = min(len(a) - ai, len(b) - bi)
+    length = 0
+    while(length + 64 <= n and a[ai+length:ai+length+64] == b[bi+length:bi+length+64]):
+        length += 64
+    while(length < n and a[ai+length] == b[bi+length]):
+        length += 1
+    return length
+
+#greedy patch generator : copies from the old image (same displacement as the last copy first,
+#then through an index of the old image), fills for runs of one byte, the rest as data
+def delta_make_patch(old, new):
+    out = bytearray(struct.pack('<5I', BL_DELTA_MAGIC, len(old), get_crc_word(old, len(old)), len(new), get_crc_word(new, len(new))))
+
+    index = {}
+    for i in range(len(old) - DELTA_KEY_LEN + 1):
+        index.setdefault(old[i:i+DELTA_KEY_LEN], i)
+
+    literals = bytearray()
+    def flush_literals():
+        if(literals):
+            out.append(BL_DELTA_OP_DATA)
+            delta_put_varint(out, len(literals))
+            out.extend(literals)
+            literals.clear()
+
+    displacement = 0
+    pos = 0
+    while(pos < len(new)):
+        run = 1
+        while(pos + run < len(new) and new[pos + run] == new[pos] and run < DELTA_MIN_FILL):
+            run += 1
+        if(run >= DELTA_MIN_FILL):
+            while(pos + run < len(new) and new[pos + run] == new[pos]):
+                run += 1
+            flush_literals()
+            out.append(BL_DELTA_OP_FILL)
+            delta_put_varint(out, run)
+            out.append(new[pos])
+            pos += run
+            continue
+
+        best_len = 0
+        best_src = 0
+        for src in (pos + displacement, index.get(new[pos:pos+DELTA_KEY_LEN])):
+            if(src is None or src < 0 or src >= len(old)):
+                continue
+            length = delta_match_len(old, src, new, pos)
+            if(length > best_len):
+                best_len, best_src = length, src
+        if(best_len >= DELTA_MIN_COPY):
+            flush_literals()
+            out.append(BL_DELTA_OP_COPY)
+            delta_put_varint(out, best_src)
+            delta_put_varint(out, best_len)
+            displacement = best_src - pos
+            pos += best_len
+        else:
+            literals.append(new[pos])
+            pos += 1
+    flush_literals()
+    return bytes(out)
+
+#reference applier, checks the patch before it is sent
+def delta_apply(old, patch):
+    out = bytearray()
+    pos = BL_DELTA_HDR_LEN
+    while(pos < len(patch)):
+        op = patch[pos]
+        pos += 1
+        if(op == BL_DELTA_OP_COPY):
+            src, pos = delta_get_varint(patch, pos)
+            length, pos = delta_get_varint(patch, pos)
+            out += old[src:src+length]
+        elif(op == BL_DELTA_OP_DATA):
+            length, pos = delta_get_varint(patch, pos)
+            out += patch[pos:pos+length]
+            pos += length
+        elif(op == BL_DELTA_OP_FILL):
+            length, pos = delta_get_varint(patch, pos)
+            out += bytes([patch[pos]]) * length
+            pos += 1
+        else:
+            return None
+    return bytes(out)
+
 #----------------------------- command processing----------------------------------------
 
 def process_COMMAND_BL_MY_NEW_COMMAND(length):
@@ -203,6 +600,10 @@ def process_COMMAND_BL_FLASH_ERASE(length):
             print("\n   Erase Status: Fail  Code: FLASH_HAL_TIMEOUT")
         elif(erase_status[0] == Flash_HAL_INV_ADDR):
             print("\n   Erase Status: Fail  Code: FLASH_HAL_INV_SECTOR")
+        elif(erase_status[0] == BL_ERASE_BACKGROUND):
+            global bg_erase_pending
+            bg_erase_pending = 1
+            print("\n   Erase Status: Started  Code: ERASE_BACKGROUND (bank 2 is erased in the background)")
         else:
             print("\n   Erase Status: Fail  Code: UNKNOWN_ERROR_CODE")
     else:
@@ -212,20 +613,677 @@ def process_COMMAND_BL_MEM_WRITE(length):
     write_status=0
     value = read_serial_port(length)
     write_status = bytearray(value)
-    if(write_status[0] == Flash_HAL_OK):
+    process_COMMAND_BL_MEM_WRITE_status(write_status[0])
+
+def process_COMMAND_BL_MEM_WRITE_status(write_status):
+    if(write_status == Flash_HAL_OK):
         print("\n   Write_status: FLASH_HAL_OK")
-    elif(write_status[0] == Flash_HAL_ERROR):
+    elif(write_status == Flash_HAL_ERROR):
         print("\n   Write_status: FLASH_HAL_ERROR")
-    elif(write_status[0] == Flash_HAL_BUSY):
+    elif(write_status == Flash_HAL_BUSY):
         print("\n   Write_status: FLASH_HAL_BUSY")
-    elif(write_status[0] == Flash_HAL_TIMEOUT):
+    elif(write_status == Flash_HAL_TIMEOUT):
         print("\n   Write_status: FLASH_HAL_TIMEOUT")
-    elif(write_status[0] == Flash_HAL_INV_ADDR):
+    elif(write_status == Flash_HAL_INV_ADDR):
         print("\n   Write_status: FLASH_HAL_INV_ADDR")
     else:
         print("\n   Write_status: UNKNOWN_ERROR")
     print("\n")
-    
+
+#reads the next chunk of the file in to data_buf as a BL_MEM_WRITE packet and sends it
+#returns the number of payload bytes sent
+def mem_write_send_packet(data_buf, base_mem_address, bytes_remaining):
+    data_buf[1] = COMMAND_BL_MEM_WRITE
+    if(bytes_remaining >= 128):
+        len_to_read = 128
+    else:
+        len_to_read = bytes_remaining
+    #get the bytes in to buffer by reading file
+    data_buf[7:7+len_to_read] = bin_file.read(len_to_read)
+
+    #populate base mem address
+    data_buf[2] = word_to_byte(base_mem_address,1,1)
+    data_buf[3] = word_to_byte(base_mem_address,2,1)
+    data_buf[4] = word_to_byte(base_mem_address,3,1)
+    data_buf[5] = word_to_byte(base_mem_address,4,1)
+
+    data_buf[6] = len_to_read
+
+    #/* 1 byte len + 1 byte command code + 4 byte mem base address
+    #* 1 byte payload len + len_to_read is amount of bytes read from file + 4 byte CRC
+    #*/
+    mem_write_cmd_total_len = COMMAND_BL_MEM_WRITE_LEN+len_to_read
+
+    #first field is "len_to_follow"
+    data_buf[0] =mem_write_cmd_total_len-1
+
+    crc32       = get_crc(data_buf,mem_write_cmd_total_len-4)
+    data_buf[7+len_to_read] = word_to_byte(crc32,1,1)
+    data_buf[8+len_to_read] = word_to_byte(crc32,2,1)
+    data_buf[9+len_to_read] = word_to_byte(crc32,3,1)
+    data_buf[10+len_to_read] = word_to_byte(crc32,4,1)
+
+    Write_to_serial_port(data_buf,mem_write_cmd_total_len)
+
+    return len_to_read
+
+#builds a v1 packet ([len to follow][command][args][CRC32]) and sends it
+def v1_send_packet(command, args):
+    packet = [len(args) + 5, command] + list(args)
+    crc32 = get_crc(packet,len(packet)) & 0xffffffff
+    packet.append(word_to_byte(crc32,1,1))
+    packet.append(word_to_byte(crc32,2,1))
+    packet.append(word_to_byte(crc32,3,1))
+    packet.append(word_to_byte(crc32,4,1))
+    Write_to_serial_port(packet,len(packet))
+
+#builds a protocol v2 packet and sends it
+def v2_send_packet(command, flags, arg, payload, seq=0):
+    packet = [0] * BL_V2_HDR_LEN
+    packet[0] = BL_V2_SOF
+    packet[1] = command
+    packet[2] = flags
+    if(bl_capabilities & BL_CAP_CRC_WORD):
+        packet[2] |= BL_V2_FLAG_CRC_WORD
+    packet[3] = seq & 0xFF                          #sequence number
+    packet[4] = word_to_byte(len(payload),1,1)
+    packet[5] = word_to_byte(len(payload),2,1)
+    packet[8] = word_to_byte(arg,1,1)
+    packet[9] = word_to_byte(arg,2,1)
+    packet[10] = word_to_byte(arg,3,1)
+    packet[11] = word_to_byte(arg,4,1)
+
+    #payload starts word aligned right after the header
+    packet += list(bytearray(payload))
+
+    if(packet[2] & BL_V2_FLAG_CRC_WORD):
+        crc32 = get_crc_word(packet,len(packet))
+    else:
+        crc32 = get_crc(packet,len(packet)) & 0xffffffff
+    packet.append(word_to_byte(crc32,1,1))
+    packet.append(word_to_byte(crc32,2,1))
+    packet.append(word_to_byte(crc32,3,1))
+    packet.append(word_to_byte(crc32,4,1))
+
+    #pad the packet to a multiple of 4 bytes
+    while(len(packet) % 4):
+        packet.append(0)
+
+    Write_to_serial_port(packet,len(packet))
+
+#reads the next chunk of the file in to a protocol v2 BL_MEM_WRITE packet and sends it
+#With BL_V2_FLAG_DEFER the write is one run of packets : FIRST on the first one, LAST on the last one
+#(its status waits for the flash and covers the whole run)
+#returns the number of payload bytes sent
+def mem_write_send_packet_v2(base_mem_address, bytes_remaining, first):
+    if(bytes_remaining >= bl_max_payload):
+        len_to_read = bl_max_payload
+    else:
+        len_to_read = bytes_remaining
+
+    flags = mem_write_flags
+    if(bl_capabilities & BL_CAP_DEFER):
+        flags |= BL_V2_FLAG_DEFER
+        if(first):
+            flags |= BL_V2_FLAG_FIRST
+        if(len_to_read == bytes_remaining):
+            flags |= BL_V2_FLAG_LAST
+
+    v2_send_packet(COMMAND_BL_MEM_WRITE, flags, base_mem_address, bin_file.read(len_to_read))
+
+    return len_to_read
+
+#writes length bytes of the open .bin file (from its current position) at base_mem_address
+#Pipelined write : packet N+1 is sent as soon as the ACK of packet N is received,
+#so it is transferred while the bootloader programs packet N.
+#The write status of packet N is read afterwards.
+#With BL_V2_FLAG_DEFER the bootloader queues packet N for its flash engine and replies the status
+#right away, it programs while the next packets come in. That only pays in bank 2 : the bootloader runs
+#from bank 1 and stalls while bank 1 is written (see flash_queue_sim.py for the gain).
+#A bootloader with BL_CAP_WINDOW gets a windowed write instead, see mem_write_window().
+def mem_write_run(base_mem_address, length):
+    global mem_write_active
+    mem_write_active=1
+    data_buf = [0] * 255
+    bytes_so_far_sent = 0
+    bytes_remaining = length
+    write_status = Flash_HAL_OK
+    start_time = time.time()
+
+    #a packet may wait for the erase of its sector, or for the whole background erase
+    global bg_erase_pending
+    if(bg_erase_pending):
+        ser.timeout = BL_MASS_ERASE_TIMEOUT
+        bg_erase_pending = 0
+    elif(mem_write_flags & BL_V2_FLAG_AUTO_ERASE):
+        ser.timeout = BL_ERASE_TIMEOUT
+
+    if(bl_protocol_version >= 2):
+        send_packet = lambda addr, remaining: mem_write_send_packet_v2(addr, remaining, remaining == length)
+    else:
+        send_packet = lambda addr, remaining: mem_write_send_packet(data_buf, addr, remaining)
+
+    if(bl_window):
+        write_status, bytes_so_far_sent = mem_write_window(base_mem_address, length)
+        len_to_read = 0
+    else:
+        len_to_read = send_packet(base_mem_address, bytes_remaining)
+    while(len_to_read):
+        base_mem_address+=len_to_read
+        bytes_so_far_sent+=len_to_read
+        bytes_remaining = length - bytes_so_far_sent
+
+        if(mem_write_read_ack() < 0):
+            write_status = Flash_HAL_TIMEOUT
+            break
+
+        #next packet goes on the wire while the current one is programmed
+        next_len = 0
+        if(bytes_remaining):
+            next_len = send_packet(base_mem_address, bytes_remaining)
+
+        write_status = mem_write_read_status()
+        print("\n   bytes_so_far_sent:{0} -- bytes_remaining:{1}\n".format(bytes_so_far_sent,bytes_remaining))
+        if(write_status != Flash_HAL_OK):
+            process_COMMAND_BL_MEM_WRITE_status(write_status)
+            if(next_len):
+                #drop the reply of the packet already in flight
+                if(mem_write_read_ack() == 0):
+                    mem_write_read_status()
+            break
+        len_to_read = next_len
+
+    elapsed = time.time() - start_time
+    if(elapsed > 0):
+        print("\n   {0} bytes in {1:.2f} s : {2:.1f} bytes/s".format(bytes_so_far_sent, elapsed, bytes_so_far_sent/elapsed))
+    ser.timeout = 2
+    mem_write_active=0
+    return write_status
+
+#Windowed write (BL_V2_FLAG_WINDOW) : packets go out as long as less than bl_window bytes are waiting
+#for their reply, every one with the next sequence number. The bootloader replies once per packet in
+#the order it receives them : ACK, 2, sequence number, status once the packet is programmed, or NACK
+#for a bad CRC. Only the NACKed packets are sent again (with a new sequence number).
+#No reply, or a reply out of step (bytes lost on the link) : wait for the bootloader to drop what it has
+#(BL_RX_FRAME_TIMEOUT), then send again all the packets with no reply.
+#Returns the write status and the number of bytes written
+def mem_write_window(base_mem_address, length):
+    data = bin_file.read(length)
+    offsets = collections.deque(range(0, length, bl_max_payload))
+    packet_len = (BL_V2_HDR_LEN + bl_max_payload + 4 + 3) & ~3
+    window = max(1, min(BL_WINDOW_MAX_PACKETS, bl_window // packet_len))
+    flags = (mem_write_flags & BL_V2_FLAG_AUTO_ERASE) | BL_V2_FLAG_WINDOW
+    in_flight = collections.deque()         #(sequence number, offset) in the order sent
+    seq = 0
+    retries = 0
+    bytes_written = 0
+    print("\n   Window : {0} packets of {1} bytes".format(window, bl_max_payload))
+
+    while(offsets or in_flight):
+        while(offsets and len(in_flight) < window):
+            offset = offsets.popleft()
+            v2_send_packet(COMMAND_BL_MEM_WRITE, flags, base_mem_address + offset, data[offset:offset+bl_max_payload], seq)
+            in_flight.append((seq, offset))
+            seq = (seq + 1) & 0xFF
+
+        reply = read_serial_port(1)
+        if(len(reply) == 1 and reply[0] == 0x7F):
+            #bad CRC : the oldest packet goes out again
+            offsets.appendleft(in_flight.popleft()[1])
+            retries += 1
+        else:
+            if(len(reply) == 1 and reply[0] == 0xA5):
+                reply += read_serial_port(3)
+            if(len(reply) == 4 and reply[1] == 2 and reply[2] == in_flight[0][0]):
+                offset = in_flight.popleft()[1]
+                if(reply[3] != Flash_HAL_OK):
+                    process_COMMAND_BL_MEM_WRITE_status(reply[3])
+                    #drop the replies of the packets still on the way
+                    read_serial_port(4 * len(in_flight))
+                    purge_serial_port()
+                    return reply[3], bytes_written
+                bytes_written += min(bl_max_payload, length - offset)
+                retries = 0
+                print("\n   bytes_so_far_sent:{0} -- bytes_remaining:{1}\n".format(bytes_written, length - bytes_written))
+                continue
+
+            print("\n   No reply or reply out of step : {0} packets sent again".format(len(in_flight)))
+            time.sleep(2 * BL_RX_FRAME_TIMEOUT)
+            purge_serial_port()
+            offsets.extendleft(reversed([offset for (s, offset) in in_flight]))
+            in_flight.clear()
+            retries += 1
+
+        if(retries > BL_WINDOW_MAX_RETRIES):
+            print("\n   Too many errors on the link")
+            #drop the replies of the packets still on the way
+            time.sleep(2 * BL_RX_FRAME_TIMEOUT)
+            purge_serial_port()
+            return Flash_HAL_TIMEOUT, bytes_written
+
+    return Flash_HAL_OK, bytes_written
+
+def process_COMMAND_BL_STREAM_status(write_status):
+    if(write_status == BL_STREAM_DATA_ERROR):
+        print("\n   Write_status: STREAM_DATA_ERROR")
+    elif(write_status == BL_DELTA_OLD_MISMATCH):
+        print("\n   Write_status: DELTA_OLD_MISMATCH, the device doesn't run the image of the patch. Use BL_MEM_WRITE")
+    elif(write_status == BL_DELTA_CRC_ERROR):
+        print("\n   Write_status: DELTA_CRC_ERROR")
+    else:
+        process_COMMAND_BL_MEM_WRITE_status(write_status)
+
+#sends data as a stream of v2 packets (first packet flagged FIRST, last one LAST) and returns the status
+#Pipelined like BL_MEM_WRITE : packet N+1 goes out after the ACK of packet N
+def v2_send_stream(command, base_mem_address, data, flags=0):
+    chunks = [data[x:x+bl_max_payload] for x in range(0, len(data), bl_max_payload)]
+    def send_chunk(n):
+        chunk_flags = flags
+        if(n == 0):
+            chunk_flags |= BL_V2_FLAG_FIRST
+        if(n == len(chunks) - 1):
+            chunk_flags |= BL_V2_FLAG_LAST
+        v2_send_packet(command, chunk_flags, base_mem_address, chunks[n])
+
+    write_status = Flash_HAL_OK
+    global bg_erase_pending
+    if(bg_erase_pending):
+        #the first packet waits for the background erase
+        ser.timeout = BL_MASS_ERASE_TIMEOUT
+        bg_erase_pending = 0
+    send_chunk(0)
+    for n in range(len(chunks)):
+        if(mem_write_read_ack() < 0):
+            return Flash_HAL_TIMEOUT
+        next_sent = 0
+        if(n + 1 < len(chunks)):
+            send_chunk(n + 1)
+            next_sent = 1
+            if(flags & BL_V2_FLAG_AUTO_ERASE):
+                #the packet may wait for the erase of a sector
+                ser.timeout = BL_ERASE_TIMEOUT
+        else:
+            #the last packet commits the stream, it can take a while
+            ser.timeout = BL_STREAM_LAST_TIMEOUT
+        write_status = mem_write_read_status()
+        ser.timeout = 2
+        if(write_status != Flash_HAL_OK):
+            process_COMMAND_BL_STREAM_status(write_status)
+            if(next_sent):
+                #drop the reply of the packet already in flight
+                if(mem_write_read_ack() == 0):
+                    mem_write_read_status()
+            break
+    return write_status
+
+#asks if the bootloader should erase the flash on the way, returns the v2 flags to use
+def ask_auto_erase():
+    if(not (bl_capabilities & BL_CAP_AUTO_ERASE)):
+        return 0
+    answer = input("\n   Erase the flash sectors as they are written (y/n) :")
+    if(answer.lower().startswith('y')):
+        return BL_V2_FLAG_AUTO_ERASE
+    return 0
+
+#asks the bootloader which protocol it speaks, bootloaders without BL_GET_PROTOCOL don't answer
+#and we stay with v1 packets
+def protocol_negotiate():
+    global bl_protocol_version
+    global bl_max_payload
+    global bl_capabilities
+    global bl_window
+    data_buf = [0] * COMMAND_BL_GET_PROTOCOL_LEN
+    data_buf[0] = COMMAND_BL_GET_PROTOCOL_LEN-1
+    data_buf[1] = COMMAND_BL_GET_PROTOCOL
+    crc32       = get_crc(data_buf,COMMAND_BL_GET_PROTOCOL_LEN-4)
+    crc32 = crc32 & 0xffffffff
+    data_buf[2] = word_to_byte(crc32,1,1)
+    data_buf[3] = word_to_byte(crc32,2,1)
+    data_buf[4] = word_to_byte(crc32,3,1)
+    data_buf[5] = word_to_byte(crc32,4,1)
+
+    ser.write(bytes(data_buf))
+
+    bl_protocol_version = 1
+    bl_max_payload = BL_V1_MAX_PAYLOAD
+    bl_capabilities = 0
+    bl_window = 0
+    ack = read_serial_port(2)
+    if(len(ack) == 2 and ack[0] == 0xA5 and ack[1] >= 4):
+        reply = read_serial_port(ack[1])
+        if(len(reply) >= 4 and reply[0] >= 2):
+            bl_protocol_version = reply[0]
+            bl_capabilities = reply[1]
+            bl_max_payload = reply[2] | (reply[3] << 8)
+        if(len(reply) >= 6 and (bl_capabilities & BL_CAP_WINDOW)):
+            bl_window = reply[4] | (reply[5] << 8)
+    purge_serial_port()
+    print("\n   Bootloader protocol v{0}, max payload {1} bytes".format(bl_protocol_version, bl_max_payload))
+    if(bl_window):
+        print("\n   Write window {0} bytes".format(bl_window))
+
+#reads ACK + "len to follow" of a BL_MEM_WRITE packet
+def mem_write_read_ack():
+    ack=read_serial_port(2)
+    if(len(ack) < 1):
+        print("\n   Timeout : Bootloader not responding")
+        return -2
+    if(ack[0] == 0xA5):
+        return 0
+    print("\n   CRC: FAIL \n")
+    return -1
+
+#reads the write status byte of a BL_MEM_WRITE packet
+def mem_write_read_status():
+    value = read_serial_port(1)
+    if(len(value) < 1):
+        print("\n   Timeout : Bootloader not responding")
+        return Flash_HAL_TIMEOUT
+    return value[0]
+
+#reads a streamed reply (header + CRC protected chunks), returns the data or None
+def read_stream_data(length):
+    value = read_serial_port(length)
+    if(len(value) < BL_STREAM_HDR_LEN):
+        print("\n   Timeout : Bootloader not responding")
+        return None
+    status = value[0]
+    chunk_len = value[1] | (value[2] << 8)
+    total_len = value[3] | (value[4] << 8) | (value[5] << 16) | (value[6] << 24)
+    if(status != ADDR_VALID):
+        print("\n   Address Status : INVALID")
+        return None
+
+    data = bytearray()
+    while(len(data) < total_len):
+        this_len = min(chunk_len, total_len - len(data))
+        chunk = read_serial_port(this_len + 4)
+        if(len(chunk) < this_len + 4):
+            print("\n   Timeout : Bootloader not responding")
+            return None
+        crc32 = chunk[this_len] | (chunk[this_len+1] << 8) | (chunk[this_len+2] << 16) | (chunk[this_len+3] << 24)
+        if(crc32 != get_crc_word(chunk, this_len)):
+            print("\n   CRC: FAIL at offset {0}".format(len(data)))
+            purge_serial_port()
+            return None
+        data += chunk[0:this_len]
+    return data
+
+def process_COMMAND_BL_MEM_READ(length):
+    start = time.time()
+    data = read_stream_data(length)
+    if(data is None):
+        return
+    elapsed = time.time() - start
+    with open(mem_read_file_name, 'wb') as f:
+        f.write(data)
+    print("\n   {0} bytes written to {1}".format(len(data), mem_read_file_name))
+    if(elapsed > 0):
+        print("\n   {0} bytes in {1:.2f} s : {2:.1f} bytes/s".format(len(data), elapsed, len(data)/elapsed))
+
+def process_COMMAND_BL_OTP_READ(length):
+    data = read_stream_data(length)
+    if(data is None):
+        return
+    if(len(data) < BL_OTP_LEN + BL_OTP_LOCK_LEN):
+        print("\n   OTP reply too short : {0} bytes".format(len(data)))
+        return
+    print("\n  ====================================")
+    print("\n  Block   Lock      Data")
+    print("\n  ====================================")
+    for block in range(BL_OTP_LEN // BL_OTP_BLOCK_LEN):
+        lock = data[BL_OTP_LEN + block]
+        block_data = data[block*BL_OTP_BLOCK_LEN:(block+1)*BL_OTP_BLOCK_LEN]
+        print("\n  {0:5d}   {1:8s}  {2}".format(block, "LOCKED" if lock == 0x00 else "open", block_data.hex()))
+
+def process_COMMAND_BL_GET_SECTOR_HASHES(length):
+    data = read_stream_data(length)
+    if(data is None):
+        return
+    print("\n  ====================================")
+    print("\n  Sector   Address       CRC32")
+    print("\n  ====================================")
+    for x in range(len(data) // 4):
+        sector = hashes_first_sector + x
+        crc32 = struct.unpack_from('<I', data, 4*x)[0]
+        print("\n  {0:6d}   {1:#010x}    {2:#010x}".format(sector, flash_sector_base(sector), crc32))
+
+#reads the CRC32 of nb_sectors sectors from the bootloader, returns the list or None
+def get_sector_hashes(first_sector, nb_sectors):
+    v1_send_packet(COMMAND_BL_GET_SECTOR_HASHES, [first_sector, nb_sectors])
+    ack = read_serial_port(2)
+    if(len(ack) < 2 or ack[0] != 0xA5):
+        print("\n   No sector hashes from the bootloader")
+        return None
+    data = read_stream_data(ack[1])
+    if(data is None):
+        return None
+    return list(struct.unpack('<{0}I'.format(nb_sectors), data))
+
+def process_COMMAND_BL_BLANK_CHECK(length):
+    value = read_serial_port(length)
+    if(len(value) < 5):
+        print("\n   Timeout : Bootloader not responding")
+        return
+    if(value[0] != ADDR_VALID):
+        print("\n   Invalid sector range")
+        return
+    blank_map = struct.unpack_from('<I', value, 1)[0]
+    print("\n   Blank map : {0:#010x}".format(blank_map))
+    for sector in range(FLASH_SECTOR_COUNT):
+        if(blank_map & (1 << sector)):
+            print("\n   Sector{0:<3d}  {1:#010x}   blank".format(sector, flash_sector_base(sector)))
+
+#reads the bitmap of the blank sectors (bit n = sector n), returns None if the bootloader doesn't answer
+def get_blank_map(first_sector, nb_sectors):
+    v1_send_packet(COMMAND_BL_BLANK_CHECK, [first_sector, nb_sectors])
+    ack = read_serial_port(2)
+    if(len(ack) < 2 or ack[0] != 0xA5):
+        return None
+    value = read_serial_port(ack[1])
+    if(len(value) < 5 or value[0] != ADDR_VALID):
+        return None
+    return struct.unpack_from('<I', value, 1)[0]
+
+#erases one sector with BL_FLASH_ERASE, returns the erase status once the sector is erased
+def flash_erase_sector(sector):
+    v1_send_packet(COMMAND_BL_FLASH_ERASE, [sector, 1])
+    ser.timeout = BL_ERASE_TIMEOUT
+    ack = read_serial_port(2)
+    value = read_serial_port(1) if (len(ack) == 2 and ack[0] == 0xA5) else b''
+    ser.timeout = 2
+    if(len(value) < 1):
+        return Flash_HAL_TIMEOUT
+    return value[0]
+
+def process_COMMAND_BL_FLASH_STATUS(length):
+    value = read_serial_port(length)
+    if(len(value) < 6):
+        print("\n   Timeout : Bootloader not responding")
+        return
+    pending = struct.unpack_from('<I', value, 1)[0]
+    print("\n   Background erase : {0}".format("running" if value[0] else "idle"))
+    print("\n   Sectors left     : {0}".format([x for x in range(32) if pending & (1 << x)]))
+    print("\n   Error            : {0:#x}".format(value[5]))
+
+#polls BL_FLASH_STATUS until the background erase is done, returns its error (0 if none)
+def wait_background_erase():
+    global bg_erase_pending
+    bg_erase_pending = 0
+    start_time = time.time()
+    while(time.time() - start_time < BL_MASS_ERASE_TIMEOUT):
+        value = v1_command(COMMAND_BL_FLASH_STATUS, [])
+        if(value is None or len(value) < 6):
+            print("\n   No flash status from the bootloader")
+            return Flash_HAL_TIMEOUT
+        if(not value[0]):
+            print("\n   Background erase done in {0:.2f} s".format(time.time() - start_time))
+            return value[5]
+        pending = struct.unpack_from('<I', value, 1)[0]
+        print("\r   Background erase : {0} sectors left  ".format(bin(pending).count('1')), end='')
+        time.sleep(0.2)
+    return Flash_HAL_TIMEOUT
+
+#decodes the BL_SLOT_INFO reply : (next boot slot, [(state, seq, size, crc) of slot A, slot B])
+def decode_slot_info(value):
+    slots = []
+    for x in range(2):
+        state = value[1 + 13*x]
+        seq, size, crc32 = struct.unpack_from('<III', value, 2 + 13*x)
+        slots.append((state, seq, size, crc32))
+    return value[0], slots
+
+def process_COMMAND_BL_SLOT_INFO(length):
+    value = read_serial_port(length)
+    if(len(value) < 27):
+        print("\n   Timeout : Bootloader not responding")
+        return
+    boot_slot, slots = decode_slot_info(value)
+    print("\n   Next boot : {0}".format(slot_names[boot_slot] if boot_slot < 2 else "no slot activated, image at {0:#010x}".format(BL_SLOT_BASE[0])))
+    print("\n  ==========================================================")
+    print("\n  Slot  Address       State       Seq    Size      CRC32")
+    print("\n  ==========================================================")
+    for x in range(2):
+        state, seq, size, crc32 = slots[x]
+        print("\n  {0:4s}  {1:#010x}    {2:10s}  {3:<5d}  {4:<8d}  {5:#010x}".format(slot_names[x], BL_SLOT_BASE[x], slot_state_names[state], seq, size, crc32))
+
+def process_COMMAND_BL_SLOT_ACTIVATE(length):
+    value = read_serial_port(length)
+    if(len(value) < 1):
+        print("\n   Timeout : Bootloader not responding")
+    elif(value[0] == BL_SLOT_OK):
+        print("\n   Slot activated, it boots at the next reset")
+    elif(value[0] in slot_status_names):
+        print("\n   Activate status : {0}".format(slot_status_names[value[0]]))
+    else:
+        process_COMMAND_BL_MEM_WRITE_status(value[0])
+
+#name of a profile entry : a phase, or the command code it measures
+def profile_entry_name(index, cmd_base):
+    if(index < len(BL_PROFILE_PHASES)):
+        return BL_PROFILE_PHASES[index]
+    code = cmd_base + index - len(BL_PROFILE_PHASES)
+    for name, value in globals().items():
+        if(name.startswith("COMMAND_BL_") and not name.endswith("_LEN") and value == code):
+            return "CMD " + name[len("COMMAND_"):]
+    return "CMD {0:#04x}".format(code)
+
+def process_COMMAND_BL_GET_PROFILE(length):
+    data = read_stream_data(length)
+    if(data is None):
+        print("\n   Profiling is not compiled in the bootloader (BL_PROFILE_EN)")
+        return
+    clock, nb_stats, nb_buckets, first_bucket, cmd_base = struct.unpack_from('<IBBBB', data, 0)
+    stat_len = (BL_PROFILE_STAT_HDR_LEN + 2*nb_buckets + 7) & ~7
+    cycles_per_us = clock / 1000000.0
+    #upper bound of each bucket in cycles, the last one has none
+    bounds = [1 << (first_bucket + x) for x in range(nb_buckets - 1)]
+
+    rows = []
+    for x in range(nb_stats):
+        offset = BL_PROFILE_HDR_LEN + x*stat_len
+        count, cmin, cmax, reserved, csum = struct.unpack_from('<IIIIQ', data, offset)
+        hist = struct.unpack_from('<{0}H'.format(nb_buckets), data, offset + BL_PROFILE_STAT_HDR_LEN)
+        if(count):
+            rows.append((profile_entry_name(x, cmd_base), count, cmin / cycles_per_us, csum / count / cycles_per_us,
+                         cmax / cycles_per_us, csum / cycles_per_us / 1000.0, hist))
+
+    if(profile_csv_file_name):
+        with open(profile_csv_file_name, 'w') as f:
+            f.write("entry,count,min_us,avg_us,max_us,total_ms,")
+            f.write(",".join(["lt_{0:.2f}us".format(b / cycles_per_us) for b in bounds] + ["above"]) + "\n")
+            for name, count, cmin, cavg, cmax, total, hist in rows:
+                f.write("{0},{1},{2:.2f},{3:.2f},{4:.2f},{5:.3f},".format(name, count, cmin, cavg, cmax, total))
+                f.write(",".join([str(h) for h in hist]) + "\n")
+        print("\n   {0} entries written to {1}".format(len(rows), profile_csv_file_name))
+        return
+
+    print("\n   Core clock {0} MHz".format(clock // 1000000))
+    print("\n  ===========================================================================================")
+    print("\n  Entry                         Count      Min us      Avg us      Max us    Total ms")
+    print("\n  ===========================================================================================")
+    for name, count, cmin, cavg, cmax, total, hist in rows:
+        print("\n  {0:28s}  {1:6d}  {2:10.1f}  {3:10.1f}  {4:10.1f}  {5:10.2f}".format(name, count, cmin, cavg, cmax, total))
+        buckets = []
+        for b in range(nb_buckets):
+            if(hist[b]):
+                label = "<{0:.1f}".format(bounds[b] / cycles_per_us) if b < len(bounds) else ">={0:.1f}".format(bounds[-1] / cycles_per_us)
+                buckets.append("{0}:{1}".format(label, hist[b]))
+        print("\n      us histogram  {0}".format("  ".join(buckets)))
+
+#reads the boot time record with BL_MEM_READ and prints it
+def read_boot_time():
+    v1_send_packet(COMMAND_BL_MEM_READ, list(struct.pack('<II', BL_BOOT_TIME_ADDR, BL_BOOT_TIME_LEN)))
+    ack = read_serial_port(2)
+    if(len(ack) < 2 or ack[0] != 0xA5):
+        print("\n   No reply from the bootloader")
+        return
+    data = read_stream_data(ack[1])
+    if(data is None or len(data) < BL_BOOT_TIME_LEN):
+        return
+    magic, boots, path, cycles, us_clock, us_decision, us_end, app_us = struct.unpack('<8I', data)
+    if(magic != BL_BOOT_TIME_MAGIC):
+        print("\n   No boot time record")
+        return
+    print("\n   Boots since power on       : {0}".format(boots))
+    print("\n   This boot                  : {0}, {1} cycles".format(boot_path_names.get(path, path), cycles))
+    print("\n   Reset to clock setup       : {0} us".format(us_clock))
+    print("\n   Reset to boot decision     : {0} us".format(us_decision))
+    print("\n   Reset to command loop      : {0} us".format(us_end))
+    print("\n   Last application start     : {0} us".format(app_us) if app_us else "\n   Last application start     : none since power on")
+
+#sends a v1 command and reads its reply (ACK, len to follow, data), returns the data or None
+def v1_command(command, args):
+    v1_send_packet(command, args)
+    ack = read_serial_port(2)
+    if(len(ack) < 2 or ack[0] != 0xA5):
+        return None
+    value = read_serial_port(ack[1])
+    if(len(value) < ack[1]):
+        return None
+    return value
+
+#sends BL_GET_VER without printing anything, returns True if the bootloader answered
+def bl_ping():
+    data_buf = [0] * COMMAND_BL_GET_VER_LEN
+    data_buf[0] = COMMAND_BL_GET_VER_LEN-1
+    data_buf[1] = COMMAND_BL_GET_VER
+    crc32       = get_crc(data_buf,COMMAND_BL_GET_VER_LEN-4)
+    crc32 = crc32 & 0xffffffff
+    data_buf[2] = word_to_byte(crc32,1,1)
+    data_buf[3] = word_to_byte(crc32,2,1)
+    data_buf[4] = word_to_byte(crc32,3,1)
+    data_buf[5] = word_to_byte(crc32,4,1)
+    purge_serial_port()
+    ser.write(bytes(data_buf))
+    ack = read_serial_port(3)
+    return (len(ack) == 3 and ack[0] == 0xA5)
+
+#goes back to the last baud rate confirmed with the bootloader
+def baud_revert():
+    if(ser.baudrate != bl_baud_good):
+        print("\n   Going back to {0} baud".format(bl_baud_good))
+        ser.baudrate = bl_baud_good
+        purge_serial_port()
+
+def process_COMMAND_BL_SET_BAUD(length, new_baud):
+    global bl_baud_good
+    value = read_serial_port(length)
+    if(len(value) < 1 or value[0] != BL_BAUD_OK):
+        print("\n   Baud rate {0} refused by the bootloader".format(new_baud))
+        return
+    old_baud = ser.baudrate
+    ser.baudrate = new_baud
+    time.sleep(0.01)
+    #the first valid packet at the new rate confirms it on the bootloader side
+    if(bl_ping()):
+        bl_baud_good = new_baud
+        print("\n   Baud rate is now {0}".format(new_baud))
+    else:
+        print("\n   No answer at {0} baud, back to {1}".format(new_baud, old_baud))
+        ser.baudrate = old_baud
+        time.sleep(BL_BAUD_CONFIRM_TIMEOUT)
+        purge_serial_port()
 
 def process_COMMAND_BL_FLASH_MASS_ERASE(length):
     pass
@@ -310,6 +1368,11 @@ def decode_menu_command_code(command):
     for i in range(255):
         data_buf.append(0)
     
+    #the commands which use the flash wait for the background erase, the reply would take too long
+    global bg_erase_pending
+    if(bg_erase_pending and command not in BG_ERASE_MENUS):
+        wait_background_erase()
+
     if(command  == 0 ):
         print("\n   Exiting...!")
         raise SystemExit
@@ -326,9 +1389,7 @@ def decode_menu_command_code(command):
         data_buf[5] = word_to_byte(crc32,4,1) 
 
         
-        Write_to_serial_port(data_buf[0],1)
-        for i in data_buf[1:COMMAND_BL_GET_VER_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_GET_VER_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_GET_VER_LEN)
         
 
         ret_value = read_bootloader_reply(data_buf[1])
@@ -348,9 +1409,7 @@ def decode_menu_command_code(command):
         data_buf[5] = word_to_byte(crc32,4,1) 
 
         
-        Write_to_serial_port(data_buf[0],1)
-        for i in data_buf[1:COMMAND_BL_GET_HELP_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_GET_HELP_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_GET_HELP_LEN)
         
 
         ret_value = read_bootloader_reply(data_buf[1])
@@ -367,9 +1426,7 @@ def decode_menu_command_code(command):
         data_buf[5] = word_to_byte(crc32,4,1) 
 
         
-        Write_to_serial_port(data_buf[0],1)
-        for i in data_buf[1:COMMAND_BL_GET_CID_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_GET_CID_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_GET_CID_LEN)
         
 
         ret_value = read_bootloader_reply(data_buf[1])
@@ -385,10 +1442,7 @@ def decode_menu_command_code(command):
         data_buf[4] = word_to_byte(crc32,3,1)
         data_buf[5] = word_to_byte(crc32,4,1)
         
-        Write_to_serial_port(data_buf[0],1)
-        
-        for i in data_buf[1:COMMAND_BL_GET_RDP_STATUS_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_GET_RDP_STATUS_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_GET_RDP_STATUS_LEN)
         
         ret_value = read_bootloader_reply(data_buf[1])
     elif(command == 5):
@@ -407,10 +1461,7 @@ def decode_menu_command_code(command):
         data_buf[8] = word_to_byte(crc32,3,1) 
         data_buf[9] = word_to_byte(crc32,4,1) 
 
-        Write_to_serial_port(data_buf[0],1)
-        
-        for i in data_buf[1:COMMAND_BL_GO_TO_ADDR_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_GO_TO_ADDR_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_GO_TO_ADDR_LEN)
         
         ret_value = read_bootloader_reply(data_buf[1])
         
@@ -420,10 +1471,11 @@ def decode_menu_command_code(command):
         print("\n   Command == > BL_FLASH_ERASE")
         data_buf[0] = COMMAND_BL_FLASH_ERASE_LEN-1 
         data_buf[1] = COMMAND_BL_FLASH_ERASE 
-        sector_num = input("\n   Enter sector number(0-11 or 0xFF) here :")
+        sector_num = input("\n   Enter sector number(0-23 or 0xFF for both banks) here :")
         sector_num = int(sector_num, 16)
+        nsec = 0
         if(sector_num != 0xff):
-            nsec=int(input("\n   Enter number of sectors to erase(max 11) here :"))
+            nsec=int(input("\n   Enter number of sectors to erase(max 24) here :"))
         
         data_buf[2]= sector_num 
         data_buf[3]= nsec 
@@ -434,12 +1486,11 @@ def decode_menu_command_code(command):
         data_buf[6] = word_to_byte(crc32,3,1) 
         data_buf[7] = word_to_byte(crc32,4,1) 
 
-        Write_to_serial_port(data_buf[0],1)
-        
-        for i in data_buf[1:COMMAND_BL_FLASH_ERASE_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_FLASH_ERASE_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_FLASH_ERASE_LEN)
         
+        ser.timeout = BL_MASS_ERASE_TIMEOUT
         ret_value = read_bootloader_reply(data_buf[1])
+        ser.timeout = 2
         
     elif(command == 8):
         print("\n   Command == > BL_MEM_WRITE")
@@ -449,8 +1500,6 @@ def decode_menu_command_code(command):
         len_to_read=0
         base_mem_address=0
 
-        data_buf[1] = COMMAND_BL_MEM_WRITE
-
         #First get the total number of bytes in the .bin file.
         t_len_of_file =calc_file_len()
 
@@ -461,60 +1510,13 @@ def decode_menu_command_code(command):
 
         base_mem_address = input("\n   Enter the memory write address here :")
         base_mem_address = int(base_mem_address, 16)
-        global mem_write_active
-        while(bytes_remaining):
-            mem_write_active=1
-            if(bytes_remaining >= 128):
-                len_to_read = 128
-            else:
-                len_to_read = bytes_remaining
-            #get the bytes in to buffer by reading file
-            for x in range(len_to_read):
-                file_read_value = bin_file.read(1)
-                file_read_value = bytearray(file_read_value)
-                data_buf[7+x]= int(file_read_value[0])
-            #read_the_file(&data_buf[7],len_to_read) 
-            #print("\n   base mem address = \n",base_mem_address, hex(base_mem_address)) 
-
-            #populate base mem address
-            data_buf[2] = word_to_byte(base_mem_address,1,1)
-            data_buf[3] = word_to_byte(base_mem_address,2,1)
-            data_buf[4] = word_to_byte(base_mem_address,3,1)
-            data_buf[5] = word_to_byte(base_mem_address,4,1)
-
-            data_buf[6] = len_to_read
-
-            #/* 1 byte len + 1 byte command code + 4 byte mem base address
-            #* 1 byte payload len + len_to_read is amount of bytes read from file + 4 byte CRC
-            #*/
-            mem_write_cmd_total_len = COMMAND_BL_MEM_WRITE_LEN+len_to_read
-
-            #first field is "len_to_follow"
-            data_buf[0] =mem_write_cmd_total_len-1
-
-            crc32       = get_crc(data_buf,mem_write_cmd_total_len-4)
-            data_buf[7+len_to_read] = word_to_byte(crc32,1,1)
-            data_buf[8+len_to_read] = word_to_byte(crc32,2,1)
-            data_buf[9+len_to_read] = word_to_byte(crc32,3,1)
-            data_buf[10+len_to_read] = word_to_byte(crc32,4,1)
-
-            #update base mem address for the next loop
-            base_mem_address+=len_to_read
-
-            Write_to_serial_port(data_buf[0],1)
-        
-            for i in data_buf[1:mem_write_cmd_total_len]:
-                Write_to_serial_port(i,mem_write_cmd_total_len-1)
+        #no BL_FLASH_ERASE needed before, the sectors are erased as the write reaches them
+        global mem_write_flags
+        mem_write_flags = ask_auto_erase()
+        mem_write_run(base_mem_address, bytes_remaining)
+        mem_write_flags = 0
+        close_the_file()
 
-            bytes_so_far_sent+=len_to_read
-            bytes_remaining = t_len_of_file - bytes_so_far_sent
-            print("\n   bytes_so_far_sent:{0} -- bytes_remaining:{1}\n".format(bytes_so_far_sent,bytes_remaining)) 
-        
-            ret_value = read_bootloader_reply(data_buf[1])
-        mem_write_active=0
-
-            
-    
     elif(command == 9):
         print("\n   Command == > BL_EN_R_W_PROTECT")
         total_sector = int(input("\n   How many sectors do you want to protect ?: "))
@@ -547,17 +1549,40 @@ def decode_menu_command_code(command):
         data_buf[7] = word_to_byte(crc32,3,1) 
         data_buf[8] = word_to_byte(crc32,4,1) 
 
-        Write_to_serial_port(data_buf[0],1)
-        
-        for i in data_buf[1:COMMAND_BL_EN_R_W_PROTECT_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_EN_R_W_PROTECT_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_EN_R_W_PROTECT_LEN)
         
         ret_value = read_bootloader_reply(data_buf[1])
             
         
     elif(command == 10):
         print("\n   Command == > COMMAND_BL_MEM_READ")
-        print("\n   This command is not supported")
+        global mem_read_file_name
+        mem_address = input("\n   Enter the memory address here :")
+        mem_address = int(mem_address, 16)
+        mem_len = input("\n   Enter the number of bytes to read :")
+        mem_len = int(mem_len, 0)
+        file_name = input("\n   Enter the output file name (default mem_read.bin) :")
+        if(file_name):
+            mem_read_file_name = file_name
+        data_buf[0] = COMMAND_BL_MEM_READ_LEN-1
+        data_buf[1] = COMMAND_BL_MEM_READ
+        data_buf[2] = word_to_byte(mem_address,1,1)
+        data_buf[3] = word_to_byte(mem_address,2,1)
+        data_buf[4] = word_to_byte(mem_address,3,1)
+        data_buf[5] = word_to_byte(mem_address,4,1)
+        data_buf[6] = word_to_byte(mem_len,1,1)
+        data_buf[7] = word_to_byte(mem_len,2,1)
+        data_buf[8] = word_to_byte(mem_len,3,1)
+        data_buf[9] = word_to_byte(mem_len,4,1)
+        crc32       = get_crc(data_buf,COMMAND_BL_MEM_READ_LEN-4)
+        data_buf[10] = word_to_byte(crc32,1,1)
+        data_buf[11] = word_to_byte(crc32,2,1)
+        data_buf[12] = word_to_byte(crc32,3,1)
+        data_buf[13] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_MEM_READ_LEN)
+
+        ret_value = read_bootloader_reply(data_buf[1])
     elif(command == 11):
         print("\n   Command == > COMMAND_BL_READ_SECTOR_P_STATUS")
         data_buf[0] = COMMAND_BL_READ_SECTOR_P_STATUS_LEN-1 
@@ -569,16 +1594,23 @@ def decode_menu_command_code(command):
         data_buf[4] = word_to_byte(crc32,3,1) 
         data_buf[5] = word_to_byte(crc32,4,1) 
 
-        Write_to_serial_port(data_buf[0],1)
-        
-        for i in data_buf[1:COMMAND_BL_READ_SECTOR_P_STATUS_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_READ_SECTOR_P_STATUS_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_READ_SECTOR_P_STATUS_LEN)
         
         ret_value = read_bootloader_reply(data_buf[1])
 
     elif(command == 12):
         print("\n   Command == > COMMAND_OTP_READ")
-        print("\n   This command is not supported")
+        data_buf[0] = COMMAND_BL_OTP_READ_LEN-1
+        data_buf[1] = COMMAND_BL_OTP_READ
+        crc32       = get_crc(data_buf,COMMAND_BL_OTP_READ_LEN-4)
+        data_buf[2] = word_to_byte(crc32,1,1)
+        data_buf[3] = word_to_byte(crc32,2,1)
+        data_buf[4] = word_to_byte(crc32,3,1)
+        data_buf[5] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_OTP_READ_LEN)
+
+        ret_value = read_bootloader_reply(data_buf[1])
     elif(command == 13):
         print("\n   Command == > COMMAND_BL_DIS_R_W_PROTECT")
         data_buf[0] = COMMAND_BL_DIS_R_W_PROTECT_LEN-1 
@@ -589,10 +1621,7 @@ def decode_menu_command_code(command):
         data_buf[4] = word_to_byte(crc32,3,1) 
         data_buf[5] = word_to_byte(crc32,4,1) 
 
-        Write_to_serial_port(data_buf[0],1)
-        
-        for i in data_buf[1:COMMAND_BL_DIS_R_W_PROTECT_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_DIS_R_W_PROTECT_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_DIS_R_W_PROTECT_LEN)
         
         ret_value = read_bootloader_reply(data_buf[1])
         
@@ -606,16 +1635,372 @@ def decode_menu_command_code(command):
         data_buf[4] = word_to_byte(crc32,3,1) 
         data_buf[5] = word_to_byte(crc32,4,1) 
 
-        Write_to_serial_port(data_buf[0],1)
-        
-        for i in data_buf[1:COMMAND_BL_MY_NEW_COMMAND_LEN]:
-            Write_to_serial_port(i,COMMAND_BL_MY_NEW_COMMAND_LEN-1)
+        Write_to_serial_port(data_buf,COMMAND_BL_MY_NEW_COMMAND_LEN)
         
         ret_value = read_bootloader_reply(data_buf[1])
+    elif(command == 15):
+        print("\n   Command == > COMMAND_BL_SET_BAUD ")
+        new_baud = input("\n   Enter the new baud rate (Ex: 2000000) :")
+        new_baud = int(new_baud)
+        data_buf[0] = COMMAND_BL_SET_BAUD_LEN-1
+        data_buf[1] = COMMAND_BL_SET_BAUD
+        data_buf[2] = word_to_byte(new_baud,1,1)
+        data_buf[3] = word_to_byte(new_baud,2,1)
+        data_buf[4] = word_to_byte(new_baud,3,1)
+        data_buf[5] = word_to_byte(new_baud,4,1)
+        crc32       = get_crc(data_buf,COMMAND_BL_SET_BAUD_LEN-4)
+        data_buf[6] = word_to_byte(crc32,1,1)
+        data_buf[7] = word_to_byte(crc32,2,1)
+        data_buf[8] = word_to_byte(crc32,3,1)
+        data_buf[9] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_SET_BAUD_LEN)
+
+        ack = read_serial_port(2)
+        if(len(ack) == 2 and ack[0] == 0xA5):
+            print("\n   CRC : SUCCESS Len :",ack[1])
+            process_COMMAND_BL_SET_BAUD(ack[1], new_baud)
+        elif(len(ack)):
+            print("\n   CRC: FAIL \n")
+            ret_value = -1
+        else:
+            ret_value = -2
+    elif(command == 16):
+        print("\n   Command == > BL_MEM_WRITE_LZ4")
+        if(not (bl_capabilities & BL_CAP_LZ4)):
+            print("\n   This bootloader has no LZ4 support, use BL_MEM_WRITE")
+            return
+
+        open_the_file()
+        image = bin_file.read()
+        close_the_file()
+
+        base_mem_address = input("\n   Enter the memory write address here :")
+        base_mem_address = int(base_mem_address, 16)
+
+        start_time = time.time()
+        compressed = lz4_compress(image)
+        compress_time = time.time() - start_time
+        if(lz4_decompress(compressed) != image):
+            print("\n   LZ4 compressor error, nothing sent")
+            return
+        print("\n   {0} bytes compressed to {1} bytes ({2:.1f} %) in {3:.2f} s".format(len(image), len(compressed), 100.0 * len(compressed) / max(len(image), 1), compress_time))
+
+        flags = ask_auto_erase()
+        start_time = time.time()
+        write_status = v2_send_stream(COMMAND_BL_MEM_WRITE_LZ4, base_mem_address, compressed, flags)
+        elapsed = time.time() - start_time
+        if(write_status == Flash_HAL_OK and elapsed > 0):
+            print("\n   {0} bytes ({1} on the wire) in {2:.2f} s : {3:.1f} bytes/s".format(len(image), len(compressed), elapsed, len(image)/elapsed))
+
+    elif(command == 17):
+        print("\n   Command == > BL_MEM_WRITE_DELTA")
+        if(not (bl_capabilities & BL_CAP_DELTA)):
+            print("\n   This bootloader has no delta support, use BL_MEM_WRITE")
+            return
+
+        old_file_name = input("\n   Enter the .bin file the device runs now :")
+        with open(old_file_name, 'rb') as f:
+            old_image = f.read()
+        open_the_file()
+        image = bin_file.read()
+        close_the_file()
+
+        base_mem_address = input("\n   Enter the memory write address here :")
+        base_mem_address = int(base_mem_address, 16)
+
+        start_time = time.time()
+        patch = delta_make_patch(old_image, image)
+        patch_time = time.time() - start_time
+        if(delta_apply(old_image, patch) != image):
+            print("\n   Delta patch error, nothing sent")
+            return
+        print("\n   {0} bytes image, {1} bytes patch ({2:.1f} %) built in {3:.2f} s".format(len(image), len(patch), 100.0 * len(patch) / max(len(image), 1), patch_time))
+
+        start_time = time.time()
+        write_status = v2_send_stream(COMMAND_BL_MEM_WRITE_DELTA, base_mem_address, patch)
+        elapsed = time.time() - start_time
+        if(write_status == Flash_HAL_OK):
+            print("\n   Write_status: FLASH_HAL_OK")
+            print("\n   {0} bytes patch applied in {1:.2f} s".format(len(patch), elapsed))
+
+    elif(command == 18):
+        print("\n   Command == > BL_GET_SECTOR_HASHES")
+        global hashes_first_sector
+        hashes_first_sector = int(input("\n   Enter the first sector (0-23) :"))
+        nb_sectors = int(input("\n   Enter the number of sectors :"))
+        data_buf[0] = COMMAND_BL_GET_SECTOR_HASHES_LEN-1
+        data_buf[1] = COMMAND_BL_GET_SECTOR_HASHES
+        data_buf[2] = hashes_first_sector
+        data_buf[3] = nb_sectors
+        crc32       = get_crc(data_buf,COMMAND_BL_GET_SECTOR_HASHES_LEN-4)
+        data_buf[4] = word_to_byte(crc32,1,1)
+        data_buf[5] = word_to_byte(crc32,2,1)
+        data_buf[6] = word_to_byte(crc32,3,1)
+        data_buf[7] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_GET_SECTOR_HASHES_LEN)
+
+        ret_value = read_bootloader_reply(data_buf[1])
+
+    elif(command == 19):
+        print("\n   Command == > BL_MEM_WRITE (changed sectors only)")
+        open_the_file()
+        image = bin_file.read()
+
+        base_mem_address = input("\n   Enter the memory write address (start of a sector) here :")
+        base_mem_address = int(base_mem_address, 16)
+        first_sector = flash_sector_at(base_mem_address)
+        if(first_sector is None):
+            print("\n   {0:#010x} is not the start of a flash sector".format(base_mem_address))
+            close_the_file()
+            return
+
+        #sectors covered by the image, the end of the last one is left erased
+        sectors = []
+        offset = 0
+        while(offset < len(image) and first_sector + len(sectors) < FLASH_SECTOR_COUNT):
+            sectors.append(first_sector + len(sectors))
+            offset += flash_sector_size(sectors[-1])
+        if(offset < len(image)):
+            print("\n   The image doesn't fit in the flash")
+            close_the_file()
+            return
+
+        start_time = time.time()
+        device_crc = get_sector_hashes(first_sector, len(sectors))
+        if(device_crc is None):
+            close_the_file()
+            ret_value = -2
+        else:
+            changed = []
+            offset = 0
+            for n, sector in enumerate(sectors):
+                size = flash_sector_size(sector)
+                local = image[offset:offset+size]
+                local += b'\xff' * (size - len(local))
+                if(get_crc_word(local, size) != device_crc[n]):
+                    changed.append((sector, offset, min(size, len(image) - offset)))
+                offset += size
+            print("\n   {0} of {1} sectors differ : {2}".format(len(changed), len(sectors), [c[0] for c in changed]))
+
+            #blank sectors are programmed without an erase
+            blank_map = get_blank_map(first_sector, len(sectors))
+            if(blank_map is None):
+                blank_map = 0
+            print("\n   {0} sectors to erase".format(len([c for c in changed if not (blank_map & (1 << c[0]))])))
+
+            for sector, offset, length in changed:
+                if(not (blank_map & (1 << sector))):
+                    erase_status = flash_erase_sector(sector)
+                    if(erase_status != Flash_HAL_OK):
+                        print("\n   Erase of sector {0} failed, status {1}".format(sector, erase_status))
+                        break
+                bin_file.seek(offset)
+                if(mem_write_run(base_mem_address + offset, length) != Flash_HAL_OK):
+                    break
+            close_the_file()
+            elapsed = time.time() - start_time
+            print("\n   Update done in {0:.2f} s".format(elapsed))
+
+    elif(command == 20):
+        print("\n   Command == > BL_BLANK_CHECK")
+        first_sector = int(input("\n   Enter the first sector (0-23) :"))
+        nb_sectors = int(input("\n   Enter the number of sectors :"))
+        data_buf[0] = COMMAND_BL_BLANK_CHECK_LEN-1
+        data_buf[1] = COMMAND_BL_BLANK_CHECK
+        data_buf[2] = first_sector
+        data_buf[3] = nb_sectors
+        crc32       = get_crc(data_buf,COMMAND_BL_BLANK_CHECK_LEN-4)
+        data_buf[4] = word_to_byte(crc32,1,1)
+        data_buf[5] = word_to_byte(crc32,2,1)
+        data_buf[6] = word_to_byte(crc32,3,1)
+        data_buf[7] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_BLANK_CHECK_LEN)
+
+        ret_value = read_bootloader_reply(data_buf[1])
+
+    elif(command == 21):
+        print("\n   Command == > BL_FLASH_ERASE_RANGE")
+        mem_address = input("\n   Enter the start address here :")
+        mem_address = int(mem_address, 16)
+        mem_len = input("\n   Enter the number of bytes to erase :")
+        mem_len = int(mem_len, 0)
+        data_buf[0] = COMMAND_BL_FLASH_ERASE_RANGE_LEN-1
+        data_buf[1] = COMMAND_BL_FLASH_ERASE_RANGE
+        data_buf[2] = word_to_byte(mem_address,1,1)
+        data_buf[3] = word_to_byte(mem_address,2,1)
+        data_buf[4] = word_to_byte(mem_address,3,1)
+        data_buf[5] = word_to_byte(mem_address,4,1)
+        data_buf[6] = word_to_byte(mem_len,1,1)
+        data_buf[7] = word_to_byte(mem_len,2,1)
+        data_buf[8] = word_to_byte(mem_len,3,1)
+        data_buf[9] = word_to_byte(mem_len,4,1)
+        crc32       = get_crc(data_buf,COMMAND_BL_FLASH_ERASE_RANGE_LEN-4)
+        data_buf[10] = word_to_byte(crc32,1,1)
+        data_buf[11] = word_to_byte(crc32,2,1)
+        data_buf[12] = word_to_byte(crc32,3,1)
+        data_buf[13] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_FLASH_ERASE_RANGE_LEN)
+
+        ser.timeout = BL_MASS_ERASE_TIMEOUT
+        ret_value = read_bootloader_reply(data_buf[1])
+        ser.timeout = 2
+
+    elif(command == 22):
+        print("\n   Command == > BL_SLOT_INFO")
+        data_buf[0] = COMMAND_BL_SLOT_INFO_LEN-1
+        data_buf[1] = COMMAND_BL_SLOT_INFO
+        crc32       = get_crc(data_buf,COMMAND_BL_SLOT_INFO_LEN-4)
+        data_buf[2] = word_to_byte(crc32,1,1)
+        data_buf[3] = word_to_byte(crc32,2,1)
+        data_buf[4] = word_to_byte(crc32,3,1)
+        data_buf[5] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_SLOT_INFO_LEN)
+
+        ret_value = read_bootloader_reply(data_buf[1])
+
+    elif(command == 23):
+        print("\n   Command == > BL_SLOT_UPDATE (write the inactive slot and activate it)")
+        value = v1_command(COMMAND_BL_SLOT_INFO, [])
+        if(value is None or len(value) < 27):
+            print("\n   No slot information from the bootloader")
+            return
+        boot_slot, slots = decode_slot_info(value)
+        slot = BL_SLOT_A if boot_slot == BL_SLOT_B else BL_SLOT_B
+        print("\n   Running slot : {0}, writing slot {1} at {2:#010x}".format(slot_names[boot_slot] if boot_slot < 2 else "-", slot_names[slot], BL_SLOT_BASE[slot]))
+
+        open_the_file()
+        image = bin_file.read()
+        if(len(image) > BL_SLOT_SIZE - BL_SLOT_TRAILER_LEN):
+            print("\n   The image doesn't fit in a slot")
+            close_the_file()
+            return
+
+        start_time = time.time()
+        #the whole slot, the trailer has to be erased too
+        ser.timeout = BL_MASS_ERASE_TIMEOUT
+        value = v1_command(COMMAND_BL_FLASH_ERASE_RANGE, list(struct.pack('<II', BL_SLOT_BASE[slot], BL_SLOT_SIZE)))
+        ser.timeout = 2
+        if(value is not None and value[0] == BL_ERASE_BACKGROUND):
+            #slot B : the first packets wait for the erase
+            bg_erase_pending = 1
+        elif(value is None or value[0] != Flash_HAL_OK):
+            print("\n   Erase of slot {0} failed".format(slot_names[slot]))
+            close_the_file()
+            return
+
+        bin_file.seek(0)
+        write_status = mem_write_run(BL_SLOT_BASE[slot], len(image))
+        close_the_file()
+        if(write_status != Flash_HAL_OK):
+            return
+
+        data_buf[0] = COMMAND_BL_SLOT_ACTIVATE_LEN-1
+        data_buf[1] = COMMAND_BL_SLOT_ACTIVATE
+        data_buf[2] = slot
+        data_buf[3:7] = list(struct.pack('<I', len(image)))
+        data_buf[7:11] = list(struct.pack('<I', get_crc_word(image, len(image))))
+        crc32       = get_crc(data_buf,COMMAND_BL_SLOT_ACTIVATE_LEN-4)
+        data_buf[11] = word_to_byte(crc32,1,1)
+        data_buf[12] = word_to_byte(crc32,2,1)
+        data_buf[13] = word_to_byte(crc32,3,1)
+        data_buf[14] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_SLOT_ACTIVATE_LEN)
+
+        ret_value = read_bootloader_reply(data_buf[1])
+        print("\n   Update done in {0:.2f} s, reset the board to start slot {1}".format(time.time() - start_time, slot_names[slot]))
+
+    elif(command == 24):
+        print("\n   Command == > BL_FLASH_STATUS")
+        data_buf[0] = COMMAND_BL_FLASH_STATUS_LEN-1
+        data_buf[1] = COMMAND_BL_FLASH_STATUS
+        crc32       = get_crc(data_buf,COMMAND_BL_FLASH_STATUS_LEN-4)
+        data_buf[2] = word_to_byte(crc32,1,1)
+        data_buf[3] = word_to_byte(crc32,2,1)
+        data_buf[4] = word_to_byte(crc32,3,1)
+        data_buf[5] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_FLASH_STATUS_LEN)
+
+        ret_value = read_bootloader_reply(data_buf[1])
+
+    elif(command == 25):
+        print("\n   Command == > BL_BOOT_TIME")
+        read_boot_time()
+
+    elif(command == 26):
+        print("\n   Command == > BL_GET_PROFILE")
+        global profile_csv_file_name
+        clear = input("\n   Clear the profile once read (y/n) :")
+        profile_csv_file_name = input("\n   Enter the CSV file name (empty : print the table) :")
+        data_buf[0] = COMMAND_BL_GET_PROFILE_LEN-1
+        data_buf[1] = COMMAND_BL_GET_PROFILE
+        data_buf[2] = 1 if clear in ("y", "Y") else 0
+        crc32       = get_crc(data_buf,COMMAND_BL_GET_PROFILE_LEN-4)
+        data_buf[3] = word_to_byte(crc32,1,1)
+        data_buf[4] = word_to_byte(crc32,2,1)
+        data_buf[5] = word_to_byte(crc32,3,1)
+        data_buf[6] = word_to_byte(crc32,4,1)
+
+        Write_to_serial_port(data_buf,COMMAND_BL_GET_PROFILE_LEN)
+
+        ret_value = read_bootloader_reply(data_buf[1])
+
+    elif(command == 27):
+        print("\n   Command == > BL_MEM_WRITE_IMAGE (ELF / Intel HEX / S-record)")
+        file_name = input("\n   Enter the image file name :")
+        try:
+            segments = image_loader.load_image(file_name)
+        except (OSError, ValueError) as e:
+            print("\n   {0}".format(e))
+            return
+
+        #the addresses are the ones of the file, only the populated bytes go on the wire
+        runs = image_loader.image_runs(segments, flash_sector_bounds())
+        sent = sum(len(data) for address, data in runs)
+        span = runs[-1][0] + len(runs[-1][1]) - runs[0][0]
+        for address, data in runs:
+            print("\n   {0:#010x}  {1:7d} bytes".format(address, len(data)))
+        print("\n   {0} bytes in {1} runs, {2} bytes of holes not sent".format(sent, len(runs), span - sent))
+
+        start_time = time.time()
+        sectors = sorted(set(flash_sector_of(address) for address, data in runs) - set([None]))
+        blank_map = 0
+        if(sectors):
+            blank_map = get_blank_map(sectors[0], sectors[-1] - sectors[0] + 1)
+            if(blank_map is None):
+                blank_map = 0
+        to_erase = [sector for sector in sectors if not (blank_map & (1 << sector))]
+        print("\n   {0} sectors written, {1} to erase : {2}".format(len(sectors), len(to_erase), to_erase))
+
+        write_status = Flash_HAL_OK
+        for sector in to_erase:
+            write_status = flash_erase_sector(sector)
+            if(write_status != Flash_HAL_OK):
+                print("\n   Erase of sector {0} failed, status {1}".format(sector, write_status))
+                break
+
+        for address, data in runs:
+            if(write_status != Flash_HAL_OK):
+                break
+            open_the_buffer(data)
+            write_status = mem_write_run(address, len(data))
+        elapsed = time.time() - start_time
+        print("\n   Image written in {0:.2f} s".format(elapsed))
+
     else:
         print("\n   Please input valid command code\n")
         return
 
+    #the bootloader falls back to the last good rate after repeated CRC failures, follow it
+    if ret_value < 0 :
+        baud_revert()
+
     if ret_value == -2 :
         print("\n   TimeOut : No response from the bootloader")
         print("\n   Reset the board and Try Again !")
@@ -652,14 +2037,20 @@ def read_bootloader_reply(command_code):
             elif(command_code) == COMMAND_BL_GO_TO_ADDR:
                 process_COMMAND_BL_GO_TO_ADDR(len_to_follow)
                 
-            elif(command_code) == COMMAND_BL_FLASH_ERASE:
+            elif(command_code) == COMMAND_BL_FLASH_ERASE or command_code == COMMAND_BL_FLASH_ERASE_RANGE:
                 process_COMMAND_BL_FLASH_ERASE(len_to_follow)
                 
             elif(command_code) == COMMAND_BL_MEM_WRITE:
                 process_COMMAND_BL_MEM_WRITE(len_to_follow)
                 
+            elif(command_code) == COMMAND_BL_MEM_READ:
+                process_COMMAND_BL_MEM_READ(len_to_follow)
+
             elif(command_code) == COMMAND_BL_READ_SECTOR_P_STATUS:
                 process_COMMAND_BL_READ_SECTOR_STATUS(len_to_follow)
+
+            elif(command_code) == COMMAND_BL_OTP_READ:
+                process_COMMAND_BL_OTP_READ(len_to_follow)
                 
             elif(command_code) == COMMAND_BL_EN_R_W_PROTECT:
                 process_COMMAND_BL_EN_R_W_PROTECT(len_to_follow)
@@ -667,6 +2058,24 @@ def read_bootloader_reply(command_code):
             elif(command_code) == COMMAND_BL_DIS_R_W_PROTECT:
                 process_COMMAND_BL_DIS_R_W_PROTECT(len_to_follow)
                 
+            elif(command_code) == COMMAND_BL_GET_SECTOR_HASHES:
+                process_COMMAND_BL_GET_SECTOR_HASHES(len_to_follow)
+
+            elif(command_code) == COMMAND_BL_BLANK_CHECK:
+                process_COMMAND_BL_BLANK_CHECK(len_to_follow)
+
+            elif(command_code) == COMMAND_BL_SLOT_INFO:
+                process_COMMAND_BL_SLOT_INFO(len_to_follow)
+
+            elif(command_code) == COMMAND_BL_SLOT_ACTIVATE:
+                process_COMMAND_BL_SLOT_ACTIVATE(len_to_follow)
+
+            elif(command_code) == COMMAND_BL_FLASH_STATUS:
+                process_COMMAND_BL_FLASH_STATUS(len_to_follow)
+
+            elif(command_code) == COMMAND_BL_GET_PROFILE:
+                process_COMMAND_BL_GET_PROFILE(len_to_follow)
+
             elif(command_code) == COMMAND_BL_MY_NEW_COMMAND:
                 process_COMMAND_BL_MY_NEW_COMMAND(len_to_follow)
                 
@@ -689,62 +2098,68 @@ def read_bootloader_reply(command_code):
 
 #----------------------------- Ask Menu implementation----------------------------------------
 
+#the menu runs only when the tool is started, gang_programmer.py imports the helpers above
+def main():
+    name = input("Enter the Port Name of your device(Ex: COM3):")
+    ret = 0
+    ret=Serial_Port_Configuration(name)
+    if(ret < 0):
+        decode_menu_command_code(0)
+
+    protocol_negotiate()
+
+
+
+
+    while True:
+        print("\n +==========================================+")
+        print(" |               Menu                       |")
+        print(" |         STM32F4 BootLoader v1            |")
+        print(" +==========================================+")
+
+
+
+        print("\n   Which BL command do you want to send ??\n")
+        print("   BL_GET_VER                            --> 1")
+        print("   BL_GET_HLP                            --> 2")
+        print("   BL_GET_CID                            --> 3")
+        print("   BL_GET_RDP_STATUS                     --> 4")
+        print("   BL_GO_TO_ADDR                         --> 5")
+        print("   BL_FLASH_MASS_ERASE                   --> 6")
+        print("   BL_FLASH_ERASE                        --> 7")
+        print("   BL_MEM_WRITE                          --> 8")
+        print("   BL_EN_R_W_PROTECT                     --> 9")
+        print("   BL_MEM_READ                           --> 10")
+        print("   BL_READ_SECTOR_P_STATUS               --> 11")
+        print("   BL_OTP_READ                           --> 12")
+        print("   BL_DIS_R_W_PROTECT                    --> 13")
+        print("   BL_MY_NEW_COMMAND                     --> 14")
+        print("   BL_SET_BAUD                           --> 15")
+        print("   BL_MEM_WRITE_LZ4                      --> 16")
+        print("   BL_MEM_WRITE_DELTA                    --> 17")
+        print("   BL_GET_SECTOR_HASHES                  --> 18")
+        print("   BL_MEM_WRITE_CHANGED                  --> 19")
+        print("   BL_BLANK_CHECK                        --> 20")
+        print("   BL_FLASH_ERASE_RANGE                  --> 21")
+        print("   BL_SLOT_INFO                          --> 22")
+        print("   BL_SLOT_UPDATE                        --> 23")
+        print("   BL_FLASH_STATUS                       --> 24")
+        print("   BL_BOOT_TIME                          --> 25")
+        print("   BL_GET_PROFILE                        --> 26")
+        print("   BL_MEM_WRITE_IMAGE                    --> 27")
+        print("   MENU_EXIT                             --> 0")
+
+        #command_code = int(input("\n   Type the command code here :") )
+
+        command_code = input("\n   Type the command code here :")
+
+        if(not command_code.isdigit()):
+            print("\n   Please Input valid code shown above")
+        else:
+            decode_menu_command_code(int(command_code))
 
-name = input("Enter the Port Name of your device(Ex: COM3):")
-ret = 0
-ret=Serial_Port_Configuration(name)
-if(ret < 0):
-    decode_menu_command_code(0)
-    
-
-    
-  
-while True:
-    print("\n +==========================================+")
-    print(" |               Menu                       |")
-    print(" |         STM32F4 BootLoader v1            |")
-    print(" +==========================================+")
-
-  
-    
-    print("\n   Which BL command do you want to send ??\n")
-    print("   BL_GET_VER                            --> 1")
-    print("   BL_GET_HLP                            --> 2")
-    print("   BL_GET_CID                            --> 3")
-    print("   BL_GET_RDP_STATUS                     --> 4")
-    print("   BL_GO_TO_ADDR                         --> 5")
-    print("   BL_FLASH_MASS_ERASE                   --> 6")
-    print("   BL_FLASH_ERASE                        --> 7")
-    print("   BL_MEM_WRITE                          --> 8")
-    print("   BL_EN_R_W_PROTECT                     --> 9")
-    print("   BL_MEM_READ                           --> 10")
-    print("   BL_READ_SECTOR_P_STATUS               --> 11")
-    print("   BL_OTP_READ                           --> 12")
-    print("   BL_DIS_R_W_PROTECT                    --> 13")
-    print("   BL_MY_NEW_COMMAND                     --> 14")
-    print("   MENU_EXIT                             --> 0")
-
-    #command_code = int(input("\n   Type the command code here :") )
-
-    command_code = input("\n   Type the command code here :")
-
-    if(not command_code.isdigit()):
-        print("\n   Please Input valid code shown above")
-    else:
-        decode_menu_command_code(int(command_code))
-
-    input("\n   Press any key to continue  :")
-    purge_serial_port()
-
-
-
-
-
-    
-
-def check_flash_status():
-    pass
-
-def protection_type():
-    pass
+        input("\n   Press any key to continue  :")
+        purge_serial_port()
 
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,125 @@
+#Host side cost of the stm32bl tool (HOST/cpp) against STM32_Programmer_V1.py, on a simulated device
+#
+#usage : python bench_host.py <stm32bl> [image.bin]      (002USER_Application.bin by default)
+#
+#Both tools run the same commands against one SimDevice of device_sim.py, served from its own process on
+#a pty : BL_GET_VER round trips, BL_MEM_WRITE of the image (pipelined 128 byte packets in both tools) and
+#BL_MEM_READ of 128 KB. A pty has no baud rate, so the times are the cost of the host (frames, CRC, system
+#calls, reply parsing) plus the one of the simulated device, which is the same for both tools : the ratio
+#understates the difference between the hosts. On a real link at 115200 baud the wire time dominates both.
+#The stm32bl commands run from one script, the time of an empty script (start, port setup) is subtracted.
+#The Python functions are the ones of the menu, called with their output thrown away. Each read back must
+#match the image.
+
+import contextlib
+import io
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+import serial
+
+import STM32_Programmer_V1 as bl
+
+BENCH_ADDRESS                                       = 0x08008000
+BENCH_VERSIONS                                      = 500       #BL_GET_VER round trips
+BENCH_WRITES                                        = 10        #writes of the image
+BENCH_READ_LEN                                      = 0x20000
+BENCH_READS                                         = 4
+
+#runs a stm32bl script, returns the time it took
+def cpp_run(tool, port, lines):
+    with tempfile.NamedTemporaryFile('w', suffix='.txt', delete=False) as script:
+        script.write("\n".join(lines) + "\n")
+    try:
+        start = time.perf_counter()
+        subprocess.run([tool, '-p', port, '-s', script.name], check=True, stdout=subprocess.DEVNULL)
+        return time.perf_counter() - start
+    finally:
+        os.unlink(script.name)
+
+def cpp_bench(tool, port, image_name, image, read_name):
+    times = {}
+    empty = cpp_run(tool, port, [])
+    times['version'] = cpp_run(tool, port, ['version'] * BENCH_VERSIONS) - empty
+    times['write'] = cpp_run(tool, port, ['write {0} {1:#x}'.format(image_name, BENCH_ADDRESS)] * BENCH_WRITES) - empty
+    times['read'] = cpp_run(tool, port, ['read {0:#x} {1} {2}'.format(BENCH_ADDRESS, BENCH_READ_LEN, read_name)] * BENCH_READS) - empty
+    with open(read_name, 'rb') as f:
+        data = f.read()
+    if(data[0:len(image)] != image):
+        raise RuntimeError("stm32bl read back differs from the image")
+    return times
+
+def python_read(address, length):
+    bl.v1_send_packet(bl.COMMAND_BL_MEM_READ, list(struct.pack('<II', address, length)))
+    ack = bl.read_serial_port(2)
+    if(len(ack) < 2 or ack[0] != 0xA5):
+        return None
+    return bl.read_stream_data(ack[1])
+
+def python_bench(port, image):
+    times = {}
+    bl.ser = serial.Serial(port, 115200, timeout=2)
+    bl.verbose_mode = 0
+    with contextlib.redirect_stdout(io.StringIO()):
+        start = time.perf_counter()
+        for n in range(BENCH_VERSIONS):
+            if(bl.v1_command(bl.COMMAND_BL_GET_VER, []) is None):
+                raise RuntimeError("no reply to BL_GET_VER")
+        times['version'] = time.perf_counter() - start
+
+        start = time.perf_counter()
+        for n in range(BENCH_WRITES):
+            bl.open_the_buffer(image)
+            if(bl.mem_write_run(BENCH_ADDRESS, len(image)) != bl.Flash_HAL_OK):
+                raise RuntimeError("write failed")
+        times['write'] = time.perf_counter() - start
+
+        start = time.perf_counter()
+        for n in range(BENCH_READS):
+            data = python_read(BENCH_ADDRESS, BENCH_READ_LEN)
+        times['read'] = time.perf_counter() - start
+    bl.ser.close()
+    if(data is None or data[0:len(image)] != image):
+        raise RuntimeError("read back differs from the image")
+    return times
+
+def main():
+    if(len(sys.argv) < 2):
+        print("usage : python bench_host.py <stm32bl> [image.bin]")
+        return 2
+    tool = sys.argv[1]
+    image_name = sys.argv[2] if len(sys.argv) > 2 else os.path.join(os.path.dirname(os.path.abspath(__file__)), '002USER_Application.bin')
+    with open(image_name, 'rb') as f:
+        image = f.read()
+
+    device = subprocess.Popen([sys.executable, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'device_sim.py'), '1'],
+        stdout=subprocess.PIPE, text=True)
+    read_name = tempfile.mktemp(suffix='.bin')
+    try:
+        port = device.stdout.readline().strip()
+        python_times = python_bench(port, image)
+        cpp_times = cpp_bench(tool, port, image_name, image, read_name)
+    finally:
+        device.terminate()
+        device.wait()
+        if(os.path.exists(read_name)):
+            os.unlink(read_name)
+
+    rows = [
+        ('version', "BL_GET_VER x {0}".format(BENCH_VERSIONS), BENCH_VERSIONS * 3),
+        ('write', "BL_MEM_WRITE {0} B x {1}".format(len(image), BENCH_WRITES), len(image) * BENCH_WRITES),
+        ('read', "BL_MEM_READ {0} B x {1}".format(BENCH_READ_LEN, BENCH_READS), BENCH_READ_LEN * BENCH_READS),
+    ]
+    print("\n   {0}, {1} bytes, simulated device on {2}\n".format(image_name, len(image), port))
+    print("   {0:32s} {1:>10s} {2:>10s} {3:>12s} {4:>12s} {5:>8s}".format("", "python s", "stm32bl s", "python kB/s", "stm32bl kB/s", "ratio"))
+    for key, name, nbytes in rows:
+        print("   {0:32s} {1:10.3f} {2:10.3f} {3:12.1f} {4:12.1f} {5:8.1f}".format(name, python_times[key], cpp_times[key],
+            nbytes / 1024.0 / python_times[key], nbytes / 1024.0 / max(cpp_times[key], 1e-6), python_times[key] / max(cpp_times[key], 1e-6)))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,310 @@
+#Simulated bootloader on a pseudo terminal, for the tests and the benchmarks of the host tools
+#
+#usage : python device_sim.py [count]        (prints the ports of count devices, serves them until Ctrl-C)
+#
+#A SimDevice answers the v1 packets of STM32_Programmer_V1.py, gang_programmer.py and the stm32bl tool of
+#HOST/cpp on the slave side of a pty, from its own thread, and the v2 BL_MEM_WRITE packets (windowed or not). The flash has the sectors of STM32_Programmer_V1.py
+#and only clears bits like the real one, the erases skip the bootloader and its copy like execute_flash_erase().
+#Served : BL_GET_VER, BL_GET_PROTOCOL, BL_FLASH_ERASE, BL_MEM_WRITE, BL_MEM_READ, BL_GET_SECTOR_HASHES,
+#BL_BLANK_CHECK and BL_FLASH_ERASE_RANGE, any other command gets ACK and status 0. There is no baud rate,
+#replies go out at once. Every packet the device takes is logged as (command, arguments) in log.
+#BL_GET_PROTOCOL replies v2 with BL_CAP_CRC_WORD, plus BL_CAP_WINDOW and the window if window is not 0.
+#A windowed BL_MEM_WRITE gets ACK, 2, its sequence number and the status, like the bootloader.
+#
+#Faults, for the tests :
+#nack           BL_MEM_WRITE packets are NACKed
+#silent         BL_MEM_WRITE packets get no reply
+#corrupt        a bit of the byte written at this address is flipped, the sector hash differs
+#bg_erase       BL_FLASH_ERASE_RANGE replies BL_ERASE_BACKGROUND when it erases bank 2, the status of the
+#               first BL_MEM_WRITE after it comes bg_erase seconds after its ACK (the bootloader waits for the erase)
+#write_delay    seconds between the ACK and the status of every BL_MEM_WRITE
+#The next ones count the v2 BL_MEM_WRITE packets from 0, as they come in :
+#bad_crc        a bit of this packet is hit on the link : NACK
+#drop           this packet is lost on the link
+#late           the reply of this packet comes late_delay seconds late
+#bad_length     the length of this packet is hit on the link : NACK, and the receive ring is dropped with
+#               the packets behind it, like bootloader_uart_get_frame()
+
+import os
+import pty
+import select
+import struct
+import sys
+import threading
+import time
+import tty
+
+import STM32_Programmer_V1 as bl
+
+SIM_VERSION                                         = 0x10
+SIM_STREAM_CHUNK                                    = 1024      #bytes per CRC protected chunk of a streamed reply
+SIM_POLL_PERIOD                                     = 0.05      #seconds, how often a blocked read looks at close()
+SIM_BOOT_SECTORS                                    = [ 0, 1, 12, 13 ]      #never erased
+SIM_MAX_PAYLOAD                                     = 4096      #BL_V2_MAX_PAYLOAD
+SIM_WINDOW                                          = 16380     #BL_RX_WINDOW
+SIM_LATE_DELAY                                      = 0.5       #seconds
+
+class SimDevice:
+    def __init__(self, nack=False, silent=False, corrupt=None, bg_erase=0.0, write_delay=0.0,
+                 max_payload=SIM_MAX_PAYLOAD, window=0, bad_crc=None, drop=None, late=None, late_delay=SIM_LATE_DELAY, bad_length=None):
+        self.nack = nack
+        self.silent = silent
+        self.corrupt = corrupt
+        self.bg_erase = bg_erase
+        self.write_delay = write_delay
+        self.max_payload = max_payload
+        self.window = window
+        self.bad_crc = bad_crc
+        self.drop = drop
+        self.late = late
+        self.late_delay = late_delay
+        self.bad_length = bad_length
+        self.bg_erase_pending = False
+        self.v2_writes = 0
+        self.log = []
+        self.flash = bytearray(b'\xff' * (2 * bl.FLASH_BANK_SIZE))
+        self.closed = False
+
+        self.master, self.slave = pty.openpty()
+        tty.setraw(self.slave)
+        self.port = os.ttyname(self.slave)
+        self.thread = threading.Thread(target=self.serve, daemon=True)
+        self.thread.start()
+
+    def close(self):
+        self.closed = True
+        self.thread.join()
+        os.close(self.master)
+        os.close(self.slave)
+
+    #----------------------------- flash ----------------------------------------
+
+    def read(self, address, length):
+        offset = address - bl.FLASH_BASE
+        if(offset < 0 or offset + length > len(self.flash)):
+            return b'\xff' * length
+        return bytes(self.flash[offset:offset+length])
+
+    def program(self, address, data):
+        offset = address - bl.FLASH_BASE
+        if(offset < 0 or offset + len(data) > len(self.flash)):
+            return bl.Flash_HAL_INV_ADDR
+        for n, value in enumerate(data):
+            if(self.corrupt == address + n):
+                value ^= 0x01
+            self.flash[offset + n] &= value
+        return bl.Flash_HAL_OK
+
+    def erase(self, sector):
+        if(sector in SIM_BOOT_SECTORS):
+            return
+        offset = bl.flash_sector_base(sector) - bl.FLASH_BASE
+        self.flash[offset:offset+bl.flash_sector_size(sector)] = b'\xff' * bl.flash_sector_size(sector)
+
+    def sector_data(self, sector):
+        return self.read(bl.flash_sector_base(sector), bl.flash_sector_size(sector))
+
+    #----------------------------- link ----------------------------------------
+
+    #None once close() was called
+    def receive(self, length):
+        data = b''
+        while(len(data) < length):
+            if(self.closed):
+                return None
+            ready, _, _ = select.select([self.master], [], [], SIM_POLL_PERIOD)
+            if(ready):
+                data += os.read(self.master, length - len(data))
+        return data
+
+    def send(self, data):
+        os.write(self.master, bytes(data))
+
+    def reply(self, data):
+        self.send(bytes([0xA5, len(data)]) + bytes(data))
+
+    #what is in the receive ring is thrown away
+    def drain(self):
+        time.sleep(SIM_POLL_PERIOD)
+        while(select.select([self.master], [], [], 0)[0]):
+            os.read(self.master, 4096)
+
+    #header + chunks with their word mode CRC32, see bootloader_stream_data()
+    def reply_stream(self, data):
+        out = bytearray([0xA5, bl.BL_STREAM_HDR_LEN]) + struct.pack('<BHI', bl.ADDR_VALID, SIM_STREAM_CHUNK, len(data))
+        for offset in range(0, len(data), SIM_STREAM_CHUNK):
+            chunk = data[offset:offset+SIM_STREAM_CHUNK]
+            out += chunk + struct.pack('<I', bl.get_crc_word(chunk, len(chunk)))
+        self.send(out)
+
+    def serve(self):
+        while(True):
+            length = self.receive(1)
+            if(length is not None and length[0] == bl.BL_V2_SOF):
+                if(not self.serve_v2()):
+                    return
+                continue
+            rest = self.receive(length[0]) if length is not None else None
+            if(rest is None):
+                return
+            packet = length + rest
+            if(bl.get_crc(packet, len(packet) - 4) != struct.unpack_from('<I', packet, len(packet) - 4)[0]):
+                self.send(b'\x7f')
+                continue
+            self.handle(packet[1], packet[2:-4])
+
+    #the rest of a v2 packet, its SOF is in, False once close() was called
+    def serve_v2(self):
+        header = self.receive(bl.BL_V2_HDR_LEN - 1)
+        if(header is None):
+            return False
+        header = bytes([bl.BL_V2_SOF]) + header
+        length = struct.unpack_from('<H', header, 4)[0]
+        index = None
+        if(header[1] == bl.COMMAND_BL_MEM_WRITE):
+            index = self.v2_writes
+            self.v2_writes += 1
+            if(index == self.bad_length):
+                length = 0xFFFF
+        if(length > self.max_payload):
+            self.log.append(('bad_length', index))
+            self.send(b'\x7f')
+            self.drain()
+            return True
+
+        rest = self.receive(((bl.BL_V2_HDR_LEN + length + 4 + 3) & ~3) - bl.BL_V2_HDR_LEN)
+        if(rest is None):
+            return False
+        packet = header + rest
+        if(index is not None and index == self.bad_crc):
+            packet = packet[0:-5] + bytes([packet[-5] ^ 0x01]) + packet[-4:]
+        if(index is not None and index == self.drop):
+            self.log.append(('dropped', index))
+            return True
+        crc_len = bl.BL_V2_HDR_LEN + length
+        crc = bl.get_crc_word(packet, crc_len) if (header[2] & bl.BL_V2_FLAG_CRC_WORD) else bl.get_crc(packet, crc_len)
+        if(crc != struct.unpack_from('<I', packet, crc_len)[0]):
+            self.log.append(('crc_error', index))
+            self.send(b'\x7f')
+            return True
+        self.handle_v2(packet, length, index)
+        return True
+
+    #----------------------------- commands ----------------------------------------
+
+    def handle(self, command, args):
+        if(command == bl.COMMAND_BL_GET_VER):
+            self.log.append(('version',))
+            self.reply([SIM_VERSION])
+
+        elif(command == bl.COMMAND_BL_GET_PROTOCOL):
+            self.log.append(('protocol',))
+            capabilities = bl.BL_CAP_CRC_WORD | (bl.BL_CAP_WINDOW if self.window else 0)
+            self.reply(struct.pack('<BBHH', 2, capabilities, self.max_payload, self.window))
+
+        elif(command == bl.COMMAND_BL_FLASH_ERASE):
+            sector, count = args[0], args[1]
+            self.log.append(('erase', sector, count))
+            sectors = range(bl.FLASH_SECTOR_COUNT) if sector == 0xFF else range(sector, min(sector + count, bl.FLASH_SECTOR_COUNT))
+            for n in sectors:
+                self.erase(n)
+            self.reply([bl.Flash_HAL_OK])
+
+        elif(command == bl.COMMAND_BL_FLASH_ERASE_RANGE):
+            address, length = struct.unpack_from('<II', args)
+            self.log.append(('erase_range', address, length))
+            sectors = [n for n in range(bl.FLASH_SECTOR_COUNT) if bl.flash_sector_base(n) < address + length and
+                address < bl.flash_sector_base(n) + bl.flash_sector_size(n)]
+            for n in sectors:
+                self.erase(n)
+            if(self.bg_erase and any(n >= bl.FLASH_SECTOR_COUNT // 2 for n in sectors)):
+                self.bg_erase_pending = True
+                self.reply([bl.BL_ERASE_BACKGROUND])
+            else:
+                self.reply([bl.Flash_HAL_OK])
+
+        elif(command == bl.COMMAND_BL_MEM_WRITE):
+            address, length = struct.unpack_from('<IB', args)
+            self.log.append(('write', address, length))
+            if(self.nack):
+                self.send(b'\x7f')
+                return
+            if(self.silent):
+                return
+            self.send([0xA5, 1])
+            delay = self.write_delay
+            if(self.bg_erase_pending):
+                delay += self.bg_erase
+                self.bg_erase_pending = False
+            if(delay):
+                time.sleep(delay)
+            self.send([self.program(address, args[5:5+length])])
+
+        elif(command == bl.COMMAND_BL_MEM_READ):
+            address, length = struct.unpack_from('<II', args)
+            self.log.append(('read', address, length))
+            self.reply_stream(self.read(address, length))
+
+        elif(command == bl.COMMAND_BL_GET_SECTOR_HASHES):
+            first, count = args[0], args[1]
+            self.log.append(('hashes', first, count))
+            hashes = b''
+            for sector in range(first, first + count):
+                data = self.sector_data(sector)
+                hashes += struct.pack('<I', bl.get_crc_word(data, len(data)))
+            self.reply_stream(hashes)
+
+        elif(command == bl.COMMAND_BL_BLANK_CHECK):
+            first, count = args[0], args[1]
+            self.log.append(('blank', first, count))
+            blank_map = 0
+            for sector in range(first, first + count):
+                if(self.sector_data(sector) == b'\xff' * bl.flash_sector_size(sector)):
+                    blank_map |= (1 << sector)
+            self.reply(struct.pack('<BI', bl.ADDR_VALID, blank_map))
+
+        else:
+            self.log.append((command,))
+            self.reply([bl.Flash_HAL_OK])
+
+    #v2 BL_MEM_WRITE, the payload is word aligned after the header
+    def handle_v2(self, packet, length, index):
+        command, flags, seq = packet[1], packet[2], packet[3]
+        if(command != bl.COMMAND_BL_MEM_WRITE):
+            self.log.append((command,))
+            self.send(b'\x7f')
+            return
+        address = struct.unpack_from('<I', packet, 8)[0]
+        self.log.append(('write', address, length))
+        if(self.nack):
+            self.send(b'\x7f')
+            return
+        if(self.silent):
+            return
+        window = flags & bl.BL_V2_FLAG_WINDOW
+        if(not window):
+            self.send([0xA5, 1])
+        delay = self.write_delay + (self.late_delay if index == self.late else 0.0)
+        if(delay):
+            time.sleep(delay)
+        status = self.program(address, packet[bl.BL_V2_HDR_LEN:bl.BL_V2_HDR_LEN+length])
+        if(window):
+            self.send([0xA5, 2, seq, status])
+        else:
+            self.send([status])
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 1
+    devices = [SimDevice() for n in range(count)]
+    print(" ".join(device.port for device in devices), flush=True)
+    try:
+        while(True):
+            time.sleep(1)
+    except KeyboardInterrupt:
+        pass
+    for device in devices:
+        device.close()
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,133 @@
+#Timing model of a BL_MEM_WRITE run : synchronous writes against the deferred writes of the flash engine
+#
+#usage : python flash_queue_sim.py [image size] [baud rate] [payload]
+#
+#Simulates the host loop of mem_write_run() (packet N+1 goes out after the ACK of packet N, the status
+#of packet N is read after that) against the bootloader, packet by packet :
+#- sync  : the bootloader ACKs, programs the payload, then replies the status
+#- defer : BL_V2_FLAG_DEFER, the payload is copied in to one of BL_WRITE_BUF_COUNT buffers and queued
+#          for the flash engine, the status goes out right away (the last one waits for the queue)
+#with the sectors already blank, or erased on the way (BL_V2_FLAG_AUTO_ERASE), in bank 1 (slot A) or bank 2
+#(slot B). The bootloader runs from bank 1 : the core stalls on its code fetches while bank 1 is erased or
+#programmed, only the DMA keeps filling the receive ring. A deferred packet to bank 1 gets its status once
+#the engine is done with the queue, the main loop gets no cycle in between. Bank 2 is read while written.
+#The flash times are the typical ones of the STM32F429 datasheet at x32 parallelism. The CPU time of a
+#packet (CRC, copy) is a few tens of microseconds.
+
+import sys
+
+LINK_BITS_PER_BYTE                                  = 10        #8N1
+HOST_LATENCY                                        = 0.001     #seconds, USB serial adapter, per read
+HOST_PACKET_TIME                                    = 0.0005    #seconds, to build a packet in python
+CPU_TIME_PER_BYTE                                   = 1.0 / 180e6 * 2      #CRC unit or memcpy, 2 cycles per byte
+
+PROGRAM_WORD_TIME                                   = 16e-6     #seconds, x32
+ERASE_TIME = { 0x4000 : 0.25, 0x10000 : 0.55, 0x20000 : 1.0 }     #seconds per sector size, x32
+
+V2_HDR_LEN                                          = 12
+BL_WRITE_BUF_COUNT                                  = 4
+APP_BASE                                            = 0x08008000  #slot A, bank 1
+APP_BASE_BANK2                                      = 0x08108000  #slot B, bank 2
+BANK2_BASE                                          = 0x08100000
+
+#sector map of one bank, bank 2 has the same layout
+BANK_SECTORS = [ 0x4000 ] * 4 + [ 0x10000 ] + [ 0x20000 ] * 7
+
+def sector_map():
+    sectors = []
+    base = 0x08000000
+    for bank in range(2):
+        for size in BANK_SECTORS:
+            sectors.append((base, size))
+            base += size
+    return sectors
+
+def wire_time(nbytes, baud):
+    return nbytes * LINK_BITS_PER_BYTE / float(baud)
+
+def v2_packet_len(payload_len):
+    return (V2_HDR_LEN + payload_len + 4 + 3) & ~3
+
+def program_time(length):
+    return ((length // 4) + (length % 4)) * PROGRAM_WORD_TIME
+
+#erase time of the sectors [address, address + length) touches for the first time
+def erase_time(address, length, erased):
+    t = 0.0
+    for base, size in sector_map():
+        if(base < address + length and address < base + size and base not in erased):
+            erased.add(base)
+            t += ERASE_TIME[size]
+    return t
+
+#returns (total time, flash busy time) of a write of image_size bytes at base, buffers = 0 : synchronous writes
+def simulate(image_size, baud, payload, buffers, auto_erase, base=APP_BASE):
+    packets = [(base + x, min(payload, image_size - x)) for x in range(0, image_size, payload)]
+    stall = base < BANK2_BASE
+    erased = set()
+    flash_busy = 0.0
+
+    wire_free = 0.0             #the link host -> bootloader is free
+    dev_free = 0.0              #the bootloader waits for the next packet
+    flash_free = 0.0            #the flash engine is idle
+    prog_done = []              #end of the programming of every packet (deferred)
+    ack_host = []
+    status_host = []
+
+    for n, (address, length) in enumerate(packets):
+        #host : packet n goes out once ACK n-1 is in, and the status of n-2 before it
+        host_ready = 0.0
+        if(n >= 1):
+            host_ready = ack_host[n - 1]
+        if(n >= 2):
+            host_ready = max(host_ready, status_host[n - 2])
+        send_start = max(host_ready + HOST_PACKET_TIME, wire_free)
+        rx_done = send_start + wire_time(v2_packet_len(length), baud)
+        wire_free = rx_done
+
+        start = max(rx_done, dev_free)
+        ack_at = start + v2_packet_len(length) * CPU_TIME_PER_BYTE
+        ack_host.append(ack_at + wire_time(2, baud) + HOST_LATENCY)
+
+        flash = (erase_time(address, length, erased) if auto_erase else 0.0) + program_time(length)
+        flash_busy += flash
+
+        if(buffers == 0):
+            status_at = ack_at + flash
+        else:
+            #a free buffer : the packet `buffers` before this one is programmed
+            buf_ready = ack_at
+            if(n >= buffers):
+                buf_ready = max(buf_ready, prog_done[n - buffers])
+            queued = buf_ready + length * CPU_TIME_PER_BYTE
+            flash_free = max(flash_free, queued) + flash
+            prog_done.append(flash_free)
+            #bank 1 : the core is stalled until the queue is empty
+            status_at = flash_free if (stall or n == len(packets) - 1) else queued
+
+        status_host.append(status_at + wire_time(1, baud) + HOST_LATENCY)
+        dev_free = status_at + wire_time(1, baud)
+
+    return status_host[-1], flash_busy
+
+def main():
+    image_size = int(sys.argv[1], 0) if len(sys.argv) > 1 else 0x40000
+    baud = int(sys.argv[2]) if len(sys.argv) > 2 else 921600
+    payload = int(sys.argv[3]) if len(sys.argv) > 3 else 4096
+
+    print("\n   {0} bytes at {1} baud, {2} byte payloads".format(image_size, baud, payload))
+    print("\n   {0:6s} {1:12s} {2:8s} {3:>9s} {4:>9s} {5:>11s} {6:>8s}".format("bank", "erase", "mode", "time (s)", "kB/s", "flash busy", "gain"))
+    for bank, base in ((1, APP_BASE), (2, APP_BASE_BANK2)):
+        for auto_erase in (0, 1):
+            sync_time = None
+            for buffers in [0, 1, 2, BL_WRITE_BUF_COUNT, 8]:
+                total, flash_busy = simulate(image_size, baud, payload, buffers, auto_erase, base)
+                if(buffers == 0):
+                    sync_time = total
+                mode = "sync" if buffers == 0 else "defer x{0}".format(buffers)
+                print("   {0:<6d} {1:12s} {2:8s} {3:9.3f} {4:9.1f} {5:10.0f}% {6:7.1f}%".format(
+                    bank, "auto" if auto_erase else "blank", mode, total, image_size / 1024.0 / total,
+                    100.0 * flash_busy / total, 100.0 * (sync_time - total) / sync_time))
+
+if __name__ == "__main__":
+    main()
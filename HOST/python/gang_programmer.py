@@ -0,0 +1,254 @@
+#Gang programmer : writes one image to many bootloaders at the same time
+#
+#usage : python gang_programmer.py <image.bin> <address> [port ...] [-b baud] [-n]
+#        no port : every serial port where a bootloader answers BL_GET_VER
+#        -b      : baud rate of the ports (115200)
+#        -n      : no erase before the write, the sectors are blank already
+#
+#The packets are built once for the image and every device gets the same ones from its own thread :
+#BL_GET_VER, BL_FLASH_ERASE_RANGE of the image, the BL_MEM_WRITE packets pipelined like mem_write_run(),
+#then BL_GET_SECTOR_HASHES of the sectors against the CRC32 of the image (the rest of the last sector
+#stays erased). The address must be the start of a flash sector.
+#The exit code is 0 only if every device passed.
+
+import sys
+import time
+import struct
+import concurrent.futures
+import serial
+
+import STM32_Programmer_V1 as bl
+
+GANG_PROBE_TIMEOUT                                  = 0.5       #seconds, for a bootloader to answer BL_GET_VER
+GANG_REPLY_TIMEOUT                                  = 2         #seconds
+GANG_PROGRESS_PERIOD                                = 1.0       #seconds between two progress lines
+
+class GangError(Exception):
+    pass
+
+#builds a v1 packet ([len to follow][command][args][CRC32])
+def v1_packet(command, args):
+    packet = [len(args) + 5, command] + list(args)
+    return bytes(packet) + struct.pack('<I', bl.get_crc(packet, len(packet)))
+
+#everything the devices get, built once
+class GangJob:
+    def __init__(self, image, address, sectors, baud, erase):
+        self.image = image
+        self.address = address
+        self.sectors = sectors
+        self.baud = baud
+        self.erase = erase
+
+        self.get_ver = v1_packet(bl.COMMAND_BL_GET_VER, [])
+        self.erase_range = v1_packet(bl.COMMAND_BL_FLASH_ERASE_RANGE, struct.pack('<II', address, len(image)))
+        self.get_hashes = v1_packet(bl.COMMAND_BL_GET_SECTOR_HASHES, [sectors[0], len(sectors)])
+
+        #BL_MEM_WRITE packets and their payload length
+        self.writes = []
+        for offset in range(0, len(image), bl.BL_V1_MAX_PAYLOAD):
+            payload = image[offset:offset+bl.BL_V1_MAX_PAYLOAD]
+            args = struct.pack('<IB', address + offset, len(payload)) + payload
+            self.writes.append((v1_packet(bl.COMMAND_BL_MEM_WRITE, args), len(payload)))
+
+        #CRC32 the sectors must have once written
+        self.hashes = []
+        offset = 0
+        for sector in sectors:
+            size = bl.flash_sector_size(sector)
+            local = image[offset:offset+size]
+            local += b'\xff' * (size - len(local))
+            self.hashes.append(bl.get_crc_word(local, size))
+            offset += size
+
+#state of one device, written by its thread, read by the progress report
+class GangDevice:
+    def __init__(self, port):
+        self.port = port
+        self.state = "waiting"
+        self.bytes_done = 0
+        self.elapsed = 0.0
+        self.error = ""
+
+def read_exact(ser, length):
+    value = ser.read(length)
+    if(len(value) < length):
+        raise GangError("timeout, bootloader not responding")
+    return value
+
+#reads ACK + "len to follow" and the reply
+def read_reply(ser):
+    ack = read_exact(ser, 1)
+    if(ack[0] == 0x7F):
+        raise GangError("NACK, CRC of the packet failed")
+    if(ack[0] != 0xA5):
+        raise GangError("unexpected reply {0:#04x}".format(ack[0]))
+    return read_exact(ser, read_exact(ser, 1)[0])
+
+#reads a streamed reply (header + CRC protected chunks), see read_stream_data()
+def read_stream(ser, length):
+    header = read_exact(ser, length)
+    status, chunk_len, total_len = struct.unpack_from('<BHI', header)
+    if(status != bl.ADDR_VALID):
+        raise GangError("address invalid")
+    data = bytearray()
+    while(len(data) < total_len):
+        this_len = min(chunk_len, total_len - len(data))
+        chunk = read_exact(ser, this_len + 4)
+        if(struct.unpack_from('<I', chunk, this_len)[0] != bl.get_crc_word(chunk, this_len)):
+            raise GangError("CRC of the reply failed")
+        data += chunk[0:this_len]
+    return data
+
+#packet N+1 goes out as soon as the ACK of packet N is in, then the status of packet N is read
+def write_image(ser, dev, job):
+    frames = job.writes
+    ser.write(frames[0][0])
+    for n in range(len(frames)):
+        #a NACK is one byte
+        if(read_exact(ser, 1)[0] != 0xA5):
+            raise GangError("NACK on the write at {0:#010x}".format(job.address + n * bl.BL_V1_MAX_PAYLOAD))
+        read_exact(ser, 1)
+        if(n + 1 < len(frames)):
+            ser.write(frames[n + 1][0])
+        status = read_exact(ser, 1)[0]
+        if(status != bl.Flash_HAL_OK):
+            raise GangError("write failed at {0:#010x}, status {1}".format(job.address + n * bl.BL_V1_MAX_PAYLOAD, status))
+        dev.bytes_done += frames[n][1]
+        #only the first packet waits for a background erase
+        ser.timeout = GANG_REPLY_TIMEOUT
+
+def program_device(dev, job):
+    start_time = time.time()
+    try:
+        with serial.Serial(dev.port, job.baud, timeout=GANG_REPLY_TIMEOUT) as ser:
+            ser.reset_input_buffer()
+            dev.state = "ping"
+            ser.write(job.get_ver)
+            read_reply(ser)
+
+            if(job.erase):
+                dev.state = "erase"
+                ser.timeout = bl.BL_MASS_ERASE_TIMEOUT
+                ser.write(job.erase_range)
+                status = read_reply(ser)[0]
+                if(status != bl.Flash_HAL_OK and status != bl.BL_ERASE_BACKGROUND):
+                    raise GangError("erase failed, status {0}".format(status))
+                #BL_ERASE_BACKGROUND : the first write waits for the whole erase
+                if(status == bl.Flash_HAL_OK):
+                    ser.timeout = GANG_REPLY_TIMEOUT
+
+            dev.state = "write"
+            write_image(ser, dev, job)
+
+            dev.state = "verify"
+            ser.timeout = bl.BL_MASS_ERASE_TIMEOUT
+            ser.write(job.get_hashes)
+            if(read_exact(ser, 1)[0] != 0xA5):
+                raise GangError("no sector hashes")
+            data = read_stream(ser, read_exact(ser, 1)[0])
+            hashes = list(struct.unpack('<{0}I'.format(len(job.sectors)), data))
+            for sector, local, device in zip(job.sectors, job.hashes, hashes):
+                if(local != device):
+                    raise GangError("verify failed, sector {0}".format(sector))
+        dev.state = "PASS"
+    except (GangError, OSError, serial.SerialException, struct.error) as e:
+        dev.error = str(e)
+        dev.state = "FAIL"
+    dev.elapsed = time.time() - start_time
+
+#True if a bootloader answers BL_GET_VER on the port
+def bootloader_probe(port, baud):
+    try:
+        with serial.Serial(port, baud, timeout=GANG_PROBE_TIMEOUT) as ser:
+            ser.reset_input_buffer()
+            ser.write(v1_packet(bl.COMMAND_BL_GET_VER, []))
+            ack = ser.read(3)
+            return (len(ack) == 3 and ack[0] == 0xA5)
+    except (OSError, serial.SerialException):
+        return False
+
+#the serial ports where a bootloader answers, probed in parallel
+def find_bootloaders(baud):
+    ports = bl.serial_ports()
+    with concurrent.futures.ThreadPoolExecutor(max_workers=bl.SERIAL_PROBE_THREADS) as pool:
+        found = list(pool.map(lambda port: bootloader_probe(port, baud), ports))
+    return [port for port, ok in zip(ports, found) if ok]
+
+def print_progress(devices, total, start_time):
+    states = {}
+    for dev in devices:
+        states[dev.state] = states.get(dev.state, 0) + 1
+    done = sum(dev.bytes_done for dev in devices)
+    print("   [{0:6.1f} s] {1}  {2:3.0f}%".format(time.time() - start_time,
+        " | ".join("{0} {1}".format(state, count) for state, count in sorted(states.items())),
+        100.0 * done / (total * len(devices))))
+
+def print_summary(devices):
+    print("\n   {0:20s} {1:6s} {2:>9s} {3:>9s} {4:>8s}  {5}".format("port", "result", "bytes", "time (s)", "kB/s", "error"))
+    for dev in devices:
+        rate = dev.bytes_done / 1024.0 / dev.elapsed if dev.elapsed > 0 else 0.0
+        print("   {0:20s} {1:6s} {2:9d} {3:9.2f} {4:8.1f}  {5}".format(dev.port, dev.state, dev.bytes_done, dev.elapsed, rate, dev.error))
+    passed = len([dev for dev in devices if dev.state == "PASS"])
+    print("\n   {0} of {1} devices passed".format(passed, len(devices)))
+
+def main():
+    args = sys.argv[1:]
+    baud = 115200
+    erase = True
+    ports = []
+    positional = []
+    while(args):
+        arg = args.pop(0)
+        if(arg == "-b" and args):
+            baud = int(args.pop(0))
+        elif(arg == "-n"):
+            erase = False
+        else:
+            positional.append(arg)
+    if(len(positional) < 2):
+        print("usage : python gang_programmer.py <image.bin> <address> [port ...] [-b baud] [-n]")
+        return 2
+    with open(positional[0], 'rb') as f:
+        image = f.read()
+    address = int(positional[1], 16)
+    ports = positional[2:]
+
+    first_sector = bl.flash_sector_at(address)
+    if(first_sector is None or not image):
+        print("\n   {0:#010x} is not the start of a flash sector, or the image is empty".format(address))
+        return 2
+    sectors = []
+    offset = 0
+    while(offset < len(image) and first_sector + len(sectors) < bl.FLASH_SECTOR_COUNT):
+        sectors.append(first_sector + len(sectors))
+        offset += bl.flash_sector_size(sectors[-1])
+    if(offset < len(image)):
+        print("\n   The image doesn't fit in the flash")
+        return 2
+
+    if(not ports):
+        ports = find_bootloaders(baud)
+        print("\n   Bootloaders found on : {0}".format(" ".join(ports)))
+    if(not ports):
+        print("\n   No device to program")
+        return 1
+
+    job = GangJob(image, address, sectors, baud, erase)
+    devices = [GangDevice(port) for port in ports]
+    print("\n   {0} bytes at {1:#010x} to {2} devices, {3} packets\n".format(len(image), address, len(devices), len(job.writes)))
+
+    start_time = time.time()
+    with concurrent.futures.ThreadPoolExecutor(max_workers=len(devices)) as pool:
+        futures = [pool.submit(program_device, dev, job) for dev in devices]
+        while(True):
+            finished, running = concurrent.futures.wait(futures, timeout=GANG_PROGRESS_PERIOD)
+            print_progress(devices, len(image), start_time)
+            if(not running):
+                break
+
+    print_summary(devices)
+    return 0 if all(dev.state == "PASS" for dev in devices) else 1
+
+if __name__ == "__main__":
+    sys.exit(main())
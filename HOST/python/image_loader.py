@@ -0,0 +1,180 @@
+#Loader of the firmware images with their addresses : ELF, Intel HEX and Motorola S-record
+#
+#usage : python image_loader.py <image file>      (prints the runs a write of the file sends)
+#
+#load_image() returns the populated segments of the file as a sorted list of (address, bytes), the
+#addresses are the ones of the file : load address (p_paddr) of the PT_LOAD program headers of an ELF
+#file, addresses of the data records of a HEX or S-record file. Nothing outside the segments is sent,
+#a config block at the end of the flash costs its own bytes only, not the hole before it.
+#image_runs() cuts the segments in to runs which never cross a flash sector, the erase of a sector
+#and its write go together (see menu 27 of STM32_Programmer_V1.py).
+
+import struct
+import sys
+
+IMAGE_GAP_FILL                                      = 16        #bytes, a smaller hole is sent as 0xFF, cheaper than a new packet
+
+PT_LOAD                                             = 1
+
+#----------------------------- ELF ----------------------------------------
+
+#PT_LOAD segments of a 32-bit little endian ELF file, .bss (no bytes in the file) is left out
+def load_elf(elf):
+    if(elf[0:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1):
+        raise ValueError("not a 32-bit little endian ELF file")
+
+    e_phoff, = struct.unpack_from('<I', elf, 0x1C)
+    e_phentsize, e_phnum = struct.unpack_from('<HH', elf, 0x2A)
+    segments = []
+    for n in range(e_phnum):
+        p_type, p_offset, p_vaddr, p_paddr, p_filesz = struct.unpack_from('<IIIII', elf, e_phoff + n * e_phentsize)
+        if(p_type != PT_LOAD or p_filesz == 0):
+            continue
+        if(p_offset + p_filesz > len(elf)):
+            raise ValueError("program header {0} goes past the end of the file".format(n))
+        segments.append((p_paddr, elf[p_offset:p_offset+p_filesz]))
+    return segments
+
+#----------------------------- Intel HEX ----------------------------------------
+
+#data records (00) of an Intel HEX file, with the extended segment (02) and linear (04) addresses
+def load_hex(text):
+    segments = []
+    base = 0
+    for line_nb, line in enumerate(text.splitlines(), 1):
+        line = line.strip()
+        if(not line):
+            continue
+        if(line[0] != ':'):
+            raise ValueError("line {0} : not an Intel HEX record".format(line_nb))
+        record = bytes.fromhex(line[1:])
+        if(len(record) < 5 or len(record) != record[0] + 5):
+            raise ValueError("line {0} : bad record length".format(line_nb))
+        if(sum(record) & 0xFF):
+            raise ValueError("line {0} : checksum failed".format(line_nb))
+
+        count, offset, record_type = struct.unpack_from('>BHB', record)
+        data = record[4:4+count]
+        if(record_type == 0x00):
+            segments.append((base + offset, data))
+        elif(record_type == 0x01):
+            break
+        elif(record_type == 0x02):
+            base = struct.unpack('>H', data)[0] << 4
+        elif(record_type == 0x04):
+            base = struct.unpack('>H', data)[0] << 16
+        #03 / 05 : start address, nothing to write
+    return segments
+
+#----------------------------- S-record ----------------------------------------
+
+#bytes of address of the data records S1, S2, S3
+SREC_ADDR_LEN = { '1' : 2, '2' : 3, '3' : 4 }
+
+#data records of a Motorola S-record file, S0 (header), S5/S6 (count) and S7-S9 (start address) are skipped
+def load_srec(text):
+    segments = []
+    for line_nb, line in enumerate(text.splitlines(), 1):
+        line = line.strip()
+        if(not line):
+            continue
+        if(len(line) < 4 or line[0] != 'S'):
+            raise ValueError("line {0} : not an S-record".format(line_nb))
+        record = bytes.fromhex(line[2:])
+        if(len(record) != record[0] + 1):
+            raise ValueError("line {0} : bad record length".format(line_nb))
+        if((sum(record) & 0xFF) != 0xFF):
+            raise ValueError("line {0} : checksum failed".format(line_nb))
+
+        addr_len = SREC_ADDR_LEN.get(line[1])
+        if(addr_len):
+            address = int.from_bytes(record[1:1+addr_len], 'big')
+            segments.append((address, record[1+addr_len:-1]))
+    return segments
+
+#----------------------------- segments ----------------------------------------
+
+#sorts the segments and joins the ones which touch, overlapping segments are an error
+def merge_segments(segments):
+    merged = []
+    for address, data in sorted(segments, key=lambda s: s[0]):
+        if(not data):
+            continue
+        if(merged and address < merged[-1][0] + len(merged[-1][1])):
+            raise ValueError("segments overlap at {0:#010x}".format(address))
+        if(merged and address == merged[-1][0] + len(merged[-1][1])):
+            merged[-1][1].extend(data)
+        else:
+            merged.append((address, bytearray(data)))
+    return [(address, bytes(data)) for address, data in merged]
+
+#reads an image file, the format is the one of its contents (the extension is not looked at)
+#returns the merged segments, raises ValueError for a raw binary : it has no address
+def load_image(file_name):
+    with open(file_name, 'rb') as f:
+        contents = f.read()
+    if(contents[0:4] == b'\x7fELF'):
+        segments = load_elf(contents)
+    else:
+        text = contents.lstrip()
+        if(text[0:1] == b':'):
+            segments = load_hex(text.decode('ascii'))
+        elif(text[0:1] == b'S' and text[1:2].isdigit()):
+            segments = load_srec(text.decode('ascii'))
+        else:
+            raise ValueError("{0} is not an ELF, Intel HEX or S-record file".format(file_name))
+    segments = merge_segments(segments)
+    if(not segments):
+        raise ValueError("{0} has nothing to write".format(file_name))
+    return segments
+
+#cuts the segments in to runs which don't cross a boundary (sorted start addresses of the flash sectors
+#and the end of the flash), holes up to IMAGE_GAP_FILL bytes inside a sector are filled with 0xFF (erased
+#flash) and don't start a new run, outside the flash (RAM) every hole starts a new run
+def image_runs(segments, boundaries):
+    runs = []
+    for address, data in segments:
+        offset = 0
+        while(offset < len(data)):
+            start = address + offset
+            end = address + len(data)
+            for boundary in boundaries:
+                if(start < boundary < end):
+                    end = boundary
+                    break
+            chunk = data[offset:offset+end-start]
+            last = runs[-1] if runs else None
+            if(last is not None):
+                last_end = last[0] + len(last[1])
+                in_flash = (boundaries[0] <= last_end and start < boundaries[-1])
+                crossed = any(last_end <= boundary <= start for boundary in boundaries)
+                if(start - last_end <= IMAGE_GAP_FILL and in_flash and not crossed):
+                    last[1].extend(b'\xff' * (start - last_end) + chunk)
+                    offset += len(chunk)
+                    continue
+            runs.append((start, bytearray(chunk)))
+            offset += len(chunk)
+    return [(address, bytes(data)) for address, data in runs]
+
+def main():
+    if(len(sys.argv) < 2):
+        print("usage : python image_loader.py <image file>")
+        return 2
+    import STM32_Programmer_V1 as bl
+    try:
+        segments = load_image(sys.argv[1])
+    except (OSError, ValueError) as e:
+        print("\n   {0}".format(e))
+        return 1
+    runs = image_runs(segments, bl.flash_sector_bounds())
+    for address, data in runs:
+        sector = bl.flash_sector_of(address)
+        print("   {0:#010x}  {1:7d} bytes  {2}".format(address, len(data),
+            "sector {0}".format(sector) if sector is not None else "not in the flash"))
+    sent = sum(len(data) for address, data in runs)
+    span = runs[-1][0] + len(runs[-1][1]) - runs[0][0]
+    print("\n   {0} bytes in {1} runs, {2} bytes of holes not sent".format(sent, len(runs), span - sent))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,120 @@
+#Decoder of the binary debug log (dbg_log.h) of the bootloader and the user application
+#
+#usage : python log_decoder.py <firmware.elf> <serial port or capture file> [baud rate]
+#
+#The target only sends the offset of the format string in the .log_fmt section of its ELF file,
+#the strings are read back from the ELF file given here, it must be the one running on the target.
+
+import re
+import struct
+import sys
+
+import serial
+
+LOG_SYNC                                            = 0xEB
+LOG_MAX_ARGS                                        = 4
+LOG_HDR_LEN                                         = 8
+
+level_names = [ "NONE", "ERROR", "WARN", "INFO", "DEBUG" ]
+
+#----------------------------- ELF ----------------------------------------
+
+#returns the contents of a section of a 32-bit little endian ELF file
+def elf_read_section(file_name, section_name):
+    with open(file_name, 'rb') as f:
+        elf = f.read()
+    if(elf[0:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1):
+        raise ValueError("{0} is not a 32-bit little endian ELF file".format(file_name))
+
+    e_shoff, = struct.unpack_from('<I', elf, 0x20)
+    e_shentsize, e_shnum, e_shstrndx = struct.unpack_from('<HHH', elf, 0x2E)
+
+    sections = []
+    for i in range(e_shnum):
+        sh_name, sh_type, sh_flags, sh_addr, sh_offset, sh_size = struct.unpack_from('<IIIIII', elf, e_shoff + i * e_shentsize)
+        sections.append((sh_name, sh_offset, sh_size))
+
+    strtab_offset = sections[e_shstrndx][1]
+    for sh_name, sh_offset, sh_size in sections:
+        end = elf.index(b'\x00', strtab_offset + sh_name)
+        if(elf[strtab_offset + sh_name:end].decode() == section_name):
+            return elf[sh_offset:sh_offset + sh_size]
+    raise ValueError("no {0} section in {1}, is the log enabled ?".format(section_name, file_name))
+
+#----------------------------- formatting ----------------------------------------
+
+c_conversion = re.compile(r'%([-#0 +]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|t)?([diouxXcp%])')
+
+#formats a C printf string with 32-bit arguments
+def c_format(fmt, args):
+    args = list(args)
+    def convert(m):
+        flags, conv = m.group(1), m.group(2)
+        if(conv == '%'):
+            return '%'
+        value = args.pop(0) if args else 0
+        if(conv in 'di'):
+            if(value & 0x80000000):
+                value -= 0x100000000
+            conv = 'd'
+        elif(conv == 'p'):
+            flags, conv = '#' + flags, 'x'
+        elif(conv == 'c'):
+            return chr(value & 0xFF)
+        return ('%' + flags + conv) % value
+    return c_conversion.sub(convert, fmt)
+
+def fmt_string(strings, fmt_id):
+    end = strings.find(b'\x00', fmt_id)
+    return strings[fmt_id:end].decode(errors='replace')
+
+#----------------------------- records ----------------------------------------
+
+#decodes the complete records at the start of buf, returns the messages and the bytes consumed
+def decode_records(strings, buf):
+    messages = []
+    pos = 0
+    while(len(buf) - pos >= LOG_HDR_LEN):
+        fmt_id = buf[pos] | (buf[pos+1] << 8)
+        level = buf[pos+2] >> 4
+        nargs = buf[pos+2] & 0x0F
+        if(buf[pos+3] != LOG_SYNC or nargs > LOG_MAX_ARGS or level >= len(level_names) or fmt_id >= len(strings)):
+            #lost track of the records (target reset, noise..), look for the next one
+            pos += 1
+            continue
+        rec_len = LOG_HDR_LEN + 4 * nargs
+        if(len(buf) - pos < rec_len):
+            break
+        tick, = struct.unpack_from('<I', buf, pos + 4)
+        args = struct.unpack_from('<{0}I'.format(nargs), buf, pos + LOG_HDR_LEN)
+        messages.append("[{0:10d}] {1:5s} {2}".format(tick, level_names[level], c_format(fmt_string(strings, fmt_id), args)))
+        pos += rec_len
+    return messages, pos
+
+def main():
+    if(len(sys.argv) < 3):
+        print("usage : python log_decoder.py <firmware.elf> <serial port or capture file> [baud rate]")
+        return 1
+
+    strings = elf_read_section(sys.argv[1], ".log_fmt")
+    baud = int(sys.argv[3]) if len(sys.argv) > 3 else 115200
+
+    try:
+        source = serial.Serial(sys.argv[2], baud, timeout=0.1)
+    except (OSError, serial.SerialException):
+        source = open(sys.argv[2], 'rb')
+
+    buf = b''
+    while True:
+        data = source.read(4096)
+        if(not data and not isinstance(source, serial.Serial)):
+            break
+        buf += data
+        messages, used = decode_records(strings, buf)
+        buf = buf[used:]
+        for m in messages:
+            print(m)
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,97 @@
+#Timing model of a BL_MEM_WRITE run : packets in sequence against the pipelined host loop
+#
+#usage : python pipeline_sim.py [image size] [payload]
+#
+#Simulates the v1 BL_MEM_WRITE packets (128 bytes of payload at most) of a write, packet by packet :
+#- sequential : the host sends packet N+1 once the write status of packet N is in, link time, CRC,
+#               programming and the round trip of the USB serial adapter all add up
+#- pipelined  : mem_write_run(), packet N+1 goes out after the ACK of packet N (the bootloader ACKs
+#               before it programs), the DMA receive ring takes it while packet N is programmed, the
+#               status of packet N is read after that
+#The bound of the pipeline is the larger of the link time and the flash time, printed for each baud rate.
+#Sectors are blank, the flash times are the ones of flash_queue_sim.py.
+
+import sys
+
+LINK_BITS_PER_BYTE                                  = 10        #8N1
+HOST_PACKET_TIME                                    = 0.0002    #seconds, to build a packet in python (table CRC)
+CPU_TIME_PER_BYTE                                   = 1.0 / 180e6 * 2      #CRC unit, 2 cycles per byte
+PROGRAM_WORD_TIME                                   = 16e-6     #seconds, x32
+
+V1_WRITE_OVERHEAD                                   = 11        #len, command, address, payload len, CRC
+BAUD_RATES                                          = [ 115200, 460800, 921600, 2000000 ]
+LATENCIES                                           = [ 0.0, 0.001, 0.004 ]     #seconds
+
+def wire_time(nbytes, baud):
+    return nbytes * LINK_BITS_PER_BYTE / float(baud)
+
+def program_time(length):
+    return ((length // 4) + (length % 4)) * PROGRAM_WORD_TIME
+
+def packets_of(image_size, payload):
+    return [min(payload, image_size - x) for x in range(0, image_size, payload)]
+
+#the host waits for the status of packet N before it sends packet N+1
+def simulate_sequential(image_size, baud, payload, latency):
+    t = 0.0
+    for length in packets_of(image_size, payload):
+        packet_len = V1_WRITE_OVERHEAD + length
+        t += HOST_PACKET_TIME + wire_time(packet_len, baud)
+        t += packet_len * CPU_TIME_PER_BYTE + wire_time(2, baud)
+        t += program_time(length) + wire_time(1, baud) + latency
+    return t
+
+#mem_write_run() : ACK of packet N, packet N+1 goes out, then the status of packet N
+def simulate_pipelined(image_size, baud, payload, latency):
+    wire_free = 0.0             #the link host -> bootloader is free
+    dev_free = 0.0              #the bootloader waits for the next packet
+    ack_host = []
+    status_host = []
+
+    for n, length in enumerate(packets_of(image_size, payload)):
+        packet_len = V1_WRITE_OVERHEAD + length
+        host_ready = 0.0
+        if(n >= 1):
+            host_ready = ack_host[n - 1]
+        if(n >= 2):
+            host_ready = max(host_ready, status_host[n - 2])
+        send_start = max(host_ready + HOST_PACKET_TIME, wire_free)
+        rx_done = send_start + wire_time(packet_len, baud)
+        wire_free = rx_done
+
+        start = max(rx_done, dev_free)
+        ack_at = start + packet_len * CPU_TIME_PER_BYTE
+        ack_host.append(ack_at + wire_time(2, baud) + latency)
+        status_at = ack_at + program_time(length)
+        dev_free = status_at + wire_time(1, baud)
+        status_host.append(dev_free + latency)
+
+    return status_host[-1]
+
+#link time and flash time of the whole write, each on its own
+def bounds(image_size, baud, payload):
+    packets = packets_of(image_size, payload)
+    link = sum(wire_time(V1_WRITE_OVERHEAD + length + 3, baud) for length in packets)
+    flash = sum(program_time(length) for length in packets)
+    return link, flash
+
+def main():
+    image_size = int(sys.argv[1], 0) if len(sys.argv) > 1 else 0x20000
+    payload = int(sys.argv[2]) if len(sys.argv) > 2 else 128
+
+    print("\n   {0} bytes, {1} byte payloads".format(image_size, payload))
+    print("\n   {0:>8s} {1:>10s} {2:>10s} {3:>10s}".format("baud", "link s", "flash s", "max s"))
+    for baud in BAUD_RATES:
+        link, flash = bounds(image_size, baud, payload)
+        print("   {0:8d} {1:10.2f} {2:10.2f} {3:10.2f}".format(baud, link, flash, max(link, flash)))
+
+    for latency in LATENCIES:
+        print("\n   seconds for a latency of {0:g} ms".format(latency * 1000))
+        print("   {0:>8s} {1:>12s} {2:>12s} {3:>8s}".format("baud", "sequential", "pipelined", "gain"))
+        for baud in BAUD_RATES:
+            seq = simulate_sequential(image_size, baud, payload, latency)
+            pipe = simulate_pipelined(image_size, baud, payload, latency)
+            print("   {0:8d} {1:12.2f} {2:12.2f} {3:7.0f}%".format(baud, seq, pipe, (seq / pipe - 1) * 100))
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,86 @@
+#Golden vectors of the CRC of the tool : get_crc() (byte mode) and get_crc_word() (word mode)
+#
+#usage : python -m unittest test_crc        (from HOST/python)
+#
+#The same vectors are checked against bootloader_calc_crc() in 001BOOTLoader/Test/test_crc.c, the host
+#and the bootloader agree on both modes, including lengths which are not a multiple of 4.
+
+import struct
+import unittest
+
+import STM32_Programmer_V1 as bl
+
+#(data, length, byte mode CRC, word mode CRC)
+DIGITS = b'123456789'
+RAMP = bytes(range(256))
+PATTERN = bytes(((i * 37 + 11) & 0xFF) for i in range(1024))
+VECTORS = [
+    (DIGITS,      0, 0xFFFFFFFF, 0xFFFFFFFF),
+    (DIGITS,      1, 0x17F7AD5C, 0x17F7AD5C),
+    (DIGITS,      3, 0x188F59D0, 0x188F59D0),
+    (DIGITS,      4, 0x368DF0F0, 0xC2091428),
+    (DIGITS,      5, 0x804CD4BE, 0xEC5BAA37),
+    (DIGITS,      8, 0x6C660178, 0xFEFC54F9),
+    (DIGITS,      9, 0x1556F485, 0xAFF19057),
+    (RAMP,      253, 0x775D3749, 0x6035C9B3),
+    (RAMP,      254, 0x1AB5BE92, 0x884C7688),
+    (RAMP,      255, 0x3ADE4C51, 0x4ED07C79),
+    (RAMP,      256, 0x96670628, 0xB7EC66F4),
+    (PATTERN,  1021, 0xE2950ED3, 0x1637BA97),
+]
+
+#the per-byte CRC the tool always had : each byte widened to a word, 32 bit steps
+def reference_feed(Crc, data):
+    Crc = Crc ^ data
+    for i in range(32):
+        if(Crc & 0x80000000):
+            Crc = ((Crc << 1) ^ 0x04C11DB7) & 0xFFFFFFFF
+        else:
+            Crc = (Crc << 1) & 0xFFFFFFFF
+    return Crc
+
+def reference_crc(buff, length):
+    Crc = 0xFFFFFFFF
+    for data in buff[0:length]:
+        Crc = reference_feed(Crc, data)
+    return Crc
+
+def reference_crc_word(buff, length):
+    Crc = 0xFFFFFFFF
+    nb_words = length // 4
+    for n in range(nb_words):
+        Crc = reference_feed(Crc, struct.unpack_from('<I', buff, 4 * n)[0])
+    for data in buff[4*nb_words:length]:
+        Crc = reference_feed(Crc, data)
+    return Crc
+
+class CrcGoldenTest(unittest.TestCase):
+
+    def test_reference(self):
+        for data, length, crc_byte, crc_word in VECTORS:
+            self.assertEqual(reference_crc(data, length), crc_byte, length)
+            self.assertEqual(reference_crc_word(data, length), crc_word, length)
+
+    def test_byte_mode(self):
+        for data, length, crc_byte, crc_word in VECTORS:
+            self.assertEqual(bl.get_crc(data, length), crc_byte, length)
+            self.assertEqual(bl.get_crc(list(data), length), crc_byte, length)
+
+    def test_word_mode(self):
+        for data, length, crc_byte, crc_word in VECTORS:
+            self.assertEqual(bl.get_crc_word(data, length), crc_word, length)
+            self.assertEqual(bl.get_crc_word(list(data), length), crc_word, length)
+
+    #the buffer of a packet is longer than what the CRC covers
+    def test_length_inside_buffer(self):
+        for length in range(0, 40):
+            self.assertEqual(bl.get_crc(PATTERN, length), reference_crc(PATTERN, length))
+            self.assertEqual(bl.get_crc_word(PATTERN, length), reference_crc_word(PATTERN, length))
+
+    #one word through the table, 4 steps of 8 bits
+    def test_feed_word(self):
+        for word in (0, 1, 0xFF, 0x12345678, 0xFFFFFFFF, 0x80000000):
+            self.assertEqual(bl.crc_feed_word(0xFFFFFFFF, word), reference_feed(0xFFFFFFFF, word))
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,128 @@
+#Frames of the tool : one write() per frame, the same bytes as before the table driven CRC
+#
+#usage : python -m unittest test_frames        (from HOST/python)
+#
+#The serial port is replaced by a recorder which keeps every write() apart. GOLDEN holds the frames of the
+#menu commands as the tool sent them byte by byte with the bitwise CRC, the other frames are checked against
+#a packet built here with reference_crc() of test_crc.py. A frame split over several writes can be cut by
+#BL_RX_FRAME_TIMEOUT on a slow host, each one must go out whole.
+
+import builtins
+import contextlib
+import io
+import struct
+import unittest
+from unittest import mock
+
+import STM32_Programmer_V1 as bl
+from test_crc import reference_crc, reference_crc_word
+
+#menu command, its inputs, the frame (hex) of the tool before the table driven CRC
+GOLDEN = [
+    (1,  [],                 "0551e7e9ab7c"),
+    (2,  [],                 "05523ecfe871"),
+    (3,  [],                 "055389d22975"),
+    (4,  [],                 "05548c826e6b"),
+    (5,  ['08008000'],       "0955008000089165193f"),
+    (7,  ['2', '3'],         "07560203ede05b04"),
+    (11, [],                 "055a8622e057"),
+    (12, [],                 "055b313f2153"),
+    (13, [],                 "055c346f664d"),
+]
+
+#keeps each write() as one frame, nothing to read
+class RecordingSerial:
+    def __init__(self):
+        self.frames = []
+        self.timeout = 2
+        self.baudrate = 115200
+
+    def write(self, data):
+        self.frames.append(bytes(data))
+        return len(data)
+
+    def read(self, length):
+        return b''
+
+    def reset_input_buffer(self):
+        pass
+
+    def flush(self):
+        pass
+
+def reference_v1(command, args):
+    packet = bytes([len(args) + 5, command]) + bytes(args)
+    return packet + struct.pack('<I', reference_crc(packet, len(packet)))
+
+def reference_v2(command, flags, arg, payload, crc_word):
+    packet = struct.pack('<BBBBHHI', bl.BL_V2_SOF, command, flags, 0, len(payload), 0, arg) + bytes(payload)
+    crc = reference_crc_word(packet, len(packet)) if crc_word else reference_crc(packet, len(packet))
+    packet += struct.pack('<I', crc)
+    return packet + bytes(-len(packet) % 4)
+
+class FramesTest(unittest.TestCase):
+
+    def setUp(self):
+        self.ser = RecordingSerial()
+        patches = [
+            mock.patch.object(bl, 'ser', self.ser, create=True),
+            mock.patch.object(bl, 'verbose_mode', 0),
+            mock.patch.object(bl, 'bl_capabilities', 0),
+            mock.patch.object(bl, 'bg_erase_pending', 0),
+            mock.patch.object(bl, 'read_bootloader_reply', lambda *args: 0),
+        ]
+        for patch in patches:
+            patch.start()
+            self.addCleanup(patch.stop)
+
+    def run_quiet(self, function, *args):
+        with contextlib.redirect_stdout(io.StringIO()):
+            return function(*args)
+
+    def test_menu_golden(self):
+        for command, inputs, frame in GOLDEN:
+            self.ser.frames = []
+            answers = iter(inputs)
+            with mock.patch.object(builtins, 'input', lambda *args: next(answers)):
+                self.run_quiet(bl.decode_menu_command_code, command)
+            self.assertEqual(self.ser.frames, [bytes.fromhex(frame)], command)
+
+    def test_v1(self):
+        for command, args in ((bl.COMMAND_BL_GET_VER, []), (bl.COMMAND_BL_FLASH_ERASE_RANGE, list(range(1, 9))),
+                              (bl.COMMAND_BL_MEM_READ, list(struct.pack('<II', 0x08008000, 0x100)))):
+            self.ser.frames = []
+            self.run_quiet(bl.v1_send_packet, command, args)
+            self.assertEqual(self.ser.frames, [reference_v1(command, args)], hex(command))
+        self.assertEqual(self.ser.frames[0][0], bl.COMMAND_BL_MEM_READ_LEN - 1)
+
+    def test_ping(self):
+        self.run_quiet(bl.bl_ping)
+        self.assertEqual(self.ser.frames, [reference_v1(bl.COMMAND_BL_GET_VER, [])])
+
+    #a whole 128 byte packet, then the end of the file
+    def test_mem_write(self):
+        data = bytes(((i * 37 + 11) & 0xFF) for i in range(128 + 21))
+        with mock.patch.object(bl, 'bin_file', io.BytesIO(data), create=True):
+            buf = [0] * 255
+            self.assertEqual(self.run_quiet(bl.mem_write_send_packet, buf, 0x08008000, len(data)), 128)
+            self.assertEqual(self.run_quiet(bl.mem_write_send_packet, buf, 0x08008080, 21), 21)
+        self.assertEqual(self.ser.frames, [
+            reference_v1(bl.COMMAND_BL_MEM_WRITE, struct.pack('<IB', 0x08008000, 128) + data[0:128]),
+            reference_v1(bl.COMMAND_BL_MEM_WRITE, struct.pack('<IB', 0x08008080, 21) + data[128:]),
+        ])
+
+    #byte mode, then word mode once the bootloader has BL_CAP_CRC_WORD, payloads not a multiple of 4
+    def test_v2(self):
+        payload = bytes(range(37))
+        self.run_quiet(bl.v2_send_packet, bl.COMMAND_BL_MEM_WRITE, bl.BL_V2_FLAG_FIRST, 0x08008000, payload)
+        with mock.patch.object(bl, 'bl_capabilities', bl.BL_CAP_CRC_WORD):
+            self.run_quiet(bl.v2_send_packet, bl.COMMAND_BL_MEM_WRITE, bl.BL_V2_FLAG_LAST, 0x08008025, payload[0:6])
+        self.assertEqual(self.ser.frames, [
+            reference_v2(bl.COMMAND_BL_MEM_WRITE, bl.BL_V2_FLAG_FIRST, 0x08008000, payload, False),
+            reference_v2(bl.COMMAND_BL_MEM_WRITE, bl.BL_V2_FLAG_LAST | bl.BL_V2_FLAG_CRC_WORD, 0x08008025, payload[0:6], True),
+        ])
+        for frame in self.ser.frames:
+            self.assertEqual(len(frame) % 4, 0)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,133 @@
+#gang_programmer.py against simulated bootloaders (device_sim.py), several at the same time
+#
+#usage : python -m unittest test_gang        (from HOST/python)
+#
+#Each device is a SimDevice on its own pty, with one fault : NACK on the writes, no reply at all, a flipped
+#bit in the flash (the sector hash differs), or a write status which comes late. The reply timeout is cut
+#to GANG_TEST_TIMEOUT so a silent device fails fast. A BL_FLASH_ERASE_RANGE into bank 2 gets
+#BL_ERASE_BACKGROUND and the status of the first write comes after the erase, longer than the reply
+#timeout : the device must still pass, a late status on any other write is a timeout.
+
+import contextlib
+import io
+import os
+import sys
+import tempfile
+import unittest
+from unittest import mock
+
+import STM32_Programmer_V1 as bl
+import gang_programmer as gang
+from device_sim import SimDevice
+
+GANG_TEST_TIMEOUT                                   = 0.3       #seconds, reply timeout of the tests
+GANG_TEST_LATE                                      = 1.0       #seconds, a status later than GANG_TEST_TIMEOUT
+BANK1_ADDRESS                                       = 0x08020000    #sector 5
+BANK2_ADDRESS                                       = 0x08108000    #sector 14
+
+IMAGE = bytes(((i * 37 + 11) & 0xFF) for i in range(1000))
+
+class GangTest(unittest.TestCase):
+
+    def setUp(self):
+        self.devices = []
+        patch = mock.patch.object(gang, 'GANG_REPLY_TIMEOUT', GANG_TEST_TIMEOUT)
+        patch.start()
+        self.addCleanup(patch.stop)
+
+    def tearDown(self):
+        for device in self.devices:
+            device.close()
+
+    def device(self, **faults):
+        device = SimDevice(**faults)
+        self.devices.append(device)
+        return device
+
+    def job(self, address, image=IMAGE):
+        sector = bl.flash_sector_at(address)
+        return gang.GangJob(image, address, [sector], 115200, True)
+
+    def program(self, device, job):
+        dev = gang.GangDevice(device.port)
+        gang.program_device(dev, job)
+        return dev
+
+    #main() with these devices, returns its exit code and what it printed
+    def run_main(self, devices, address, *options):
+        with tempfile.NamedTemporaryFile(suffix='.bin', delete=False) as f:
+            f.write(IMAGE)
+        self.addCleanup(os.unlink, f.name)
+        argv = ['gang_programmer.py', f.name, '{0:08x}'.format(address)] + [device.port for device in devices] + list(options)
+        out = io.StringIO()
+        with mock.patch.object(sys, 'argv', argv), contextlib.redirect_stdout(out):
+            result = gang.main()
+        return result, out.getvalue()
+
+    def test_pass(self):
+        device = self.device()
+        dev = self.program(device, self.job(BANK1_ADDRESS))
+        self.assertEqual((dev.state, dev.error), ("PASS", ""))
+        self.assertEqual(dev.bytes_done, len(IMAGE))
+        self.assertEqual(device.read(BANK1_ADDRESS, len(IMAGE)), IMAGE)
+        self.assertEqual(device.log[0:2], [('version',), ('erase_range', BANK1_ADDRESS, len(IMAGE))])
+        self.assertEqual(device.log[-1], ('hashes', 5, 1))
+
+    def test_nack(self):
+        dev = self.program(self.device(nack=True), self.job(BANK1_ADDRESS))
+        self.assertEqual(dev.state, "FAIL")
+        self.assertEqual(dev.error, "NACK on the write at {0:#010x}".format(BANK1_ADDRESS))
+        self.assertEqual(dev.bytes_done, 0)
+
+    def test_timeout(self):
+        device = self.device(silent=True)
+        dev = self.program(device, self.job(BANK1_ADDRESS))
+        self.assertEqual((dev.state, dev.error), ("FAIL", "timeout, bootloader not responding"))
+        self.assertLess(dev.elapsed, 10 * GANG_TEST_TIMEOUT)
+        self.assertEqual(device.log[-1], ('write', BANK1_ADDRESS, bl.BL_V1_MAX_PAYLOAD))
+
+    def test_hash_mismatch(self):
+        dev = self.program(self.device(corrupt=BANK1_ADDRESS + 300), self.job(BANK1_ADDRESS))
+        self.assertEqual((dev.state, dev.error), ("FAIL", "verify failed, sector 5"))
+        self.assertEqual(dev.bytes_done, len(IMAGE))
+
+    #the first write waits for the erase with the erase timeout, the next ones with the reply timeout
+    def test_background_erase(self):
+        device = self.device(bg_erase=GANG_TEST_LATE)
+        dev = self.program(device, self.job(BANK2_ADDRESS))
+        self.assertEqual((dev.state, dev.error), ("PASS", ""))
+        self.assertGreaterEqual(dev.elapsed, GANG_TEST_LATE)
+        self.assertEqual(device.read(BANK2_ADDRESS, len(IMAGE)), IMAGE)
+
+        # Bank 1 is erased before the reply, no long wait for its first write
+        dev = self.program(self.device(bg_erase=GANG_TEST_LATE), self.job(BANK1_ADDRESS))
+        self.assertEqual(dev.state, "PASS")
+        self.assertLess(dev.elapsed, GANG_TEST_LATE)
+
+    def test_late_status(self):
+        dev = self.program(self.device(write_delay=GANG_TEST_LATE), self.job(BANK2_ADDRESS))
+        self.assertEqual((dev.state, dev.error), ("FAIL", "timeout, bootloader not responding"))
+
+    #the faults stay with their device, the good ones are written all the same
+    def test_main(self):
+        good = [self.device(), self.device(bg_erase=GANG_TEST_LATE)]
+        bad = [self.device(nack=True), self.device(silent=True), self.device(corrupt=BANK2_ADDRESS)]
+        result, out = self.run_main(good + bad, BANK2_ADDRESS)
+        self.assertEqual(result, 1)
+        self.assertIn("2 of 5 devices passed", out)
+        for device in good:
+            self.assertEqual(device.read(BANK2_ADDRESS, len(IMAGE)), IMAGE)
+
+        result, out = self.run_main(good, BANK2_ADDRESS)
+        self.assertEqual(result, 0)
+        self.assertIn("2 of 2 devices passed", out)
+
+    #-n : no erase, the writes go to the flash as it is
+    def test_no_erase(self):
+        device = self.device()
+        result, out = self.run_main([device], BANK1_ADDRESS, '-n')
+        self.assertEqual(result, 0)
+        self.assertNotIn('erase_range', [entry[0] for entry in device.log])
+
+if __name__ == "__main__":
+    unittest.main()
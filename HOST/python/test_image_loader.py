@@ -0,0 +1,214 @@
+#image_loader.py : Intel HEX, S-record and ELF files, the runs of a write, and menu 27 on a simulated device
+#
+#usage : python -m unittest test_image_loader        (from HOST/python)
+#
+#The files are built here, records with their checksums and an ELF with its program headers only. The
+#runs never cross a flash sector, holes up to IMAGE_GAP_FILL bytes are sent as 0xFF. Menu 27 of the tool
+#writes a HEX file to a SimDevice (device_sim.py) : only the sectors holding old data are erased, the
+#flash must read back the segments, the filled holes and nothing else.
+
+import builtins
+import contextlib
+import io
+import os
+import struct
+import tempfile
+import unittest
+from unittest import mock
+
+import serial
+
+import STM32_Programmer_V1 as bl
+import image_loader
+from device_sim import SimDevice
+
+SECTOR_2                                            = 0x08008000
+SECTOR_3                                            = 0x0800C000
+SECTOR_11                                           = 0x080E0000
+
+def pattern(length, seed):
+    return bytes(((seed + i * 37) & 0xFF) for i in range(length))
+
+#----------------------------- file builders ----------------------------------------
+
+def hex_record(record_type, offset, data):
+    record = struct.pack('>BHB', len(data), offset, record_type) + bytes(data)
+    return ":" + (record + bytes([-sum(record) & 0xFF])).hex().upper()
+
+#data records of 16 bytes, an 04 record at each 64 KB
+def hex_file(segments):
+    lines = []
+    upper = None
+    for address, data in segments:
+        for offset in range(0, len(data), 16):
+            if((address + offset) >> 16 != upper):
+                upper = (address + offset) >> 16
+                lines.append(hex_record(0x04, 0, struct.pack('>H', upper)))
+            lines.append(hex_record(0x00, (address + offset) & 0xFFFF, data[offset:offset+16]))
+    lines.append(hex_record(0x01, 0, b''))
+    return "\n".join(lines) + "\n"
+
+def srec_record(kind, address, data):
+    addr_len = { '0' : 2, '1' : 2, '2' : 3, '3' : 4, '5' : 2, '7' : 4 }[kind]
+    record = bytes([addr_len + len(data) + 1]) + address.to_bytes(addr_len, 'big') + bytes(data)
+    return "S" + kind + (record + bytes([~sum(record) & 0xFF])).hex().upper()
+
+#32-bit little endian ELF : header and program headers (type, file data, vaddr, paddr, memsz)
+def elf_file(headers):
+    phoff = 52
+    offset = phoff + 32 * len(headers)
+    elf = bytearray(b'\x7fELF' + bytes([1, 1, 1]) + bytes(9))
+    elf += struct.pack('<HHIIIIIHHHHHH', 2, 40, 1, 0x08008000, phoff, 0, 0, 52, 32, len(headers), 40, 0, 0)
+    contents = b''
+    for p_type, data, vaddr, paddr, memsz in headers:
+        elf += struct.pack('<IIIIIIII', p_type, offset + len(contents), vaddr, paddr, len(data), memsz, 5, 4)
+        contents += data
+    return bytes(elf + contents)
+
+#----------------------------- tests ----------------------------------------
+
+class LoaderTest(unittest.TestCase):
+
+    def write_file(self, contents):
+        with tempfile.NamedTemporaryFile(delete=False) as f:
+            f.write(contents.encode('ascii') if isinstance(contents, str) else contents)
+        self.addCleanup(os.unlink, f.name)
+        return f.name
+
+    def test_hex(self):
+        first = pattern(40, 1)
+        second = pattern(20, 2)
+        text = hex_file([(SECTOR_2, first), (SECTOR_11 + 0x1FFF8, second)])
+        self.assertEqual(image_loader.load_image(self.write_file(text)), [(SECTOR_2, first), (SECTOR_11 + 0x1FFF8, second)])
+
+        # 02 record (segment address), the end of file record stops the parse
+        text = hex_record(0x02, 0, b'\x10\x00') + "\n" + hex_record(0x00, 0x20, b'\x01\x02') + "\n" + \
+            hex_record(0x01, 0, b'') + "\n" + hex_record(0x00, 0x40, b'\x03')
+        self.assertEqual(image_loader.load_hex(text), [(0x10020, b'\x01\x02')])
+
+    def test_hex_errors(self):
+        good = hex_record(0x00, 0x10, b'\x01\x02\x03')
+        bad_sum = good[:-2] + "{0:02X}".format((int(good[-2:], 16) + 1) & 0xFF)
+        with self.assertRaisesRegex(ValueError, "line 2 : checksum failed"):
+            image_loader.load_hex(good + "\n" + bad_sum)
+        with self.assertRaisesRegex(ValueError, "bad record length"):
+            image_loader.load_hex(good[:-4] + good[-2:])
+        with self.assertRaisesRegex(ValueError, "not an Intel HEX record"):
+            image_loader.load_hex(good + "\n" + good[1:])
+
+    def test_srec(self):
+        text = "\n".join([srec_record('0', 0, b'hdr'),
+            srec_record('1', 0x1234, b'\x01\x02'),
+            srec_record('2', 0x081000, b'\x03'),
+            srec_record('3', SECTOR_2, pattern(30, 3)),
+            srec_record('5', 3, b''),
+            srec_record('7', SECTOR_2, b'')])
+        self.assertEqual(image_loader.load_image(self.write_file(text)),
+            [(0x1234, b'\x01\x02'), (0x081000, b'\x03'), (SECTOR_2, pattern(30, 3))])
+
+    def test_srec_errors(self):
+        good = srec_record('3', SECTOR_2, b'\x01\x02')
+        bad_sum = good[:-2] + "{0:02X}".format((int(good[-2:], 16) + 1) & 0xFF)
+        with self.assertRaisesRegex(ValueError, "checksum failed"):
+            image_loader.load_srec(bad_sum)
+        with self.assertRaisesRegex(ValueError, "bad record length"):
+            image_loader.load_srec(good[:-2])
+        with self.assertRaisesRegex(ValueError, "line 2 : not an S-record"):
+            image_loader.load_srec(good + "\nX3")
+
+    #the load address (LMA) of .data, .bss left out, program headers other than PT_LOAD skipped
+    def test_elf(self):
+        text = pattern(64, 4)
+        data = pattern(12, 5)
+        elf = elf_file([(image_loader.PT_LOAD, text, SECTOR_2, SECTOR_2, len(text)),
+            (image_loader.PT_LOAD, data, 0x20000000, SECTOR_2 + len(text), len(data)),
+            (image_loader.PT_LOAD, b'', 0x2000000C, 0x2000000C, 0x100),
+            (0x70000001, pattern(8, 6), 0, SECTOR_3, 8)])
+        self.assertEqual(image_loader.load_image(self.write_file(elf)), [(SECTOR_2, text + data)])
+
+        with self.assertRaisesRegex(ValueError, "program header 0 goes past the end of the file"):
+            image_loader.load_elf(elf_file([(image_loader.PT_LOAD, text, SECTOR_2, SECTOR_2, len(text))])[:-4])
+        with self.assertRaisesRegex(ValueError, "not a 32-bit little endian ELF"):
+            image_loader.load_elf(elf[0:4] + b'\x02' + elf[5:])
+
+    def test_not_an_image(self):
+        with self.assertRaisesRegex(ValueError, "is not an ELF, Intel HEX or S-record file"):
+            image_loader.load_image(self.write_file(pattern(100, 7)))
+        with self.assertRaisesRegex(ValueError, "has nothing to write"):
+            image_loader.load_image(self.write_file(hex_record(0x01, 0, b'')))
+
+    def test_overlap(self):
+        text = hex_file([(SECTOR_2, pattern(32, 8)), (SECTOR_2 + 0x10, b'\x01')])
+        with self.assertRaisesRegex(ValueError, "segments overlap at 0x08008010"):
+            image_loader.load_image(self.write_file(text))
+        # touching segments are joined
+        self.assertEqual(image_loader.merge_segments([(SECTOR_2 + 4, b'\x02'), (SECTOR_2, b'\x01' * 4)]), [(SECTOR_2, b'\x01' * 4 + b'\x02')])
+
+    def test_runs(self):
+        bounds = bl.flash_sector_bounds()
+        a = pattern(100, 9)
+        b = pattern(10, 10)
+        c = pattern(10, 11)
+        fill = image_loader.IMAGE_GAP_FILL
+        segments = [(SECTOR_2, a), (SECTOR_2 + 100 + fill, b), (SECTOR_2 + 126 + fill + 1, c)]
+        self.assertEqual(image_loader.image_runs(segments, bounds),
+            [(SECTOR_2, a + b'\xff' * fill + b), (SECTOR_2 + 126 + fill + 1, c)])
+
+        # cut at the sector boundary, a small hole across it is not filled
+        across = pattern(64, 12)
+        self.assertEqual(image_loader.image_runs([(SECTOR_3 - 32, across)], bounds),
+            [(SECTOR_3 - 32, across[0:32]), (SECTOR_3, across[32:])])
+        self.assertEqual(image_loader.image_runs([(SECTOR_3 - 4, b'\x01' * 4), (SECTOR_3 + 4, b'\x02')], bounds),
+            [(SECTOR_3 - 4, b'\x01' * 4), (SECTOR_3 + 4, b'\x02')])
+
+        # outside the flash every hole starts a run
+        self.assertEqual(image_loader.image_runs([(0x20000000, b'\x01'), (0x20000002, b'\x02')], bounds),
+            [(0x20000000, b'\x01'), (0x20000002, b'\x02')])
+
+class Menu27Test(unittest.TestCase):
+
+    def setUp(self):
+        self.device = SimDevice()
+        self.addCleanup(self.device.close)
+        port = serial.Serial(self.device.port, 115200, timeout=2)
+        self.addCleanup(port.close)
+        patches = [
+            mock.patch.object(bl, 'ser', port, create=True),
+            mock.patch.object(bl, 'verbose_mode', 0),
+            mock.patch.object(bl, 'bg_erase_pending', 0),
+        ]
+        for patch in patches:
+            patch.start()
+            self.addCleanup(patch.stop)
+
+    def test_write_image(self):
+        fill = image_loader.IMAGE_GAP_FILL
+        first = pattern(300, 13)
+        second = pattern(50, 14)
+        across = pattern(64, 15)
+        config = pattern(16, 16)
+        segments = [(SECTOR_2, first), (SECTOR_2 + 300 + fill, second), (SECTOR_3 - 32, across), (SECTOR_11 + 0x1FFF0, config)]
+        with tempfile.NamedTemporaryFile('w', suffix='.hex', delete=False) as f:
+            f.write(hex_file(segments))
+        self.addCleanup(os.unlink, f.name)
+
+        # old data in sectors 2 and 3, sector 11 blank
+        self.device.program(SECTOR_2 + 0x1000, b'\x00' * 16)
+        self.device.program(SECTOR_3 + 0x1000, b'\x00' * 16)
+
+        with mock.patch.object(builtins, 'input', lambda *args: f.name), contextlib.redirect_stdout(io.StringIO()):
+            bl.decode_menu_command_code(27)
+
+        self.assertEqual([entry for entry in self.device.log if entry[0] == 'erase'], [('erase', 2, 1), ('erase', 3, 1)])
+        self.assertEqual(self.device.read(SECTOR_2, 300 + fill + 50), first + b'\xff' * fill + second)
+        self.assertEqual(self.device.read(SECTOR_3 - 32, 64), across)
+        self.assertEqual(self.device.read(SECTOR_11 + 0x1FFF0, 16), config)
+        self.assertEqual(self.device.read(SECTOR_3 + 0x1000, 16), b'\xff' * 16)
+
+        # holes bigger than IMAGE_GAP_FILL are not sent, nothing else in the sectors
+        written = sum(n for entry, address, n in [e for e in self.device.log if e[0] == 'write'])
+        self.assertEqual(written, 300 + fill + 50 + 64 + 16)
+        self.assertEqual(self.device.sector_data(3), across[32:] + b'\xff' * (bl.flash_sector_size(3) - 32))
+
+if __name__ == "__main__":
+    unittest.main()
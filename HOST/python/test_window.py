@@ -0,0 +1,114 @@
+#Windowed BL_MEM_WRITE (mem_write_window()) against a simulated bootloader (device_sim.py)
+#
+#usage : python -m unittest test_window        (from HOST/python)
+#
+#The tool negotiates the protocol with the SimDevice (v2, word mode CRC, BL_CAP_WINDOW), then writes
+#through mem_write_run() with small packets so the window holds a few of them. Every reply is
+#ACK, 2, sequence number, status. The faults of the link : a NACK makes the tool send the oldest packet
+#again, a packet lost, a reply later than the timeout or a length hit on the link (NACK, the device drops
+#its ring) make it send again everything with no reply. The flash must read back the image every time,
+#a link which fails for good stops after BL_WINDOW_MAX_RETRIES.
+
+import contextlib
+import io
+import unittest
+from unittest import mock
+
+import serial
+
+import STM32_Programmer_V1 as bl
+from device_sim import SimDevice
+
+WINDOW_PAYLOAD                                      = 256
+WINDOW_PACKETS                                      = 4
+WINDOW_BYTES                                        = WINDOW_PACKETS * ((bl.BL_V2_HDR_LEN + WINDOW_PAYLOAD + 4 + 3) & ~3)
+WINDOW_TIMEOUT                                      = 0.3       #seconds, reply timeout of the tests
+WINDOW_ADDRESS                                      = 0x08020000    #sector 5
+
+IMAGE = bytes(((i * 37 + 11) & 0xFF) for i in range(20 * WINDOW_PAYLOAD + 100))
+
+class WindowTest(unittest.TestCase):
+
+    def setUp(self):
+        patches = [mock.patch.object(bl, name, getattr(bl, name)) for name in
+            ('bl_protocol_version', 'bl_max_payload', 'bl_capabilities', 'bl_window', 'mem_write_flags', 'bg_erase_pending')]
+        patches.append(mock.patch.object(bl, 'verbose_mode', 0))
+        for patch in patches:
+            patch.start()
+            self.addCleanup(patch.stop)
+
+    #a device with these faults, the tool connected to it and the protocol negotiated
+    def connect(self, **faults):
+        device = SimDevice(max_payload=WINDOW_PAYLOAD, window=WINDOW_BYTES, **faults)
+        self.addCleanup(device.close)
+        port = serial.Serial(device.port, 115200, timeout=WINDOW_TIMEOUT)
+        self.addCleanup(port.close)
+        patch = mock.patch.object(bl, 'ser', port, create=True)
+        patch.start()
+        self.addCleanup(patch.stop)
+        with contextlib.redirect_stdout(io.StringIO()):
+            bl.protocol_negotiate()
+        return device
+
+    def write(self, image=IMAGE):
+        bl.open_the_buffer(image)
+        with contextlib.redirect_stdout(io.StringIO()):
+            return bl.mem_write_run(WINDOW_ADDRESS, len(image))
+
+    def writes(self, device):
+        return [entry for entry in device.log if entry[0] == 'write']
+
+    def test_negotiate(self):
+        self.connect()
+        self.assertEqual(bl.bl_protocol_version, 2)
+        self.assertEqual(bl.bl_max_payload, WINDOW_PAYLOAD)
+        self.assertEqual(bl.bl_window, WINDOW_BYTES)
+
+    def test_write(self):
+        device = self.connect()
+        self.assertEqual(self.write(), bl.Flash_HAL_OK)
+        self.assertEqual(device.read(WINDOW_ADDRESS, len(IMAGE)), IMAGE)
+        packets = (len(IMAGE) + WINDOW_PAYLOAD - 1) // WINDOW_PAYLOAD
+        self.assertEqual(len(self.writes(device)), packets)
+        self.assertEqual(self.writes(device)[-1], ('write', WINDOW_ADDRESS + (packets - 1) * WINDOW_PAYLOAD, 100))
+
+    #the oldest packet only is sent again, after the ones already on the way
+    def test_nack(self):
+        device = self.connect(bad_crc=0)
+        self.assertEqual(self.write(), bl.Flash_HAL_OK)
+        self.assertEqual(device.read(WINDOW_ADDRESS, len(IMAGE)), IMAGE)
+        packets = (len(IMAGE) + WINDOW_PAYLOAD - 1) // WINDOW_PAYLOAD
+        writes = self.writes(device)
+        self.assertEqual(device.log.count(('crc_error', 0)), 1)
+        self.assertEqual(len(writes), packets)
+        self.assertEqual(writes[WINDOW_PACKETS - 1], ('write', WINDOW_ADDRESS, WINDOW_PAYLOAD))
+
+    def test_dropped_packet(self):
+        device = self.connect(drop=2)
+        self.assertEqual(self.write(), bl.Flash_HAL_OK)
+        self.assertEqual(device.read(WINDOW_ADDRESS, len(IMAGE)), IMAGE)
+        self.assertIn(('dropped', 2), device.log)
+
+    def test_late_reply(self):
+        device = self.connect(late=3)
+        self.assertEqual(self.write(), bl.Flash_HAL_OK)
+        self.assertEqual(device.read(WINDOW_ADDRESS, len(IMAGE)), IMAGE)
+        packets = (len(IMAGE) + WINDOW_PAYLOAD - 1) // WINDOW_PAYLOAD
+        self.assertGreater(len(self.writes(device)), packets)
+
+    def test_bad_length(self):
+        device = self.connect(bad_length=5)
+        self.assertEqual(self.write(), bl.Flash_HAL_OK)
+        self.assertEqual(device.read(WINDOW_ADDRESS, len(IMAGE)), IMAGE)
+        self.assertIn(('bad_length', 5), device.log)
+
+    #every packet NACKed : the window, then one packet again per NACK up to the limit, nothing left to read
+    def test_retry_limit(self):
+        device = self.connect(nack=True)
+        self.assertEqual(self.write(), bl.Flash_HAL_TIMEOUT)
+        self.assertEqual(len(self.writes(device)), WINDOW_PACKETS + bl.BL_WINDOW_MAX_RETRIES)
+        self.assertEqual(bl.ser.in_waiting, 0)
+        self.assertEqual(device.read(WINDOW_ADDRESS, 16), b'\xff' * 16)
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,103 @@
+#Timing model of a windowed BL_MEM_WRITE run against the link latency
+#
+#usage : python window_sim.py [image size] [baud rate] [payload]
+#
+#Simulates the host loop of mem_write_window() against the bootloader, packet by packet : the host keeps
+#up to `window` packets on the way (at most BL_RX_WINDOW bytes), the bootloader handles them in order
+#(CRC, program) and replies ACK + sequence number + status once a packet is programmed. The latency is
+#the one of the USB serial adapter, added to every reply before the host sees it.
+#The "pipelined" row is mem_write_run() without a window : packet N+1 goes out after the ACK of packet N.
+#Sectors are blank, the flash times are the ones of flash_queue_sim.py.
+
+import sys
+
+LINK_BITS_PER_BYTE                                  = 10        #8N1
+HOST_PACKET_TIME                                    = 0.0002    #seconds, to build a packet in python (table CRC)
+CPU_TIME_PER_BYTE                                   = 1.0 / 180e6 * 2      #CRC unit, 2 cycles per byte
+PROGRAM_WORD_TIME                                   = 16e-6     #seconds, x32
+
+V2_HDR_LEN                                          = 12
+BL_RX_WINDOW                                        = 16384 - 4
+LATENCIES                                           = [ 0.0, 0.001, 0.004, 0.016 ]     #seconds
+WINDOWS                                             = [ 1, 2, 4, 8, 16, 32 ]
+
+def wire_time(nbytes, baud):
+    return nbytes * LINK_BITS_PER_BYTE / float(baud)
+
+def v2_packet_len(payload_len):
+    return (V2_HDR_LEN + payload_len + 4 + 3) & ~3
+
+def program_time(length):
+    return ((length // 4) + (length % 4)) * PROGRAM_WORD_TIME
+
+#returns the time of a write of image_size bytes with `window` packets on the way
+def simulate_window(image_size, baud, payload, window, latency):
+    packets = [min(payload, image_size - x) for x in range(0, image_size, payload)]
+    wire_free = 0.0             #the link host -> bootloader is free
+    dev_free = 0.0              #the bootloader waits for the next packet
+    reply_host = []
+
+    for n, length in enumerate(packets):
+        #host : packet n goes out once the reply of packet n - window is in
+        host_ready = reply_host[n - window] if (n >= window) else 0.0
+        send_start = max(host_ready + HOST_PACKET_TIME, wire_free)
+        rx_done = send_start + wire_time(v2_packet_len(length), baud)
+        wire_free = rx_done
+
+        start = max(rx_done, dev_free)
+        reply_at = start + v2_packet_len(length) * CPU_TIME_PER_BYTE + program_time(length)
+        dev_free = reply_at + wire_time(4, baud)
+        reply_host.append(dev_free + latency)
+
+    return reply_host[-1]
+
+#mem_write_run() : ACK of packet N, packet N+1 goes out, then the status of packet N
+def simulate_pipelined(image_size, baud, payload, latency):
+    packets = [min(payload, image_size - x) for x in range(0, image_size, payload)]
+    wire_free = 0.0
+    dev_free = 0.0
+    ack_host = []
+    status_host = []
+
+    for n, length in enumerate(packets):
+        host_ready = 0.0
+        if(n >= 1):
+            host_ready = ack_host[n - 1]
+        if(n >= 2):
+            host_ready = max(host_ready, status_host[n - 2])
+        send_start = max(host_ready + HOST_PACKET_TIME, wire_free)
+        rx_done = send_start + wire_time(v2_packet_len(length), baud)
+        wire_free = rx_done
+
+        start = max(rx_done, dev_free)
+        ack_at = start + v2_packet_len(length) * CPU_TIME_PER_BYTE
+        ack_host.append(ack_at + wire_time(2, baud) + latency)
+        status_at = ack_at + program_time(length)
+        dev_free = status_at + wire_time(1, baud)
+        status_host.append(dev_free + latency)
+
+    return status_host[-1]
+
+def main():
+    image_size = int(sys.argv[1], 0) if len(sys.argv) > 1 else 0x40000
+    baud = int(sys.argv[2]) if len(sys.argv) > 2 else 921600
+    payload = int(sys.argv[3]) if len(sys.argv) > 3 else 1024
+    max_window = BL_RX_WINDOW // v2_packet_len(payload)
+
+    print("\n   {0} bytes at {1} baud, {2} byte payloads, at most {3} packets on the way".format(
+        image_size, baud, payload, max_window))
+    print("   link alone : {0:.1f} kB/s".format(
+        image_size / 1024.0 / wire_time(image_size * v2_packet_len(payload) / payload, baud)))
+    print("\n   kB/s for a latency of")
+    print("   {0:12s}".format("mode") + "".join("{0:>10s}".format("{0:g} ms".format(l * 1000)) for l in LATENCIES))
+
+    print("   {0:12s}".format("pipelined") + "".join("{0:10.1f}".format(
+        image_size / 1024.0 / simulate_pipelined(image_size, baud, payload, l)) for l in LATENCIES))
+    for window in WINDOWS:
+        if(window > max_window):
+            break
+        print("   {0:12s}".format("window x{0}".format(window)) + "".join("{0:10.1f}".format(
+            image_size / 1024.0 / simulate_window(image_size, baud, payload, window, l)) for l in LATENCIES))
+
+if __name__ == "__main__":
+    main()